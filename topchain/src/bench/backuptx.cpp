@@ -0,0 +1,61 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "hash.h"
+#include "key.h"
+#include "random.h"
+#include "script/standard.h"
+#include "validation.h"
+#include "wallet/wallet.h"
+
+// One submitsubblocks batch: sign the owner extension of each subblock and
+// build and sign its backup transaction on the subchain's lanes. Committing
+// the transactions needs a chain and a mempool and is left out.
+static const int BACKUP_BATCH_SIZE = 16;
+
+static void BackupSubBlockBatch(benchmark::State& state)
+{
+    CWallet wallet;
+    CKey keyLane;
+    keyLane.MakeNewKey(true);
+    CKey keyOwner;
+    keyOwner.MakeNewKey(true);
+    const std::vector<unsigned char> vchOwnerPubKey = ToByteVector(keyOwner.GetPubKey());
+    const uint256 subChainId = GetRandHash();
+    const CScript scriptLane = GetScriptForDestination(keyLane.GetPubKey().GetID());
+    const CScript scriptPlatform = GetScriptForDestination(keyOwner.GetPubKey().GetID());
+    const std::vector<unsigned char> vSubBlockData(1000, 0x55);
+
+    LOCK2(cs_main, wallet.cs_wallet);
+    wallet.AddKeyPubKey(keyLane, keyLane.GetPubKey());
+
+    while (state.KeepRunning()) {
+        // As if the lanes had just been funded
+        wallet.mapBackupLanes.clear();
+        for (int i = 0; i < BACKUP_BATCH_SIZE; i++)
+            wallet.AddBackupLane(subChainId, COutPoint(GetRandHash(), 0), CTxOut(COIN, scriptLane));
+
+        std::vector<CBackupSubBlockExt> vExt(BACKUP_BATCH_SIZE);
+        for (int i = 0; i < BACKUP_BATCH_SIZE; i++) {
+            CBackupSubBlockExt& ext = vExt[i];
+            ext.subChainId = subChainId;
+            CHashWriter ss(SER_GETHASH, 0);
+            ss << vSubBlockData;
+            ext.subBlockHash = ss.GetHash();
+            ext.subBlockHeight = i;
+            std::vector<unsigned char> vchSig;
+            keyOwner.Sign(ext.GetSignatureHash(), vchSig);
+            ext.signature = CScript() << vchSig << vchOwnerPubKey;
+        }
+
+        std::vector<CWalletTx> vwtx;
+        std::string strFailReason;
+        bool success = wallet.CreateBackupTransactions(vExt, scriptPlatform, COIN / 100, vwtx, strFailReason);
+        assert(success);
+        assert(vwtx.size() == BACKUP_BATCH_SIZE);
+    }
+}
+
+BENCHMARK(BackupSubBlockBatch);
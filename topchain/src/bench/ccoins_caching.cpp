@@ -5,6 +5,7 @@
 #include "bench.h"
 #include "coins.h"
 #include "policy/policy.h"
+#include "random.h"
 #include "wallet/crypter.h"
 
 #include <vector>
@@ -85,3 +86,31 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching);
+
+// Lookups in a cache holding 1M coins, some 100 MB and far more than fits in
+// the CPU caches: one hit on a random coin and one miss per iteration. This is
+// what the layout of CCoinsMap matters for. Filling the cache is not timed.
+static void CCoinsCachingLarge(benchmark::State& state)
+{
+    const size_t nCoins = 1000000;
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    FastRandomContext rng(true);
+
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(nCoins);
+    const CScript script = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, 1))));
+    for (size_t i = 0; i < nCoins; i++) {
+        outpoints.emplace_back(rng.rand256(), i % 4);
+        coins.AddCoin(outpoints.back(), Coin(CTxOut(i, script), 1, false), false);
+    }
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const Coin& coin = coins.AccessCoin(outpoints[rng.randrange(nCoins)]);
+        assert(!coin.IsSpent());
+        assert(!coins.HaveCoinInCache(COutPoint(outpoints[i++ % nCoins].hash, 4)));
+    }
+}
+
+BENCHMARK(CCoinsCachingLarge);
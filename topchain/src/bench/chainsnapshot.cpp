@@ -0,0 +1,131 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chain.h"
+#include "chainsnapshot.h"
+#include "crypto/sha256.h"
+#include "random.h"
+#include "streams.h"
+#include "sync.h"
+#include "version.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+// Headers returned per request, as in a /rest/headers/20/<hash> query
+static const int HEADERS_PER_REQUEST = 20;
+// Bytes hashed while the chain lock is held, standing in for ConnectBlock
+static const size_t CONNECT_WORK_BYTES = 256 * 1024;
+
+namespace {
+
+struct BlockHasher
+{
+    size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+};
+
+/** Header chain grown by a background thread, which holds cs while it "connects" each block. */
+class ChainWriter
+{
+public:
+    CCriticalSection cs;
+    CChain chain;
+    std::unordered_map<uint256, const CBlockIndex*, BlockHasher> mapIndex;
+    CBlockIndexLookup lookup;
+    CChainSnapshotRef snapshot;
+
+private:
+    std::deque<uint256> hashes;
+    std::deque<CBlockIndex> entries;
+    std::vector<unsigned char> work;
+    std::atomic<bool> fStop;
+    boost::thread_group threads;
+
+    void Connect()
+    {
+        LOCK(cs);
+        entries.emplace_back();
+        CBlockIndex& index = entries.back();
+        index.pprev = chain.Tip();
+        index.nHeight = chain.Height() + 1;
+        index.nTime = index.nHeight;
+        hashes.push_back(GetRandHash());
+        index.phashBlock = &hashes.back();
+        index.BuildSkip();
+
+        unsigned char hash[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write(work.data(), work.size()).Finalize(hash);
+        work[0] = hash[0];
+
+        chain.SetTip(&index);
+        mapIndex.emplace(index.GetBlockHash(), &index);
+        lookup.Insert(&index);
+        std::atomic_store(&snapshot, CChainSnapshotRef(std::make_shared<const CChainSnapshot>(chain, *snapshot)));
+    }
+
+public:
+    ChainWriter() : snapshot(std::make_shared<const CChainSnapshot>()), work(CONNECT_WORK_BYTES), fStop(false)
+    {
+        for (int i = 0; i < 1000; i++)
+            Connect();
+        threads.create_thread([this] {
+            while (!fStop)
+                Connect();
+        });
+    }
+
+    ~ChainWriter()
+    {
+        fStop = true;
+        threads.join_all();
+    }
+};
+
+} // namespace
+
+// Requests served under the lock the writer holds while connecting blocks,
+// the way the REST handlers used to take cs_main
+static void ChainReadsLocked(benchmark::State& state)
+{
+    ChainWriter writer;
+    FastRandomContext insecure_rand(true);
+    while (state.KeepRunning()) {
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        LOCK(writer.cs);
+        const uint256 hash = writer.chain[insecure_rand.randrange(writer.chain.Height() + 1)]->GetBlockHash();
+        auto it = writer.mapIndex.find(hash);
+        const CBlockIndex* pindex = it != writer.mapIndex.end() ? it->second : nullptr;
+        for (int i = 0; i < HEADERS_PER_REQUEST && pindex && writer.chain.Contains(pindex); i++) {
+            ssHeader << pindex->GetBlockHeader();
+            pindex = writer.chain.Next(pindex);
+        }
+    }
+}
+
+// The same requests served from the published snapshot and the sharded lookup
+static void ChainReadsSnapshot(benchmark::State& state)
+{
+    ChainWriter writer;
+    FastRandomContext insecure_rand(true);
+    while (state.KeepRunning()) {
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        CChainSnapshotRef chain = std::atomic_load(&writer.snapshot);
+        const uint256 hash = (*chain)[insecure_rand.randrange(chain->Height() + 1)]->GetBlockHash();
+        const CBlockIndex* pindex = writer.lookup.Find(hash);
+        for (int i = 0; i < HEADERS_PER_REQUEST && pindex && chain->Contains(pindex); i++) {
+            ssHeader << pindex->GetBlockHeader();
+            pindex = chain->Next(pindex);
+        }
+    }
+}
+
+BENCHMARK(ChainReadsLocked);
+BENCHMARK(ChainReadsSnapshot);
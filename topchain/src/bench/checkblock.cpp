@@ -7,6 +7,7 @@
 #include "chainparams.h"
 #include "validation.h"
 #include "streams.h"
+#include "consensus/merkle.h"
 #include "consensus/validation.h"
 
 namespace block_bench {
@@ -52,5 +53,22 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
     }
 }
 
+// Merkle root of the block's txids, the part of CheckBlock that is pure hashing
+static void MerkleRootBlockTest(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    while (state.KeepRunning()) {
+        bool mutated;
+        uint256 root = BlockMerkleRoot(block, &mutated);
+        assert(root == block.hashMerkleRoot && !mutated);
+    }
+}
+
 BENCHMARK(DeserializeBlockTest);
 BENCHMARK(DeserializeAndCheckBlockTest);
+BENCHMARK(MerkleRootBlockTest);
@@ -0,0 +1,153 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "coins.h"
+#include "fs.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+
+#include <fcntl.h>
+
+#include <boost/thread/thread.hpp>
+
+// Transactions in the block, and inputs of each
+static const int BLOCK_TXS = 250;
+static const int TX_INPUTS = 4;
+// Other coins in the chainstate, which is far larger than the database cache
+static const int CHAINSTATE_COINS = 2000000;
+// Database cache, far smaller than the chainstate
+static const size_t COINS_DB_CACHE = 8 << 20;
+
+namespace {
+
+/**
+ * A chainstate database on disk holding the coins a block spends among many
+ * others. Reopening it drops LevelDB's caches and, where the platform allows,
+ * evicts its files from the page cache, so reads go to the drive as with a
+ * cold -dbcache after a restart.
+ */
+class ColdChainstate
+{
+private:
+    fs::path pathTemp;
+
+    static CCoinsViewDB* Open() { return new CCoinsViewDB(COINS_DB_CACHE); }
+
+public:
+    std::unique_ptr<CCoinsViewDB> db;
+    CBlock block;
+
+    ColdChainstate()
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        ClearDatadirCache();
+        pathTemp = fs::temp_directory_path() / strprintf("bench_bitcoin_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+        fs::create_directories(pathTemp);
+        gArgs.ForceSetArg("-datadir", pathTemp.string());
+        db.reset(Open());
+
+        FastRandomContext insecure_rand(true);
+        Coin coin;
+        coin.out.nValue = 1000;
+        coin.out.scriptPubKey = CScript() << OP_TRUE;
+        coin.nHeight = 1;
+        for (int i = 0; i < CHAINSTATE_COINS; ) {
+            CCoinsViewCache cache(db.get());
+            for (int j = 0; j < 100000 && i < CHAINSTATE_COINS; j++, i++)
+                cache.AddCoin(COutPoint(insecure_rand.rand256(), i % 4), Coin(coin), false);
+            cache.SetBestBlock(insecure_rand.rand256());
+            assert(cache.Flush());
+        }
+
+        CCoinsViewCache cache(db.get());
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vout.resize(1);
+        block.vtx.push_back(MakeTransactionRef(coinbase));
+        for (int i = 0; i < BLOCK_TXS; i++) {
+            CMutableTransaction tx;
+            for (int j = 0; j < TX_INPUTS; j++) {
+                COutPoint outpoint(insecure_rand.rand256(), j);
+                cache.AddCoin(outpoint, Coin(coin), false);
+                tx.vin.emplace_back(outpoint);
+            }
+            tx.vout.resize(1);
+            block.vtx.push_back(MakeTransactionRef(tx));
+        }
+        cache.SetBestBlock(insecure_rand.rand256());
+        assert(cache.Flush());
+    }
+
+    ~ColdChainstate()
+    {
+        db.reset();
+        fs::remove_all(pathTemp);
+    }
+
+    void Reopen()
+    {
+        db.reset();
+#ifdef POSIX_FADV_DONTNEED
+        for (fs::directory_iterator it(GetDataDir() / "chainstate"); it != fs::directory_iterator(); ++it) {
+            FILE* file = fsbridge::fopen(it->path(), "rb");
+            if (!file)
+                continue;
+            FileCommit(file);
+            posix_fadvise(fileno(file), 0, 0, POSIX_FADV_DONTNEED);
+            fclose(file);
+        }
+#endif
+        db.reset(Open());
+    }
+};
+
+/** Look up the inputs one at a time, as the loop in ConnectBlock does */
+static void AccessInputs(const CBlock& block, CCoinsViewCache& cache)
+{
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        for (const CTxIn& txin : block.vtx[i]->vin)
+            assert(!cache.AccessCoin(txin.prevout).IsSpent());
+    }
+}
+
+} // namespace
+
+// Both benchmarks reopen the cold database for every block, which is part of
+// the time measured.
+static void ConnectBlockColdCache(benchmark::State& state)
+{
+    ColdChainstate chainstate;
+    while (state.KeepRunning()) {
+        chainstate.Reopen();
+        CCoinsViewCache cache(chainstate.db.get());
+        AccessInputs(chainstate.block, cache);
+    }
+}
+
+static void ConnectBlockColdCachePrefetch(benchmark::State& state)
+{
+    ColdChainstate chainstate;
+    nPrefetchThreads = DEFAULT_PREFETCH_THREADS;
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nPrefetchThreads; i++)
+        threadGroup.create_thread(&ThreadCoinPrefetch);
+    while (state.KeepRunning()) {
+        chainstate.Reopen();
+        CCoinsViewCache cache(chainstate.db.get());
+        PrefetchBlockInputs(chainstate.block, cache, *chainstate.db);
+        AccessInputs(chainstate.block, cache);
+    }
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nPrefetchThreads = 0;
+}
+
+BENCHMARK(ConnectBlockColdCache);
+BENCHMARK(ConnectBlockColdCachePrefetch);
@@ -52,6 +52,38 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D64_1024(benchmark::State& state, sha256_implementation::UseImplementation use_implementation)
+{
+    SHA256AutoDetect(use_implementation);
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+    SHA256AutoDetect();
+}
+
+// Double-SHA256 of 1024 64-byte inputs, as done for each level of a merkle
+// tree, with each kernel. Falls back to a slower one if the CPU lacks it.
+static void SHA256D64_1024_STANDARD(benchmark::State& state)
+{
+    SHA256D64_1024(state, sha256_implementation::STANDARD);
+}
+
+static void SHA256D64_1024_SSE4(benchmark::State& state)
+{
+    SHA256D64_1024(state, sha256_implementation::USE_SSE4);
+}
+
+static void SHA256D64_1024_AVX2(benchmark::State& state)
+{
+    SHA256D64_1024(state, sha256_implementation::USE_SSE4_AND_AVX2);
+}
+
+static void SHA256D64_1024_SHANI(benchmark::State& state)
+{
+    SHA256D64_1024(state, sha256_implementation::USE_SSE4_AND_SHANI);
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -98,6 +130,10 @@ BENCHMARK(SHA256);
 BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024_STANDARD);
+BENCHMARK(SHA256D64_1024_SSE4);
+BENCHMARK(SHA256D64_1024_AVX2);
+BENCHMARK(SHA256D64_1024_SHANI);
 BENCHMARK(SipHash_32b);
 BENCHMARK(FastRandom_32bit);
 BENCHMARK(FastRandom_1bit);
@@ -0,0 +1,62 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <vector>
+
+static const int SUBCHAIN_TX_COUNT = 1000;
+
+static CMutableTransaction MakeCreateSubChainTx()
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = COIN;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CCreateSubChainExt ext;
+    ext.subChainId = GetRandHash();
+    ext.subChainOwner = GetRandHash();
+    ext.subChainName = "benchmark subchain name";
+    ext.subCoinName = "benchmark subcoin name";
+    for (int i = 0; i < 4; i++)
+        ext.subChainSeeds.push_back(strprintf("seed%d.subchain.example.com:8333", i));
+    ext.signature = CScript() << std::vector<unsigned char>(72, 0x30);
+    mtx.extData.nExtType = EXTDATA_CREATESUBCHAIN;
+    mtx.extData.data = ext;
+    return mtx;
+}
+
+// The per-transaction work that mempool acceptance does for subchain
+// transactions: deserialize, look at the extension data and register the
+// operation in the subchain meta mempool.
+static void AcceptSubChainTx(benchmark::State& state)
+{
+    std::vector<CDataStream> vStreams;
+    for (int i = 0; i < SUBCHAIN_TX_COUNT; i++) {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << MakeCreateSubChainTx();
+        vStreams.push_back(stream);
+    }
+
+    while (state.KeepRunning()) {
+        CSubChainMetaMemPool pool;
+        for (const CDataStream& stream : vStreams) {
+            CDataStream ss(stream);
+            CTransactionRef ptx;
+            ss >> ptx;
+            if (ptx->extData.NeedsToSaveMeta() && !ptx->GetSubChainId().IsNull())
+                assert(pool.addToMemPool(ptx, 0, 0, LockPoints()));
+        }
+    }
+}
+
+BENCHMARK(AcceptSubChainTx);
@@ -0,0 +1,170 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "compat.h"
+#include "netbase.h"
+#include "netpoll.h"
+#include "random.h"
+#include "util.h"
+
+#include <numeric>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+
+// Simulated local peers for the socket pollers: each peer is a connected
+// socket pair, the poller watches our end and the benchmark writes small
+// messages into the other one, the way a busy node sees pings and invs.
+static const int POLL_BENCH_PEERS = 1000;
+// A message header plus an 8 byte nonce
+static const size_t POLL_BENCH_MESSAGE_SIZE = 32;
+
+namespace {
+class PollBenchPeers
+{
+public:
+    std::vector<SOCKET> vLocal;
+    std::vector<SOCKET> vRemote;
+
+    explicit PollBenchPeers(int nPeers)
+    {
+        int nFD = RaiseFileDescriptorLimit(FD_SETSIZE + nPeers + 64);
+        for (int i = 0; i < nPeers; i++) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+                break;
+            // Move the writing end out of the way so that our ends stay below
+            // FD_SETSIZE and select() sees the same peer count as epoll.
+            int fdRemote = nFD > FD_SETSIZE + nPeers ? fcntl(fds[1], F_DUPFD, FD_SETSIZE) : -1;
+            if (fdRemote >= 0) {
+                close(fds[1]);
+                fds[1] = fdRemote;
+            }
+            vLocal.push_back(fds[0]);
+            vRemote.push_back(fds[1]);
+            SetSocketNonBlocking(vLocal.back(), true);
+            SetSocketNonBlocking(vRemote.back(), true);
+        }
+    }
+
+    ~PollBenchPeers()
+    {
+        for (SOCKET& hSocket : vLocal)
+            CloseSocket(hSocket);
+        for (SOCKET& hSocket : vRemote)
+            CloseSocket(hSocket);
+    }
+
+    /** Drop peers the poller cannot watch, e.g. beyond FD_SETSIZE for select(). */
+    void Restrict(const CSocketPoller& poller)
+    {
+        size_t n = 0;
+        while (n < vLocal.size() && poller.IsWatchable(vLocal[n]))
+            n++;
+        for (size_t i = n; i < vLocal.size(); i++) {
+            CloseSocket(vLocal[i]);
+            CloseSocket(vRemote[i]);
+        }
+        vLocal.resize(n);
+        vRemote.resize(n);
+    }
+};
+} // namespace
+
+/** Have the given peers send one message each and wait until all of it was read through the poller. */
+static void DeliverMessages(CSocketPoller& poller, const PollBenchPeers& peers, const std::vector<size_t>& vSenders)
+{
+    static const char msg[POLL_BENCH_MESSAGE_SIZE] = {};
+    char buf[0x1000];
+    std::vector<CSocketPoller::Event> vEvents;
+
+    for (size_t i : vSenders)
+        send(peers.vRemote[i], msg, sizeof(msg), 0);
+
+    size_t nPending = vSenders.size() * sizeof(msg);
+    while (nPending > 0) {
+        if (!poller.IsEdgeTriggered()) {
+            for (size_t i = 0; i < peers.vLocal.size(); i++)
+                poller.Watch(peers.vLocal[i], i, CSocketPoller::POLL_RECV);
+        }
+        vEvents.clear();
+        if (poller.Wait(50, vEvents) == SOCKET_ERROR)
+            return;
+        for (const CSocketPoller::Event& ev : vEvents) {
+            // Read until EWOULDBLOCK, as an edge-triggered caller must
+            ssize_t nBytes;
+            while ((nBytes = recv(peers.vLocal[ev.nId], buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+                nPending -= nBytes;
+        }
+    }
+}
+
+/** All peers send at once; measures the cost of a full round of readiness. */
+static void PollThroughput(benchmark::State& state, std::unique_ptr<CSocketPoller> poller)
+{
+    if (!poller)
+        return;
+    PollBenchPeers peers(POLL_BENCH_PEERS);
+    peers.Restrict(*poller);
+    if (poller->IsEdgeTriggered()) {
+        for (size_t i = 0; i < peers.vLocal.size(); i++)
+            poller->Watch(peers.vLocal[i], i, CSocketPoller::POLL_RECV);
+    }
+
+    std::vector<size_t> vSenders(peers.vLocal.size());
+    std::iota(vSenders.begin(), vSenders.end(), 0);
+    while (state.KeepRunning()) {
+        DeliverMessages(*poller, peers, vSenders);
+    }
+}
+
+/** A single random peer sends while all others stay idle; measures the time to notice it. */
+static void PollLatency(benchmark::State& state, std::unique_ptr<CSocketPoller> poller)
+{
+    if (!poller)
+        return;
+    PollBenchPeers peers(POLL_BENCH_PEERS);
+    peers.Restrict(*poller);
+    if (peers.vLocal.empty())
+        return;
+    if (poller->IsEdgeTriggered()) {
+        for (size_t i = 0; i < peers.vLocal.size(); i++)
+            poller->Watch(peers.vLocal[i], i, CSocketPoller::POLL_RECV);
+    }
+
+    FastRandomContext rng(true);
+    std::vector<size_t> vSenders(1);
+    while (state.KeepRunning()) {
+        vSenders[0] = rng.randrange(peers.vLocal.size());
+        DeliverMessages(*poller, peers, vSenders);
+    }
+}
+
+static void SocketPollSelectThroughput(benchmark::State& state)
+{
+    PollThroughput(state, MakeSelectPoller());
+}
+
+static void SocketPollEpollThroughput(benchmark::State& state)
+{
+    PollThroughput(state, MakeEpollPoller());
+}
+
+static void SocketPollSelectLatency(benchmark::State& state)
+{
+    PollLatency(state, MakeSelectPoller());
+}
+
+static void SocketPollEpollLatency(benchmark::State& state)
+{
+    PollLatency(state, MakeEpollPoller());
+}
+
+BENCHMARK(SocketPollSelectThroughput);
+BENCHMARK(SocketPollEpollThroughput);
+BENCHMARK(SocketPollSelectLatency);
+BENCHMARK(SocketPollEpollLatency);
+#endif // WIN32
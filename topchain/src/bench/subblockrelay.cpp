@@ -0,0 +1,111 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "net.h"
+#include "netmessagemaker.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+
+// The relay path of a 1 MB subblock: the serialized message is queued to a
+// number of peers, and each of them frames it from the socket and
+// deserializes it again.
+static const size_t RELAY_SUBBLOCK_SIZE = 1000 * 1000;
+static const int RELAY_PEERS = 8;
+
+static CSerializedNetMsg MakeSubBlockMsg()
+{
+    CSubBlock block;
+    block.subChainId = GetRandHash();
+    block.subblockdata.resize(RELAY_SUBBLOCK_SIZE);
+    GetRandBytes(block.subblockdata.data(), 32);
+    block.nHeight = 1;
+    block.nTime = 1500000000;
+    return CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::SUBBLOCK, block);
+}
+
+static void RelayToPeers(benchmark::State& state, bool fShared)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CConnman connman(0x1337, 0x1337);
+    std::vector<std::unique_ptr<CNode>> vPeers;
+    for (int i = 0; i < RELAY_PEERS; i++) {
+        vPeers.emplace_back(new CNode(i, NODE_NETWORK, 0, INVALID_SOCKET, CAddress(), 0, 0, CAddress(), "", false));
+    }
+    CNetMsgPayloadRef payload = std::make_shared<const CNetMsgPayload>(std::move(MakeSubBlockMsg().data));
+
+    while (state.KeepRunning()) {
+        for (auto& pnode : vPeers) {
+            CSerializedNetMsg msg;
+            msg.command = NetMsgType::SUBBLOCK;
+            if (fShared) {
+                msg.payload = payload;
+            } else {
+                msg.data = payload->data;
+            }
+            connman.PushMessage(pnode.get(), std::move(msg));
+        }
+        // Nothing can be sent without a socket; drop the queued messages
+        for (auto& pnode : vPeers) {
+            LOCK(pnode->cs_vSend);
+            pnode->vSendMsg.clear();
+            pnode->nSendSize = 0;
+        }
+    }
+}
+
+static void ReceiveSubBlock(benchmark::State& state, bool fInPlace)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CSerializedNetMsg msg = MakeSubBlockMsg();
+    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
+    std::vector<unsigned char> vWire;
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, vWire, 0, hdr};
+    vWire.insert(vWire.end(), msg.data.begin(), msg.data.end());
+
+    // Stands in for the socket handler's stack buffer and recv()
+    char pchBuf[0x10000];
+    while (state.KeepRunning()) {
+        CNetMessage netmsg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+        size_t nPos = netmsg.readHeader((const char*)vWire.data(), vWire.size());
+        while (!netmsg.complete()) {
+            unsigned int nBytes = std::min(sizeof(pchBuf), vWire.size() - nPos);
+            char* pch = pchBuf;
+            if (fInPlace)
+                pch = netmsg.GetDataBuffer(nBytes);
+            memcpy(pch, vWire.data() + nPos, nBytes);
+            nPos += netmsg.readData(pch, nBytes);
+        }
+        CSubBlock block;
+        netmsg.vRecv >> block;
+    }
+}
+
+static void SubBlockRelaySendCopy(benchmark::State& state)
+{
+    RelayToPeers(state, false);
+}
+
+static void SubBlockRelaySendShared(benchmark::State& state)
+{
+    RelayToPeers(state, true);
+}
+
+static void SubBlockRelayReceiveCopy(benchmark::State& state)
+{
+    ReceiveSubBlock(state, false);
+}
+
+static void SubBlockRelayReceiveInPlace(benchmark::State& state)
+{
+    ReceiveSubBlock(state, true);
+}
+
+BENCHMARK(SubBlockRelaySendCopy);
+BENCHMARK(SubBlockRelaySendShared);
+BENCHMARK(SubBlockRelayReceiveCopy);
+BENCHMARK(SubBlockRelayReceiveInPlace);
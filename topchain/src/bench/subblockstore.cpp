@@ -0,0 +1,96 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "clientversion.h"
+#include "random.h"
+#include "streams.h"
+#include "subblockcompress.h"
+#include "tinyformat.h"
+
+// Storing and loading a 1 MB subblock of contract calls as a compressed
+// record, against the plain record as it was stored before.
+static const size_t STORE_SUBBLOCK_SIZE = 1000 * 1000;
+
+static std::vector<unsigned char> MakeContractCalls(size_t nSize)
+{
+    std::string str;
+    while (str.size() < nSize) {
+        str += strprintf("{\"contract\":\"%s\",\"method\":\"transfer\",\"args\":[\"%s\",%u]},",
+                         GetRandHash().GetHex().substr(0, 40), GetRandHash().GetHex().substr(0, 40), GetRand(1000000));
+    }
+    return std::vector<unsigned char>(str.begin(), str.begin() + nSize);
+}
+
+static CSubBlock MakeSubBlock()
+{
+    CSubBlock block;
+    block.subChainId = GetRandHash();
+    block.subblockdata = MakeContractCalls(STORE_SUBBLOCK_SIZE);
+    block.nHeight = 1;
+    block.nTime = 1500000000;
+    return block;
+}
+
+static CSubBlockDictionary MakeDictionary()
+{
+    std::deque<std::vector<unsigned char> > vSamples;
+    for (size_t i = 0; i < SUBBLOCK_DICT_SAMPLES; i++)
+        vSamples.push_back(MakeContractCalls(1000));
+    return CSubBlockDictionary(TrainSubBlockDictionary(vSamples, SUBBLOCK_DICT_SIZE));
+}
+
+static void SubBlockStorePlain(benchmark::State& state)
+{
+    const CSubBlock block = MakeSubBlock();
+    while (state.KeepRunning()) {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << block;
+        CSubBlock blockRead;
+        ss >> blockRead;
+    }
+}
+
+static void StoreCompressed(benchmark::State& state, bool fDictionary)
+{
+    const CSubBlock block = MakeSubBlock();
+    const CSubBlockDictionary dict = MakeDictionary();
+    const CSubBlockDictionary* pdict = fDictionary ? &dict : nullptr;
+    while (state.KeepRunning()) {
+        CCompressedSubBlock compressed;
+        bool success = CompressSubBlock(block, pdict, compressed);
+        assert(success);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << compressed;
+        ss >> compressed;
+        CSubBlock blockRead;
+        success = DecompressSubBlock(compressed, pdict, blockRead);
+        assert(success);
+    }
+}
+
+static void SubBlockStoreCompressed(benchmark::State& state)
+{
+    StoreCompressed(state, false);
+}
+
+static void SubBlockStoreCompressedDict(benchmark::State& state)
+{
+    StoreCompressed(state, true);
+}
+
+static void SubBlockTrainDictionary(benchmark::State& state)
+{
+    std::deque<std::vector<unsigned char> > vSamples;
+    for (size_t i = 0; i < SUBBLOCK_DICT_SAMPLES; i++)
+        vSamples.push_back(MakeContractCalls(SUBBLOCK_DICT_SAMPLE_SIZE));
+    while (state.KeepRunning()) {
+        TrainSubBlockDictionary(vSamples, SUBBLOCK_DICT_SIZE);
+    }
+}
+
+BENCHMARK(SubBlockStorePlain);
+BENCHMARK(SubBlockStoreCompressed);
+BENCHMARK(SubBlockStoreCompressedDict);
+BENCHMARK(SubBlockTrainDictionary);
@@ -0,0 +1,121 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "consensus/consensus.h"
+#include "fs.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "streams.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "util.h"
+#include "validation.h"
+
+#include <vector>
+
+static const int META_TX_COUNT = 100000;
+static const int META_TX_PER_BLOCK = 1000;
+static const int META_BLOCKS_PER_FILE = 25;
+
+static CTransactionRef MakeSubChainMetaTx()
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = COIN;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CCreateSubChainExt ext;
+    ext.subChainId = GetRandHash();
+    ext.subChainOwner = GetRandHash();
+    ext.subChainName = "benchchain";
+    ext.subCoinName = "BENCH";
+    ext.subChainSeeds.push_back("127.0.0.1:8333");
+    mtx.extData.nExtType = EXTDATA_CREATESUBCHAIN;
+    mtx.extData.data = ext;
+    return MakeTransactionRef(std::move(mtx));
+}
+
+// Write synthetic blocks full of subchain creation transactions to blk?????.dat
+// and record each transaction's position in the metadata DB, the same way
+// ConnectBlock does. With fRecords the per-subchain records are written too.
+static void WriteSubChainMetaBlocks(bool fRecords)
+{
+    const CMessageHeader::MessageStartChars& messageStart = Params().MessageStart();
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    std::map<uint256, CSubChainMetaRecord> mapRecords;
+    for (int nBlock = 0; nBlock < META_TX_COUNT / META_TX_PER_BLOCK; nBlock++) {
+        CBlock block;
+        for (int i = 0; i < META_TX_PER_BLOCK; i++)
+            block.vtx.push_back(MakeSubChainMetaTx());
+
+        CDiskBlockPos pos(nBlock / META_BLOCKS_PER_FILE, 0);
+        CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+        assert(!fileout.IsNull());
+        fseek(fileout.Get(), 0, SEEK_END);
+        unsigned int nSize = GetSerializeSize(fileout, block);
+        fileout << FLATDATA(messageStart) << nSize;
+        pos.nPos = ftell(fileout.Get());
+        fileout << block;
+
+        CDiskTxPos postx(pos, GetSizeOfCompactSize(block.vtx.size()));
+        for (const CTransactionRef& tx : block.vtx) {
+            vPos.push_back(std::make_pair(tx->GetHash(), postx));
+            if (fRecords) {
+                CSubChainMetaRecord& record = mapRecords[tx->GetSubChainId()];
+                record.createTxId = record.lastTxId = tx->GetHash();
+                record.nCreateHeight = record.nHeight = nBlock;
+                record.createExt = GetExtPayload<CCreateSubChainExt>(tx->extData);
+                record.nOpType = tx->extData.nExtType;
+                record.nOps = 1;
+            }
+            postx.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+        }
+    }
+    assert(psubchainmeta->WriteTxIndex(vPos, std::map<uint256, CSubChainMetaRecord>(), uint256(), CSubChainMetaUndo()));
+    if (fRecords)
+        assert(psubchainmeta->WriteRebuiltRecords(mapRecords));
+}
+
+static void SubChainMetaLoadBench(benchmark::State& state, bool fRecords)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    ClearDatadirCache();
+    fs::path pathTemp = fs::temp_directory_path() / strprintf("bench_bitcoin_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    fs::create_directories(pathTemp);
+    gArgs.ForceSetArg("-datadir", pathTemp.string());
+
+    psubchainmeta = new CSubChainMetaDB(1 << 20, true);
+    WriteSubChainMetaBlocks(fRecords);
+
+    while (state.KeepRunning()) {
+        CSubChainMetaMemPool pool;
+        assert(fRecords ? pool.LoadSubChainMetaData() : pool.LoadSubChainMetaFromBlocks());
+        assert(pool.mapSubChainMeta.size() == META_TX_COUNT);
+    }
+
+    delete psubchainmeta;
+    psubchainmeta = nullptr;
+    fs::remove_all(pathTemp);
+}
+
+// Measures rebuilding the metadata from 100k metadata transactions spread
+// across several block files, as on the first start after an upgrade.
+static void SubChainMetaLoad(benchmark::State& state)
+{
+    SubChainMetaLoadBench(state, false);
+}
+
+// Same data set, rebuilt from the per-subchain records without block file I/O.
+static void SubChainMetaLoadRecords(benchmark::State& state)
+{
+    SubChainMetaLoadBench(state, true);
+}
+
+BENCHMARK(SubChainMetaLoad);
+BENCHMARK(SubChainMetaLoadRecords);
@@ -0,0 +1,88 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "random.h"
+#include "rpc/blockchain.h"
+#include "txmempool.h"
+
+#include <univalue.h>
+
+#include <limits>
+#include <vector>
+
+static const int SUBCHAIN_COUNT = 4;
+static const int SUBCHAIN_OPS = 10000;
+
+// Fill pool with SUBCHAIN_COUNT subchains of SUBCHAIN_OPS operations each: a
+// creation followed by backup-subblock operations, each linked to the last.
+static std::vector<uint256> FillSubChainMetaPool(CSubChainMetaMemPool& pool)
+{
+    std::vector<uint256> vSubChainIds;
+    for (int nChain = 0; nChain < SUBCHAIN_COUNT; nChain++) {
+        const uint256 subChainId = GetRandHash();
+        CSubChainMetaMemPoolEntry::CMetaEntryRef pprev;
+        for (int i = 0; i < SUBCHAIN_OPS; i++) {
+            CExtData extData;
+            if (i == 0) {
+                CCreateSubChainExt ext;
+                ext.subChainId = subChainId;
+                ext.subChainOwner = GetRandHash();
+                ext.subChainName = "benchchain";
+                ext.subCoinName = "BENCH";
+                extData.nExtType = EXTDATA_CREATESUBCHAIN;
+                extData.data = ext;
+            } else {
+                CBackupSubBlockExt ext;
+                ext.subChainId = subChainId;
+                ext.subBlockHash = GetRandHash();
+                ext.subBlockHeight = i;
+                extData.nExtType = EXTDATA_BACKUPSUBBLOCK;
+                extData.data = ext;
+            }
+            const uint256 txid = GetRandHash();
+            CSubChainMetaMemPoolEntry entry(txid, extData, pprev, subChainId, extData.nExtType, i, i, LockPoints(), i);
+            LOCK(pool.cs_meta);
+            assert(pool.addToMemPool(entry));
+            pprev = pool.GetEntryByTxId(txid);
+        }
+        vSubChainIds.push_back(subChainId);
+    }
+    return vSubChainIds;
+}
+
+static void SubChainMetaInfoBench(benchmark::State& state, size_t nStart, size_t nCount, bool fLatestOnly)
+{
+    CSubChainMetaMemPool pool;
+    std::vector<uint256> vSubChainIds = FillSubChainMetaPool(pool);
+
+    size_t nChain = 0;
+    while (state.KeepRunning()) {
+        UniValue result = subChainMetaInfoToJSON(pool, vSubChainIds[nChain++ % vSubChainIds.size()], nStart, nCount, fLatestOnly);
+        assert(!result["metainfo"].empty());
+    }
+}
+
+// getsubchainmetainfo for the whole history of a subchain with 10k operations
+static void SubChainMetaInfoAll(benchmark::State& state)
+{
+    SubChainMetaInfoBench(state, 0, std::numeric_limits<size_t>::max(), false);
+}
+
+// One page of 100 operations from the middle of the history
+static void SubChainMetaInfoPage(benchmark::State& state)
+{
+    SubChainMetaInfoBench(state, SUBCHAIN_OPS / 2, 100, false);
+}
+
+// Only the latest operation, looked up through the last-operation map
+static void SubChainMetaInfoLatest(benchmark::State& state)
+{
+    SubChainMetaInfoBench(state, 0, 0, true);
+}
+
+BENCHMARK(SubChainMetaInfoAll);
+BENCHMARK(SubChainMetaInfoPage);
+BENCHMARK(SubChainMetaInfoLatest);
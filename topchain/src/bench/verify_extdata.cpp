@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "checkqueue.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "util.h"
+#include "validation.h"
+
+#include <vector>
+#include <boost/thread/thread.hpp>
+
+static const int BACKUP_TX_COUNT = 2000;
+static const int MIN_CORES = 2;
+static const int QUEUE_BATCH_SIZE = 128;
+
+static std::vector<CTransactionRef> MakeBackupSubBlockTxs(const CKey& key)
+{
+    std::vector<CTransactionRef> vtx;
+    uint256 subChainId = GetRandHash();
+    for (int i = 0; i < BACKUP_TX_COUNT; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = COIN;
+        mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+        CBackupSubBlockExt ext;
+        ext.subChainId = subChainId;
+        ext.subBlockHash = GetRandHash();
+        ext.subBlockHeight = i;
+        std::vector<unsigned char> vchSig;
+        assert(key.Sign(ext.GetSignatureHash(), vchSig));
+        ext.signature = CScript() << vchSig << ToByteVector(key.GetPubKey());
+        mtx.extData.nExtType = EXTDATA_BACKUPSUBBLOCK;
+        mtx.extData.data = ext;
+        vtx.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+    return vtx;
+}
+
+// Verify the owner signatures of a block full of backup-subblock transactions
+// on the script check queue, as ConnectBlock does. With fWarm the signatures
+// have been seen at mempool acceptance and are answered from the cache.
+static void VerifyExtDataBench(benchmark::State& state, bool fWarm)
+{
+    InitExtDataSignatureCache();
+
+    CKey key;
+    key.MakeNewKey(true);
+    const uint256 hashOwner = GetSubChainOwner(key.GetPubKey());
+    std::vector<CTransactionRef> vtx = MakeBackupSubBlockTxs(key);
+    if (fWarm) {
+        for (const CTransactionRef& tx : vtx)
+            assert(CachingVerifyExtData(*tx, hashOwner, true));
+    }
+
+    CCheckQueue<CScriptCheck> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()); ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CScriptCheck> control(&queue);
+        for (const CTransactionRef& tx : vtx) {
+            std::vector<CScriptCheck> vChecks(1);
+            CScriptCheck check(*tx, hashOwner, false);
+            check.swap(vChecks.back());
+            control.Add(vChecks);
+        }
+        assert(control.Wait());
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void VerifyExtDataCold(benchmark::State& state)
+{
+    VerifyExtDataBench(state, false);
+}
+
+static void VerifyExtDataWarm(benchmark::State& state)
+{
+    VerifyExtDataBench(state, true);
+}
+
+BENCHMARK(VerifyExtDataCold);
+BENCHMARK(VerifyExtDataWarm);
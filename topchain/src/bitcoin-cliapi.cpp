@@ -6,7 +6,10 @@
 
 #include "bitcoin-cli.h"
 #include "bitcoin-cliapi.h"
+#include "primitives/block.h"
+#include "streams.h"
 #include "uint256.h"
+#include "version.h"
 
 std::string HelpMessageCli()
 {
@@ -100,7 +103,8 @@ static void http_error_cb(enum evhttp_request_error err, void *ctx)
 }
 #endif
 
-UniValue CallRPC(const std::string& strMethod, const UniValue& params)
+/** POST strBody to endpoint on the RPC server and wait for the reply */
+static HTTPReply PostToRPCServer(const std::string& endpoint, const std::string& strBody, const char* pszContentType)
 {
     std::string host;
     // In preference order, we choose the following for the port:
@@ -145,26 +149,14 @@ UniValue CallRPC(const std::string& strMethod, const UniValue& params)
     evhttp_add_header(output_headers, "Host", host.c_str());
     evhttp_add_header(output_headers, "Connection", "close");
     evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
+    if (pszContentType)
+        evhttp_add_header(output_headers, "Content-Type", pszContentType);
 
     // Attach request data
-    std::string strRequest = JSONRPCRequestObj(strMethod, params, 1).write() + "\n";
     struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
     assert(output_buffer);
-    evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
+    evbuffer_add(output_buffer, strBody.data(), strBody.size());
 
-    // check if we should use a special wallet endpoint
-    std::string endpoint = "/";
-    std::string walletName = gArgs.GetArg("-rpcwallet", "");
-    if (!walletName.empty()) {
-        char *encodedURI = evhttp_uriencode(walletName.c_str(), walletName.size(), false);
-        if (encodedURI) {
-            endpoint = "/wallet/"+ std::string(encodedURI);
-            free(encodedURI);
-        }
-        else {
-            throw CConnectionFailed("uri-encode failed");
-        }
-    }
     int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, endpoint.c_str());
     req.release(); // ownership moved to evcon in above call
     if (r != 0) {
@@ -182,6 +174,27 @@ UniValue CallRPC(const std::string& strMethod, const UniValue& params)
     else if (response.body.empty())
         throw std::runtime_error("no response from server");
 
+    return response;
+}
+
+UniValue CallRPC(const std::string& strMethod, const UniValue& params)
+{
+    // check if we should use a special wallet endpoint
+    std::string endpoint = "/";
+    std::string walletName = gArgs.GetArg("-rpcwallet", "");
+    if (!walletName.empty()) {
+        char *encodedURI = evhttp_uriencode(walletName.c_str(), walletName.size(), false);
+        if (encodedURI) {
+            endpoint = "/wallet/"+ std::string(encodedURI);
+            free(encodedURI);
+        }
+        else {
+            throw CConnectionFailed("uri-encode failed");
+        }
+    }
+    std::string strRequest = JSONRPCRequestObj(strMethod, params, 1).write() + "\n";
+    HTTPReply response = PostToRPCServer(endpoint, strRequest, nullptr);
+
     // Parse reply
     UniValue valReply(UniValue::VSTR);
     if (!valReply.read(response.body))
@@ -298,19 +311,17 @@ int CommandRPC(const std::string& strMethod, const std::vector<std::string>& arg
     return nRet;
 }
 
-int runCommand(const std::string& conf_file, const std::string& datadir, const std::string& strMethod, const std::vector<std::string>& args, const int maxTryTime, UniValue& errCode, UniValue& errMsg, UniValue& result, std::string& strPrint)
+/** Set up the environment and read the configuration; returns CONTINUE_EXECUTION on success */
+static int InitRPCClient(const std::string& conf_file, const std::string& datadir, std::string& strPrint)
 {
     SetupEnvironment();
     if (!SetupNetworking()) {
         strPrint ="Error: Initializing networking failed\n";
-        errCode = EXIT_FAILURE;
         return EXIT_FAILURE;
     }
 
     try {
-        int ret = AppInitRPC(conf_file, datadir);
-        if (ret != CONTINUE_EXECUTION)
-            return ret;
+        return AppInitRPC(conf_file, datadir);
     }
     catch (const std::exception& e) {
         PrintExceptionContinue(&e, "AppInitRPC()");
@@ -319,8 +330,17 @@ int runCommand(const std::string& conf_file, const std::string& datadir, const s
         PrintExceptionContinue(nullptr, "AppInitRPC()");
         return EXIT_FAILURE;
     }
+}
 
-    int ret = EXIT_FAILURE;
+int runCommand(const std::string& conf_file, const std::string& datadir, const std::string& strMethod, const std::vector<std::string>& args, const int maxTryTime, UniValue& errCode, UniValue& errMsg, UniValue& result, std::string& strPrint)
+{
+    int ret = InitRPCClient(conf_file, datadir, strPrint);
+    if (ret != CONTINUE_EXECUTION) {
+        errCode = ret;
+        return ret;
+    }
+
+    ret = EXIT_FAILURE;
     try {
         ret = CommandRPC(strMethod, args, maxTryTime, errCode, errMsg, result, strPrint);
     }
@@ -480,3 +500,57 @@ int genbridgeownerinfo(const genbridgeownerinfoRequest& req, commonResponse& res
 	}
 	return  runCommand(rpc_conf_file, datadir, strMethod, args, 10 /*maxTryTimes*/, errCode, errMsg, result, retDebugInfo);
 }
+
+int submitsubblocks(const submitsubblocksRequest& req, commonResponse& res, std::vector<std::string>& txids)
+{
+	int& retErrCode = res.retErrCode;
+	std::string& retErrMsg = res.retErrMsg;
+	std::string& retDebugInfo = res.retDebugInfo;
+
+	retErrCode = EXIT_FAILURE;
+	retErrMsg = "";
+	txids.clear();
+
+	int ret = InitRPCClient(req.info.rpc_conf_file, req.info.datadir, retDebugInfo);
+	if (ret != CONTINUE_EXECUTION)
+		return ret;
+
+	// Send the batch as raw bytes: no hex and no JSON around the subblock data
+	std::vector<CSubBlock> vSubBlocks(req.subblocks.size());
+	for (size_t i = 0; i < req.subblocks.size(); i++) {
+		CSubBlock& block = vSubBlocks[i];
+		block.subChainId = uint256S(req.subchainid);
+		block.nHeight = req.subblocks[i].first;
+		block.subblockdata.assign(req.subblocks[i].second.begin(), req.subblocks[i].second.end());
+		block.nTime = GetTime();
+	}
+	std::vector<unsigned char> vBody;
+	CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, vBody, 0, vSubBlocks);
+
+	try {
+		HTTPReply response = PostToRPCServer("/binary/submitsubblocks", std::string(vBody.begin(), vBody.end()), "application/octet-stream");
+		if (response.status == HTTP_OK) {
+			std::vector<uint256> vTxid;
+			CDataStream ssReply(response.body.data(), response.body.data() + response.body.size(), SER_NETWORK, PROTOCOL_VERSION);
+			ssReply >> vTxid;
+			for (const uint256& txid : vTxid)
+				txids.push_back(txid.GetHex());
+			retErrCode = 0;
+			return 0;
+		}
+		UniValue reply(UniValue::VOBJ);
+		if (!reply.read(response.body) || !reply.isObject())
+			throw std::runtime_error("couldn't parse reply from server");
+		const UniValue& error = find_value(reply, "error");
+		const UniValue& errCode = find_value(error, "code");
+		const UniValue& errMsg = find_value(error, "message");
+		retErrCode = errCode.isNum() ? errCode.get_int() : EXIT_FAILURE;
+		if (errMsg.isStr())
+			retErrMsg = errMsg.get_str();
+		retDebugInfo = "error: " + error.write();
+	}
+	catch (const std::exception& e) {
+		retDebugInfo = std::string("error: ") + e.what();
+	}
+	return abs(retErrCode);
+}
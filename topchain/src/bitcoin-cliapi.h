@@ -6,6 +6,11 @@
 #ifndef BITCOIN_CLIAPI_H
 #define BITCOIN_CLIAPI_H
 
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
 struct rpcinfo{
    std::string rpc_conf_file; 
    std::string datadir; 
@@ -56,10 +61,19 @@ struct genbridgeownerinfoRequest{
     genbridgeownerinfoRequest():reset("0"){}
 };
 
+struct submitsubblocksRequest{
+    rpcinfo info;
+    std::string subchainid;
+    //! Height and raw (not hex) data of each subblock
+    std::vector<std::pair<uint32_t, std::string>> subblocks;
+};
+
 int createsubchain(const createsubchainRequest& req, commonResponse& res);
 int gensubchainblock(const gensubchainblockRequest& req, commonResponse& res);
 int commitsubchain(const commitsubchainRequest& req, commonResponse& res);
 int genbridgeownerinfo(const genbridgeownerinfoRequest& req, commonResponse& res);
+/** Back up a batch of subblocks in one call; txids receives the backup transaction of each */
+int submitsubblocks(const submitsubblocksRequest& req, commonResponse& res, std::vector<std::string>& txids);
 
 extern void RandomInit();
 extern std::string SHA256AutoDetect();
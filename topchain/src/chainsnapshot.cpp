@@ -0,0 +1,119 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainsnapshot.h"
+
+#include "primitives/block.h"
+#include "validation.h"
+
+#include <algorithm>
+
+CBlockIndexLookup blockIndexLookup;
+
+static CChainSnapshotRef chainSnapshot = std::make_shared<const CChainSnapshot>();
+
+CChainSnapshot::CChainSnapshot(const CChain& chain, const CChainSnapshot& prev) : nHeight(chain.Height())
+{
+    // Highest height at which both chains agree
+    int nFork = std::min(prev.nHeight, nHeight);
+    while (nFork >= 0 && prev.At(nFork).pindex != chain[nFork])
+        nFork--;
+
+    // Chunks that end at or below the fork point are shared, the rest is built again
+    const int nShared = (nFork + 1) / CHUNK_SIZE;
+    const int nChunks = (nHeight + CHUNK_SIZE) / CHUNK_SIZE;
+    vChunks.reserve(nChunks);
+    vChunks.assign(prev.vChunks.begin(), prev.vChunks.begin() + nShared);
+    for (int nChunk = nShared; nChunk < nChunks; nChunk++) {
+        std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+        chunk->reserve(CHUNK_SIZE);
+        const int nEnd = std::min((nChunk + 1) * CHUNK_SIZE, nHeight + 1);
+        for (int nHeightIn = nChunk * CHUNK_SIZE; nHeightIn < nEnd; nHeightIn++) {
+            if (nHeightIn <= nFork) {
+                chunk->push_back(prev.At(nHeightIn));
+                continue;
+            }
+            Entry entry;
+            entry.pindex = chain[nHeightIn];
+            if (entry.pindex->nStatus & BLOCK_HAVE_DATA)
+                entry.pos = entry.pindex->GetBlockPos();
+            chunk->push_back(entry);
+        }
+        vChunks.push_back(std::move(chunk));
+    }
+}
+
+CChainSnapshotRef GetChainSnapshot()
+{
+    return std::atomic_load(&chainSnapshot);
+}
+
+void PublishChainSnapshot(const CChain& chain)
+{
+    AssertLockHeld(cs_main);
+    CChainSnapshotRef prev = GetChainSnapshot();
+    if (prev->Height() == chain.Height() && prev->Tip() == chain.Tip())
+        return;
+    std::atomic_store(&chainSnapshot, CChainSnapshotRef(std::make_shared<const CChainSnapshot>(chain, *prev)));
+}
+
+void CBlockIndexLookup::Insert(const CBlockIndex* pindex)
+{
+    const uint256& hash = pindex->GetBlockHash();
+    Shard& shard = shards[ShardIndex(hash)];
+    LOCK(shard.cs);
+    shard.map.emplace(hash, pindex);
+}
+
+const CBlockIndex* CBlockIndexLookup::Find(const uint256& hash) const
+{
+    const Shard& shard = shards[ShardIndex(hash)];
+    LOCK(shard.cs);
+    auto it = shard.map.find(hash);
+    return it != shard.map.end() ? it->second : nullptr;
+}
+
+void CBlockIndexLookup::Clear()
+{
+    for (Shard& shard : shards) {
+        LOCK(shard.cs);
+        shard.map.clear();
+    }
+}
+
+bool GetBlockPos(const CBlockIndex* pindex, const CChainSnapshot& chain, CDiskBlockPos& pos, bool& fPruned)
+{
+    fPruned = false;
+    if (chain.Contains(pindex)) {
+        pos = chain.GetBlockPos(pindex);
+        fPruned = pos.IsNull();
+        return !fPruned;
+    }
+
+    LOCK(cs_main);
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA)) {
+        fPruned = fHavePruned && pindex->nTx > 0;
+        return false;
+    }
+    pos = pindex->GetBlockPos();
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const CChainSnapshot& chain, const Consensus::Params& consensusParams, bool& fPruned)
+{
+    CDiskBlockPos pos;
+    if (!GetBlockPos(pindex, chain, pos, fPruned))
+        return false;
+    if (!ReadBlockFromDisk(block, pos, consensusParams))
+        return false;
+    return block.GetHash() == pindex->GetBlockHash();
+}
+
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CChainSnapshot& chain, const CMessageHeader::MessageStartChars& message_start, bool& fPruned)
+{
+    CDiskBlockPos pos;
+    if (!GetBlockPos(pindex, chain, pos, fPruned))
+        return false;
+    return ReadRawBlockFromDisk(block, pos, pindex->GetBlockHash(), message_start);
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CHAINSNAPSHOT_H
+#define BITCOIN_CHAINSNAPSHOT_H
+
+#include "chain.h"
+#include "protocol.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <assert.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class CBlock;
+
+namespace Consensus { struct Params; }
+
+/**
+ * Immutable copy of the active chain, for readers that must not wait for
+ * cs_main while a block is being connected.
+ *
+ * A new snapshot is published (under cs_main) whenever chainActive moves, and
+ * readers take a reference to the current one without locking. Heights are
+ * kept in fixed size chunks which are shared between consecutive snapshots,
+ * so that publishing only copies the chunks at or above the fork point.
+ *
+ * Only the fields of the CBlockIndex entries that never change once an entry
+ * is in the block index (hash, header, pprev, nHeight, nChainWork, pskip) may
+ * be read through a snapshot. Where the block data was stored is recorded in
+ * the snapshot itself.
+ */
+class CChainSnapshot
+{
+public:
+    struct Entry {
+        const CBlockIndex* pindex;
+        //! Position of the block data when the entry was added, null if it was pruned
+        CDiskBlockPos pos;
+    };
+
+private:
+    enum { CHUNK_SIZE = 1024 };
+    typedef std::vector<Entry> Chunk;
+
+    std::vector<std::shared_ptr<const Chunk> > vChunks;
+    int nHeight;
+
+    const Entry& At(int nHeightIn) const { return (*vChunks[nHeightIn / CHUNK_SIZE])[nHeightIn % CHUNK_SIZE]; }
+
+public:
+    /** An empty chain. */
+    CChainSnapshot() : nHeight(-1) {}
+    /** Copy of chain, sharing the chunks below its fork point with prev. Requires cs_main. */
+    CChainSnapshot(const CChain& chain, const CChainSnapshot& prev);
+
+    const CBlockIndex* Tip() const { return nHeight >= 0 ? At(nHeight).pindex : nullptr; }
+    int Height() const { return nHeight; }
+
+    const CBlockIndex* operator[](int nHeightIn) const
+    {
+        if (nHeightIn < 0 || nHeightIn > nHeight)
+            return nullptr;
+        return At(nHeightIn).pindex;
+    }
+
+    bool Contains(const CBlockIndex* pindex) const { return (*this)[pindex->nHeight] == pindex; }
+
+    const CBlockIndex* Next(const CBlockIndex* pindex) const
+    {
+        if (Contains(pindex))
+            return (*this)[pindex->nHeight + 1];
+        return nullptr;
+    }
+
+    /** Where the data of a block of this chain is stored, or a null position if it was pruned. */
+    CDiskBlockPos GetBlockPos(const CBlockIndex* pindex) const
+    {
+        assert(Contains(pindex));
+        return At(pindex->nHeight).pos;
+    }
+};
+
+typedef std::shared_ptr<const CChainSnapshot> CChainSnapshotRef;
+
+/** The most recently published snapshot of chainActive. Never null. */
+CChainSnapshotRef GetChainSnapshot();
+
+/** Publish a new snapshot of chain. Requires cs_main. */
+void PublishChainSnapshot(const CChain& chain);
+
+/**
+ * Map from block hash to block index entry that can be queried without
+ * cs_main. It is split in shards with a lock of their own, so that
+ * concurrent lookups rarely contend with each other or with insertions.
+ * Entries are added once their immutable fields have been filled in.
+ */
+class CBlockIndexLookup
+{
+private:
+    enum { SHARD_COUNT = 16 };
+
+    struct Hasher {
+        size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+    };
+
+    struct Shard {
+        mutable CCriticalSection cs;
+        std::unordered_map<uint256, const CBlockIndex*, Hasher> map;
+    };
+
+    Shard shards[SHARD_COUNT];
+
+    // Bits of the hash not used to pick the bucket within a shard
+    static size_t ShardIndex(const uint256& hash) { return (hash.GetCheapHash() >> 32) % SHARD_COUNT; }
+
+public:
+    void Insert(const CBlockIndex* pindex);
+    const CBlockIndex* Find(const uint256& hash) const;
+    void Clear();
+};
+
+extern CBlockIndexLookup blockIndexLookup;
+
+/**
+ * Find where the data of the block of pindex is stored. For blocks on chain
+ * this is the position recorded in the snapshot and cs_main is not taken,
+ * for others the block index is consulted under cs_main. Returns false if
+ * there is no data, with fPruned set if it is known to have been pruned.
+ * The file may still be pruned later, reads from pos then fail like they do
+ * for any missing block.
+ */
+bool GetBlockPos(const CBlockIndex* pindex, const CChainSnapshot& chain, CDiskBlockPos& pos, bool& fPruned);
+
+/** Read the block of pindex from disk, looking up its position with GetBlockPos. */
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const CChainSnapshot& chain, const Consensus::Params& consensusParams, bool& fPruned);
+
+/** Read the block of pindex as serialized on disk, looking up its position with GetBlockPos. */
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CChainSnapshot& chain, const CMessageHeader::MessageStartChars& message_start, bool& fPruned);
+
+#endif // BITCOIN_CHAINSNAPSHOT_H
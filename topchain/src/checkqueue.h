@@ -29,6 +29,24 @@ class CCheckQueueControl;
 template <typename T>
 class CCheckQueue
 {
+public:
+    /**
+     * The checks added together on behalf of one unit of work (e.g. one
+     * block) and their combined result. Checks of several groups can be
+     * queued at once; the workers take them in any order, and the master
+     * waits for one group at a time.
+     */
+    struct Group
+    {
+        //! Number of checks of this group that haven't completed yet.
+        unsigned int nTodo;
+
+        //! Whether all completed checks of this group succeeded.
+        bool fAllOk;
+
+        Group() : nTodo(0), fAllOk(true) {}
+    };
+
 private:
     //! Mutex to protect the inner state
     boost::mutex mutex;
@@ -43,17 +61,20 @@ private:
     //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
     std::vector<T> queue;
 
+    //! The group each element of queue belongs to
+    std::vector<Group*> queueGroups;
+
+    //! The group used by Add and Wait without an explicit group.
+    Group defaultGroup;
+
     //! The number of workers (including the master) that are idle.
     int nIdle;
 
     //! The total number of workers (including the master).
     int nTotal;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
-
     /**
-     * Number of verifications that haven't completed yet.
+     * Number of verifications that haven't completed yet, over all groups.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
@@ -65,43 +86,59 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    /**
+     * Internal function that does bulk of the verification work. The master
+     * passes the group it waits for, and returns as soon as that group is
+     * done, even if checks of other groups are still queued.
+     */
+    bool Loop(Group* pgroupMaster = nullptr)
     {
+        const bool fMaster = pgroupMaster != nullptr;
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
+        std::vector<Group*> vGroups;
+        std::vector<char> vOk;
         vChecks.reserve(nBatchSize);
+        vGroups.reserve(nBatchSize);
+        vOk.reserve(nBatchSize);
         unsigned int nNow = 0;
-        bool fOk = true;
         do {
             {
                 boost::unique_lock<boost::mutex> lock(mutex);
                 // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
                 if (nNow) {
-                    fAllOk &= fOk;
+                    bool fGroupDone = false;
+                    for (unsigned int i = 0; i < nNow; i++) {
+                        vGroups[i]->fAllOk &= (bool)vOk[i];
+                        if (--vGroups[i]->nTodo == 0)
+                            fGroupDone = true;
+                    }
                     nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
+                    if (fGroupDone && !fMaster)
+                        // We processed the last element of a group; inform the master it may exit and return the result
                         condMaster.notify_one();
                 } else {
                     // first iteration
                     nTotal++;
                 }
                 // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
+                while (fMaster ? pgroupMaster->nTodo != 0 && queue.empty() : queue.empty()) {
+                    if (fQuit && nTodo == 0) {
                         nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                        return true;
                     }
                     nIdle++;
                     cond.wait(lock); // wait
                     nIdle--;
                 }
+                if (fMaster && pgroupMaster->nTodo == 0) {
+                    nTotal--;
+                    bool fRet = pgroupMaster->fAllOk;
+                    // reset the status for new work later
+                    pgroupMaster->fAllOk = true;
+                    // return the current status
+                    return fRet;
+                }
                 // Decide how many work units to process now.
                 // * Do not try to do everything at once, but aim for increasingly smaller batches so
                 //   all workers finish approximately simultaneously.
@@ -109,19 +146,23 @@ private:
                 // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
                 nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
                 vChecks.resize(nNow);
+                vGroups.resize(nNow);
+                vOk.resize(nNow);
                 for (unsigned int i = 0; i < nNow; i++) {
                     // We want the lock on the mutex to be as short as possible, so swap jobs from the global
                     // queue to the local batch vector instead of copying.
                     vChecks[i].swap(queue.back());
                     queue.pop_back();
+                    vGroups[i] = queueGroups.back();
+                    queueGroups.pop_back();
+                    // Check whether we need to do work at all
+                    vOk[i] = vGroups[i]->fAllOk;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
             // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
+            for (unsigned int i = 0; i < nNow; i++)
+                if (vOk[i])
+                    vOk[i] = vChecks[i]();
             vChecks.clear();
         } while (true);
     }
@@ -131,7 +172,7 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
@@ -142,17 +183,31 @@ public:
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Wait(defaultGroup);
+    }
+
+    //! Wait until the checks of group finish, and return whether they were all successful.
+    bool Wait(Group& group)
+    {
+        return Loop(&group);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
+    {
+        Add(vChecks, defaultGroup);
+    }
+
+    //! Add a batch of checks to the queue, as part of group
+    void Add(std::vector<T>& vChecks, Group& group)
     {
         boost::unique_lock<boost::mutex> lock(mutex);
         for (T& check : vChecks) {
             queue.push_back(T());
             check.swap(queue.back());
         }
+        queueGroups.insert(queueGroups.end(), vChecks.size(), &group);
+        group.nTodo += vChecks.size();
         nTodo += vChecks.size();
         if (vChecks.size() == 1)
             condWorker.notify_one();
@@ -214,4 +269,48 @@ public:
     }
 };
 
+/**
+ * RAII-style controller for the checks of one CCheckQueue::Group, which
+ * guarantees they are finished before it goes away. Unlike
+ * CCheckQueueControl it does not take the queue's ControlMutex, so that
+ * several groups (e.g. of consecutive blocks being validated in a
+ * pipeline) can be outstanding at once: the owner must hold a
+ * CCheckQueueControl on the same queue for as long as any of them exist.
+ */
+template <typename T>
+class CCheckQueueGroupControl
+{
+private:
+    CCheckQueue<T> * const pqueue;
+    typename CCheckQueue<T>::Group group;
+    bool fDone;
+
+public:
+    CCheckQueueGroupControl() = delete;
+    CCheckQueueGroupControl(const CCheckQueueGroupControl&) = delete;
+    CCheckQueueGroupControl& operator=(const CCheckQueueGroupControl&) = delete;
+    explicit CCheckQueueGroupControl(CCheckQueue<T> * const pqueueIn) : pqueue(pqueueIn), fDone(false) {}
+
+    bool Wait()
+    {
+        if (pqueue == nullptr)
+            return true;
+        bool fRet = pqueue->Wait(group);
+        fDone = true;
+        return fRet;
+    }
+
+    void Add(std::vector<T>& vChecks)
+    {
+        if (pqueue != nullptr)
+            pqueue->Add(vChecks, group);
+    }
+
+    ~CCheckQueueGroupControl()
+    {
+        if (!fDone)
+            Wait();
+    }
+};
+
 #endif // BITCOIN_CHECKQUEUE_H
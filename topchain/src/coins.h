@@ -9,6 +9,7 @@
 #include "primitives/transaction.h"
 #include "compressor.h"
 #include "core_memusage.h"
+#include "flathashmap.h"
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
@@ -17,7 +18,6 @@
 #include <assert.h>
 #include <stdint.h>
 
-#include <unordered_map>
 
 /**
  * A UTXO entry.
@@ -84,8 +84,8 @@ public:
 class SaltedOutpointHasher
 {
 private:
-    /** Salt */
-    const uint64_t k0, k1;
+    /** Salt. Not const, so that two CCoinsMaps can be swapped. */
+    uint64_t k0, k1;
 
 public:
     SaltedOutpointHasher();
@@ -119,7 +119,7 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+typedef flat_hash_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -167,6 +167,10 @@ public:
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
+    //! Like BatchWrite, but the view may take over mapCoins and finish the
+    //! write in the background, while reads keep seeing the written coins.
+    virtual bool BatchWriteBackground(CCoinsMap &mapCoins, const uint256 &hashBlock);
+
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
 
@@ -192,6 +196,7 @@ public:
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWriteBackground(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -231,6 +236,14 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Add a coin the caller read from the backing view, unmodified, as if
+     * it had been looked up through this cache. Does nothing if the outpoint
+     * is in the cache already. This lets coins be read from the database on
+     * other threads (see PrefetchBlockInputs) and then cached here.
+     */
+    void AddFetchedCoin(const COutPoint &outpoint, Coin&& coin);
+
     /**
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
@@ -263,6 +276,14 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush,
+     * letting the base write them out in the background if it can. Only the
+     * hand-over happens here; the cache is empty afterwards and can be used
+     * right away.
+     */
+    bool FlushBackground();
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -0,0 +1,116 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// 8-way interleaved double-SHA256 of 64-byte inputs, using AVX2.
+
+#if defined(__x86_64__) || defined(__amd64__)
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace sha256d64_avx2 {
+namespace {
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+AVX2_TARGET inline __m256i K8(uint32_t x) { return _mm256_set1_epi32(x); }
+AVX2_TARGET inline __m256i Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+AVX2_TARGET inline __m256i Add(__m256i x, __m256i y, __m256i z) { return Add(Add(x, y), z); }
+AVX2_TARGET inline __m256i Add(__m256i x, __m256i y, __m256i z, __m256i w) { return Add(Add(x, y), Add(z, w)); }
+AVX2_TARGET inline __m256i Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+AVX2_TARGET inline __m256i Xor(__m256i x, __m256i y, __m256i z) { return Xor(Xor(x, y), z); }
+AVX2_TARGET inline __m256i Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+AVX2_TARGET inline __m256i And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+AVX2_TARGET inline __m256i ShR(__m256i x, int n) { return _mm256_srli_epi32(x, n); }
+AVX2_TARGET inline __m256i ShL(__m256i x, int n) { return _mm256_slli_epi32(x, n); }
+AVX2_TARGET inline __m256i RotR(__m256i x, int n) { return Or(ShR(x, n), ShL(x, 32 - n)); }
+
+AVX2_TARGET inline __m256i Ch(__m256i x, __m256i y, __m256i z) { return Xor(z, And(x, Xor(y, z))); }
+AVX2_TARGET inline __m256i Maj(__m256i x, __m256i y, __m256i z) { return Or(And(x, y), And(z, Or(x, y))); }
+AVX2_TARGET inline __m256i Sigma0(__m256i x) { return Xor(RotR(x, 2), RotR(x, 13), RotR(x, 22)); }
+AVX2_TARGET inline __m256i Sigma1(__m256i x) { return Xor(RotR(x, 6), RotR(x, 11), RotR(x, 25)); }
+AVX2_TARGET inline __m256i sigma0(__m256i x) { return Xor(RotR(x, 7), RotR(x, 18), ShR(x, 3)); }
+AVX2_TARGET inline __m256i sigma1(__m256i x) { return Xor(RotR(x, 17), RotR(x, 19), ShR(x, 10)); }
+
+/** Run the 64 rounds over one message block per lane and add the result into s. w is overwritten. */
+AVX2_TARGET inline void Rounds(__m256i* s, __m256i* w)
+{
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16)
+            w[i & 15] = Add(w[i & 15], sigma1(w[(i - 2) & 15]), w[(i - 7) & 15], sigma0(w[(i - 15) & 15]));
+        __m256i t1 = Add(h, Sigma1(e), Ch(e, f, g), Add(K8(K[i]), w[i & 15]));
+        __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g; g = f; f = e; e = Add(d, t1);
+        d = c; c = b; b = a; a = Add(t1, t2);
+    }
+    s[0] = Add(s[0], a); s[1] = Add(s[1], b); s[2] = Add(s[2], c); s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e); s[5] = Add(s[5], f); s[6] = Add(s[6], g); s[7] = Add(s[7], h);
+}
+
+/** Word j of each of the eight 64-byte inputs, one per lane. */
+AVX2_TARGET inline __m256i Read8(const unsigned char* in, int j)
+{
+    return _mm256_set_epi32(ReadBE32(in + 448 + 4 * j), ReadBE32(in + 384 + 4 * j), ReadBE32(in + 320 + 4 * j), ReadBE32(in + 256 + 4 * j),
+                            ReadBE32(in + 192 + 4 * j), ReadBE32(in + 128 + 4 * j), ReadBE32(in + 64 + 4 * j), ReadBE32(in + 4 * j));
+}
+
+AVX2_TARGET inline void Write8(unsigned char* out, int j, __m256i v)
+{
+    WriteBE32(out + 4 * j, _mm256_extract_epi32(v, 0));
+    WriteBE32(out + 32 + 4 * j, _mm256_extract_epi32(v, 1));
+    WriteBE32(out + 64 + 4 * j, _mm256_extract_epi32(v, 2));
+    WriteBE32(out + 96 + 4 * j, _mm256_extract_epi32(v, 3));
+    WriteBE32(out + 128 + 4 * j, _mm256_extract_epi32(v, 4));
+    WriteBE32(out + 160 + 4 * j, _mm256_extract_epi32(v, 5));
+    WriteBE32(out + 192 + 4 * j, _mm256_extract_epi32(v, 6));
+    WriteBE32(out + 224 + 4 * j, _mm256_extract_epi32(v, 7));
+}
+
+} // namespace
+
+AVX2_TARGET void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[8], t[8], w[16];
+
+    // First hash: the 64-byte input, then the padding block for a 64-byte message
+    for (int i = 0; i < 8; i++) s[i] = K8(INIT[i]);
+    for (int j = 0; j < 16; j++) w[j] = Read8(in, j);
+    Rounds(s, w);
+    for (int j = 0; j < 16; j++) w[j] = K8(0);
+    w[0] = K8(0x80000000ul);
+    w[15] = K8(512);
+    Rounds(s, w);
+
+    // Second hash: the 32-byte digest, padded
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+        t[i] = K8(INIT[i]);
+    }
+    w[8] = K8(0x80000000ul);
+    for (int j = 9; j < 15; j++) w[j] = K8(0);
+    w[15] = K8(256);
+    Rounds(t, w);
+
+    for (int i = 0; i < 8; i++) Write8(out, i, t[i]);
+}
+
+} // namespace sha256d64_avx2
+
+#endif
@@ -0,0 +1,153 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// SHA256 using the Intel SHA extensions, following the structure of Intel's
+// reference code: the state is kept as the ABEF and CDGH halves that
+// sha256rnds2 operates on, and each step runs four rounds.
+
+#if defined(__x86_64__) || defined(__amd64__)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace {
+
+#define SHANI_TARGET __attribute__((target("sse4.1,sha")))
+
+alignas(16) const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+alignas(16) const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+//! Byte order shuffle turning four big endian words into native ones
+SHANI_TARGET inline __m128i ByteSwapMask() { return _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL); }
+
+SHANI_TARGET inline __m128i Load(const unsigned char* in) { return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), ByteSwapMask()); }
+SHANI_TARGET inline void Store(unsigned char* out, __m128i v) { _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(v, ByteSwapMask())); }
+
+/** Turn a state in word order (abcd, efgh) into the (abef, cdgh) form used by sha256rnds2. */
+SHANI_TARGET inline void Unpack(__m128i abcd, __m128i efgh, __m128i& state0, __m128i& state1)
+{
+    __m128i tmp = _mm_shuffle_epi32(abcd, 0xB1);    // cdab
+    efgh = _mm_shuffle_epi32(efgh, 0x1B);           // efgh
+    state0 = _mm_alignr_epi8(tmp, efgh, 8);         // abef
+    state1 = _mm_blend_epi16(efgh, tmp, 0xF0);      // cdgh
+}
+
+/** Inverse of Unpack. */
+SHANI_TARGET inline void Pack(__m128i state0, __m128i state1, __m128i& abcd, __m128i& efgh)
+{
+    __m128i tmp = _mm_shuffle_epi32(state0, 0x1B);  // feba
+    state1 = _mm_shuffle_epi32(state1, 0xB1);       // dchg
+    abcd = _mm_blend_epi16(tmp, state1, 0xF0);      // dcba
+    efgh = _mm_alignr_epi8(state1, tmp, 8);         // hgfe
+}
+
+/** Run the 64 rounds over the message block w (words in native order) and add the result into the state. w is overwritten. */
+SHANI_TARGET inline void Rounds(__m128i& state0, __m128i& state1, __m128i* w)
+{
+    const __m128i save0 = state0, save1 = state1;
+    for (int i = 0; i < 16; i++) {
+        if (i >= 4) {
+            w[i & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]),
+                                                          _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4)),
+                                            w[(i + 3) & 3]);
+        }
+        __m128i msg = _mm_add_epi32(w[i & 3], _mm_load_si128((const __m128i*)(K + 4 * i)));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+    }
+    state0 = _mm_add_epi32(state0, save0);
+    state1 = _mm_add_epi32(state1, save1);
+}
+
+/** Rounds for two independent lanes, interleaved so that one hides the latency of the other. */
+SHANI_TARGET inline void Rounds2(__m128i* state0, __m128i* state1, __m128i (*w)[4])
+{
+    const __m128i save0[2] = {state0[0], state0[1]}, save1[2] = {state1[0], state1[1]};
+    for (int i = 0; i < 16; i++) {
+        for (int l = 0; l < 2; l++) {
+            if (i >= 4) {
+                w[l][i & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w[l][i & 3], w[l][(i + 1) & 3]),
+                                                                 _mm_alignr_epi8(w[l][(i + 3) & 3], w[l][(i + 2) & 3], 4)),
+                                                   w[l][(i + 3) & 3]);
+            }
+            __m128i msg = _mm_add_epi32(w[l][i & 3], _mm_load_si128((const __m128i*)(K + 4 * i)));
+            state1[l] = _mm_sha256rnds2_epu32(state1[l], state0[l], msg);
+            state0[l] = _mm_sha256rnds2_epu32(state0[l], state1[l], _mm_shuffle_epi32(msg, 0x0E));
+        }
+    }
+    for (int l = 0; l < 2; l++) {
+        state0[l] = _mm_add_epi32(state0[l], save0[l]);
+        state1[l] = _mm_add_epi32(state1[l], save1[l]);
+    }
+}
+
+} // namespace
+
+namespace sha256_shani {
+SHANI_TARGET void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i state0, state1, w[4];
+    Unpack(_mm_loadu_si128((const __m128i*)s), _mm_loadu_si128((const __m128i*)(s + 4)), state0, state1);
+    while (blocks--) {
+        for (int j = 0; j < 4; j++) w[j] = Load(chunk + 16 * j);
+        Rounds(state0, state1, w);
+        chunk += 64;
+    }
+    __m128i abcd, efgh;
+    Pack(state0, state1, abcd, efgh);
+    _mm_storeu_si128((__m128i*)s, abcd);
+    _mm_storeu_si128((__m128i*)(s + 4), efgh);
+}
+} // namespace sha256_shani
+
+namespace sha256d64_shani {
+SHANI_TARGET void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    __m128i state0[2], state1[2], w[2][4];
+
+    // First hash: the 64-byte input, then the padding block for a 64-byte message
+    for (int l = 0; l < 2; l++) {
+        Unpack(_mm_load_si128((const __m128i*)INIT), _mm_load_si128((const __m128i*)(INIT + 4)), state0[l], state1[l]);
+        for (int j = 0; j < 4; j++) w[l][j] = Load(in + 64 * l + 16 * j);
+    }
+    Rounds2(state0, state1, w);
+    for (int l = 0; l < 2; l++) {
+        w[l][0] = _mm_set_epi32(0, 0, 0, 0x80000000);
+        w[l][1] = w[l][2] = _mm_setzero_si128();
+        w[l][3] = _mm_set_epi32(512, 0, 0, 0);
+    }
+    Rounds2(state0, state1, w);
+
+    // Second hash: the 32-byte digest, padded
+    for (int l = 0; l < 2; l++) {
+        Pack(state0[l], state1[l], w[l][0], w[l][1]);
+        w[l][2] = _mm_set_epi32(0, 0, 0, 0x80000000);
+        w[l][3] = _mm_set_epi32(256, 0, 0, 0);
+        Unpack(_mm_load_si128((const __m128i*)INIT), _mm_load_si128((const __m128i*)(INIT + 4)), state0[l], state1[l]);
+    }
+    Rounds2(state0, state1, w);
+
+    for (int l = 0; l < 2; l++) {
+        __m128i abcd, efgh;
+        Pack(state0[l], state1[l], abcd, efgh);
+        Store(out + 32 * l, abcd);
+        Store(out + 32 * l + 16, efgh);
+    }
+}
+} // namespace sha256d64_shani
+
+#endif
@@ -0,0 +1,111 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// 4-way interleaved double-SHA256 of 64-byte inputs, using SSE4.1.
+
+#if defined(__x86_64__) || defined(__amd64__)
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace sha256d64_sse41 {
+namespace {
+
+#define SSE41_TARGET __attribute__((target("sse4.1")))
+
+const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+SSE41_TARGET inline __m128i K4(uint32_t x) { return _mm_set1_epi32(x); }
+SSE41_TARGET inline __m128i Add(__m128i x, __m128i y) { return _mm_add_epi32(x, y); }
+SSE41_TARGET inline __m128i Add(__m128i x, __m128i y, __m128i z) { return Add(Add(x, y), z); }
+SSE41_TARGET inline __m128i Add(__m128i x, __m128i y, __m128i z, __m128i w) { return Add(Add(x, y), Add(z, w)); }
+SSE41_TARGET inline __m128i Xor(__m128i x, __m128i y) { return _mm_xor_si128(x, y); }
+SSE41_TARGET inline __m128i Xor(__m128i x, __m128i y, __m128i z) { return Xor(Xor(x, y), z); }
+SSE41_TARGET inline __m128i Or(__m128i x, __m128i y) { return _mm_or_si128(x, y); }
+SSE41_TARGET inline __m128i And(__m128i x, __m128i y) { return _mm_and_si128(x, y); }
+SSE41_TARGET inline __m128i ShR(__m128i x, int n) { return _mm_srli_epi32(x, n); }
+SSE41_TARGET inline __m128i ShL(__m128i x, int n) { return _mm_slli_epi32(x, n); }
+SSE41_TARGET inline __m128i RotR(__m128i x, int n) { return Or(ShR(x, n), ShL(x, 32 - n)); }
+
+SSE41_TARGET inline __m128i Ch(__m128i x, __m128i y, __m128i z) { return Xor(z, And(x, Xor(y, z))); }
+SSE41_TARGET inline __m128i Maj(__m128i x, __m128i y, __m128i z) { return Or(And(x, y), And(z, Or(x, y))); }
+SSE41_TARGET inline __m128i Sigma0(__m128i x) { return Xor(RotR(x, 2), RotR(x, 13), RotR(x, 22)); }
+SSE41_TARGET inline __m128i Sigma1(__m128i x) { return Xor(RotR(x, 6), RotR(x, 11), RotR(x, 25)); }
+SSE41_TARGET inline __m128i sigma0(__m128i x) { return Xor(RotR(x, 7), RotR(x, 18), ShR(x, 3)); }
+SSE41_TARGET inline __m128i sigma1(__m128i x) { return Xor(RotR(x, 17), RotR(x, 19), ShR(x, 10)); }
+
+/** Run the 64 rounds over one message block per lane and add the result into s. w is overwritten. */
+SSE41_TARGET inline void Rounds(__m128i* s, __m128i* w)
+{
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16)
+            w[i & 15] = Add(w[i & 15], sigma1(w[(i - 2) & 15]), w[(i - 7) & 15], sigma0(w[(i - 15) & 15]));
+        __m128i t1 = Add(h, Sigma1(e), Ch(e, f, g), Add(K4(K[i]), w[i & 15]));
+        __m128i t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g; g = f; f = e; e = Add(d, t1);
+        d = c; c = b; b = a; a = Add(t1, t2);
+    }
+    s[0] = Add(s[0], a); s[1] = Add(s[1], b); s[2] = Add(s[2], c); s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e); s[5] = Add(s[5], f); s[6] = Add(s[6], g); s[7] = Add(s[7], h);
+}
+
+/** Word j of each of the four 64-byte inputs, one per lane. */
+SSE41_TARGET inline __m128i Read4(const unsigned char* in, int j)
+{
+    return _mm_set_epi32(ReadBE32(in + 192 + 4 * j), ReadBE32(in + 128 + 4 * j), ReadBE32(in + 64 + 4 * j), ReadBE32(in + 4 * j));
+}
+
+SSE41_TARGET inline void Write4(unsigned char* out, int j, __m128i v)
+{
+    WriteBE32(out + 4 * j, _mm_extract_epi32(v, 0));
+    WriteBE32(out + 32 + 4 * j, _mm_extract_epi32(v, 1));
+    WriteBE32(out + 64 + 4 * j, _mm_extract_epi32(v, 2));
+    WriteBE32(out + 96 + 4 * j, _mm_extract_epi32(v, 3));
+}
+
+} // namespace
+
+SSE41_TARGET void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    __m128i s[8], t[8], w[16];
+
+    // First hash: the 64-byte input, then the padding block for a 64-byte message
+    for (int i = 0; i < 8; i++) s[i] = K4(INIT[i]);
+    for (int j = 0; j < 16; j++) w[j] = Read4(in, j);
+    Rounds(s, w);
+    for (int j = 0; j < 16; j++) w[j] = K4(0);
+    w[0] = K4(0x80000000ul);
+    w[15] = K4(512);
+    Rounds(s, w);
+
+    // Second hash: the 32-byte digest, padded
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+        t[i] = K4(INIT[i]);
+    }
+    w[8] = K4(0x80000000ul);
+    for (int j = 9; j < 15; j++) w[j] = K4(0);
+    w[15] = K4(256);
+    Rounds(t, w);
+
+    for (int i = 0; i < 8; i++) Write4(out, i, t[i]);
+}
+
+} // namespace sha256d64_sse41
+
+#endif
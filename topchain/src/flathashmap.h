@@ -0,0 +1,305 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATHASHMAP_H
+#define BITCOIN_FLATHASHMAP_H
+
+#include "support/allocators/pool.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Open addressing hash map with its entries in an arena.
+ *
+ * The table is a flat array of slots probed linearly, with one control byte
+ * per slot holding the top 7 bits of the key's hash, so most probes that do
+ * not match are rejected without leaving the control array. Entries
+ * themselves are carved from a pool_resource owned by the map: no malloc
+ * header and no chain pointer per entry, and neighbouring insertions end up
+ * next to each other in memory.
+ *
+ * Supports the subset of the std::unordered_map interface the coins cache
+ * needs, with the same guarantees: iterators are invalidated by insertions
+ * that grow the table, references to entries stay valid until the entry is
+ * erased, and erasing an entry only invalidates iterators pointing to it.
+ *
+ * Hash must return well mixed bits (as a salted SipHash does): the low bits
+ * pick the slot and the high bits fill the control byte.
+ */
+template <typename K, typename T, typename Hash>
+class flat_hash_map
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef std::size_t size_type;
+
+private:
+    // Chunks small enough to come from the malloc heap rather than mmap, as
+    // short lived maps holding a few entries are common
+    typedef pool_resource<sizeof(value_type), 32 * 1024> resource_type;
+
+    // Control bytes: the hash tag (0x00-0x7f) for a used slot, or one of
+    enum : unsigned char {
+        CTRL_EMPTY = 0x80,
+        CTRL_DELETED = 0xfe,
+    };
+    enum { MIN_SLOTS = 16 };
+
+    Hash hasher;
+    std::unique_ptr<resource_type> resource;
+    std::vector<unsigned char> ctrl;
+    std::vector<value_type*> slots;
+    size_type _size;
+    size_type _deleted;
+
+    static unsigned char Tag(std::size_t hash) { return hash >> (sizeof(std::size_t) * 8 - 7); }
+    static bool IsUsed(unsigned char c) { return c < 0x80; }
+
+    /** Slot holding key, or slots.size() if it is absent. */
+    size_type FindSlot(const K& key) const
+    {
+        if (_size == 0)
+            return slots.size();
+        const std::size_t hash = hasher(key);
+        const unsigned char tag = Tag(hash);
+        const size_type mask = slots.size() - 1;
+        for (size_type pos = hash & mask; ; pos = (pos + 1) & mask) {
+            const unsigned char c = ctrl[pos];
+            if (c == tag && slots[pos]->first == key)
+                return pos;
+            if (c == CTRL_EMPTY)
+                return slots.size();
+        }
+    }
+
+    /** First empty or deleted slot on the probe sequence of hash. The table must have room. */
+    size_type FreeSlot(std::size_t hash) const
+    {
+        const size_type mask = slots.size() - 1;
+        size_type pos = hash & mask;
+        while (IsUsed(ctrl[pos]))
+            pos = (pos + 1) & mask;
+        return pos;
+    }
+
+    /** Rebuild the table with room for at least one more entry, dropping deleted slots. */
+    void Grow()
+    {
+        size_type nSlots = std::max<size_type>(slots.size(), MIN_SLOTS);
+        while ((_size + 1) * 16 > nSlots * 7)
+            nSlots *= 2;
+        std::vector<unsigned char> ctrlOld;
+        std::vector<value_type*> slotsOld;
+        ctrlOld.swap(ctrl);
+        slotsOld.swap(slots);
+        ctrl.assign(nSlots, CTRL_EMPTY);
+        slots.assign(nSlots, nullptr);
+        for (size_type i = 0; i < slotsOld.size(); i++) {
+            if (!IsUsed(ctrlOld[i]))
+                continue;
+            const std::size_t hash = hasher(slotsOld[i]->first);
+            const size_type pos = FreeSlot(hash);
+            ctrl[pos] = Tag(hash);
+            slots[pos] = slotsOld[i];
+        }
+        _deleted = 0;
+    }
+
+    void Destroy(value_type* p)
+    {
+        p->~value_type();
+        resource->deallocate(p, sizeof(value_type), alignof(value_type));
+    }
+
+    /** Insert the entry p unless its key is present, in which case p is destroyed. */
+    std::pair<size_type, bool> Insert(value_type* p)
+    {
+        // Keep at least 1/8 of the slots empty so that probes terminate quickly
+        if ((_size + _deleted + 1) * 8 > slots.size() * 7)
+            Grow();
+        const std::size_t hash = hasher(p->first);
+        const unsigned char tag = Tag(hash);
+        const size_type mask = slots.size() - 1;
+        size_type posFree = slots.size();
+        for (size_type pos = hash & mask; ; pos = (pos + 1) & mask) {
+            const unsigned char c = ctrl[pos];
+            if (c == tag && slots[pos]->first == p->first) {
+                Destroy(p);
+                return std::make_pair(pos, false);
+            }
+            if (c == CTRL_DELETED && posFree == slots.size())
+                posFree = pos;
+            if (c == CTRL_EMPTY) {
+                if (posFree == slots.size())
+                    posFree = pos;
+                else
+                    _deleted--;
+                break;
+            }
+        }
+        ctrl[posFree] = tag;
+        slots[posFree] = p;
+        _size++;
+        return std::make_pair(posFree, true);
+    }
+
+    template <bool IsConst>
+    class iterator_impl
+    {
+        friend class flat_hash_map;
+        typedef typename std::conditional<IsConst, const flat_hash_map, flat_hash_map>::type map_type;
+
+        map_type* map;
+        size_type pos;
+
+        iterator_impl(map_type* mapIn, size_type posIn) : map(mapIn), pos(posIn) {}
+        void SkipUnused()
+        {
+            while (pos < map->slots.size() && !IsUsed(map->ctrl[pos]))
+                pos++;
+        }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename flat_hash_map::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<IsConst, const value_type&, value_type&>::type reference;
+
+        iterator_impl() : map(nullptr), pos(0) {}
+        template <bool OtherConst, typename = typename std::enable_if<IsConst && !OtherConst>::type>
+        iterator_impl(const iterator_impl<OtherConst>& it) : map(it.map), pos(it.pos) {}
+
+        reference operator*() const { return *map->slots[pos]; }
+        pointer operator->() const { return map->slots[pos]; }
+        iterator_impl& operator++() { pos++; SkipUnused(); return *this; }
+        iterator_impl operator++(int) { iterator_impl copy(*this); ++(*this); return copy; }
+        friend bool operator==(const iterator_impl& a, const iterator_impl& b) { return a.pos == b.pos; }
+        friend bool operator!=(const iterator_impl& a, const iterator_impl& b) { return a.pos != b.pos; }
+
+        template <bool> friend class iterator_impl;
+    };
+
+public:
+    typedef iterator_impl<false> iterator;
+    typedef iterator_impl<true> const_iterator;
+
+    flat_hash_map() : resource(new resource_type()), _size(0), _deleted(0) {}
+    ~flat_hash_map()
+    {
+        for (size_type i = 0; i < slots.size(); i++) {
+            if (IsUsed(ctrl[i]))
+                slots[i]->~value_type();
+        }
+    }
+
+    flat_hash_map(const flat_hash_map&) = delete;
+    flat_hash_map& operator=(const flat_hash_map&) = delete;
+
+    iterator begin() { iterator it(this, 0); it.SkipUnused(); return it; }
+    const_iterator begin() const { const_iterator it(this, 0); it.SkipUnused(); return it; }
+    iterator end() { return iterator(this, slots.size()); }
+    const_iterator end() const { return const_iterator(this, slots.size()); }
+
+    bool empty() const { return _size == 0; }
+    size_type size() const { return _size; }
+
+    iterator find(const K& key) { return iterator(this, FindSlot(key)); }
+    const_iterator find(const K& key) const { return const_iterator(this, FindSlot(key)); }
+    size_type count(const K& key) const { return FindSlot(key) != slots.size(); }
+
+    /** Construct an entry from args and insert it, unless its key is already present. */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        void* p = resource->allocate(sizeof(value_type), alignof(value_type));
+        value_type* entry;
+        try {
+            entry = new (p) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            resource->deallocate(p, sizeof(value_type), alignof(value_type));
+            throw;
+        }
+        std::pair<size_type, bool> ret = Insert(entry);
+        return std::make_pair(iterator(this, ret.first), ret.second);
+    }
+
+    T& operator[](const K& key)
+    {
+        size_type pos = FindSlot(key);
+        if (pos != slots.size())
+            return slots[pos]->second;
+        return emplace(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first->second;
+    }
+
+    /** Erase the entry at it, returning an iterator to the next one. */
+    iterator erase(const_iterator it)
+    {
+        const size_type mask = slots.size() - 1;
+        Destroy(slots[it.pos]);
+        slots[it.pos] = nullptr;
+        // A slot followed by an empty one ends no probe sequence that needs it
+        if (ctrl[(it.pos + 1) & mask] == CTRL_EMPTY) {
+            ctrl[it.pos] = CTRL_EMPTY;
+        } else {
+            ctrl[it.pos] = CTRL_DELETED;
+            _deleted++;
+        }
+        _size--;
+        iterator next(this, it.pos);
+        ++next;
+        return next;
+    }
+
+    size_type erase(const K& key)
+    {
+        size_type pos = FindSlot(key);
+        if (pos == slots.size())
+            return 0;
+        erase(const_iterator(this, pos));
+        return 1;
+    }
+
+    /** Destroy all entries and give back all memory. */
+    void clear()
+    {
+        for (size_type i = 0; i < slots.size(); i++) {
+            if (IsUsed(ctrl[i]))
+                slots[i]->~value_type();
+        }
+        std::vector<unsigned char>().swap(ctrl);
+        std::vector<value_type*>().swap(slots);
+        resource.reset(new resource_type());
+        _size = 0;
+        _deleted = 0;
+    }
+
+    void swap(flat_hash_map& other)
+    {
+        std::swap(hasher, other.hasher);
+        resource.swap(other.resource);
+        ctrl.swap(other.ctrl);
+        slots.swap(other.slots);
+        std::swap(_size, other._size);
+        std::swap(_deleted, other._deleted);
+    }
+
+    //! Number of slots in the table
+    size_type slot_count() const { return slots.size(); }
+    //! Memory held by the entry arena
+    size_type pool_usage() const { return resource->ChunkUsage(); }
+};
+
+#endif // BITCOIN_FLATHASHMAP_H
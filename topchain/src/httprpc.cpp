@@ -15,6 +15,7 @@
 #include "utilstrencodings.h"
 #include "ui_interface.h"
 #include "crypto/hmac_sha256.h"
+#include <set>
 #include <stdio.h>
 
 #include <boost/algorithm/string.hpp> // boost::trim
@@ -22,6 +23,11 @@
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
 
+/** Methods that can be called through /binary/, taking their data raw */
+static const std::set<std::string> setBinaryRPCMethods = {
+    "submitsubblocks",
+};
+
 /** Simple one-shot callback timer to be used by the RPC mechanism to e.g.
  * re-lock the wallet.
  */
@@ -142,7 +148,8 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
     return multiUserAuthorized(strUserPass);
 }
 
-static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+/** Check that req is an authorized POST, replying with the error if it is not */
+static bool CheckRPCRequest(HTTPRequest* req, JSONRPCRequest& jreq)
 {
     // JSONRPC handles only POST
     if (req->GetRequestMethod() != HTTPRequest::POST) {
@@ -157,7 +164,6 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         return false;
     }
 
-    JSONRPCRequest jreq;
     if (!RPCAuthorized(authHeader.second, jreq.authUser)) {
         LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", req->GetPeer().ToString());
 
@@ -170,6 +176,14 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         req->WriteReply(HTTP_UNAUTHORIZED);
         return false;
     }
+    return true;
+}
+
+static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+{
+    JSONRPCRequest jreq;
+    if (!CheckRPCRequest(req, jreq))
+        return false;
 
     try {
         // Parse request
@@ -208,6 +222,67 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     return true;
 }
 
+/**
+ * An RPC call without the JSON and hex around its data: POST /binary/<method>,
+ * or /wallet/<name>/binary/<method> for a wallet method of a named wallet,
+ * with the raw argument as body. Only methods in setBinaryRPCMethods can be
+ * called this way. The method sees the body as its only parameter, with
+ * JSONRPCRequest::fBinary set, and strURI as the request URI. A string result
+ * is sent back as raw bytes, anything else as JSON. Errors come back as
+ * JSON-RPC error replies.
+ */
+static bool ExecuteBinaryRPC(HTTPRequest* req, const std::string& strMethod, const std::string& strURI)
+{
+    JSONRPCRequest jreq;
+    if (!CheckRPCRequest(req, jreq))
+        return false;
+
+    try {
+        if (!setBinaryRPCMethods.count(strMethod))
+            throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found in binary form");
+        jreq.strMethod = strMethod;
+        jreq.params = UniValue(UniValue::VARR);
+        jreq.params.push_back(req->ReadBody());
+        jreq.fBinary = true;
+        jreq.URI = strURI;
+
+        UniValue result = tableRPC.execute(jreq);
+
+        if (result.isStr()) {
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReply(HTTP_OK, result.get_str());
+        } else {
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, result.write() + "\n");
+        }
+    } catch (const UniValue& objError) {
+        JSONErrorReply(req, objError, NullUniValue);
+        return false;
+    } catch (const std::exception& e) {
+        JSONErrorReply(req, JSONRPCError(RPC_MISC_ERROR, e.what()), NullUniValue);
+        return false;
+    }
+    return true;
+}
+
+static bool HTTPReq_BinaryRPC(HTTPRequest* req, const std::string& strMethod)
+{
+    return ExecuteBinaryRPC(req, strMethod, req->GetURI());
+}
+
+#ifdef ENABLE_WALLET
+/** JSON-RPC on /wallet/<name>, and binary calls on /wallet/<name>/binary/<method> */
+static bool HTTPReq_WalletRPC(HTTPRequest* req, const std::string& strPath)
+{
+    static const std::string BINARY_ENDPOINT = "/binary/";
+    // Method names have no slashes, so the last one separates the method
+    size_t nPos = strPath.rfind(BINARY_ENDPOINT);
+    if (nPos != std::string::npos)
+        return ExecuteBinaryRPC(req, strPath.substr(nPos + BINARY_ENDPOINT.size()), "/wallet/" + strPath.substr(0, nPos));
+    return HTTPReq_JSONRPC(req, strPath);
+}
+#endif
+
 static bool InitRPCAuthentication()
 {
     if (gArgs.GetArg("-rpcpassword", "") == "")
@@ -233,9 +308,10 @@ bool StartHTTPRPC()
         return false;
 
     RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/binary/", false, HTTPReq_BinaryRPC);
 #ifdef ENABLE_WALLET
     // ifdef can be removed once we switch to better endpoint support and API versioning
-    RegisterHTTPHandler("/wallet/", false, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/wallet/", false, HTTPReq_WalletRPC);
 #endif
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
@@ -252,6 +328,7 @@ void StopHTTPRPC()
 {
     LogPrint(BCLog::RPC, "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    UnregisterHTTPHandler("/binary/", false);
     if (httpRPCTimerInterface) {
         RPCUnsetTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "httpserver.h"
+#include "httpworkqueue.h"
 
 #include "chainparamsbase.h"
 #include "compat.h"
@@ -20,7 +21,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <atomic>
+#include <deque>
 #include <future>
+#include <map>
 
 #include <event2/thread.h>
 #include <event2/buffer.h>
@@ -39,6 +43,8 @@
 
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
+/** Bytes of a JSON-RPC request body searched for the method name */
+static const size_t MAX_METHOD_SCAN_SIZE = 1024;
 
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
@@ -60,96 +66,6 @@ private:
     HTTPRequestHandler func;
 };
 
-/** Simple work queue for distributing work over multiple threads.
- * Work items are simply callable objects.
- */
-template <typename WorkItem>
-class WorkQueue
-{
-private:
-    /** Mutex protects entire object */
-    std::mutex cs;
-    std::condition_variable cond;
-    std::deque<std::unique_ptr<WorkItem>> queue;
-    bool running;
-    size_t maxDepth;
-    int numThreads;
-
-    /** RAII object to keep track of number of running worker threads */
-    class ThreadCounter
-    {
-    public:
-        WorkQueue &wq;
-        ThreadCounter(WorkQueue &w): wq(w)
-        {
-            std::lock_guard<std::mutex> lock(wq.cs);
-            wq.numThreads += 1;
-        }
-        ~ThreadCounter()
-        {
-            std::lock_guard<std::mutex> lock(wq.cs);
-            wq.numThreads -= 1;
-            wq.cond.notify_all();
-        }
-    };
-
-public:
-    WorkQueue(size_t _maxDepth) : running(true),
-                                 maxDepth(_maxDepth),
-                                 numThreads(0)
-    {
-    }
-    /** Precondition: worker threads have all stopped
-     * (call WaitExit)
-     */
-    ~WorkQueue()
-    {
-    }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
-    {
-        std::unique_lock<std::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
-            return false;
-        }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
-        cond.notify_one();
-        return true;
-    }
-    /** Thread function */
-    void Run()
-    {
-        ThreadCounter count(*this);
-        while (true) {
-            std::unique_ptr<WorkItem> i;
-            {
-                std::unique_lock<std::mutex> lock(cs);
-                while (running && queue.empty())
-                    cond.wait(lock);
-                if (!running)
-                    break;
-                i = std::move(queue.front());
-                queue.pop_front();
-            }
-            (*i)();
-        }
-    }
-    /** Interrupt and exit loops */
-    void Interrupt()
-    {
-        std::unique_lock<std::mutex> lock(cs);
-        running = false;
-        cond.notify_all();
-    }
-    /** Wait for worker threads to exit */
-    void WaitExit()
-    {
-        std::unique_lock<std::mutex> lock(cs);
-        while (numThreads > 0)
-            cond.wait(lock);
-    }
-};
-
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
@@ -172,6 +88,10 @@ struct evhttp* eventHTTP = 0;
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Priority classes by URI prefix, in the order they are tried
+static std::vector<std::pair<std::string, HTTPPriority>> uriPriorities;
+//! Priority classes by JSON-RPC method, for requests no URI prefix matched
+static std::map<std::string, HTTPPriority> methodPriorities;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
@@ -216,6 +136,93 @@ static bool InitHTTPAllowList()
     return true;
 }
 
+const char* HTTPPriorityName(HTTPPriority priority)
+{
+    switch (priority) {
+    case HTTP_PRIORITY_HIGH:
+        return "high";
+    case HTTP_PRIORITY_NORMAL:
+        return "normal";
+    case HTTP_PRIORITY_LOW:
+        return "low";
+    default:
+        return "unknown";
+    }
+}
+
+/** Initialize priority classes from -rpcpriority, followed by the defaults */
+static bool InitHTTPPriorities()
+{
+    uriPriorities.clear();
+    methodPriorities.clear();
+    std::vector<std::string> vRules = gArgs.GetArgs("-rpcpriority");
+    // Cheap calls that monitoring relies on, subblock backups that have to
+    // keep up with their subchain, and the calls and endpoints that serve
+    // whole blocks to explorers
+    for (const char* rule : {"high:getblockcount", "high:getbestblockhash", "high:getconnectioncount",
+                             "high:getrpcinfo", "high:uptime", "high:help", "high:stop",
+                             "high:submitsubblocks", "high:/binary/submitsubblocks",
+                             "low:getblock", "low:getsubchainmetainfo", "low:gettxoutsetinfo",
+                             "low:/rest/"}) {
+        vRules.push_back(rule);
+    }
+    for (const std::string& strRule : vRules) {
+        size_t nColon = strRule.find(':');
+        std::string strClass = strRule.substr(0, nColon);
+        std::string strTarget = nColon == std::string::npos ? "" : strRule.substr(nColon + 1);
+        int nClass = 0;
+        while (nClass < HTTP_PRIORITY_COUNT && strClass != HTTPPriorityName((HTTPPriority)nClass))
+            nClass++;
+        if (nClass == HTTP_PRIORITY_COUNT || strTarget.empty()) {
+            uiInterface.ThreadSafeMessageBox(
+                strprintf("Invalid -rpcpriority specification: %s. Valid is a class (high, normal or low) followed by a colon and an RPC method name (e.g. high:getblockcount) or a URI prefix (e.g. low:/rest/).", strRule),
+                "", CClientUIInterface::MSG_ERROR);
+            return false;
+        }
+        // Rules given earlier (on the command line) take precedence
+        if (strTarget[0] == '/')
+            uriPriorities.emplace_back(strTarget, (HTTPPriority)nClass);
+        else
+            methodPriorities.emplace(strTarget, (HTTPPriority)nClass);
+    }
+    return true;
+}
+
+/** Find the "method" member of a JSON-RPC request in the start of its body.
+ * This is only a guess used for scheduling, the request is parsed in full by
+ * its handler: batches and anything unusual are simply not recognized.
+ */
+static std::string ScanRPCMethod(const std::string& strBody)
+{
+    size_t nPos = strBody.find("\"method\"");
+    if (nPos == std::string::npos)
+        return "";
+    nPos += 8;
+    while (nPos < strBody.size() && (strBody[nPos] == ' ' || strBody[nPos] == '\t' || strBody[nPos] == '\r' || strBody[nPos] == '\n' || strBody[nPos] == ':'))
+        nPos++;
+    if (nPos >= strBody.size() || strBody[nPos] != '"')
+        return "";
+    size_t nEnd = strBody.find('"', ++nPos);
+    if (nEnd == std::string::npos)
+        return "";
+    return strBody.substr(nPos, nEnd - nPos);
+}
+
+/** Priority class of a request, by URI prefix or JSON-RPC method */
+static HTTPPriority GetRequestPriority(HTTPRequest& req, const std::string& strURI)
+{
+    for (const std::pair<std::string, HTTPPriority>& rule : uriPriorities) {
+        if (strURI.compare(0, rule.first.size(), rule.first) == 0)
+            return rule.second;
+    }
+    if (req.GetRequestMethod() == HTTPRequest::POST && !methodPriorities.empty()) {
+        std::map<std::string, HTTPPriority>::const_iterator it = methodPriorities.find(ScanRPCMethod(req.PeekBody(MAX_METHOD_SCAN_SIZE)));
+        if (it != methodPriorities.end())
+            return it->second;
+    }
+    return HTTP_PRIORITY_NORMAL;
+}
+
 /** HTTP request method as string - use for logging only */
 static std::string RequestMethodString(HTTPRequest::RequestMethod m)
 {
@@ -286,12 +293,13 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        HTTPPriority priority = GetRequestPriority(*hreq, strURI);
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), path, i->handler));
         assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        if (workQueue->Enqueue(item.get(), priority))
             item.release(); /* if true, queue took ownership */
         else {
-            LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
+            LogPrintf("WARNING: %s priority request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n", HTTPPriorityName(priority));
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
         }
     } else {
@@ -356,10 +364,10 @@ static bool HTTPBindAddresses(struct evhttp* http)
 }
 
 /** Simple wrapper to set thread name and run work queue */
-static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue)
+static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue, int nWorker)
 {
     RenameThread("bitcoin-httpworker");
-    queue->Run();
+    queue->Run(nWorker);
 }
 
 /** libevent event log callback */
@@ -380,6 +388,9 @@ bool InitHTTPServer()
     if (!InitHTTPAllowList())
         return false;
 
+    if (!InitHTTPPriorities())
+        return false;
+
     if (gArgs.GetBoolArg("-rpcssl", false)) {
         uiInterface.ThreadSafeMessageBox(
             "SSL mode for RPC (-rpcssl) is no longer supported.",
@@ -424,9 +435,10 @@ bool InitHTTPServer()
 
     LogPrint(BCLog::HTTP, "Initialized HTTP server\n");
     int workQueueDepth = std::max((long)gArgs.GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
+    int rpcThreads = std::max((long)gArgs.GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
+    LogPrintf("HTTP: creating work queue of depth %d for %d workers\n", workQueueDepth, rpcThreads);
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth, rpcThreads);
     // tranfer ownership to eventBase/HTTP via .release()
     eventBase = base_ctr.release();
     eventHTTP = http_ctr.release();
@@ -453,14 +465,14 @@ std::future<bool> threadResult;
 bool StartHTTPServer()
 {
     LogPrint(BCLog::HTTP, "Starting HTTP server\n");
-    int rpcThreads = std::max((long)gArgs.GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
+    int rpcThreads = workQueue->NumWorkers();
     LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
     std::packaged_task<bool(event_base*, evhttp*)> task(ThreadHTTP);
     threadResult = task.get_future();
     threadHTTP = std::thread(std::move(task), eventBase, eventHTTP);
 
     for (int i = 0; i < rpcThreads; i++) {
-        std::thread rpc_worker(HTTPWorkQueueRun, workQueue);
+        std::thread rpc_worker(HTTPWorkQueueRun, workQueue, i);
         rpc_worker.detach();
     }
     return true;
@@ -515,6 +527,16 @@ void StopHTTPServer()
     LogPrint(BCLog::HTTP, "Stopped HTTP server\n");
 }
 
+bool GetHTTPQueueStats(int& nWorkers, int& nMaxDepth, std::vector<HTTPQueueStats>& stats)
+{
+    if (!workQueue)
+        return false;
+    nWorkers = workQueue->NumWorkers();
+    nMaxDepth = workQueue->MaxDepth();
+    stats = workQueue->GetStats();
+    return true;
+}
+
 struct event_base* EventBase()
 {
     return eventBase;
@@ -591,6 +613,17 @@ std::string HTTPRequest::ReadBody()
     return rv;
 }
 
+std::string HTTPRequest::PeekBody(size_t nMaxSize)
+{
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return "";
+    std::string rv(std::min(evbuffer_get_length(buf), nMaxSize), '\0');
+    ev_ssize_t nRead = evbuffer_copyout(buf, &rv[0], rv.size());
+    rv.resize(std::max<ev_ssize_t>(nRead, 0));
+    return rv;
+}
+
 void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 {
     struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
@@ -606,10 +639,42 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
-    // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
+    SendReply(nStatus);
+}
+
+void HTTPRequest::WriteReplyFile(int nStatus, FILE* file, int64_t nOffset, int64_t nLength)
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    bool fAdded = false;
+#ifndef WIN32
+    // Hand libevent a descriptor of its own, it closes it once the data has been sent
+    int fd = dup(fileno(file));
+    if (fd >= 0) {
+        fAdded = evbuffer_add_file(evb, fd, nOffset, nLength) == 0;
+        if (!fAdded)
+            close(fd);
+    }
+#endif
+    if (!fAdded) {
+        std::vector<char> vData(nLength);
+        if (fseek(file, nOffset, SEEK_SET) == 0 && fread(vData.data(), 1, vData.size(), file) == vData.size()) {
+            evbuffer_add(evb, vData.data(), vData.size());
+        } else {
+            LogPrintf("%s: failed to read %d bytes at offset %d\n", __func__, nLength, nOffset);
+            nStatus = HTTP_INTERNAL;
+        }
+    }
+    SendReply(nStatus);
+}
+
+void HTTPRequest::SendReply(int nStatus)
+{
+    // Send event to main http thread to send reply message
     auto req_copy = req;
     HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
         evhttp_send_reply(req_copy, nStatus, nullptr, nullptr);
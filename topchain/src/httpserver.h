@@ -7,7 +7,9 @@
 
 #include <string>
 #include <stdint.h>
+#include <stdio.h>
 #include <functional>
+#include <vector>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -32,6 +34,45 @@ void InterruptHTTPServer();
 /** Stop HTTP server */
 void StopHTTPServer();
 
+/** Scheduling class of an HTTP request, set with -rpcpriority. Queued
+ * requests of a higher class are run first.
+ */
+enum HTTPPriority {
+    HTTP_PRIORITY_HIGH,
+    HTTP_PRIORITY_NORMAL,
+    HTTP_PRIORITY_LOW,
+    HTTP_PRIORITY_COUNT
+};
+
+/** Name of a priority class as used by -rpcpriority */
+const char* HTTPPriorityName(HTTPPriority priority);
+
+/** Number of buckets of the queue latency histograms. Bucket i counts the
+ * requests that waited less than 2^i microseconds (and not less than
+ * 2^(i-1)), the last one also counts all that waited longer.
+ */
+static const int HTTP_LATENCY_BUCKETS = 24;
+
+/** Work queue statistics of one priority class */
+struct HTTPQueueStats
+{
+    //! Requests currently queued
+    int64_t nQueued;
+    //! Requests queued since startup
+    uint64_t nRequests;
+    //! Requests rejected because the work queue was full
+    uint64_t nRejected;
+    //! Requests run by another worker than the one they were queued to
+    uint64_t nStolen;
+    //! Time requests spent in the queue, see HTTP_LATENCY_BUCKETS
+    std::vector<uint64_t> vLatency;
+};
+
+/** Work queue statistics, with one entry per priority class. Returns false
+ * if the HTTP server is not running.
+ */
+bool GetHTTPQueueStats(int& nWorkers, int& nMaxDepth, std::vector<HTTPQueueStats>& stats);
+
 /** Change logging level for libevent. Removes BCLog::LIBEVENT from logCategories if
  * libevent doesn't support debug logging.*/
 bool UpdateHTTPServerLogging(bool enable);
@@ -60,6 +101,9 @@ private:
     struct evhttp_request* req;
     bool replySent;
 
+    /** Hand the request with the output buffer filled in back to the main http thread. */
+    void SendReply(int nStatus);
+
 public:
     HTTPRequest(struct evhttp_request* req);
     ~HTTPRequest();
@@ -98,6 +142,11 @@ public:
      */
     std::string ReadBody();
 
+    /**
+     * Copy at most nMaxSize bytes of the request body without consuming it.
+     */
+    std::string PeekBody(size_t nMaxSize);
+
     /**
      * Write output header.
      *
@@ -114,6 +163,16 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Write HTTP reply with nLength bytes of file starting at nOffset as the
+     * body. Where the platform allows, libevent sends them straight from the
+     * file (with sendfile or mmap) instead of copying them into the output
+     * buffer. The caller keeps ownership of file.
+     *
+     * @note Same restrictions as WriteReply.
+     */
+    void WriteReplyFile(int nStatus, FILE* file, int64_t nOffset, int64_t nLength);
 };
 
 /** Event handler closure.
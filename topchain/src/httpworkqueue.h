@@ -0,0 +1,287 @@
+// Copyright (c) 2015-2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_HTTPWORKQUEUE_H
+#define BITCOIN_HTTPWORKQUEUE_H
+
+#include "httpserver.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/** Work queue for distributing work over multiple threads.
+ * Work items are simply callable objects, queued with a priority class.
+ *
+ * Every worker thread has queues of its own, with a lock of its own, so that
+ * the event thread and the workers rarely contend. Items are queued to an
+ * idle worker if there is one, otherwise round-robin. A worker runs the items
+ * of its own queues highest class first, and once they are empty steals from
+ * the other workers before going to sleep, so that a slow request holds up
+ * the items queued behind it only until another worker is free.
+ *
+ * Items of the normal and low classes are rejected once maxDepth items are
+ * queued, and low items also once they take up half of that, so that
+ * requests of the high class are still accepted (up to twice maxDepth) and
+ * normal ones (up to maxDepth) while the queue is flooded with low ones.
+ */
+template <typename WorkItem>
+class WorkQueue
+{
+private:
+    struct Entry {
+        std::unique_ptr<WorkItem> item;
+        int64_t nTimeQueued;
+    };
+
+    struct Worker {
+        /** Mutex protects queues and fWake */
+        std::mutex cs;
+        std::condition_variable cond;
+        std::deque<Entry> queues[HTTP_PRIORITY_COUNT];
+        //! Set to make the worker look for work once more before sleeping
+        bool fWake;
+        //! Worker has no work of its own and is (about to go) sleeping
+        std::atomic<bool> fIdle;
+
+        Worker() : fWake(false), fIdle(false) {}
+    };
+
+    struct ClassStats {
+        std::atomic<int64_t> nQueued;
+        std::atomic<uint64_t> nRequests;
+        std::atomic<uint64_t> nRejected;
+        std::atomic<uint64_t> nStolen;
+        std::atomic<uint64_t> vLatency[HTTP_LATENCY_BUCKETS];
+
+        ClassStats() : nQueued(0), nRequests(0), nRejected(0), nStolen(0)
+        {
+            for (std::atomic<uint64_t>& count : vLatency)
+                count = 0;
+        }
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    ClassStats stats[HTTP_PRIORITY_COUNT];
+    std::atomic<int64_t> nQueued;
+    std::atomic<size_t> nNextWorker;
+    std::atomic<bool> running;
+    const int64_t maxDepth;
+
+    /** Mutex protects numThreads */
+    std::mutex cs;
+    std::condition_variable cond;
+    int numThreads;
+
+    /** RAII object to keep track of number of running worker threads */
+    class ThreadCounter
+    {
+    public:
+        WorkQueue &wq;
+        ThreadCounter(WorkQueue &w): wq(w)
+        {
+            std::lock_guard<std::mutex> lock(wq.cs);
+            wq.numThreads += 1;
+        }
+        ~ThreadCounter()
+        {
+            std::lock_guard<std::mutex> lock(wq.cs);
+            wq.numThreads -= 1;
+            wq.cond.notify_all();
+        }
+    };
+
+    /** Whether an item of class priority fits, with n items queued in total and nClass of its class */
+    bool HasRoom(HTTPPriority priority, int64_t n, int64_t nClass) const
+    {
+        switch (priority) {
+        case HTTP_PRIORITY_HIGH:
+            return n < 2 * maxDepth;
+        case HTTP_PRIORITY_LOW:
+            return n < maxDepth && nClass < std::max<int64_t>(maxDepth / 2, 1);
+        default:
+            return n < maxDepth;
+        }
+    }
+
+    /** Take the oldest item of the highest class queued to worker, not above nMaxClass. Requires worker.cs. */
+    static bool Pop(Worker& worker, int nMaxClass, Entry& entry, int& nClass)
+    {
+        for (nClass = 0; nClass <= nMaxClass; nClass++) {
+            std::deque<Entry>& queue = worker.queues[nClass];
+            if (!queue.empty()) {
+                entry = std::move(queue.front());
+                queue.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Take an item queued to another worker than nSelf, highest class first */
+    bool Steal(size_t nSelf, Entry& entry, int& nClass)
+    {
+        for (int nTry = 0; nTry < HTTP_PRIORITY_COUNT; nTry++) {
+            for (size_t i = 1; i < workers.size(); i++) {
+                Worker& victim = *workers[(nSelf + i) % workers.size()];
+                std::lock_guard<std::mutex> lock(victim.cs);
+                if (Pop(victim, nTry, entry, nClass))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    void Wake(Worker& worker)
+    {
+        std::lock_guard<std::mutex> lock(worker.cs);
+        worker.fWake = true;
+        worker.cond.notify_one();
+    }
+
+    void Dequeued(const Entry& entry, int nClass, bool fStolen)
+    {
+        nQueued--;
+        ClassStats& s = stats[nClass];
+        s.nQueued--;
+        if (fStolen)
+            s.nStolen++;
+        uint64_t nLatency = std::max<int64_t>(GetTimeMicros() - entry.nTimeQueued, 0);
+        int nBucket = 0;
+        while (nLatency && nBucket < HTTP_LATENCY_BUCKETS - 1) {
+            nLatency >>= 1;
+            nBucket++;
+        }
+        s.vLatency[nBucket]++;
+    }
+
+public:
+    WorkQueue(size_t _maxDepth, int _numWorkers) : nQueued(0),
+                                                   nNextWorker(0),
+                                                   running(true),
+                                                   maxDepth(_maxDepth),
+                                                   numThreads(0)
+    {
+        for (int i = 0; i < std::max(_numWorkers, 1); i++)
+            workers.emplace_back(new Worker());
+    }
+    /** Precondition: worker threads have all stopped
+     * (call WaitExit)
+     */
+    ~WorkQueue()
+    {
+    }
+    /** Number of worker threads that should call Run */
+    int NumWorkers() const { return workers.size(); }
+    int64_t MaxDepth() const { return maxDepth; }
+    /** Enqueue a work item */
+    bool Enqueue(WorkItem* item, HTTPPriority priority)
+    {
+        ClassStats& s = stats[priority];
+        s.nRequests++;
+        // Only the event thread queues items, the counts can only drop meanwhile
+        if (!HasRoom(priority, nQueued, s.nQueued)) {
+            s.nRejected++;
+            return false;
+        }
+        nQueued++;
+        s.nQueued++;
+
+        // Prefer a worker that is idle, so the item does not have to be stolen
+        const size_t nStart = nNextWorker++ % workers.size();
+        size_t nTarget = nStart;
+        for (size_t i = 0; i < workers.size(); i++) {
+            if (workers[(nStart + i) % workers.size()]->fIdle) {
+                nTarget = (nStart + i) % workers.size();
+                break;
+            }
+        }
+        Worker& target = *workers[nTarget];
+        {
+            std::lock_guard<std::mutex> lock(target.cs);
+            target.queues[priority].push_back(Entry{std::unique_ptr<WorkItem>(item), GetTimeMicros()});
+            target.fWake = true;
+            target.cond.notify_one();
+        }
+        // The target is busy: wake an idle worker (if one went idle meanwhile) to steal it
+        if (!target.fIdle) {
+            for (size_t i = 1; i < workers.size(); i++) {
+                Worker& worker = *workers[(nTarget + i) % workers.size()];
+                if (worker.fIdle) {
+                    Wake(worker);
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+    /** Thread function of worker nSelf */
+    void Run(size_t nSelf)
+    {
+        ThreadCounter count(*this);
+        Worker& self = *workers[nSelf];
+        while (running) {
+            Entry entry;
+            int nClass;
+            bool fStolen = false;
+            bool fFound;
+            {
+                std::lock_guard<std::mutex> lock(self.cs);
+                self.fWake = false;
+                fFound = Pop(self, HTTP_PRIORITY_COUNT - 1, entry, nClass);
+            }
+            if (!fFound) {
+                // Going idle before looking at the other queues makes sure an
+                // item queued to a busy worker after we looked gets us woken
+                self.fIdle = true;
+                fFound = fStolen = Steal(nSelf, entry, nClass);
+                if (!fFound) {
+                    std::unique_lock<std::mutex> lock(self.cs);
+                    while (running && !self.fWake)
+                        self.cond.wait(lock);
+                }
+                self.fIdle = false;
+            }
+            if (fFound && running) {
+                Dequeued(entry, nClass, fStolen);
+                (*entry.item)();
+            }
+        }
+    }
+    /** Interrupt and exit loops */
+    void Interrupt()
+    {
+        running = false;
+        for (const std::unique_ptr<Worker>& worker : workers)
+            Wake(*worker);
+    }
+    /** Wait for worker threads to exit */
+    void WaitExit()
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        while (numThreads > 0)
+            cond.wait(lock);
+    }
+    /** Statistics per priority class */
+    std::vector<HTTPQueueStats> GetStats() const
+    {
+        std::vector<HTTPQueueStats> ret(HTTP_PRIORITY_COUNT);
+        for (int i = 0; i < HTTP_PRIORITY_COUNT; i++) {
+            ret[i].nQueued = stats[i].nQueued;
+            ret[i].nRequests = stats[i].nRequests;
+            ret[i].nRejected = stats[i].nRejected;
+            ret[i].nStolen = stats[i].nStolen;
+            for (const std::atomic<uint64_t>& count : stats[i].vLatency)
+                ret[i].vLatency.push_back(count);
+        }
+        return ret;
+    }
+};
+
+#endif // BITCOIN_HTTPWORKQUEUE_H
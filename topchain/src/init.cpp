@@ -25,6 +25,7 @@
 #include "netbase.h"
 #include "net.h"
 #include "net_processing.h"
+#include "netpoll.h"
 #include "policy/feerate.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
@@ -34,6 +35,8 @@
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "subblockcache.h"
+#include "subblockcompress.h"
 #include "timedata.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -48,6 +51,7 @@
 #include "warnings.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <atomic>
 #include <memory>
 
 #ifndef WIN32
@@ -89,6 +93,44 @@ static CZMQNotificationInterface* pzmqNotificationInterface = nullptr;
 #endif
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+/** Interval in seconds between checkpoints of the fee estimates to disk */
+static const int64_t FEE_ESTIMATES_CHECKPOINT_INTERVAL = 10 * 60;
+//! Estimator height last written to disk, to skip checkpoints without new blocks
+static unsigned int nFeeEstimatesWrittenHeight = 0;
+
+/**
+ * Write the fee estimates to a new file that then replaces fee_estimates.dat,
+ * so that a crash while writing leaves the previous checkpoint in place.
+ */
+static bool WriteFeeEstimates()
+{
+    fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+    fs::path est_path_new = GetDataDir() / (std::string(FEE_ESTIMATES_FILENAME) + ".new");
+    unsigned int nHeight = ::feeEstimator.BestSeenHeight();
+    {
+        CAutoFile est_fileout(fsbridge::fopen(est_path_new, "wb"), SER_DISK, CLIENT_VERSION);
+        if (est_fileout.IsNull()) {
+            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path_new.string());
+            return false;
+        }
+        if (!::feeEstimator.Write(est_fileout))
+            return false;
+        FileCommit(est_fileout.Get());
+    }
+    if (!RenameOver(est_path_new, est_path)) {
+        LogPrintf("%s: Failed to rename %s to %s\n", __func__, est_path_new.string(), est_path.string());
+        return false;
+    }
+    nFeeEstimatesWrittenHeight = nHeight;
+    return true;
+}
+
+/** Scheduled: write the fee estimates if blocks were processed since the last write */
+static void CheckpointFeeEstimates()
+{
+    if (::feeEstimator.BestSeenHeight() != nFeeEstimatesWrittenHeight)
+        WriteFeeEstimates();
+}
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -212,12 +254,7 @@ void Shutdown()
     if (fFeeEstimatesInitialized)
     {
         ::feeEstimator.FlushUnconfirmed(::mempool);
-        fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-        CAutoFile est_fileout(fsbridge::fopen(est_path, "wb"), SER_DISK, CLIENT_VERSION);
-        if (!est_fileout.IsNull())
-            ::feeEstimator.Write(est_fileout);
-        else
-            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
+        WriteFeeEstimates();
         fFeeEstimatesInitialized = false;
     }
 
@@ -373,6 +410,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     if (showDebug) {
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
+        strUsage += HelpMessageOpt("-dbprefetchthreads=<n>", strprintf("Number of threads reading the coins spent by a block from disk before it is connected (0 to %d, default: %d)", MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
+        strUsage += HelpMessageOpt("-dbbackgroundflush", strprintf("Write routine coin cache flushes to disk in the background; memory use can briefly reach twice -dbcache (default: %u)", DEFAULT_BACKGROUND_COIN_FLUSH));
     }
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     if (showDebug)
@@ -396,6 +435,7 @@ std::string HelpMessage(HelpMessageMode mode)
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
+    strUsage += HelpMessageOpt("-subblockcompress", strprintf(_("Store new subblocks compressed, against a dictionary trained on recent subblocks. Compressed subblocks cannot be read by older versions (default: %u)"), DEFAULT_SUBBLOCK_COMPRESS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -418,6 +458,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
+#ifdef USE_EPOLL
+    strUsage += HelpMessageOpt("-netepoll", strprintf(_("Use epoll to wait for peer socket events, which is not limited to %u connections (default: %u)"), FD_SETSIZE, DEFAULT_NET_EPOLL));
+#endif
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
@@ -440,6 +483,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-whitelist=<IP address or network>", _("Whitelist peers connecting from the given IP address (e.g. 1.2.3.4) or CIDR notated network (e.g. 1.2.3.0/24). Can be specified multiple times.") +
         " " + _("Whitelisted peers cannot be DoS banned and their transactions are always relayed, even if they are already in the mempool, useful e.g. for a gateway"));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
+    strUsage += HelpMessageOpt("-subblockcachesize=<n>", strprintf(_("Keep up to <n> MiB of recently served subblocks in memory, 0 to disable (default: %u)"), DEFAULT_SUBBLOCK_CACHE_SIZE));
 
 #ifdef ENABLE_WALLET
     strUsage += CWallet::GetWalletHelpString(showDebug);
@@ -462,12 +506,14 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", defaultChainParams->DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", defaultChainParams->DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
+        strUsage += HelpMessageOpt("-checksubchainsigs", strprintf("Verify subchain owner signatures in transaction extension data (default: %u)", DEFAULT_CHECK_SUBCHAIN_SIGS));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", DEFAULT_STOPAFTERBLOCKIMPORT));
         strUsage += HelpMessageOpt("-stopatheight", strprintf("Stop running after reaching the given height in the main chain (default: %u)", DEFAULT_STOPATHEIGHT));
+        strUsage += HelpMessageOpt("-validationpipeline", strprintf("When connecting several blocks, start on each block before the script checks of the previous one are finished (default: %u)", DEFAULT_VALIDATION_PIPELINE));
 
         strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
         strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
@@ -518,6 +564,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmaxweight=<n>", strprintf(_("Set maximum BIP141 block weight (default: %d)"), DEFAULT_BLOCK_MAX_WEIGHT));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", _("Set maximum BIP141 block weight to this * 4. Deprecated, use blockmaxweight"));
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
+    strUsage += HelpMessageOpt("-blocktemplaterefresh=<n>", strprintf(_("While block templates are requested, select transactions for the next one in the background every <n> milliseconds, 0 to disable (default: %d)"), DEFAULT_BLOCK_TEMPLATE_REFRESH));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
 
@@ -535,6 +582,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcpriority=<class>:<target>", "Queue RPC calls to method <target>, or HTTP requests to URIs starting with <target> if it starts with '/', in priority class <class> (high, normal or low). This option can be specified multiple times (default: high for cheap status calls such as getblockcount and for submitsubblocks, low for getblock, getsubchainmetainfo, gettxoutsetinfo and /rest/)");
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
@@ -644,6 +692,36 @@ void CleanupBlockRevFiles()
     }
 }
 
+/** Reindex subblk?????.dat files, claiming the next unread file from nNextFile until none are left */
+static void ThreadReindexSubBlocks(const CChainParams& chainparams, std::atomic<int>* nNextFile)
+{
+    RenameThread("bitcoin-loadsubblk");
+    while (true) {
+        CDiskBlockPos pos((*nNextFile)++, 0);
+        if (!fs::exists(GetBlockPosFilename(pos, "subblk")))
+            break; // No subblock files left to reindex
+        FILE *file = OpenSubBlockFile(pos, true);
+        if (!file)
+            break; // This error is logged in OpenSubBlockFile
+        LogPrintf("Reindexing subblock file subblk%05u.dat...\n", (unsigned int)pos.nFile);
+        LoadExternalSubBlockFile(chainparams, file, &pos);
+    }
+}
+
+/** Subblock reindex threads, interrupted and joined if ThreadImport exits early */
+struct CSubBlockReindexThreads
+{
+    std::atomic<int> nNextFile;
+    boost::thread_group threads;
+
+    CSubBlockReindexThreads() : nNextFile(0) {}
+    ~CSubBlockReindexThreads()
+    {
+        threads.interrupt_all();
+        threads.join_all();
+    }
+};
+
 void ThreadImport(std::vector<fs::path> vImportFiles)
 {
     const CChainParams& chainparams = Params();
@@ -651,11 +729,16 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
 
     {
     CImportingNow imp;
+    CSubBlockReindexThreads subBlockReindex;
 
-    LogPrintf("hsss1\n");
     // -reindex
     if (fReindex) {
-    LogPrintf("hsss2\n");
+        // Subblocks do not depend on main chain validation: scan the subblock
+        // files on their own threads while the main chain is imported.
+        int nThreads = std::max(1, std::min(GetNumCores() - 1, MAX_SUBBLOCK_REINDEX_THREADS));
+        for (int i = 0; i < nThreads; i++)
+            subBlockReindex.threads.create_thread(boost::bind(&ThreadReindexSubBlocks, boost::cref(chainparams), &subBlockReindex.nNextFile));
+
         int nFile = 0;
         while (true) {
             CDiskBlockPos pos(nFile, 0);
@@ -669,27 +752,22 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
             nFile++;
         }
 
-        nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!fs::exists(GetBlockPosFilename(pos, "subblk")))
-                break; // No block files left to reindex
-            FILE *file = OpenSubBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing subblock file subblk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalSubBlockFile(chainparams, file, &pos);
-            nFile++;
-        }
+        pblocktree->WriteReindexing(false);
+        LogPrintf("Reindexing block files finished\n");
+        // To avoid ending up in a situation without genesis block, re-try initializing (no-op if reindexing worked):
+        LoadGenesisBlock(chainparams);
+    }
 
-        subchainmempool.LoadSubChainMetaData();
+    // Subchain metadata comes from the main chain's block files and the
+    // metadata DB only, so it does not wait for the subblock reindex.
+    if (!subchainmempool.LoadSubChainMetaData())
+        LogPrintf("Failed to load subchain metadata\n");
 
-        pblocktree->WriteReindexing(false);
+    if (fReindex) {
+        subBlockReindex.threads.join_all();
         psubblocktree->WriteReindexing(false);
         fReindex = false;
         LogPrintf("Reindexing finished\n");
-        // To avoid ending up in a situation without genesis block, re-try initializing (no-op if reindexing worked):
-        LoadGenesisBlock(chainparams);
     }
 
     // hardcoded $DATADIR/bootstrap.dat
@@ -870,6 +948,7 @@ ServiceFlags nRelevantServices = NODE_NETWORK;
 int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
+bool fNetEpoll = false;
 ServiceFlags nLocalServices = NODE_NETWORK;
 
 } // namespace
@@ -959,8 +1038,14 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
-    // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
+#ifdef USE_EPOLL
+    fNetEpoll = gArgs.GetBoolArg("-netepoll", DEFAULT_NET_EPOLL);
+#endif
+
+    // Trim requested connection counts, to fit into system limitations.
+    // Only select() is bound to FD_SETSIZE; with epoll the fd limit decides.
+    if (!fNetEpoll)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1022,6 +1107,10 @@ bool AppInitParameterInteraction()
     }
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fBackgroundCoinFlush = gArgs.GetBoolArg("-dbbackgroundflush", DEFAULT_BACKGROUND_COIN_FLUSH);
+    fValidationPipeline = gArgs.GetBoolArg("-validationpipeline", DEFAULT_VALIDATION_PIPELINE);
+    fCheckSubChainSigs = gArgs.GetBoolArg("-checksubchainsigs", DEFAULT_CHECK_SUBCHAIN_SIGS);
+    fSubBlockCompress = gArgs.GetBoolArg("-subblockcompress", DEFAULT_SUBBLOCK_COMPRESS);
 
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
     if (!hashAssumeValid.IsNull())
@@ -1067,6 +1156,8 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nPrefetchThreads = std::max(0, std::min((int)gArgs.GetArg("-dbprefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS));
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = gArgs.GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1279,6 +1370,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i automatic connections (%i file descriptors available)\n", nMaxConnections, nFD);
 
     InitSignatureCache();
+    InitExtDataSignatureCache();
     InitScriptExecutionCache();
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
@@ -1287,6 +1379,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    LogPrintf("Using %u threads for coin prefetching\n", nPrefetchThreads);
+    for (int i = 0; i < nPrefetchThreads; i++)
+        threadGroup.create_thread(&ThreadCoinPrefetch);
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -1425,6 +1521,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         nMaxOutboundLimit = gArgs.GetArg("-maxuploadtarget", DEFAULT_MAX_UPLOAD_TARGET)*1024*1024;
     }
 
+    subblockmsgcache.SetMaxUsage(std::max((int64_t)0, gArgs.GetArg("-subblockcachesize", DEFAULT_SUBBLOCK_CACHE_SIZE)) * 1024 * 1024);
+
     // ********************************************************* Step 7: load block chain
 
     fReindex = gArgs.GetBoolArg("-reindex", false);
@@ -1469,7 +1567,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReset);
                 psubblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReset,"subblocks");
 
-                psubchainmeta = new CSubChainMetaDB(nBlockTreeDBCache, false, fReset);
+                // The subchain metadata follows the chainstate, and is rebuilt with it
+                psubchainmeta = new CSubChainMetaDB(nBlockTreeDBCache, false, fReset || fReindexChainState);
 
                 if (fReset) {
                     pblocktree->WriteReindexing(true);
@@ -1553,6 +1652,11 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                         break;
                     }
                     assert(chainActive.Tip() != nullptr);
+
+                    if (!ReplaySubChainMeta(chainparams)) {
+                        strLoadError = _("Unable to replay subchain metadata. You will need to rebuild the database using -reindex-chainstate.");
+                        break;
+                    }
                 }
 
                 if (!fReset) {
@@ -1637,7 +1741,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Allowed to fail as this file IS missing on first startup.
     if (!est_filein.IsNull())
         ::feeEstimator.Read(est_filein);
+    nFeeEstimatesWrittenHeight = ::feeEstimator.BestSeenHeight();
     fFeeEstimatesInitialized = true;
+    // Checkpoint the estimates as blocks come in, so that they survive an unclean shutdown
+    scheduler.scheduleEvery(CheckpointFeeEstimates, FEE_ESTIMATES_CHECKPOINT_INTERVAL * 1000);
 
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
@@ -1698,6 +1805,12 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
+    int64_t nTemplateRefresh = gArgs.GetArg("-blocktemplaterefresh", DEFAULT_BLOCK_TEMPLATE_REFRESH);
+    if (nTemplateRefresh > 0) {
+        blocktemplateengine.SetRefreshInterval(nTemplateRefresh);
+        threadGroup.create_thread(boost::bind(&TraceThread<std::function<void()> >, "blocktemplate", std::function<void()>(std::bind(&ThreadBlockTemplateEngine, std::cref(chainparams)))));
+    }
+
     // Wait for genesis block to be processed
     {
         boost::unique_lock<boost::mutex> lock(cs_GenesisWait);
@@ -1735,6 +1848,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
+    connOptions.fUseEpoll = fNetEpoll;
 
     for (const std::string& strBind : gArgs.GetArgs("-bind")) {
         CService addrBind;
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "flathashmap.h"
 #include "indirectmap.h"
 
 #include <stdlib.h>
@@ -130,6 +131,14 @@ static inline size_t IncrementalDynamicUsage(const indirectmap<X, Y>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X*, Y> >));
 }
 
+// flat_hash_map has a control byte and an entry pointer per slot, and keeps its entries in an arena
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const flat_hash_map<X, Y, Z>& m)
+{
+    return MallocUsage(m.slot_count()) + MallocUsage(sizeof(void*) * m.slot_count()) + m.pool_usage();
+}
+
 template<typename X>
 static inline size_t DynamicUsage(const std::unique_ptr<X>& p)
 {
@@ -45,6 +45,8 @@
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockWeight = 0;
 
+CBlockTemplateEngine blocktemplateengine;
+
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -106,7 +108,70 @@ void BlockAssembler::resetBlock()
     nFees = 0;
 }
 
-std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx)
+void BlockAssembler::InitChainContext(const CBlockIndex* pindexPrev, bool fMineWitnessTx)
+{
+    nHeight = pindexPrev->nHeight + 1;
+
+    const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
+
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? nMedianTimePast
+                       : pblock->GetBlockTime();
+
+    // Decide whether to include witness transactions
+    // This is only needed in case the witness softfork activation is reverted
+    // (which would require a very deep reorganization) or when
+    // -promiscuousmempoolflags is used.
+    // TODO: replace this with a call to main to assess validity of a mempool
+    // transaction (which in most cases can be a no-op).
+    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()) && fMineWitnessTx;
+}
+
+bool CBlockTxSelection::SameParams(const CBlockTxSelection& other) const
+{
+    return hashPrevBlock == other.hashPrevBlock && nHeight == other.nHeight && nLockTimeCutoff == other.nLockTimeCutoff &&
+           fIncludeWitness == other.fIncludeWitness && nBlockMaxWeight == other.nBlockMaxWeight && blockMinFeeRate == other.blockMinFeeRate;
+}
+
+CBlockTxSelection BlockAssembler::GetSelectionParams(const CBlockIndex* pindexPrev) const
+{
+    CBlockTxSelection params;
+    params.hashPrevBlock = pindexPrev->GetBlockHash();
+    params.nHeight = nHeight;
+    params.nLockTimeCutoff = nLockTimeCutoff;
+    params.fIncludeWitness = fIncludeWitness;
+    params.nBlockMaxWeight = nBlockMaxWeight;
+    params.blockMinFeeRate = blockMinFeeRate;
+    params.nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    params.nTimeSelected = GetTimeMicros();
+    return params;
+}
+
+std::shared_ptr<const CBlockTxSelection> BlockAssembler::SaveSelection(const CBlockTxSelection& params) const
+{
+    std::shared_ptr<CBlockTxSelection> selection = std::make_shared<CBlockTxSelection>(params);
+    // Skip the coinbase placeholder
+    selection->vtx.assign(pblock->vtx.begin() + 1, pblock->vtx.end());
+    selection->vTxFees.assign(pblocktemplate->vTxFees.begin() + 1, pblocktemplate->vTxFees.end());
+    selection->vTxSigOpsCost.assign(pblocktemplate->vTxSigOpsCost.begin() + 1, pblocktemplate->vTxSigOpsCost.end());
+    selection->nBlockWeight = nBlockWeight;
+    selection->nBlockSigOpsCost = nBlockSigOpsCost;
+    selection->nFees = nFees;
+    return selection;
+}
+
+void BlockAssembler::LoadSelection(const CBlockTxSelection& selection)
+{
+    pblock->vtx.insert(pblock->vtx.end(), selection.vtx.begin(), selection.vtx.end());
+    pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), selection.vTxFees.begin(), selection.vTxFees.end());
+    pblocktemplate->vTxSigOpsCost.insert(pblocktemplate->vTxSigOpsCost.end(), selection.vTxSigOpsCost.begin(), selection.vTxSigOpsCost.end());
+    nBlockWeight = selection.nBlockWeight;
+    nBlockSigOpsCost = selection.nBlockSigOpsCost;
+    nFees = selection.nFees;
+    nBlockTx = selection.vtx.size();
+}
+
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx, bool fAllowStaleSelection)
 {
     int64_t nTimeStart = GetTimeMicros();
 
@@ -125,7 +190,6 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     LOCK2(cs_main, mempool.cs);
     CBlockIndex* pindexPrev = chainActive.Tip();
-    nHeight = pindexPrev->nHeight + 1;
 
     pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
     // -regtest only: allow overriding block.nVersion with
@@ -134,24 +198,23 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         pblock->nVersion = gArgs.GetArg("-blockversion", pblock->nVersion);
 
     pblock->nTime = GetAdjustedTime();
-    const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-
-    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                       ? nMedianTimePast
-                       : pblock->GetBlockTime();
-
-    // Decide whether to include witness transactions
-    // This is only needed in case the witness softfork activation is reverted
-    // (which would require a very deep reorganization) or when
-    // -promiscuousmempoolflags is used.
-    // TODO: replace this with a call to main to assess validity of a mempool
-    // transaction (which in most cases can be a no-op).
-    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()) && fMineWitnessTx;
+    InitChainContext(pindexPrev, fMineWitnessTx);
     LogPrintf("include %d f=%d i=%d", fIncludeWitness, fMineWitnessTx, IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()));
 
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    const CBlockTxSelection params = GetSelectionParams(pindexPrev);
+    Options options;
+    options.nBlockMaxWeight = nBlockMaxWeight;
+    options.blockMinFeeRate = blockMinFeeRate;
+    blocktemplateengine.Requested(options, fMineWitnessTx);
+    std::shared_ptr<const CBlockTxSelection> selection = blocktemplateengine.Get(params, fAllowStaleSelection);
+    if (selection) {
+        LoadSelection(*selection);
+    } else {
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+        blocktemplateengine.Put(SaveSelection(params));
+    }
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -189,11 +252,39 @@ LogPrintf("coinbaseinfonvalue:%ld\n",coinbaseTx.vout[0].nValue);
     LogPrintf("runhere3\n");
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%s, %d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), selection ? "reused" : "selected", nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    blocktemplateengine.RecordTemplate(nTime2 - nTimeStart, selection != nullptr);
 
     return std::move(pblocktemplate);
 }
 
+bool BlockAssembler::RefreshTemplateEngine(bool fMineWitnessTx)
+{
+    resetBlock();
+
+    pblocktemplate.reset(new CBlockTemplate());
+    pblock = &pblocktemplate->block;
+    pblock->vtx.emplace_back();
+    pblocktemplate->vTxFees.push_back(-1);
+    pblocktemplate->vTxSigOpsCost.push_back(-1);
+
+    LOCK2(cs_main, mempool.cs);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    pblock->nTime = GetAdjustedTime();
+    InitChainContext(pindexPrev, fMineWitnessTx);
+
+    const CBlockTxSelection params = GetSelectionParams(pindexPrev);
+    if (blocktemplateengine.Get(params, false))
+        return false;
+
+    int nPackagesSelected = 0;
+    int nDescendantsUpdated = 0;
+    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    blocktemplateengine.Put(SaveSelection(params));
+    LogPrint(BCLog::BENCH, "RefreshTemplateEngine(): %u txs, %d packages, %d updated descendants, %.2fms\n", nBlockTx, nPackagesSelected, nDescendantsUpdated, 0.001 * (GetTimeMicros() - params.nTimeSelected));
+    return true;
+}
+
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
 {
     for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
@@ -444,6 +535,106 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+CBlockTemplateEngine::CBlockTemplateEngine() : nRefreshInterval(DEFAULT_BLOCK_TEMPLATE_REFRESH), nLastRequest(0), fLastMineWitnessTx(true), stats()
+{
+}
+
+void CBlockTemplateEngine::SetRefreshInterval(int64_t nMillis)
+{
+    LOCK(cs);
+    nRefreshInterval = nMillis;
+}
+
+int64_t CBlockTemplateEngine::GetRefreshInterval() const
+{
+    LOCK(cs);
+    return nRefreshInterval;
+}
+
+std::shared_ptr<const CBlockTxSelection> CBlockTemplateEngine::Get(const CBlockTxSelection& params, bool fAllowStale) const
+{
+    AssertLockHeld(mempool.cs);
+    std::shared_ptr<const CBlockTxSelection> current;
+    int64_t nMaxAge;
+    {
+        LOCK(cs);
+        current = selection;
+        // Allow for a refresh that is under way
+        nMaxAge = 2 * nRefreshInterval * 1000;
+    }
+    if (!current || !current->SameParams(params))
+        return nullptr;
+    if (current->nTransactionsUpdated == params.nTransactionsUpdated)
+        return current;
+
+    // The mempool changed since the selection was made. It may miss better
+    // paying transactions that arrived since, but it is still a valid block
+    // as long as all of its transactions are still in the mempool: none of
+    // them can have gained an unconfirmed parent without a change of tip.
+    if (!fAllowStale || params.nTimeSelected - current->nTimeSelected > nMaxAge)
+        return nullptr;
+    for (const CTransactionRef& tx : current->vtx) {
+        if (!mempool.exists(tx->GetHash()))
+            return nullptr;
+    }
+    return current;
+}
+
+void CBlockTemplateEngine::Put(const std::shared_ptr<const CBlockTxSelection>& selectionIn)
+{
+    LOCK(cs);
+    selection = selectionIn;
+}
+
+void CBlockTemplateEngine::Requested(const BlockAssembler::Options& options, bool fMineWitnessTx)
+{
+    LOCK(cs);
+    nLastRequest = GetTimeMicros();
+    lastOptions = options;
+    fLastMineWitnessTx = fMineWitnessTx;
+}
+
+void CBlockTemplateEngine::RecordTemplate(int64_t nMicros, bool fReused)
+{
+    LOCK(cs);
+    stats.nTemplates++;
+    if (fReused)
+        stats.nReused++;
+    stats.nLastMicros = nMicros;
+    stats.nTotalMicros += nMicros;
+}
+
+BlockTemplateStats CBlockTemplateEngine::GetStats() const
+{
+    LOCK(cs);
+    return stats;
+}
+
+void CBlockTemplateEngine::Refresh(const CChainParams& chainparams)
+{
+    BlockAssembler::Options options;
+    bool fMineWitnessTx;
+    {
+        LOCK(cs);
+        if (nLastRequest == 0 || GetTimeMicros() - nLastRequest > BLOCK_TEMPLATE_IDLE_TIMEOUT * 1000000)
+            return;
+        options = lastOptions;
+        fMineWitnessTx = fLastMineWitnessTx;
+    }
+    if (BlockAssembler(chainparams, options).RefreshTemplateEngine(fMineWitnessTx)) {
+        LOCK(cs);
+        stats.nRefreshes++;
+    }
+}
+
+void ThreadBlockTemplateEngine(const CChainParams& chainparams)
+{
+    while (true) {
+        MilliSleep(blocktemplateengine.GetRefreshInterval());
+        blocktemplateengine.Refresh(chainparams);
+    }
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
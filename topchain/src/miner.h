@@ -21,6 +21,10 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -blocktemplaterefresh, in milliseconds */
+static const int64_t DEFAULT_BLOCK_TEMPLATE_REFRESH = 500;
+/** Seconds after the last block template request that the background selection stops being refreshed */
+static const int64_t BLOCK_TEMPLATE_IDLE_TIMEOUT = 60;
 
 struct CBlockTemplate
 {
@@ -128,6 +132,35 @@ struct update_for_parent_inclusion
     CTxMemPool::txiter iter;
 };
 
+/** Transactions picked for a block by package selection, together with what
+ *  the pick depended on, so that later templates can reuse it. */
+struct CBlockTxSelection
+{
+    // Chain context, options and mempool state the selection was made for
+    uint256 hashPrevBlock;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    bool fIncludeWitness;
+    uint64_t nBlockMaxWeight;
+    CFeeRate blockMinFeeRate;
+    unsigned int nTransactionsUpdated;
+    int64_t nTimeSelected;
+
+    // The selected transactions in block order, without the coinbase
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOpsCost;
+    uint64_t nBlockWeight;
+    uint64_t nBlockSigOpsCost;
+    CAmount nFees;
+
+    CBlockTxSelection() : nHeight(0), nLockTimeCutoff(0), fIncludeWitness(false), nBlockMaxWeight(0), nTransactionsUpdated(0),
+                          nTimeSelected(0), nBlockWeight(0), nBlockSigOpsCost(0), nFees(0) {}
+
+    /** Whether the selection was made for the same chain context and options as other */
+    bool SameParams(const CBlockTxSelection& other) const;
+};
+
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
 {
@@ -165,13 +198,27 @@ public:
     BlockAssembler(const CChainParams& params);
     BlockAssembler(const CChainParams& params, const Options& options);
 
-    /** Construct a new block template with coinbase to scriptPubKeyIn */
-    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+    /** Construct a new block template with coinbase to scriptPubKeyIn.
+      * With fAllowStaleSelection, the transactions may come from a selection
+      * the template engine made slightly before the latest mempool changes. */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true, bool fAllowStaleSelection=false);
+
+    /** Make a new transaction selection for the template engine, unless the one it has is current.
+      * Returns whether a selection was made. */
+    bool RefreshTemplateEngine(bool fMineWitnessTx);
 
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
+    /** Set the height, locktime cutoff and witness inclusion for a block on top of pindexPrev. pblock->nTime must be set. */
+    void InitChainContext(const CBlockIndex* pindexPrev, bool fMineWitnessTx);
+    /** The parameters a transaction selection made now would be made with */
+    CBlockTxSelection GetSelectionParams(const CBlockIndex* pindexPrev) const;
+    /** Package the transactions added to the block so far as a selection with params */
+    std::shared_ptr<const CBlockTxSelection> SaveSelection(const CBlockTxSelection& params) const;
+    /** Add the transactions of a kept selection to the block */
+    void LoadSelection(const CBlockTxSelection& selection);
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
 
@@ -202,6 +249,69 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+struct BlockTemplateStats
+{
+    uint64_t nTemplates;        //!< Templates created
+    uint64_t nReused;           //!< Templates that took a kept selection instead of selecting
+    uint64_t nRefreshes;        //!< Selections made by the background thread
+    int64_t nLastMicros;        //!< Time taken by the last template
+    int64_t nTotalMicros;       //!< Time taken by all templates
+};
+
+/**
+ * Keeps the most recent transaction selection, so that creating a block
+ * template does not have to redo package selection over the whole mempool.
+ *
+ * The ordering selection works from is the mempool's ancestor score index,
+ * which is already kept up to date as transactions enter and leave. What is
+ * expensive is walking it and updating descendants of every selected
+ * package; that is done here ahead of time. While templates are being
+ * requested, a background thread selects again every -blocktemplaterefresh
+ * milliseconds if the tip or the mempool changed, and every template built
+ * synchronously leaves its selection behind as well.
+ *
+ * A kept selection is only used when it was made for the same tip, height,
+ * locktime cutoff and options. It must also match the mempool exactly, unless
+ * the caller accepts a slightly stale selection, in which case all of its
+ * transactions must merely still be in the mempool.
+ */
+class CBlockTemplateEngine
+{
+private:
+    mutable CCriticalSection cs;
+    std::shared_ptr<const CBlockTxSelection> selection;
+    int64_t nRefreshInterval;
+
+    // Parameters of the latest template request, which refreshes reuse
+    int64_t nLastRequest;
+    BlockAssembler::Options lastOptions;
+    bool fLastMineWitnessTx;
+
+    BlockTemplateStats stats;
+
+public:
+    CBlockTemplateEngine();
+
+    void SetRefreshInterval(int64_t nMillis);
+    int64_t GetRefreshInterval() const;
+
+    /** The kept selection if it can stand in for one made now with params, or null. Requires mempool.cs. */
+    std::shared_ptr<const CBlockTxSelection> Get(const CBlockTxSelection& params, bool fAllowStale) const;
+    void Put(const std::shared_ptr<const CBlockTxSelection>& selectionIn);
+    /** Note a template request, which keeps refreshes going */
+    void Requested(const BlockAssembler::Options& options, bool fMineWitnessTx);
+    void RecordTemplate(int64_t nMicros, bool fReused);
+    BlockTemplateStats GetStats() const;
+
+    /** Select again if templates were requested recently. Called by the background thread. */
+    void Refresh(const CChainParams& chainparams);
+};
+
+extern CBlockTemplateEngine blocktemplateengine;
+
+/** Background thread keeping blocktemplateengine's selection fresh */
+void ThreadBlockTemplateEngine(const CChainParams& chainparams);
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
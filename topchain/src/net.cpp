@@ -18,6 +18,7 @@
 #include "hash.h"
 #include "primitives/transaction.h"
 #include "netbase.h"
+#include "netpoll.h"
 #include "scheduler.h"
 #include "ui_interface.h"
 #include "utilstrencodings.h"
@@ -76,6 +77,48 @@ const static std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
+
+/** Payloads at least this large are received into recycled buffers, and straight from the socket */
+static const unsigned int RECV_BUFFER_POOL_MIN_SIZE = 64 * 1024;
+/** Number of idle receive buffers kept for reuse */
+static const size_t RECV_BUFFER_POOL_MAX_BUFFERS = 4;
+/** Receive buffers above this capacity are freed rather than kept */
+static const size_t RECV_BUFFER_POOL_MAX_CAPACITY = MAX_PROTOCOL_MESSAGE_LENGTH;
+
+/**
+ * Idle payload buffers of large received messages. Blocks and subblocks
+ * arrive one after another, and taking their buffer from here saves
+ * allocating, faulting in and scrubbing a fresh megabyte for each of them.
+ */
+class CRecvBufferPool
+{
+private:
+    std::mutex mutex;
+    std::vector<CSerializeData> vFree;
+
+public:
+    void Take(CDataStream& stream)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (vFree.empty())
+            return;
+        stream.swap(vFree.back());
+        vFree.pop_back();
+    }
+
+    void Give(CDataStream& stream)
+    {
+        CSerializeData vch;
+        stream.swap(vch);
+        if (vch.capacity() < RECV_BUFFER_POOL_MIN_SIZE || vch.capacity() > RECV_BUFFER_POOL_MAX_CAPACITY)
+            return;
+        vch.clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (vFree.size() < RECV_BUFFER_POOL_MAX_BUFFERS)
+            vFree.push_back(std::move(vch));
+    }
+};
+static CRecvBufferPool recvBufferPool;
 //
 // Global state variables
 //
@@ -386,7 +429,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!socketPoller->IsWatchable(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return nullptr;
@@ -674,6 +717,9 @@ void CNode::copyStats(CNodeStats &stats)
         X(nRecvBytes);
     }
     X(fWhitelisted);
+    X(nSubBlockInvSent);
+    X(nSubBlockInvKnown);
+    X(nSubBlocksServed);
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -709,7 +755,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -749,6 +795,19 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+bool CNode::GetRecvMsgBuffer(char*& pch, unsigned int& nBytes)
+{
+    LOCK(cs_vRecv);
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data || vRecvMsg.back().complete())
+        return false;
+    CNetMessage& msg = vRecvMsg.back();
+    // Small remainders are better read together with whatever follows them
+    if (msg.hdr.nMessageSize - msg.nDataPos < RECV_BUFFER_POOL_MIN_SIZE || msg.hdr.nMessageSize > MAX_PROTOCOL_MESSAGE_LENGTH)
+        return false;
+    pch = msg.GetDataBuffer(nBytes);
+    return true;
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -807,23 +866,44 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
+CNetMessage::~CNetMessage()
+{
+    recvBufferPool.Give(vRecv);
+}
+
+void CNetMessage::GrowData(unsigned int nSize)
+{
+    if (vRecv.size() >= nSize)
+        return;
+    if (vRecv.empty() && hdr.nMessageSize >= RECV_BUFFER_POOL_MIN_SIZE)
+        recvBufferPool.Take(vRecv);
+    // Allocate up to 256 KiB ahead, but never more than the total message size.
+    vRecv.resize(std::min(hdr.nMessageSize, nSize + 256 * 1024));
+}
+
 int CNetMessage::readData(const char *pch, unsigned int nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
+    GrowData(nDataPos + nCopy);
 
     hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Data received in place through GetDataBuffer is already where it belongs
+    if (pch != &vRecv[nDataPos])
+        memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+char* CNetMessage::GetDataBuffer(unsigned int& nBytes)
+{
+    GrowData(nDataPos + 1);
+    nBytes = std::min(hdr.nMessageSize, (unsigned int)vRecv.size()) - nDataPos;
+    return &vRecv[nDataPos];
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -840,6 +920,38 @@ const uint256& CNetMessage::GetMessageHash() const
 
 
 
+/** Most buffers handed to one gathered send call */
+static const int MAX_SEND_BUFFERS = 64;
+
+/**
+ * Send as much of the given buffers as the socket takes in one call, using
+ * sendmsg() where available so that headers and payloads go out together.
+ */
+static int SendBuffers(SOCKET hSocket, const std::pair<const unsigned char*, size_t>* pbufs, int nBufs)
+{
+#ifdef WIN32
+    WSABUF wsabuf[MAX_SEND_BUFFERS];
+    for (int i = 0; i < nBufs; i++) {
+        wsabuf[i].buf = reinterpret_cast<char*>(const_cast<unsigned char*>(pbufs[i].first));
+        wsabuf[i].len = pbufs[i].second;
+    }
+    DWORD nSent = 0;
+    if (WSASend(hSocket, wsabuf, nBufs, &nSent, 0, nullptr, nullptr) == SOCKET_ERROR)
+        return SOCKET_ERROR;
+    return nSent;
+#else
+    struct iovec iov[MAX_SEND_BUFFERS];
+    for (int i = 0; i < nBufs; i++) {
+        iov[i].iov_base = const_cast<unsigned char*>(pbufs[i].first);
+        iov[i].iov_len = pbufs[i].second;
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nBufs;
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode) const
 {
@@ -847,27 +959,51 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        // Gather the unsent headers and payloads of the queued messages
+        std::pair<const unsigned char*, size_t> bufs[MAX_SEND_BUFFERS];
+        int nBufs = 0;
+        size_t nGathered = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (auto itGather = it; itGather != pnode->vSendMsg.end() && nBufs + 2 <= MAX_SEND_BUFFERS; ++itGather) {
+            const std::vector<unsigned char>* parts[] = {&itGather->header, &itGather->Payload()};
+            for (const std::vector<unsigned char>* pvch : parts) {
+                if (nOffset >= pvch->size()) {
+                    nOffset -= pvch->size();
+                    continue;
+                }
+                bufs[nBufs++] = std::make_pair(pvch->data() + nOffset, pvch->size() - nOffset);
+                nGathered += pvch->size() - nOffset;
+                nOffset = 0;
+            }
+        }
+        assert(nGathered > 0);
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            nBytes = SendBuffers(pnode->hSocket, bufs, nBufs);
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Retire the messages that went out completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nMsgLeft = it->size() - pnode->nSendOffset;
+                if (nLeft < nMsgLeft) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nMsgLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= it->size();
                 pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nGathered) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1075,7 +1211,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!socketPoller->IsWatchable(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1120,8 +1256,145 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+/**
+ * Receive from a node's socket until the kernel has nothing more for it, as
+ * an edge-triggered poller requires. Returns true if data may be left, when
+ * receiving stopped early: on a full buffer, so that other nodes are served
+ * before this one is read again, or because its process queue is full.
+ * Returns false once recv() would block, or the socket was closed.
+ */
+bool CConnman::SocketRecvData(CNode *pnode)
+{
+    while (true)
+    {
+        // typical socket buffer is 8K-64K
+        char pchBuf[0x10000];
+        // the rest of a large payload is received into the message itself
+        char* pchRecv = pchBuf;
+        unsigned int nRecvSize = sizeof(pchBuf);
+        pnode->GetRecvMsgBuffer(pchRecv, nRecvSize);
+        int nBytes = 0;
+        {
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                return false;
+            nBytes = recv(pnode->hSocket, pchRecv, nRecvSize, MSG_DONTWAIT);
+        }
+        if (nBytes > 0)
+        {
+            bool notify = false;
+            if (!pnode->ReceiveMsgBytes(pchRecv, nBytes, notify))
+                pnode->CloseSocketDisconnect();
+            RecordBytesRecv(nBytes);
+            if (notify) {
+                size_t nSizeAdded = 0;
+                auto it(pnode->vRecvMsg.begin());
+                for (; it != pnode->vRecvMsg.end(); ++it) {
+                    if (!it->complete())
+                        break;
+                    nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+                }
+                {
+                    LOCK(pnode->cs_vProcessMsg);
+                    pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                    pnode->nProcessQueueSize += nSizeAdded;
+                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+                }
+                WakeMessageHandler();
+            }
+            if (pnode->fDisconnect)
+                return false;
+            if (nBytes == (int)nRecvSize || pnode->fPauseRecv)
+                return true;
+            // A short read only drained the socket as of that moment; read
+            // again until it would block
+        }
+        else if (nBytes == 0)
+        {
+            // socket closed gracefully
+            if (!pnode->fDisconnect) {
+                LogPrint(BCLog::NET, "socket closed\n");
+            }
+            pnode->CloseSocketDisconnect();
+            return false;
+        }
+        else
+        {
+            // error
+            int nErr = WSAGetLastError();
+            if (nErr == WSAEINTR)
+                continue;
+            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINPROGRESS)
+            {
+                if (!pnode->fDisconnect)
+                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+                pnode->CloseSocketDisconnect();
+            }
+            return false;
+        }
+    }
+}
+
+void CConnman::InactivityCheck(CNode *pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+        else if (!pnode->fSuccessfullyConnected)
+        {
+            LogPrintf("version handshake timeout from %d\n", pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+/** Poller ids of listening sockets are negative, node ids are not. */
+static int64_t ListenSocketPollId(size_t nListenSocket)
+{
+    return -1 - (int64_t)nListenSocket;
+}
+
 void CConnman::ThreadSocketHandler()
 {
+    CSocketPoller& poller = *socketPoller;
+    const bool fEdgeTriggered = poller.IsEdgeTriggered();
+    const int64_t nPollIntervalMillis = 50; // frequency to poll pnode->vSend
+
+    // With an edge-triggered poller, nodes are registered once and tracked
+    // here by id. Only this thread adds or removes entries, and a node leaves
+    // the map before it can be deleted, so the pointers need no extra refs.
+    std::map<NodeId, CNode*> mapPolledNodes;
+    // Polled nodes that still have unread data which flow control held back.
+    std::set<NodeId> setRecvPending;
+    int64_t nLastInactivityCheck = 0;
+    std::vector<CSocketPoller::Event> vEvents;
+
+    if (fEdgeTriggered) {
+        for (size_t i = 0; i < vhListenSocket.size(); i++) {
+            poller.Watch(vhListenSocket[i].socket, ListenSocketPollId(i), CSocketPoller::POLL_RECV | CSocketPoller::POLL_LEVEL);
+        }
+    }
+
     unsigned int nPrevNodeCount = 0;
     while (!interruptNet)
     {
@@ -1142,6 +1415,18 @@ void CConnman::ThreadSocketHandler()
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
 
+                    // stop watching the socket before it is closed and its fd reused
+                    if (pnode->fPollWatched) {
+                        {
+                            LOCK(pnode->cs_hSocket);
+                            if (pnode->hSocket != INVALID_SOCKET)
+                                poller.Unwatch(pnode->hSocket);
+                        }
+                        pnode->fPollWatched = false;
+                        mapPolledNodes.erase(pnode->GetId());
+                        setRecvPending.erase(pnode->GetId());
+                    }
+
                     // close socket and cleanup
                     pnode->CloseSocketDisconnect();
 
@@ -1149,6 +1434,23 @@ void CConnman::ThreadSocketHandler()
                     pnode->Release();
                     vNodesDisconnected.push_back(pnode);
                 }
+                else if (fEdgeTriggered && !pnode->fPollWatched)
+                {
+                    LOCK(pnode->cs_hSocket);
+                    if (pnode->hSocket == INVALID_SOCKET)
+                        continue;
+                    if (!poller.Watch(pnode->hSocket, pnode->GetId(), CSocketPoller::POLL_RECV | CSocketPoller::POLL_SEND)) {
+                        pnode->fDisconnect = true;
+                        continue;
+                    }
+                    pnode->fPollWatched = true;
+                    // Whatever arrived before registration is not reported
+                    // as an edge, so look at the socket once.
+                    pnode->fPollRecvReady = true;
+                    pnode->fPollSendReady = true;
+                    mapPolledNodes[pnode->GetId()] = pnode;
+                    setRecvPending.insert(pnode->GetId());
+                }
             }
         }
         {
@@ -1189,26 +1491,28 @@ void CConnman::ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+        int64_t nTimeoutMillis = nPollIntervalMillis;
+        if (fEdgeTriggered)
+        {
+            // Registrations persist; only check whether a node we had to
+            // leave unread can be read now.
+            for (NodeId id : setRecvPending) {
+                CNode* pnode = mapPolledNodes[id];
+                if (pnode->fPauseRecv)
+                    continue;
+                LOCK(pnode->cs_vSend);
+                if (pnode->vSendMsg.empty()) {
+                    nTimeoutMillis = 0;
+                    break;
+                }
+            }
         }
-
+        else
         {
+            for (size_t i = 0; i < vhListenSocket.size(); i++) {
+                poller.Watch(vhListenSocket[i].socket, ListenSocketPollId(i), CSocketPoller::POLL_RECV);
+            }
+
             LOCK(cs_vNodes);
             for (CNode* pnode : vNodes)
             {
@@ -1234,46 +1538,44 @@ void CConnman::ThreadSocketHandler()
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
+                int nEvents = CSocketPoller::POLL_ERR;
                 if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
+                    nEvents |= CSocketPoller::POLL_SEND;
+                } else if (select_recv) {
+                    nEvents |= CSocketPoller::POLL_RECV;
                 }
+                poller.Watch(pnode->hSocket, pnode->GetId(), nEvents);
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        vEvents.clear();
+        int nReady = poller.Wait(nTimeoutMillis, vEvents);
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
+        if (nReady == SOCKET_ERROR)
         {
-            if (have_fds)
+            if (fEdgeTriggered || !vEvents.empty())
             {
                 int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                LogPrintf("socket %s error %s\n", poller.GetName(), NetworkErrorString(nErr));
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+            if (!interruptNet.sleep_for(std::chrono::milliseconds(nPollIntervalMillis)))
                 return;
         }
 
         //
         // Accept new connections
         //
-        for (const ListenSocket& hListenSocket : vhListenSocket)
+        std::map<NodeId, int> mapReady;
+        for (const CSocketPoller::Event& ev : vEvents)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (ev.nId >= 0) {
+                mapReady[ev.nId] |= ev.nEvents;
+                continue;
+            }
+            const ListenSocket& hListenSocket = vhListenSocket[-1 - ev.nId];
+            if (hListenSocket.socket != INVALID_SOCKET && (ev.nEvents & CSocketPoller::POLL_RECV))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1282,6 +1584,72 @@ void CConnman::ThreadSocketHandler()
         //
         // Service each socket
         //
+        if (fEdgeTriggered)
+        {
+            for (NodeId id : setRecvPending)
+                mapReady.emplace(id, 0);
+
+            for (const std::pair<const NodeId, int>& ready : mapReady)
+            {
+                if (interruptNet)
+                    return;
+
+                auto it = mapPolledNodes.find(ready.first);
+                if (it == mapPolledNodes.end())
+                    continue;
+                CNode* pnode = it->second;
+                if (ready.second & (CSocketPoller::POLL_RECV | CSocketPoller::POLL_ERR))
+                    pnode->fPollRecvReady = true;
+                if (ready.second & CSocketPoller::POLL_SEND)
+                    pnode->fPollSendReady = true;
+
+                //
+                // Send
+                //
+                bool fSendPending;
+                {
+                    LOCK(pnode->cs_vSend);
+                    if (pnode->fPollSendReady && !pnode->vSendMsg.empty()) {
+                        size_t nBytes = SocketSendData(pnode);
+                        if (nBytes) {
+                            RecordBytesSent(nBytes);
+                        }
+                        // Data left over means the kernel buffer is full;
+                        // the next edge tells us when it drained.
+                        if (!pnode->vSendMsg.empty())
+                            pnode->fPollSendReady = false;
+                    }
+                    fSendPending = !pnode->vSendMsg.empty();
+                }
+
+                //
+                // Receive, with the same flow control as the select() path:
+                // not while the send queue is draining or the process queue
+                // is full. Errors are read right away so the socket is closed.
+                //
+                if (pnode->fPollRecvReady &&
+                    ((ready.second & CSocketPoller::POLL_ERR) || (!pnode->fPauseRecv && !fSendPending))) {
+                    pnode->fPollRecvReady = SocketRecvData(pnode);
+                }
+                if (pnode->fPollRecvReady) {
+                    setRecvPending.insert(ready.first);
+                } else {
+                    setRecvPending.erase(ready.first);
+                }
+            }
+
+            //
+            // Inactivity checking
+            //
+            int64_t nTime = GetSystemTimeInSeconds();
+            if (nTime != nLastInactivityCheck) {
+                nLastInactivityCheck = nTime;
+                for (const std::pair<const NodeId, CNode*>& polled : mapPolledNodes)
+                    InactivityCheck(polled.second);
+            }
+            continue;
+        }
+
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
@@ -1297,76 +1665,22 @@ void CConnman::ThreadSocketHandler()
             //
             // Receive
             //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
+            auto it = mapReady.find(pnode->GetId());
+            int nEvents = it == mapReady.end() ? 0 : it->second;
             {
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
             }
-            if (recvSet || errorSet)
+            if (nEvents & (CSocketPoller::POLL_RECV | CSocketPoller::POLL_ERR))
             {
-                // typical socket buffer is 8K-64K
-                char pchBuf[0x10000];
-                int nBytes = 0;
-                {
-                    LOCK(pnode->cs_hSocket);
-                    if (pnode->hSocket == INVALID_SOCKET)
-                        continue;
-                    nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                }
-                if (nBytes > 0)
-                {
-                    bool notify = false;
-                    if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                        pnode->CloseSocketDisconnect();
-                    RecordBytesRecv(nBytes);
-                    if (notify) {
-                        size_t nSizeAdded = 0;
-                        auto it(pnode->vRecvMsg.begin());
-                        for (; it != pnode->vRecvMsg.end(); ++it) {
-                            if (!it->complete())
-                                break;
-                            nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                        }
-                        {
-                            LOCK(pnode->cs_vProcessMsg);
-                            pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                            pnode->nProcessQueueSize += nSizeAdded;
-                            pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                        }
-                        WakeMessageHandler();
-                    }
-                }
-                else if (nBytes == 0)
-                {
-                    // socket closed gracefully
-                    if (!pnode->fDisconnect) {
-                        LogPrint(BCLog::NET, "socket closed\n");
-                    }
-                    pnode->CloseSocketDisconnect();
-                }
-                else if (nBytes < 0)
-                {
-                    // error
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                    {
-                        if (!pnode->fDisconnect)
-                            LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                        pnode->CloseSocketDisconnect();
-                    }
-                }
+                SocketRecvData(pnode);
             }
 
             //
             // Send
             //
-            if (sendSet)
+            if (nEvents & CSocketPoller::POLL_SEND)
             {
                 LOCK(pnode->cs_vSend);
                 size_t nBytes = SocketSendData(pnode);
@@ -1378,35 +1692,7 @@ void CConnman::ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-                else if (!pnode->fSuccessfullyConnected)
-                {
-                    LogPrintf("version handshake timeout from %d\n", pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -2240,6 +2526,7 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     semAddnode = nullptr;
     flagInterruptMsgProc = false;
     SetTryNewOutboundPeer(false);
+    socketPoller = MakeSelectPoller();
 
     Options connOptions;
     Init(connOptions);
@@ -2363,6 +2650,13 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         fMsgProcWake = false;
     }
 
+    socketPoller.reset();
+    if (fUseEpoll)
+        socketPoller = MakeEpollPoller();
+    if (!socketPoller)
+        socketPoller = MakeSelectPoller();
+    LogPrintf("Using %s for peer socket events\n", socketPoller->GetName());
+
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
 
@@ -2757,6 +3051,9 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     timeLastMempoolReq = 0;
     nLastBlockTime = 0;
     nLastTXTime = 0;
+    nSubBlockInvSent = 0;
+    nSubBlockInvKnown = 0;
+    nSubBlocksServed = 0;
     nPingNonceSent = 0;
     nPingUsecStart = 0;
     nPingUsecTime = 0;
@@ -2767,6 +3064,9 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fPollWatched = false;
+    fPollRecvReady = false;
+    fPollSendReady = false;
     nProcessQueueSize = 0;
 
     for (const std::string &msg : getAllNetMessageTypes())
@@ -2833,17 +3133,24 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
 
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    CNetSendMsg sendMsg;
+    sendMsg.data = std::move(msg.data);
+    sendMsg.payload = std::move(msg.payload);
+    const std::vector<unsigned char>& payload = sendMsg.Payload();
+    size_t nMessageSize = payload.size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
 
-    std::vector<unsigned char> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
     CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
-    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    if (sendMsg.payload) {
+        memcpy(hdr.pchChecksum, sendMsg.payload->pchChecksum, CMessageHeader::CHECKSUM_SIZE);
+    } else {
+        uint256 hash = Hash(payload.data(), payload.data() + nMessageSize);
+        memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    }
 
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    sendMsg.header.reserve(CMessageHeader::HEADER_SIZE);
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, sendMsg.header, 0, hdr};
 
     size_t nBytesSent = 0;
     {
@@ -2856,9 +3163,7 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.push_back(std::move(sendMsg));
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
@@ -36,6 +36,7 @@
 
 class CScheduler;
 class CNode;
+class CSocketPoller;
 
 namespace boost {
     class thread_group;
@@ -83,6 +84,8 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Default for -netepoll: use edge-triggered epoll for peer sockets where available */
+static const bool DEFAULT_NET_EPOLL = true;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
@@ -112,9 +115,26 @@ struct CSerializedNetMsg
     CSerializedNetMsg& operator=(const CSerializedNetMsg&) = delete;
 
     std::vector<unsigned char> data;
+    //! Payload shared with other senders, sent instead of data when set
+    CNetMsgPayloadRef payload;
     std::string command;
 };
 
+/**
+ * A message in a peer's send queue. The header is serialized separately and
+ * sent together with the payload in one gathered write, so the payload is
+ * never concatenated or copied, and may be shared between peers.
+ */
+struct CNetSendMsg
+{
+    std::vector<unsigned char> header;
+    std::vector<unsigned char> data;
+    CNetMsgPayloadRef payload;
+
+    const std::vector<unsigned char>& Payload() const { return payload ? payload->data : data; }
+    size_t size() const { return header.size() + Payload().size(); }
+};
+
 class NetEventsInterface;
 class CConnman
 {
@@ -145,6 +165,7 @@ public:
         std::vector<std::string> vSeedNodes;
         std::vector<CSubNet> vWhitelistedRange;
         std::vector<CService> vBinds, vWhiteBinds;
+        bool fUseEpoll = false;
     };
 
     void Init(const Options& connOptions) {
@@ -162,6 +183,7 @@ public:
         nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
         nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
         vWhitelistedRange = connOptions.vWhitelistedRange;
+        fUseEpoll = connOptions.fUseEpoll;
     }
 
     CConnman(uint64_t seed0, uint64_t seed1);
@@ -325,6 +347,8 @@ private:
     void ThreadOpenConnections();
     void ThreadMessageHandler();
     void AcceptConnection(const ListenSocket& hListenSocket);
+    bool SocketRecvData(CNode *pnode);
+    void InactivityCheck(CNode *pnode);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -382,6 +406,11 @@ private:
 
     std::vector<ListenSocket> vhListenSocket;
     std::atomic<bool> fNetworkActive;
+
+    /** Prefer the edge-triggered epoll backend for socket readiness */
+    bool fUseEpoll;
+    /** Readiness backend used by ThreadSocketHandler; set up in Start() */
+    std::unique_ptr<CSocketPoller> socketPoller;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
     bool setBannedIsDirty;
@@ -539,6 +568,9 @@ public:
     double dPingTime;
     double dPingWait;
     double dMinPing;
+    uint64_t nSubBlockInvSent;
+    uint64_t nSubBlockInvKnown;
+    uint64_t nSubBlocksServed;
     // Our address, as reported by the peer
     std::string addrLocal;
     // Address of this peer
@@ -573,6 +605,9 @@ public:
         nDataPos = 0;
         nTime = 0;
     }
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    ~CNetMessage();
 
     bool complete() const
     {
@@ -591,6 +626,11 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+    /** Space for the next nBytes (at most) of payload, so it can be received in place. */
+    char* GetDataBuffer(unsigned int& nBytes);
+
+private:
+    void GrowData(unsigned int nSize);
 };
 
 
@@ -606,7 +646,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CNetSendMsg> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -658,6 +698,11 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // Edge-triggered poller state, only touched by the socket handler thread.
+    // A ready flag stays set until a read or write hits EWOULDBLOCK.
+    bool fPollWatched;
+    bool fPollRecvReady;
+    bool fPollSendReady;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -684,7 +729,9 @@ public:
     // There is no final sorting before sending, as they are always sent immediately
     // and in the order requested.
     std::vector<uint256> vInventoryBlockToSend;
-    std::vector<uint256> vInventorySubBlockToSend;
+    // Set of subblock hashes we still have to announce. They are trickled
+    // in batches like transactions, so the order is not important.
+    std::set<uint256> setInventorySubBlockToSend;
     CCriticalSection cs_inventory;
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
@@ -702,6 +749,14 @@ public:
     std::atomic<int64_t> nLastBlockTime;
     std::atomic<int64_t> nLastTXTime;
 
+    // Subblock relay counters
+    // Subblock invs announced to the peer
+    std::atomic<uint64_t> nSubBlockInvSent;
+    // Subblock announcements dropped because the peer already knew the subblock
+    std::atomic<uint64_t> nSubBlockInvKnown;
+    // Subblocks sent to the peer in response to getdata
+    std::atomic<uint64_t> nSubBlocksServed;
+
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
     std::atomic<uint64_t> nPingNonceSent;
@@ -762,6 +817,12 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    /**
+     * If the message being received still misses a large part of its payload,
+     * return space inside it to receive into; passing that space back to
+     * ReceiveMsgBytes then skips the copy. Returns false otherwise.
+     */
+    bool GetRecvMsgBuffer(char*& pch, unsigned int& nBytes);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -829,7 +890,11 @@ public:
         } else if (inv.type == MSG_BLOCK) {
             vInventoryBlockToSend.push_back(inv.hash);
         } else if (inv.type == MSG_SUBBLOCK) {
-            vInventorySubBlockToSend.push_back(inv.hash);
+            if (!filterInventoryKnown.contains(inv.hash)) {
+                setInventorySubBlockToSend.insert(inv.hash);
+            } else {
+                nSubBlockInvKnown++;
+            }
         }
     }
 
@@ -24,6 +24,7 @@
 #include "random.h"
 #include "reverse_iterator.h"
 #include "scheduler.h"
+#include "subblockcache.h"
 #include "tinyformat.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -993,6 +994,9 @@ static void RelayTransaction(const CTransaction& tx, CConnman* connman)
 void RelaySubBlock(const CSubBlock& block, CConnman* connman)
 {
     CInv inv(MSG_SUBBLOCK, block.GetHash());
+    // Every peer we announce to is expected to fetch it: serialize it once now
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    subblockmsgcache.Insert(inv.hash, std::make_shared<const CNetMsgPayload>(std::move(msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::SUBBLOCK, block).data)));
     connman->ForEachNode([&inv](CNode* pnode)
     {
         pnode->PushInventory(inv);
@@ -1112,6 +1116,15 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     std::shared_ptr<const CBlock> pblock;
                     if (a_recent_block && a_recent_block->GetHash() == (*mi).second->GetBlockHash()) {
                         pblock = a_recent_block;
+                    } else if (inv.type == MSG_WITNESS_BLOCK) {
+                        // Blocks are stored in the network serialization with witnesses,
+                        // so send the bytes from disk without deserializing them
+                        CSerializedNetMsg msg;
+                        msg.command = NetMsgType::BLOCK;
+                        if (!ReadRawBlockFromDisk(msg.data, (*mi).second, Params().MessageStart()))
+                            assert(!"cannot load block from disk");
+                        connman->PushMessage(pfrom, std::move(msg));
+                        // pblock stays unset, the block has been sent
                     } else {
                         // Send block from disk
                         std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
@@ -1119,53 +1132,55 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                             assert(!"cannot load block from disk");
                         pblock = pblockRead;
                     }
-                    if (inv.type == MSG_BLOCK)
-                        connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
-                    else if (inv.type == MSG_FILTERED_BLOCK)
-                    {
-                        bool sendMerkleBlock = false;
-                        CMerkleBlock merkleBlock;
+                    if (pblock) {
+                        if (inv.type == MSG_BLOCK)
+                            connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
+                        else if (inv.type == MSG_WITNESS_BLOCK)
+                            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
+                        else if (inv.type == MSG_FILTERED_BLOCK)
                         {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                sendMerkleBlock = true;
-                                merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
+                            bool sendMerkleBlock = false;
+                            CMerkleBlock merkleBlock;
+                            {
+                                LOCK(pfrom->cs_filter);
+                                if (pfrom->pfilter) {
+                                    sendMerkleBlock = true;
+                                    merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
+                                }
                             }
+                            if (sendMerkleBlock) {
+                                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+                                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                                // This avoids hurting performance by pointlessly requiring a round-trip
+                                // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                                // they must either disconnect and retry or request the full block.
+                                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                                // however we MUST always provide at least what the remote peer needs
+                                typedef std::pair<unsigned int, uint256> PairType;
+                                for (PairType& pair : merkleBlock.vMatchedTxn)
+                                    connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
+                            }
+                            // else
+                                // no response
                         }
-                        if (sendMerkleBlock) {
-                            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            for (PairType& pair : merkleBlock.vMatchedTxn)
-                                connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
-                        }
-                        // else
-                            // no response
-                    }
-                    else if (inv.type == MSG_CMPCT_BLOCK)
-                    {
-                        // If a peer is asking for old blocks, we're almost guaranteed
-                        // they won't have a useful mempool to match against a compact block,
-                        // and we don't feel like constructing the object for them, so
-                        // instead we respond with the full, non-compact block.
-                        bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-                        int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-                        if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
-                                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+                        else if (inv.type == MSG_CMPCT_BLOCK)
+                        {
+                            // If a peer is asking for old blocks, we're almost guaranteed
+                            // they won't have a useful mempool to match against a compact block,
+                            // and we don't feel like constructing the object for them, so
+                            // instead we respond with the full, non-compact block.
+                            bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+                            int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+                            if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                                if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
+                                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+                                } else {
+                                    CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
+                                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                                }
                             } else {
-                                CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
-                                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
                             }
-                        } else {
-                            connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
                         }
                     }
 
@@ -1217,23 +1232,32 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
 		if (send)
 		{
-			std::shared_ptr<const CSubBlock> pblock;
-			//TODO open it 
-			if (a_recent_subblock && a_recent_subblock->GetHash() == (*mi).second->GetBlockHash()) {
-				pblock = a_recent_subblock;
-			} else {
-				// Send block from disk
-				CSubBlock block;
-				std::shared_ptr<CSubBlock> pblockRead = std::make_shared<CSubBlock>();
-				if (!ReadSubBlockFromDisk(*pblockRead, (*mi).second, consensusParams))
-					assert(!"cannot load block from disk");
-				pblock = pblockRead;
+			// Serve the serialized message from the cache if we have sent it before
+			CSubBlockMsgCache::DataRef data = subblockmsgcache.Get(inv.hash);
+			if (!data) {
+				std::shared_ptr<const CSubBlock> pblock;
+				if (a_recent_subblock && a_recent_subblock->GetHash() == (*mi).second->GetBlockHash()) {
+					pblock = a_recent_subblock;
+				} else {
+					// Send block from disk
+					std::shared_ptr<CSubBlock> pblockRead = std::make_shared<CSubBlock>();
+					if (!ReadSubBlockFromDisk(*pblockRead, (*mi).second, consensusParams))
+						assert(!"cannot load block from disk");
+					pblock = pblockRead;
+				}
+				data = std::make_shared<const CNetMsgPayload>(std::move(msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::SUBBLOCK, *pblock).data));
+				subblockmsgcache.Insert(inv.hash, data);
+				{
+					LOCK(cs_most_recent_subblock);
+					most_recent_subblock = pblock;
+				}
 			}
-			connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::SUBBLOCK, *pblock));
-                    {
-			    LOCK(cs_most_recent_subblock);
-			    most_recent_subblock = pblock;
-                    } 
+			CSerializedNetMsg msg;
+			msg.command = NetMsgType::SUBBLOCK;
+			msg.payload = data;
+			connman->PushMessage(pfrom, std::move(msg));
+			pfrom->AddInventoryKnown(inv);
+			pfrom->nSubBlocksServed++;
 		}
 
             }
@@ -2674,6 +2698,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         vRecv >> *pblock;
 
         LogPrint(BCLog::NET, "received subblock %s peer=%d\n", pblock->GetHash().ToString(), pfrom->GetId());
+        pfrom->AddInventoryKnown(CInv(MSG_SUBBLOCK, pblock->GetHash()));
 
         bool forceProcessing = false;
         const uint256 hash(pblock->GetHash());
@@ -3482,19 +3507,6 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
             }
             pto->vInventoryBlockToSend.clear();
 
-            vInv.reserve(std::max<size_t>(pto->vInventorySubBlockToSend.size(), INVENTORY_BROADCAST_MAX));
-
-            // Add blocks
-            for (const uint256& hash : pto->vInventorySubBlockToSend) {
-                vInv.push_back(CInv(MSG_SUBBLOCK, hash));
- LogPrintf("\naddinv hash vInv=%d s=%s\n",vInv.size(), vInv[0].ToString());
-                if (vInv.size() == MAX_INV_SZ) {
-                    connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
-                    vInv.clear();
-                }
-            }
-            pto->vInventorySubBlockToSend.clear();
-
             // Check whether periodic sends should happen
             bool fSendTrickle = pto->fWhitelisted;
             if (pto->nNextInvSend < nNow) {
@@ -3542,6 +3554,28 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 pto->timeLastMempoolReq = GetTime();
             }
 
+            // Determine subblocks to relay, skipping those the peer already has
+            if (fSendTrickle) {
+                unsigned int nRelayedSubBlocks = 0;
+                std::set<uint256>::iterator it = pto->setInventorySubBlockToSend.begin();
+                while (it != pto->setInventorySubBlockToSend.end() && nRelayedSubBlocks < INVENTORY_BROADCAST_MAX) {
+                    const uint256 hash = *it;
+                    it = pto->setInventorySubBlockToSend.erase(it);
+                    if (pto->filterInventoryKnown.contains(hash)) {
+                        pto->nSubBlockInvKnown++;
+                        continue;
+                    }
+                    vInv.push_back(CInv(MSG_SUBBLOCK, hash));
+                    nRelayedSubBlocks++;
+                    pto->nSubBlockInvSent++;
+                    if (vInv.size() == MAX_INV_SZ) {
+                        connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+                        vInv.clear();
+                    }
+                    pto->filterInventoryKnown.insert(hash);
+                }
+            }
+
             // Determine transactions to relay
             if (fSendTrickle) {
                 // Produce a vector with all candidates for sending
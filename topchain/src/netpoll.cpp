@@ -0,0 +1,179 @@
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "netpoll.h"
+
+#include "netbase.h"
+#include "util.h"
+
+#include <algorithm>
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+class CSelectPoller : public CSocketPoller
+{
+private:
+    std::vector<Event> vInterest;
+
+public:
+    const char* GetName() const override { return "select"; }
+    bool IsEdgeTriggered() const override { return false; }
+    bool IsWatchable(SOCKET hSocket) const override { return IsSelectableSocket(hSocket); }
+
+    bool Watch(SOCKET hSocket, int64_t nId, int nEvents) override
+    {
+        if (!IsSelectableSocket(hSocket))
+            return false;
+        vInterest.push_back(Event{hSocket, nId, nEvents});
+        return true;
+    }
+
+    void Unwatch(SOCKET hSocket) override
+    {
+        vInterest.erase(std::remove_if(vInterest.begin(), vInterest.end(),
+            [hSocket](const Event& ev) { return ev.hSocket == hSocket; }), vInterest.end());
+    }
+
+    int Wait(int64_t nTimeoutMillis, std::vector<Event>& vEvents) override
+    {
+        struct timeval timeout = MillisToTimeval(nTimeoutMillis);
+
+        fd_set fdsetRecv;
+        fd_set fdsetSend;
+        fd_set fdsetError;
+        FD_ZERO(&fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        SOCKET hSocketMax = 0;
+
+        for (const Event& ev : vInterest) {
+            if (ev.nEvents & POLL_RECV)
+                FD_SET(ev.hSocket, &fdsetRecv);
+            if (ev.nEvents & POLL_SEND)
+                FD_SET(ev.hSocket, &fdsetSend);
+            if (ev.nEvents & POLL_ERR)
+                FD_SET(ev.hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, ev.hSocket);
+        }
+
+        int nSelect = select(vInterest.empty() ? 0 : hSocketMax + 1,
+                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        int nReady = 0;
+        for (const Event& ev : vInterest) {
+            int nEvents = 0;
+            if (nSelect == SOCKET_ERROR) {
+                nEvents = POLL_RECV;
+            } else {
+                if (FD_ISSET(ev.hSocket, &fdsetRecv))
+                    nEvents |= POLL_RECV;
+                if (FD_ISSET(ev.hSocket, &fdsetSend))
+                    nEvents |= POLL_SEND;
+                if (FD_ISSET(ev.hSocket, &fdsetError))
+                    nEvents |= POLL_ERR;
+            }
+            if (nEvents) {
+                vEvents.push_back(Event{ev.hSocket, ev.nId, nEvents});
+                nReady++;
+            }
+        }
+        vInterest.clear();
+        return nSelect == SOCKET_ERROR ? SOCKET_ERROR : nReady;
+    }
+};
+
+#ifdef USE_EPOLL
+class CEpollPoller : public CSocketPoller
+{
+private:
+    //! Upper bound on the events returned by a single epoll_wait()
+    static const int MAX_EPOLL_EVENTS = 512;
+
+    int fdEpoll;
+    std::vector<struct epoll_event> vReady;
+
+public:
+    explicit CEpollPoller(int fdEpollIn) : fdEpoll(fdEpollIn), vReady(MAX_EPOLL_EVENTS) {}
+    ~CEpollPoller() { close(fdEpoll); }
+
+    const char* GetName() const override { return "epoll"; }
+    bool IsEdgeTriggered() const override { return true; }
+    bool IsWatchable(SOCKET hSocket) const override { return hSocket != INVALID_SOCKET; }
+
+    bool Watch(SOCKET hSocket, int64_t nId, int nEvents) override
+    {
+        struct epoll_event ev = {};
+        if (nEvents & POLL_RECV)
+            ev.events |= EPOLLIN | EPOLLRDHUP;
+        if (nEvents & POLL_SEND)
+            ev.events |= EPOLLOUT;
+        if (!(nEvents & POLL_LEVEL))
+            ev.events |= EPOLLET;
+        ev.data.u64 = (uint64_t)nId;
+        if (epoll_ctl(fdEpoll, EPOLL_CTL_ADD, hSocket, &ev) == 0)
+            return true;
+        if (errno == EEXIST && epoll_ctl(fdEpoll, EPOLL_CTL_MOD, hSocket, &ev) == 0)
+            return true;
+        LogPrintf("epoll_ctl() failed for socket %d: %s\n", hSocket, NetworkErrorString(errno));
+        return false;
+    }
+
+    void Unwatch(SOCKET hSocket) override
+    {
+        // A non-null event pointer keeps pre-2.6.9 kernels happy.
+        struct epoll_event ev = {};
+        epoll_ctl(fdEpoll, EPOLL_CTL_DEL, hSocket, &ev);
+    }
+
+    int Wait(int64_t nTimeoutMillis, std::vector<Event>& vEvents) override
+    {
+        int nReady = epoll_wait(fdEpoll, vReady.data(), vReady.size(), nTimeoutMillis);
+        if (nReady < 0)
+            return SOCKET_ERROR;
+        for (int i = 0; i < nReady; i++) {
+            const struct epoll_event& ev = vReady[i];
+            int nEvents = 0;
+            if (ev.events & (EPOLLIN | EPOLLRDHUP))
+                nEvents |= POLL_RECV;
+            if (ev.events & EPOLLOUT)
+                nEvents |= POLL_SEND;
+            if (ev.events & (EPOLLERR | EPOLLHUP))
+                nEvents |= POLL_ERR;
+            // The socket itself is not tracked here; callers map events back
+            // to their owner through the id they registered.
+            vEvents.push_back(Event{INVALID_SOCKET, (int64_t)ev.data.u64, nEvents});
+        }
+        return nReady;
+    }
+};
+#endif // USE_EPOLL
+
+} // namespace
+
+std::unique_ptr<CSocketPoller> MakeSelectPoller()
+{
+    return std::unique_ptr<CSocketPoller>(new CSelectPoller());
+}
+
+std::unique_ptr<CSocketPoller> MakeEpollPoller()
+{
+#ifdef USE_EPOLL
+    int fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (fdEpoll < 0) {
+        LogPrintf("epoll_create1() failed: %s\n", NetworkErrorString(errno));
+        return nullptr;
+    }
+    return std::unique_ptr<CSocketPoller>(new CEpollPoller(fdEpoll));
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETPOLL_H
+#define BITCOIN_NETPOLL_H
+
+#include "compat.h"
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__linux__)
+#define USE_EPOLL 1
+#endif
+
+/**
+ * Socket readiness notification used by the socket handler thread.
+ *
+ * Two kinds of backend exist. Level-triggered backends (select) forget their
+ * interest set after every Wait(), so callers re-register the sockets they
+ * care about each round, exactly like building fd_sets by hand. Edge-triggered
+ * backends (epoll) keep a socket registered until Unwatch() or until it is
+ * closed, and only report a direction again once it has gone from not-ready to
+ * ready; callers must therefore read or write until EWOULDBLOCK before they can
+ * rely on being woken up again.
+ */
+class CSocketPoller
+{
+public:
+    enum {
+        POLL_RECV = (1U << 0),
+        POLL_SEND = (1U << 1),
+        POLL_ERR = (1U << 2),
+        //! Keep reporting the socket while it is ready, even on an
+        //! edge-triggered backend (used for listening sockets).
+        POLL_LEVEL = (1U << 3),
+    };
+
+    struct Event {
+        //! Only filled in by level-triggered backends; use nId to find the owner.
+        SOCKET hSocket;
+        int64_t nId;
+        int nEvents;
+    };
+
+    virtual ~CSocketPoller() {}
+
+    virtual const char* GetName() const = 0;
+    virtual bool IsEdgeTriggered() const = 0;
+    /** Whether this backend can watch the given socket at all. */
+    virtual bool IsWatchable(SOCKET hSocket) const = 0;
+    /** Register interest in hSocket; nId is handed back with its events. */
+    virtual bool Watch(SOCKET hSocket, int64_t nId, int nEvents) = 0;
+    /** Drop a registration. Must be called before the socket is closed. */
+    virtual void Unwatch(SOCKET hSocket) = 0;
+    /**
+     * Wait up to nTimeoutMillis for readiness and append it to vEvents.
+     * Returns the number of events, or SOCKET_ERROR. On error the select
+     * backend still reports every registered socket as readable, so callers
+     * fall back to probing them with non-blocking reads.
+     */
+    virtual int Wait(int64_t nTimeoutMillis, std::vector<Event>& vEvents) = 0;
+};
+
+std::unique_ptr<CSocketPoller> MakeSelectPoller();
+/** Returns nullptr when epoll is not available on this platform. */
+std::unique_ptr<CSocketPoller> MakeEpollPoller();
+
+#endif // BITCOIN_NETPOLL_H
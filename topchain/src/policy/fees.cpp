@@ -15,6 +15,8 @@
 #include "util.h"
 
 static constexpr double INF_FEERATE = 1e99;
+/** Lowest accumulated decay before TxConfirmStats applies it to its stored averages */
+static constexpr double MIN_DECAY_SCALE = 1e-30;
 
 std::string StringForFeeEstimateHorizon(FeeEstimateHorizon horizon) {
     static const std::map<FeeEstimateHorizon, std::string> horizon_strings = {
@@ -78,6 +80,18 @@ private:
     const std::vector<double>& buckets;              // The upper-bound of the range for the bucket (inclusive)
     const std::map<double, unsigned int>& bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
 
+    // The moving averages below are kept undecayed: a stored value times
+    // decayScale is the actual average. Decaying every average for a new
+    // block is then just a multiplication of decayScale, and data points are
+    // added divided by it. The two-dimensional tables are stored flat, one
+    // row of buckets per period, so a row is contiguous.
+
+    // Number of buckets per row of the flat tables
+    size_t numBuckets;
+
+    // Number of periods tracked (rows of the flat tables)
+    size_t numPeriods;
+
     // For each bucket X:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
@@ -85,11 +99,11 @@ private:
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
-    std::vector<std::vector<double>> confAvg; // confAvg[Y][X]
+    std::vector<double> confAvg; // confAvg[Y * numBuckets + X]
 
     // Track moving avg of txs which have been evicted from the mempool
     // after failing to be confirmed within Y blocks
-    std::vector<std::vector<double>> failAvg; // failAvg[Y][X]
+    std::vector<double> failAvg; // failAvg[Y * numBuckets + X]
 
     // Sum the total feerate of all tx's in each bucket
     // Track the historical moving average of this total over blocks
@@ -100,18 +114,29 @@ private:
 
     double decay;
 
+    // Decay applied to all the moving averages since they were last normalized
+    double decayScale;
+
     // Resolution (# of blocks) with which confirmations are tracked
     unsigned int scale;
 
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
-    std::vector<std::vector<int> > unconfTxs;  //unconfTxs[Y][X]
+    std::vector<int> unconfTxs;  //unconfTxs[Y * numBuckets + X]
     // transactions still unconfirmed after GetMaxConfirms for each bucket
     std::vector<int> oldUnconfTxs;
 
     void resizeInMemoryCounters(size_t newbuckets);
 
+    /** Apply decayScale to the stored moving averages and reset it to 1 */
+    void NormalizeMovingAverages();
+
+    double ConfAvg(unsigned int period, unsigned int bucket) const { return confAvg[period * numBuckets + bucket] * decayScale; }
+    double FailAvg(unsigned int period, unsigned int bucket) const { return failAvg[period * numBuckets + bucket] * decayScale; }
+    double TxCtAvg(unsigned int bucket) const { return txCtAvg[bucket] * decayScale; }
+    double Avg(unsigned int bucket) const { return avg[bucket] * decayScale; }
+
 public:
     /**
      * Create new TxConfirmStats. This is called by BlockPolicyEstimator's
@@ -161,7 +186,7 @@ public:
                              EstimationResult *result = nullptr) const;
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() const { return scale * confAvg.size(); }
+    unsigned int GetMaxConfirms() const { return scale * numPeriods; }
 
     /** Write state of estimation data to a file*/
     void Write(CAutoFile& fileout) const;
@@ -170,7 +195,7 @@ public:
      * Read saved state of estimation data from a file and replace all internal data structures and
      * variables with this state.
      */
-    void Read(CAutoFile& filein, int nFileVersion, size_t numBuckets);
+    void Read(CAutoFile& filein, int nFileVersion, size_t numFileBuckets);
 };
 
 
@@ -180,37 +205,32 @@ TxConfirmStats::TxConfirmStats(const std::vector<double>& defaultBuckets,
     : buckets(defaultBuckets), bucketMap(defaultBucketMap)
 {
     decay = _decay;
+    decayScale = 1;
     scale = _scale;
-    confAvg.resize(maxPeriods);
-    for (unsigned int i = 0; i < maxPeriods; i++) {
-        confAvg[i].resize(buckets.size());
-    }
-    failAvg.resize(maxPeriods);
-    for (unsigned int i = 0; i < maxPeriods; i++) {
-        failAvg[i].resize(buckets.size());
-    }
+    numBuckets = buckets.size();
+    numPeriods = maxPeriods;
+    confAvg.resize(numPeriods * numBuckets);
+    failAvg.resize(numPeriods * numBuckets);
 
-    txCtAvg.resize(buckets.size());
-    avg.resize(buckets.size());
+    txCtAvg.resize(numBuckets);
+    avg.resize(numBuckets);
 
-    resizeInMemoryCounters(buckets.size());
+    resizeInMemoryCounters(numBuckets);
 }
 
 void TxConfirmStats::resizeInMemoryCounters(size_t newbuckets) {
     // newbuckets must be passed in because the buckets referred to during Read have not been updated yet.
-    unconfTxs.resize(GetMaxConfirms());
-    for (unsigned int i = 0; i < unconfTxs.size(); i++) {
-        unconfTxs[i].resize(newbuckets);
-    }
-    oldUnconfTxs.resize(newbuckets);
+    unconfTxs.assign(GetMaxConfirms() * newbuckets, 0);
+    oldUnconfTxs.assign(newbuckets, 0);
 }
 
 // Roll the unconfirmed txs circular buffer
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
+    int* current = &unconfTxs[(nBlockHeight % GetMaxConfirms()) * numBuckets];
+    for (unsigned int j = 0; j < numBuckets; j++) {
+        oldUnconfTxs[j] += current[j];
+        current[j] = 0;
     }
 }
 
@@ -222,23 +242,34 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
         return;
     int periodsToConfirm = (blocksToConfirm + scale - 1)/scale;
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = periodsToConfirm; i <= confAvg.size(); i++) {
-        confAvg[i - 1][bucketindex]++;
+    const double weight = 1 / decayScale;
+    for (size_t i = periodsToConfirm; i <= numPeriods; i++) {
+        confAvg[(i - 1) * numBuckets + bucketindex] += weight;
     }
-    txCtAvg[bucketindex]++;
-    avg[bucketindex] += val;
+    txCtAvg[bucketindex] += weight;
+    avg[bucketindex] += val * weight;
 }
 
 void TxConfirmStats::UpdateMovingAverages()
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay;
-        for (unsigned int i = 0; i < failAvg.size(); i++)
-            failAvg[i][j] = failAvg[i][j] * decay;
-        avg[j] = avg[j] * decay;
-        txCtAvg[j] = txCtAvg[j] * decay;
-    }
+    decayScale *= decay;
+    // Data points are added as 1 / decayScale; keep that well inside the
+    // range of a double
+    if (decayScale < MIN_DECAY_SCALE)
+        NormalizeMovingAverages();
+}
+
+void TxConfirmStats::NormalizeMovingAverages()
+{
+    for (double& x : confAvg)
+        x *= decayScale;
+    for (double& x : failAvg)
+        x *= decayScale;
+    for (double& x : avg)
+        x *= decayScale;
+    for (double& x : txCtAvg)
+        x *= decayScale;
+    decayScale = 1;
 }
 
 // returns -1 on error conditions
@@ -273,7 +304,7 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int bestFarBucket = startbucket;
 
     bool foundAnswer = false;
-    unsigned int bins = unconfTxs.size();
+    unsigned int bins = GetMaxConfirms();
     bool newBucketRange = true;
     bool passing = true;
     EstimatorBucket passBucket;
@@ -286,11 +317,11 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
             newBucketRange = false;
         }
         curFarBucket = bucket;
-        nConf += confAvg[periodTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
-        failNum += failAvg[periodTarget - 1][bucket];
+        nConf += ConfAvg(periodTarget - 1, bucket);
+        totalNum += TxCtAvg(bucket);
+        failNum += FailAvg(periodTarget - 1, bucket);
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
+            extraNum += unconfTxs[((nBlockHeight - confct)%bins) * numBuckets + bucket];
         extraNum += oldUnconfTxs[bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
@@ -346,13 +377,13 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int minBucket = std::min(bestNearBucket, bestFarBucket);
     unsigned int maxBucket = std::max(bestNearBucket, bestFarBucket);
     for (unsigned int j = minBucket; j <= maxBucket; j++) {
-        txSum += txCtAvg[j];
+        txSum += TxCtAvg(j);
     }
     if (foundAnswer && txSum != 0) {
         txSum = txSum / 2;
         for (unsigned int j = minBucket; j <= maxBucket; j++) {
-            if (txCtAvg[j] < txSum)
-                txSum -= txCtAvg[j];
+            if (TxCtAvg(j) < txSum)
+                txSum -= TxCtAvg(j);
             else { // we're in the right bucket
                 median = avg[j] / txCtAvg[j];
                 break;
@@ -394,17 +425,36 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     return median;
 }
 
+/** Copy a flat table of moving averages with decayScale applied, in rows of numBuckets */
+static std::vector<std::vector<double>> UnflattenAverages(const std::vector<double>& table, size_t numBuckets, double decayScale)
+{
+    std::vector<std::vector<double>> rows(table.size() / numBuckets);
+    for (size_t i = 0; i < rows.size(); i++) {
+        rows[i].reserve(numBuckets);
+        for (size_t j = 0; j < numBuckets; j++)
+            rows[i].push_back(table[i * numBuckets + j] * decayScale);
+    }
+    return rows;
+}
+
 void TxConfirmStats::Write(CAutoFile& fileout) const
 {
+    // The file keeps the per-period layout and actual averages, so it stays
+    // readable by versions without the flat tables and lazy decay
+    std::vector<double> avgOut(avg), txCtAvgOut(txCtAvg);
+    for (double& x : avgOut)
+        x *= decayScale;
+    for (double& x : txCtAvgOut)
+        x *= decayScale;
     fileout << decay;
     fileout << scale;
-    fileout << avg;
-    fileout << txCtAvg;
-    fileout << confAvg;
-    fileout << failAvg;
+    fileout << avgOut;
+    fileout << txCtAvgOut;
+    fileout << UnflattenAverages(confAvg, numBuckets, decayScale);
+    fileout << UnflattenAverages(failAvg, numBuckets, decayScale);
 }
 
-void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets)
+void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numFileBuckets)
 {
     // Read data file and do some very basic sanity checking
     // buckets and bucketMap are not updated yet, so don't access them
@@ -421,56 +471,66 @@ void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets
     }
 
     filein >> avg;
-    if (avg.size() != numBuckets) {
+    if (avg.size() != numFileBuckets) {
         throw std::runtime_error("Corrupt estimates file. Mismatch in feerate average bucket count");
     }
     filein >> txCtAvg;
-    if (txCtAvg.size() != numBuckets) {
+    if (txCtAvg.size() != numFileBuckets) {
         throw std::runtime_error("Corrupt estimates file. Mismatch in tx count bucket count");
     }
-    filein >> confAvg;
-    maxPeriods = confAvg.size();
+    std::vector<std::vector<double>> fileConfAvg;
+    filein >> fileConfAvg;
+    maxPeriods = fileConfAvg.size();
     maxConfirms = scale * maxPeriods;
 
     if (maxConfirms <= 0 || maxConfirms > 6 * 24 * 7) { // one week
         throw std::runtime_error("Corrupt estimates file.  Must maintain estimates for between 1 and 1008 (one week) confirms");
     }
+    confAvg.clear();
+    confAvg.reserve(maxPeriods * numFileBuckets);
     for (unsigned int i = 0; i < maxPeriods; i++) {
-        if (confAvg[i].size() != numBuckets) {
+        if (fileConfAvg[i].size() != numFileBuckets) {
             throw std::runtime_error("Corrupt estimates file. Mismatch in feerate conf average bucket count");
         }
+        confAvg.insert(confAvg.end(), fileConfAvg[i].begin(), fileConfAvg[i].end());
     }
 
     if (nFileVersion >= 149900) {
-        filein >> failAvg;
-        if (maxPeriods != failAvg.size()) {
+        std::vector<std::vector<double>> fileFailAvg;
+        filein >> fileFailAvg;
+        if (maxPeriods != fileFailAvg.size()) {
             throw std::runtime_error("Corrupt estimates file. Mismatch in confirms tracked for failures");
         }
+        failAvg.clear();
+        failAvg.reserve(maxPeriods * numFileBuckets);
         for (unsigned int i = 0; i < maxPeriods; i++) {
-            if (failAvg[i].size() != numBuckets) {
+            if (fileFailAvg[i].size() != numFileBuckets) {
                 throw std::runtime_error("Corrupt estimates file. Mismatch in one of failure average bucket counts");
             }
+            failAvg.insert(failAvg.end(), fileFailAvg[i].begin(), fileFailAvg[i].end());
         }
     } else {
-        failAvg.resize(confAvg.size());
-        for (unsigned int i = 0; i < failAvg.size(); i++) {
-            failAvg[i].resize(numBuckets);
-        }
+        failAvg.assign(maxPeriods * numFileBuckets, 0);
     }
 
+    // The file holds actual averages
+    decayScale = 1;
+    numBuckets = numFileBuckets;
+    numPeriods = maxPeriods;
+
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
-    resizeInMemoryCounters(numBuckets);
+    resizeInMemoryCounters(numFileBuckets);
 
     LogPrint(BCLog::ESTIMATEFEE, "Reading estimates: %u buckets counting confirms up to %u blocks\n",
-             numBuckets, maxConfirms);
+             numFileBuckets, maxConfirms);
 }
 
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    unsigned int blockIndex = nBlockHeight % unconfTxs.size();
-    unconfTxs[blockIndex][bucketindex]++;
+    unsigned int blockIndex = nBlockHeight % GetMaxConfirms();
+    unconfTxs[blockIndex * numBuckets + bucketindex]++;
     return bucketindex;
 }
 
@@ -485,7 +545,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         return;  //This can't happen because we call this with our best seen height, no entries can have higher
     }
 
-    if (blocksAgo >= (int)unconfTxs.size()) {
+    if (blocksAgo >= (int)GetMaxConfirms()) {
         if (oldUnconfTxs[bucketindex] > 0) {
             oldUnconfTxs[bucketindex]--;
         } else {
@@ -494,9 +554,9 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         }
     }
     else {
-        unsigned int blockIndex = entryHeight % unconfTxs.size();
-        if (unconfTxs[blockIndex][bucketindex] > 0) {
-            unconfTxs[blockIndex][bucketindex]--;
+        unsigned int blockIndex = entryHeight % GetMaxConfirms();
+        if (unconfTxs[blockIndex * numBuckets + bucketindex] > 0) {
+            unconfTxs[blockIndex * numBuckets + bucketindex]--;
         } else {
             LogPrint(BCLog::ESTIMATEFEE, "Blockpolicy error, mempool tx removed from blockIndex=%u,bucketIndex=%u already\n",
                      blockIndex, bucketindex);
@@ -504,8 +564,8 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
     }
     if (!inBlock && (unsigned int)blocksAgo >= scale) { // Only counts as a failure if not confirmed for entire period
         unsigned int periodsAgo = blocksAgo / scale;
-        for (size_t i = 0; i < periodsAgo && i < failAvg.size(); i++) {
-            failAvg[i][bucketindex]++;
+        for (size_t i = 0; i < periodsAgo && i < numPeriods; i++) {
+            failAvg[i * numBuckets + bucketindex] += 1 / decayScale;
         }
     }
 }
@@ -735,6 +795,12 @@ unsigned int CBlockPolicyEstimator::HighestTargetTracked(FeeEstimateHorizon hori
     }
 }
 
+unsigned int CBlockPolicyEstimator::BestSeenHeight() const
+{
+    LOCK(cs_feeEstimator);
+    return nBestSeenHeight;
+}
+
 unsigned int CBlockPolicyEstimator::BlockSpan() const
 {
     if (firstRecordedHeight == 0) return 0;
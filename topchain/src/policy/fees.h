@@ -228,6 +228,9 @@ public:
     /** Calculation of highest target that estimates are tracked for */
     unsigned int HighestTargetTracked(FeeEstimateHorizon horizon) const;
 
+    /** Height of the last block processed, which changes whenever the estimates do */
+    unsigned int BestSeenHeight() const;
+
 private:
     unsigned int nBestSeenHeight;
     unsigned int firstRecordedHeight;
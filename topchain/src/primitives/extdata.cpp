@@ -1,5 +1,8 @@
 #include "primitives/extdata.h"
 
+#include "hash.h"
+#include "pubkey.h"
+
 std::string CGenesisCoinBaseExt::ToString() const
 {
     std::string str;
@@ -10,12 +13,51 @@ std::string CGenesisCoinBaseExt::ToString() const
     return str;
 }
 
+/** Split an owner signature script into the signature and the signer's public key */
+static bool GetOwnerSignature(const CScript& script, std::vector<unsigned char>& vchSig, CPubKey& pubkey)
+{
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> vchPubKey;
+    if (!script.GetOp(pc, opcode, vchSig) || !script.GetOp(pc, opcode, vchPubKey) || pc != script.end())
+        return false;
+    pubkey.Set(vchPubKey.begin(), vchPubKey.end());
+    return pubkey.IsFullyValid();
+}
+
+uint256 GetSubChainOwner(const CPubKey& pubkey)
+{
+    return Hash(pubkey.begin(), pubkey.end());
+}
+
+uint256 CCreateSubChainExt::GetSignatureHash() const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << subChainId << subChainOwner << subChainName << subCoinName << subChainSeeds << CScript();
+    return ss.GetHash();
+}
+
 bool CCreateSubChainExt::Verify() const
 {
-    return false;
+    std::vector<unsigned char> vchSig;
+    CPubKey pubkey;
+    if (!GetOwnerSignature(signature, vchSig, pubkey) || GetSubChainOwner(pubkey) != subChainOwner)
+        return false;
+    return pubkey.Verify(GetSignatureHash(), vchSig);
+}
+
+uint256 CBackupSubBlockExt::GetSignatureHash() const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << subChainId << subBlockHash << subBlockHeight << CScript();
+    return ss.GetHash();
 }
 
-bool CBackupSubBlockExt::Verify() const
+bool CBackupSubBlockExt::Verify(const uint256& hashOwner) const
 {
-    return false;
+    std::vector<unsigned char> vchSig;
+    CPubKey pubkey;
+    if (hashOwner.IsNull() || !GetOwnerSignature(signature, vchSig, pubkey) || GetSubChainOwner(pubkey) != hashOwner)
+        return false;
+    return pubkey.Verify(GetSignatureHash(), vchSig);
 }
\ No newline at end of file
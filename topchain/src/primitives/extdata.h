@@ -7,7 +7,9 @@
 #include "uint256.h"
 #include "univalue.h"
 #include "script/script.h"
-#include "boost/any.hpp"
+#include <boost/variant.hpp>
+
+class CPubKey;
 
 enum ExtDataType {
     EXTDATA_NO,
@@ -33,11 +35,14 @@ public:
     std::string ToString() const;
 };
 
+/** The subChainOwner that stands for an owner key: the hash of the serialized public key */
+uint256 GetSubChainOwner(const CPubKey& pubkey);
+
 class CCreateSubChainExt
 {
 public:
     uint256                           subChainId;//子链id
-    uint256                           subChainOwner;//子链拥有者
+    uint256                           subChainOwner;//子链拥有者, GetSubChainOwner() of the owner key
     std::string                      subChainName;//子链名称
     std::string                      subCoinName;//子链币名称
     std::vector<std::string> subChainSeeds;//子链种子节点
@@ -55,6 +60,9 @@ public:
         READWRITE(signature);
     }
 
+    //! Hash committed to by the owner signature: the extension with an empty signature
+    uint256 GetSignatureHash() const;
+    //! Check that signature holds "<sig> <pubkey>", that pubkey is the subChainOwner key and that sig signs GetSignatureHash()
     bool Verify() const;
 };
 
@@ -76,14 +84,35 @@ public:
         READWRITE(signature);
     }
 
-    bool Verify() const;
+    //! Hash committed to by the owner signature: the extension with an empty signature
+    uint256 GetSignatureHash() const;
+    /**
+     * Check that signature holds "<sig> <pubkey>", that pubkey is the owner
+     * key hashOwner registered by the subchain's create, and that sig signs
+     * GetSignatureHash()
+     */
+    bool Verify(const uint256& hashOwner) const;
+};
+
+class CNoExtData {
+public:
+    friend bool operator==(const CNoExtData &a, const CNoExtData &b) { return true; }
 };
 
+/**
+ * The payload of a transaction's extension data. It is either:
+ *  * CNoExtData: no payload (EXTDATA_NO)
+ *  * CGenesisCoinBaseExt: EXTDATA_GENESISCOINBASE
+ *  * CCreateSubChainExt: EXTDATA_CREATESUBCHAIN
+ *  * CBackupSubBlockExt: EXTDATA_BACKUPSUBBLOCK
+ */
+typedef boost::variant<CNoExtData, CGenesisCoinBaseExt, CCreateSubChainExt, CBackupSubBlockExt> CExtPayload;
+
 class CExtData
 {
 public:
     uint8_t nExtType;
-    boost::any data;
+    CExtPayload data;
 
 public:
     CExtData() : nExtType(0), data() {}
@@ -98,29 +127,41 @@ public:
         UnserializeExtData(*this, s);
     }
 
+    /** Access the payload without copying it; returns nullptr if it does not hold a T. */
+    template <typename T>
+    const T* Get() const
+    {
+        return boost::get<T>(&data);
+    }
+
+    //! Whether the extension carries a subchain owner signature
+    bool HasOwnerSignature() const
+    {
+        return nExtType == EXTDATA_CREATESUBCHAIN || nExtType == EXTDATA_BACKUPSUBBLOCK;
+    }
+
+    //! Whether the transaction is an operation recorded in the subchain metadata
     bool NeedsToSaveMeta() const
     {
-        if(nExtType == EXTDATA_CREATESUBCHAIN)
+        if(nExtType == EXTDATA_CREATESUBCHAIN || nExtType == EXTDATA_BACKUPSUBBLOCK)
         {
             return true;
         }
         return false;
     }
 
-    uint256 GetSubChainId() const
+    const uint256& GetSubChainId() const
     {
-        uint256 ret;
-        if(nExtType == EXTDATA_CREATESUBCHAIN)
+        static const uint256 nullId;
+        if(const CCreateSubChainExt* ext = Get<CCreateSubChainExt>())
         {
-            CCreateSubChainExt ext =  boost::any_cast<CCreateSubChainExt>(data);
-            ret = ext.subChainId;
+            return ext->subChainId;
         }
-        else if(nExtType == EXTDATA_BACKUPSUBBLOCK)
+        else if(const CBackupSubBlockExt* ext = Get<CBackupSubBlockExt>())
         {
-            CBackupSubBlockExt ext =  boost::any_cast<CBackupSubBlockExt>(data);
-            ret = ext.subChainId;
+            return ext->subChainId;
         }
-        return ret;
+        return nullId;
     }
 
     uint256 GetPreTxId() const
@@ -131,11 +172,20 @@ public:
 
 };
 
+/** Return the payload of the given type, failing if nExtType and the payload disagree. */
+template<typename T>
+inline const T& GetExtPayload(const CExtData& extdata)
+{
+    const T* ext = extdata.Get<T>();
+    if (!ext)
+        throw std::ios_base::failure("CExtData: payload does not match its type");
+    return *ext;
+}
+
 template<typename Stream>
 inline void SerializeExtData(const CExtData& extdata, Stream& s) 
 {
     uint8_t nExtType = extdata.nExtType;
-    boost::any data = extdata.data;
     s << nExtType;
     if(nExtType == EXTDATA_NO)
     {
@@ -143,21 +193,16 @@ inline void SerializeExtData(const CExtData& extdata, Stream& s)
     }
     else if(nExtType == EXTDATA_GENESISCOINBASE)
     {
-        CGenesisCoinBaseExt ext =  boost::any_cast<CGenesisCoinBaseExt>(data);
-        s << ext;
+        s << GetExtPayload<CGenesisCoinBaseExt>(extdata);
     }
     else if(nExtType == EXTDATA_CREATESUBCHAIN)
     {
-        CCreateSubChainExt ext =  boost::any_cast<CCreateSubChainExt>(data);
-        s << ext;
+        s << GetExtPayload<CCreateSubChainExt>(extdata);
     }
     else if(nExtType == EXTDATA_BACKUPSUBBLOCK)
     {
-        CBackupSubBlockExt ext =  boost::any_cast<CBackupSubBlockExt>(data);
-        s << ext;
+        s << GetExtPayload<CBackupSubBlockExt>(extdata);
     }
-
-    LogPrintf("SerializeExtData%d", nExtType);
 }
 
 template<typename Stream>
@@ -167,28 +212,23 @@ inline void  UnserializeExtData(CExtData& extdata, Stream& s)
     uint8_t nExtType = extdata.nExtType;
     if(nExtType == EXTDATA_NO)
     {
-        return ;
+        extdata.data = CNoExtData();
     }
     else if(nExtType == EXTDATA_GENESISCOINBASE)
     {
-        CGenesisCoinBaseExt ext;
-        s >> ext;
-        extdata.data = ext;
+        extdata.data = CGenesisCoinBaseExt();
+        s >> boost::get<CGenesisCoinBaseExt>(extdata.data);
     }
     else if(nExtType == EXTDATA_CREATESUBCHAIN)
     {
-        CCreateSubChainExt ext;
-        s >> ext;
-        extdata.data = ext;
+        extdata.data = CCreateSubChainExt();
+        s >> boost::get<CCreateSubChainExt>(extdata.data);
     }
     else if(nExtType == EXTDATA_BACKUPSUBBLOCK)
     {
-        CBackupSubBlockExt ext;
-        s >> ext;
-        extdata.data = ext;
+        extdata.data = CBackupSubBlockExt();
+        s >> boost::get<CBackupSubBlockExt>(extdata.data);
     }
-
-    LogPrintf("UnserializeExtData%d", nExtType);
 }
 
 inline UniValue GetValueFromAmount(const CAmount& amount)
@@ -204,7 +244,6 @@ inline void ExtDataToValue(const CExtData& extdata, UniValue& extentry)
 {
     UniValue entry(UniValue::VOBJ);
     uint8_t nExtType = extdata.nExtType;
-    boost::any data = extdata.data;
     extentry.pushKV("type", (uint8_t)nExtType);
     if(nExtType == EXTDATA_NO)
     {
@@ -212,19 +251,19 @@ inline void ExtDataToValue(const CExtData& extdata, UniValue& extentry)
     }
     else if(nExtType == EXTDATA_GENESISCOINBASE)
     {
-        CGenesisCoinBaseExt ext =  boost::any_cast<CGenesisCoinBaseExt>(data);
+        const CGenesisCoinBaseExt& ext = GetExtPayload<CGenesisCoinBaseExt>(extdata);
         entry.pushKV("platformaddress", ext.platformAddress);
         entry.pushKV("initialplatformfee", ext.nInitPlatformFee);
     }
     else if(nExtType == EXTDATA_CREATESUBCHAIN)
     {
-        CCreateSubChainExt ext =  boost::any_cast<CCreateSubChainExt>(data);
+        const CCreateSubChainExt& ext = GetExtPayload<CCreateSubChainExt>(extdata);
         entry.pushKV("subchain-id", ext.subChainId.ToString());
         entry.pushKV("subchain-name", ext.subChainName);
         entry.pushKV("subcoin-name", ext.subCoinName);
         entry.pushKV("subchain-owner", ext.subChainOwner.ToString());
         UniValue seeds(UniValue::VARR);
-        for (std::string str : ext.subChainSeeds)
+        for (const std::string& str : ext.subChainSeeds)
         {
             seeds.push_back(str);
         }
@@ -233,7 +272,7 @@ inline void ExtDataToValue(const CExtData& extdata, UniValue& extentry)
     }
     else if(nExtType == EXTDATA_BACKUPSUBBLOCK)
     {
-        CBackupSubBlockExt ext =  boost::any_cast<CBackupSubBlockExt>(data);
+        const CBackupSubBlockExt& ext = GetExtPayload<CBackupSubBlockExt>(extdata);
         entry.pushKV("subchain-id", ext.subChainId.ToString());
         entry.pushKV("subblock-hash", ext.subBlockHash.ToString());
         entry.pushKV("subblock-height",std::to_string(ext.subBlockHeight));
@@ -242,10 +281,14 @@ inline void ExtDataToValue(const CExtData& extdata, UniValue& extentry)
     extentry.pushKV("data", entry);
 }
 
-inline bool  VerifyExtData(const CExtData& extdata)
+/**
+ * Check the owner signature of extdata. A create is checked against the owner
+ * it names; hashOwner is the owner registered for the subchain, which backups
+ * are checked against, and is null if the subchain is not known.
+ */
+inline bool  VerifyExtData(const CExtData& extdata, const uint256& hashOwner)
 {
     uint8_t nExtType = extdata.nExtType;
-    boost::any data = extdata.data;
     bool ret = false;
     if(nExtType == EXTDATA_NO)
     {
@@ -257,13 +300,13 @@ inline bool  VerifyExtData(const CExtData& extdata)
     }
     else if(nExtType == EXTDATA_CREATESUBCHAIN)
     {
-        CCreateSubChainExt ext =  boost::any_cast<CCreateSubChainExt>(data);
-        ret = ext.Verify();
+        const CCreateSubChainExt* ext = extdata.Get<CCreateSubChainExt>();
+        ret = ext && ext->Verify();
     }
     else if(nExtType == EXTDATA_BACKUPSUBBLOCK)
     {
-        CBackupSubBlockExt ext =  boost::any_cast<CBackupSubBlockExt>(data);
-        ret = ext.Verify();
+        const CBackupSubBlockExt* ext = extdata.Get<CBackupSubBlockExt>();
+        ret = ext && ext->Verify(hashOwner);
     }
 
     return ret ;
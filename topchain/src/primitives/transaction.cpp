@@ -77,11 +77,11 @@ uint256 CTransaction::GetWitnessHash() const
 }
 
 /* For backward compatibility, the hash is initialized to 0. TODO: remove the need for this default constructor entirely. */
-CTransaction::CTransaction() : nVersion(CTransaction::CURRENT_VERSION), vin(), vout(), nLockTime(0), hash(), extData() {}
+CTransaction::CTransaction() : nVersion(CTransaction::CURRENT_VERSION), vin(), vout(), nLockTime(0), extData(), hash(), subChainId() {}
 CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), 
-                                                                                            hash(ComputeHash()),  extData(tx.extData) {}
+                                                                                            extData(tx.extData), hash(ComputeHash()), subChainId(extData.GetSubChainId()) {}
 CTransaction::CTransaction(CMutableTransaction &&tx) : nVersion(tx.nVersion), vin(std::move(tx.vin)), vout(std::move(tx.vout)), nLockTime(tx.nLockTime), 
-                                                                                     hash(ComputeHash()), extData(tx.extData) {}
+                                                                                     extData(std::move(tx.extData)), hash(ComputeHash()), subChainId(extData.GetSubChainId()) {}
 
 CAmount CTransaction::GetValueOut() const
 {
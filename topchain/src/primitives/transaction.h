@@ -288,6 +288,7 @@ public:
 private:
     /** Memory only. */
     const uint256 hash;
+    const uint256 subChainId;
 
     uint256 ComputeHash() const;
 
@@ -317,6 +318,11 @@ public:
         return hash;
     }
 
+    //! Subchain this transaction operates on, null if its extension data names none
+    const uint256& GetSubChainId() const {
+        return subChainId;
+    }
+
     // Compute a hash that includes both transaction and witness data
     uint256 GetWitnessHash() const;
 
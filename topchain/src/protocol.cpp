@@ -5,6 +5,7 @@
 
 #include "protocol.h"
 
+#include "hash.h"
 #include "util.h"
 #include "utilstrencodings.h"
 
@@ -93,6 +94,12 @@ CMessageHeader::CMessageHeader(const MessageStartChars& pchMessageStartIn, const
     memset(pchChecksum, 0, CHECKSUM_SIZE);
 }
 
+CNetMsgPayload::CNetMsgPayload(std::vector<unsigned char>&& dataIn) : data(std::move(dataIn))
+{
+    uint256 hash = Hash(data.data(), data.data() + data.size());
+    memcpy(pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+}
+
 std::string CMessageHeader::GetCommand() const
 {
     return std::string(pchCommand, pchCommand + strnlen(pchCommand, COMMAND_SIZE));
@@ -15,8 +15,10 @@
 #include "uint256.h"
 #include "version.h"
 
+#include <memory>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 /** Message header.
  * (4) message start.
@@ -62,6 +64,21 @@ public:
     uint8_t pchChecksum[CHECKSUM_SIZE];
 };
 
+/**
+ * Serialized message payload together with its header checksum. It is
+ * immutable, so one instance can be queued to any number of peers without
+ * copying or hashing the payload again.
+ */
+class CNetMsgPayload
+{
+public:
+    const std::vector<unsigned char> data;
+    uint8_t pchChecksum[CMessageHeader::CHECKSUM_SIZE];
+
+    explicit CNetMsgPayload(std::vector<unsigned char>&& dataIn);
+};
+typedef std::shared_ptr<const CNetMsgPayload> CNetMsgPayloadRef;
+
 /**
  * Bitcoin protocol message types. When adding new message types, don't forget
  * to update allNetMessageTypes in protocol.cpp.
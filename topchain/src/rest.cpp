@@ -5,6 +5,7 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "chainsnapshot.h"
 #include "core_io.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
@@ -143,18 +144,15 @@ static bool rest_headers(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    CChainSnapshotRef chain = GetChainSnapshot();
     std::vector<const CBlockIndex *> headers;
     headers.reserve(count);
-    {
-        LOCK(cs_main);
-        BlockMap::const_iterator it = mapBlockIndex.find(hash);
-        const CBlockIndex *pindex = (it != mapBlockIndex.end()) ? it->second : nullptr;
-        while (pindex != nullptr && chainActive.Contains(pindex)) {
-            headers.push_back(pindex);
-            if (headers.size() == (unsigned long)count)
-                break;
-            pindex = chainActive.Next(pindex);
-        }
+    const CBlockIndex *pindex = blockIndexLookup.Find(hash);
+    while (pindex != nullptr && chain->Contains(pindex)) {
+        headers.push_back(pindex);
+        if (headers.size() == (unsigned long)count)
+            break;
+        pindex = chain->Next(pindex);
     }
 
     CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
@@ -179,7 +177,7 @@ static bool rest_headers(HTTPRequest* req,
     case RF_JSON: {
         UniValue jsonHeaders(UniValue::VARR);
         for (const CBlockIndex *pindex : headers) {
-            jsonHeaders.push_back(blockheaderToJSON(pindex));
+            jsonHeaders.push_back(blockheaderToJSON(pindex, *chain));
         }
         std::string strJSON = jsonHeaders.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
@@ -208,26 +206,48 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
-    CBlockIndex* pblockindex = nullptr;
-    {
-        LOCK(cs_main);
-        if (mapBlockIndex.count(hash) == 0)
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+    CChainSnapshotRef chain = GetChainSnapshot();
+    const CBlockIndex* pblockindex = blockIndexLookup.Find(hash);
+    if (!pblockindex)
+        return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
 
-        pblockindex = mapBlockIndex[hash];
-        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+    CDiskBlockPos pos;
+    bool fPruned;
+    if (!GetBlockPos(pblockindex, *chain, pos, fPruned)) {
+        if (fPruned)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
-
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
+    // Blocks are stored on disk in their network serialization with witnesses,
+    // so unless witnesses have to be stripped the binary and hex formats are
+    // served from the stored bytes without deserializing the block
+    const bool fRawBlock = RPCSerializationFlags() == 0;
 
     switch (rf) {
     case RF_BINARY: {
+        if (fRawBlock) {
+            unsigned int nSize;
+            CAutoFile filein(OpenRawBlockFile(pos, Params().MessageStart(), nSize), SER_DISK, CLIENT_VERSION);
+            CBlockHeader header;
+            try {
+                if (!filein.IsNull())
+                    filein >> header;
+            } catch (const std::exception&) {
+                header.SetNull();
+            }
+            if (filein.IsNull() || header.GetHash() != hash)
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReplyFile(HTTP_OK, filein.Get(), pos.nPos, nSize);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pos, Params().GetConsensus()) || block.GetHash() != hash)
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+        ssBlock << block;
         std::string binaryBlock = ssBlock.str();
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
@@ -235,14 +255,30 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_HEX: {
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        std::string strHex;
+        if (fRawBlock) {
+            std::vector<uint8_t> vBlock;
+            if (!ReadRawBlockFromDisk(vBlock, pos, hash, Params().MessageStart()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+            strHex = HexStr(vBlock.begin(), vBlock.end()) + "\n";
+        } else {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pos, Params().GetConsensus()) || block.GetHash() != hash)
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+            ssBlock << block;
+            strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        }
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pos, Params().GetConsensus()) || block.GetHash() != hash)
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        UniValue objBlock = blockToJSON(block, pblockindex, *chain, showTxDetails);
         std::string strJSON = objBlock.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strJSON);
@@ -499,8 +535,11 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     std::string bitmapStringRepresentation;
     std::vector<bool> hits;
     bitmap.resize((vOutPoints.size() + 7) / 8);
+    CChainSnapshotRef chain;
     {
         LOCK2(cs_main, mempool.cs);
+        // The tip the coins were read at, for reporting after the locks are released
+        chain = GetChainSnapshot();
 
         CCoinsView viewDummy;
         CCoinsViewCache view(&viewDummy);
@@ -530,7 +569,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         // serialize data
         // use exact same output as mentioned in Bip64
         CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
-        ssGetUTXOResponse << chainActive.Height() << chainActive.Tip()->GetBlockHash() << bitmap << outs;
+        ssGetUTXOResponse << chain->Height() << chain->Tip()->GetBlockHash() << bitmap << outs;
         std::string ssGetUTXOResponseString = ssGetUTXOResponse.str();
 
         req->WriteHeader("Content-Type", "application/octet-stream");
@@ -540,7 +579,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 
     case RF_HEX: {
         CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
-        ssGetUTXOResponse << chainActive.Height() << chainActive.Tip()->GetBlockHash() << bitmap << outs;
+        ssGetUTXOResponse << chain->Height() << chain->Tip()->GetBlockHash() << bitmap << outs;
         std::string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
 
         req->WriteHeader("Content-Type", "text/plain");
@@ -553,8 +592,8 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 
         // pack in some essentials
         // use more or less the same output as mentioned in Bip64
-        objGetUTXOResponse.push_back(Pair("chainHeight", chainActive.Height()));
-        objGetUTXOResponse.push_back(Pair("chaintipHash", chainActive.Tip()->GetBlockHash().GetHex()));
+        objGetUTXOResponse.push_back(Pair("chainHeight", chain->Height()));
+        objGetUTXOResponse.push_back(Pair("chaintipHash", chain->Tip()->GetBlockHash().GetHex()));
         objGetUTXOResponse.push_back(Pair("bitmap", bitmapStringRepresentation));
 
         UniValue utxos(UniValue::VARR);
@@ -8,6 +8,7 @@
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "chainsnapshot.h"
 #include "checkpoints.h"
 #include "coins.h"
 #include "consensus/validation.h"
@@ -75,14 +76,14 @@ double GetDifficulty(const CBlockIndex* blockindex)
     return dDiff;
 }
 
-UniValue blockheaderToJSON(const CBlockIndex* blockindex)
+UniValue blockheaderToJSON(const CBlockIndex* blockindex, const CChainSnapshot& chain)
 {
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (chain.Contains(blockindex))
+        confirmations = chain.Height() - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", blockindex->nVersion));
@@ -97,20 +98,20 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    const CBlockIndex *pnext = chain.Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, const CChainSnapshot& chain, bool txDetails)
 {
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (chain.Contains(blockindex))
+        confirmations = chain.Height() - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("strippedsize", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS)));
     result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
@@ -141,7 +142,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    const CBlockIndex *pnext = chain.Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
@@ -160,8 +161,7 @@ UniValue getblockcount(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainSnapshot()->Height();
 }
 
 UniValue getbestblockhash(const JSONRPCRequest& request)
@@ -177,8 +177,7 @@ UniValue getbestblockhash(const JSONRPCRequest& request)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainSnapshot()->Tip()->GetBlockHash().GetHex();
 }
 
 void RPCNotifyBlockChange(bool ibd, const CBlockIndex * pindex)
@@ -616,13 +615,13 @@ UniValue getblockhash(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
+    CChainSnapshotRef chain = GetChainSnapshot();
 
     int nHeight = request.params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (nHeight < 0 || nHeight > chain->Height())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    const CBlockIndex* pblockindex = (*chain)[nHeight];
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -660,7 +659,7 @@ UniValue getblockheader(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
+    CChainSnapshotRef chain = GetChainSnapshot();
 
     std::string strHash = request.params[0].get_str();
     uint256 hash(uint256S(strHash));
@@ -669,11 +668,10 @@ UniValue getblockheader(const JSONRPCRequest& request)
     if (!request.params[1].isNull())
         fVerbose = request.params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
+    const CBlockIndex* pblockindex = blockIndexLookup.Find(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -682,7 +680,7 @@ UniValue getblockheader(const JSONRPCRequest& request)
         return strHex;
     }
 
-    return blockheaderToJSON(pblockindex);
+    return blockheaderToJSON(pblockindex, *chain);
 }
 
 UniValue getblock(const JSONRPCRequest& request)
@@ -735,7 +733,7 @@ UniValue getblock(const JSONRPCRequest& request)
             + HelpExampleRpc("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
+    CChainSnapshotRef chain = GetChainSnapshot();
 
     std::string strHash = request.params[0].get_str();
     uint256 hash(uint256S(strHash));
@@ -748,22 +746,30 @@ UniValue getblock(const JSONRPCRequest& request)
             verbosity = request.params[1].get_bool() ? 1 : 0;
     }
 
-    if (mapBlockIndex.count(hash) == 0)
+    const CBlockIndex* pblockindex = blockIndexLookup.Find(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
+    // Blocks are stored in their network serialization with witnesses, so
+    // unless those have to be stripped the hex is made from the stored bytes
+    const bool fRawBlock = verbosity <= 0 && RPCSerializationFlags() == 0;
+    std::vector<uint8_t> vBlock;
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
-
-    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    bool fPruned;
+    if (fRawBlock ? !ReadRawBlockFromDisk(vBlock, pblockindex, *chain, Params().MessageStart(), fPruned) :
+                    !ReadBlockFromDisk(block, pblockindex, *chain, Params().GetConsensus(), fPruned)) {
+        if (fPruned)
+            throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
         // Block not found on disk. This could be because we have the block
         // header in our index but don't have the block (for example if a
         // non-whitelisted node sends us an unrequested long chain of valid
         // blocks, we add the headers to our index, but don't accept the
         // block).
         throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
+    }
+
+    if (fRawBlock)
+        return HexStr(vBlock.begin(), vBlock.end());
 
     if (verbosity <= 0)
     {
@@ -773,7 +779,7 @@ UniValue getblock(const JSONRPCRequest& request)
         return strHex;
     }
 
-    return blockToJSON(block, pblockindex, verbosity >= 2);
+    return blockToJSON(block, pblockindex, *chain, verbosity >= 2);
 }
 
 struct CCoinsStats
@@ -1201,58 +1207,83 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
     return obj;
 }
 
+static UniValue subChainMetaEntryToJSON(const CSubChainMetaMemPoolEntry& entry)
+{
+    UniValue info(UniValue::VOBJ);
+    info.push_back(Pair("subchainid",    entry.GetSubChainId().ToString()));
+    info.push_back(Pair("txid",          entry.GetTxId().ToString()));
+    info.push_back(Pair("optype",        entry.GetOpType()));
+    info.push_back(Pair("time",          entry.GetTime()));
+    info.push_back(Pair("height",        (int64_t)entry.GetHeight()));
+
+    UniValue extdata(UniValue::VOBJ);
+    ExtDataToValue(entry.GetExtData(), extdata);
+    info.push_back(Pair("extdata",    extdata));
+    return info;
+}
+
+UniValue subChainMetaInfoToJSON(const CSubChainMetaMemPool& pool, const uint256& subchainid, size_t nStart, size_t nCount, bool fLatestOnly)
+{
+    UniValue obj(UniValue::VOBJ);
+    UniValue metainfoes(UniValue::VARR);
+    if (fLatestOnly) {
+        pool.VisitLatestSubChainOp(subchainid, [&metainfoes](const CSubChainMetaMemPoolEntry& entry) {
+            metainfoes.push_back(subChainMetaEntryToJSON(entry));
+            return true;
+        });
+    } else {
+        size_t nTotal = pool.ForEachSubChainOp(subchainid, nStart, [&metainfoes, nCount](const CSubChainMetaMemPoolEntry& entry) {
+            if (metainfoes.size() >= nCount)
+                return false;
+            metainfoes.push_back(subChainMetaEntryToJSON(entry));
+            return true;
+        });
+        obj.push_back(Pair("total", (uint64_t)nTotal));
+    }
+    obj.push_back(Pair("metainfo",  metainfoes));
+    return obj;
+}
+
 UniValue getsubchainmetainfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 1)
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 4)
         throw std::runtime_error(
-            "getsubchainmetainfo\n"
-            "Returns an object containing various state info regarding blockchain processing.\n"
+            "getsubchainmetainfo \"subchainid\" ( skip count latest )\n"
+            "\nReturns the metadata operations recorded for a subchain, oldest first.\n"
+            "Operations are numbered from the create. After a restart only the create and the latest\n"
+            "operation of a subchain are known, and skip counts operation numbers.\n"
+            "\nArguments:\n"
+            "1. \"subchainid\"    (string, required) The subchain id\n"
+            "2. skip            (numeric, optional, default=0) Number of operations to skip\n"
+            "3. count           (numeric, optional) Maximum number of operations to return, all if omitted\n"
+            "4. latest          (boolean, optional, default=false) Only return the latest operation; skip and count are ignored\n"
             "\nResult:\n"
             "{\n"
-            "  \"softforks\": [            (array) status of softforks in progress\n"
+            "  \"total\": n,               (numeric) Number of operations on the subchain (omitted with latest)\n"
+            "  \"metainfo\": [\n"
             "     {\n"
-            "        \"reject\": {            (object) progress toward rejecting pre-softfork blocks\n"
-            "           \"status\": xx,       (boolean) true if threshold reached\n"
-            "        },\n"
+            "        \"subchainid\": \"xxxx\", (string) The subchain id\n"
+            "        \"txid\": \"xxxx\",       (string) The transaction id of the operation\n"
+            "        \"optype\": n,           (numeric) The extension data type of the operation\n"
+            "        \"time\": n,             (numeric) Local time the operation entered the pool\n"
+            "        \"height\": n,           (numeric) Block height the operation entered the pool at\n"
+            "        \"extdata\": {...}       (object) The extension data\n"
             "     }, ...\n"
-            "  ],\n"
-            "  \"bip9_softforks\": {          (object) status of BIP9 softforks in progress\n"
-            "     \"xxxx\" : {                (string) name of the softfork\n"
-            "        \"statistics\": {        (object) numeric statistics about BIP9 signalling for a softfork (only for \"started\" status)\n"
-            "           \"possible\": xx      (boolean) returns false if there are not enough blocks left in this period to pass activation threshold \n"
-            "        }\n"
-            "     }\n"
-            "  }\n"
+            "  ]\n"
             "}\n"
             "\nExamples:\n"
-            + HelpExampleCli("getblockchaininfo", "")
-            + HelpExampleRpc("getblockchaininfo", "")
+            + HelpExampleCli("getsubchainmetainfo", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" 0 10")
+            + HelpExampleRpc("getsubchainmetainfo", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", 0, 10")
         );
 
-    LOCK(cs_main);
-    std::string strHash = request.params[0].get_str();
-    uint256 subchainid(uint256S(strHash));
+    uint256 subchainid(ParseHashV(request.params[0], "subchainid"));
+    int64_t nStart = request.params.size() > 1 && !request.params[1].isNull() ? request.params[1].get_int64() : 0;
+    int64_t nCount = request.params.size() > 2 && !request.params[2].isNull() ? request.params[2].get_int64() : std::numeric_limits<int64_t>::max();
+    bool fLatestOnly = request.params.size() > 3 && !request.params[3].isNull() && request.params[3].get_bool();
+    if (nStart < 0 || nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid skip or count");
 
-    UniValue obj(UniValue::VOBJ);
-    UniValue metainfoes(UniValue::VARR);
-    std::vector<CSubChainMetaMemPoolEntry> vec(subchainmempool.GetEntryBySubChainId(subchainid));
-    for(CSubChainMetaMemPoolEntry entry : vec)
-    {
-        UniValue info(UniValue::VOBJ);
-        info.push_back(Pair("subchainid",    entry.GetSubChainId().ToString()));
-        info.push_back(Pair("txid",             entry.GetTx().GetHash().ToString()));
-        info.push_back(Pair("optype",        entry.GetOpType()));
-        info.push_back(Pair("time",            entry.GetTime()));
-        info.push_back(Pair("GetHeight",    entry.GetTime()));
-
-        UniValue extdata(UniValue::VOBJ);
-        ExtDataToValue(entry.GetTx().extData, extdata);
-        info.push_back(Pair("extdata",    extdata));
-
-        metainfoes.push_back(info);
-    }
-    obj.push_back(Pair("metainfo",  metainfoes));
-    return obj;
+    return subChainMetaInfoToJSON(subchainmempool, subchainid, nStart, nCount, fLatestOnly);
 }
 
 /** Comparison function for sorting the getchaintips heads.  */
@@ -1590,7 +1621,7 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafe argNames
   //  --------------------- ------------------------  -----------------------  ------ ----------
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,  {} },
-    { "blockchain",         "getsubchainmetainfo",      &getsubchainmetainfo,      true,  {} },
+    { "blockchain",         "getsubchainmetainfo",    &getsubchainmetainfo,    true,  {"subchainid","skip","count","latest"} },
     { "blockchain",         "getchaintxstats",        &getchaintxstats,        true,  {"nblocks", "blockhash"} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  {} },
     { "blockchain",         "getblockcount",          &getblockcount,          true,  {} },
@@ -5,9 +5,14 @@
 #ifndef BITCOIN_RPC_BLOCKCHAIN_H
 #define BITCOIN_RPC_BLOCKCHAIN_H
 
+#include <stddef.h>
+
 class CBlock;
 class CBlockIndex;
+class CChainSnapshot;
+class CSubChainMetaMemPool;
 class UniValue;
+class uint256;
 
 /**
  * Get the difficulty of the net wrt to the given block index, or the chain tip if
@@ -21,17 +26,20 @@ double GetDifficulty(const CBlockIndex* blockindex = nullptr);
 /** Callback for when block tip changed. */
 void RPCNotifyBlockChange(bool ibd, const CBlockIndex *);
 
-/** Block description to JSON */
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+/** Block description to JSON, with confirmations and next block taken from chain */
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, const CChainSnapshot& chain, bool txDetails = false);
 
 /** Mempool information to JSON */
 UniValue mempoolInfoToJSON();
 
+/** Operations of one subchain in the subchain meta pool to JSON */
+UniValue subChainMetaInfoToJSON(const CSubChainMetaMemPool& pool, const uint256& subchainid, size_t nStart, size_t nCount, bool fLatestOnly);
+
 /** Mempool to JSON */
 UniValue mempoolToJSON(bool fVerbose = false);
 
-/** Block header to JSON */
-UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+/** Block header to JSON, with confirmations and next block taken from chain */
+UniValue blockheaderToJSON(const CBlockIndex* blockindex, const CChainSnapshot& chain);
 
 #endif
 
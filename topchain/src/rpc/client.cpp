@@ -125,6 +125,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "setnetworkactive", 0, "state" },
     { "getmempoolancestors", 1, "verbose" },
     { "getmempooldescendants", 1, "verbose" },
+    { "getsubchainmetainfo", 1, "skip" },
+    { "getsubchainmetainfo", 2, "count" },
+    { "getsubchainmetainfo", 3, "latest" },
     { "bumpfee", 1, "options" },
     { "logging", 0, "include" },
     { "logging", 1, "exclude" },
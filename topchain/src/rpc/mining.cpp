@@ -203,6 +203,10 @@ UniValue getmininginfo(const JSONRPCRequest& request)
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
+            "  \"templates\": n,             (numeric) The number of block templates created\n"
+            "  \"templatesreused\": n,       (numeric) How many of them reused a transaction selection made ahead of time\n"
+            "  \"templatelatency\": x.xxx,   (numeric) Time taken to create the last block template, in milliseconds\n"
+            "  \"avgtemplatelatency\": x.xxx, (numeric) Average time taken to create a block template, in milliseconds\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmininginfo", "")
@@ -221,6 +225,11 @@ UniValue getmininginfo(const JSONRPCRequest& request)
     obj.push_back(Pair("networkhashps",    getnetworkhashps(request)));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
+    BlockTemplateStats templateStats = blocktemplateengine.GetStats();
+    obj.push_back(Pair("templates",        templateStats.nTemplates));
+    obj.push_back(Pair("templatesreused",  templateStats.nReused));
+    obj.push_back(Pair("templatelatency",  0.001 * templateStats.nLastMicros));
+    obj.push_back(Pair("avgtemplatelatency", templateStats.nTemplates ? 0.001 * templateStats.nTotalMicros / templateStats.nTemplates : 0.0));
     return obj;
 }
 
@@ -519,8 +528,10 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         fLastTemplateSupportsSegwit = fSupportsSegwit;
 
         // Create new block
+        // Templates here are reused for seconds already, so a selection the
+        // template engine made just before the latest mempool changes is fine.
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit, true);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
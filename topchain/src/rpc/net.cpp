@@ -13,6 +13,7 @@
 #include "netbase.h"
 #include "policy/policy.h"
 #include "protocol.h"
+#include "subblockcache.h"
 #include "sync.h"
 #include "timedata.h"
 #include "ui_interface.h"
@@ -228,6 +229,9 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       ...\n"
             "    ],\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"subblockinvsent\": n,      (numeric) Subblock invs announced to the peer\n"
+            "    \"subblockinvknown\": n,     (numeric) Subblock announcements skipped because the peer already had the subblock\n"
+            "    \"subblocksserved\": n,      (numeric) Subblocks sent to the peer in response to getdata\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
             "       ...\n"
@@ -295,6 +299,9 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("subblockinvsent", stats.nSubBlockInvSent));
+        obj.push_back(Pair("subblockinvknown", stats.nSubBlockInvKnown));
+        obj.push_back(Pair("subblocksserved", stats.nSubBlocksServed));
 
         UniValue sendPerMsgCmd(UniValue::VOBJ);
         for (const mapMsgCmdSize::value_type &i : stats.mapSendBytesPerMsgCmd) {
@@ -516,6 +523,39 @@ UniValue getnettotals(const JSONRPCRequest& request)
     return obj;
 }
 
+UniValue getsubblockcacheinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+            "getsubblockcacheinfo\n"
+            "\nReturns information about the cache of subblock messages served to peers.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"size\": xxxxx,      (numeric) Number of cached subblocks\n"
+            "  \"usage\": xxxxx,     (numeric) Memory used by the cache in bytes\n"
+            "  \"maxusage\": xxxxx,  (numeric) Maximum memory used by the cache in bytes\n"
+            "  \"hits\": xxxxx,      (numeric) Subblock requests answered from the cache\n"
+            "  \"misses\": xxxxx,    (numeric) Subblock requests that had to be read from disk\n"
+            "  \"hitrate\": x.xxx    (numeric) Fraction of subblock requests answered from the cache\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsubblockcacheinfo", "")
+            + HelpExampleRpc("getsubblockcacheinfo", "")
+       );
+
+    SubBlockCacheStats stats = subblockmsgcache.GetStats();
+    uint64_t nRequests = stats.nHits + stats.nMisses;
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("size", (uint64_t)stats.nEntries));
+    obj.push_back(Pair("usage", (uint64_t)stats.nUsage));
+    obj.push_back(Pair("maxusage", (uint64_t)stats.nMaxUsage));
+    obj.push_back(Pair("hits", stats.nHits));
+    obj.push_back(Pair("misses", stats.nMisses));
+    obj.push_back(Pair("hitrate", nRequests ? (double)stats.nHits / nRequests : 0.0));
+    return obj;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -759,6 +799,7 @@ static const CRPCCommand commands[] =
     { "network",            "disconnectnode",         &disconnectnode,         true,  {"address", "nodeid"} },
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,  {"node"} },
     { "network",            "getnettotals",           &getnettotals,           true,  {} },
+    { "network",            "getsubblockcacheinfo",   &getsubblockcacheinfo,   true,  {} },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true,  {} },
     { "network",            "setban",                 &setban,                 true,  {"subnet", "command", "bantime", "absolute"} },
     { "network",            "listbanned",             &listbanned,             true,  {} },
@@ -7,6 +7,7 @@
 
 #include "base58.h"
 #include "fs.h"
+#include "httpserver.h"
 #include "init.h"
 #include "random.h"
 #include "sync.h"
@@ -263,6 +264,59 @@ UniValue uptime(const JSONRPCRequest& jsonRequest)
     return GetTime() - GetStartupTime();
 }
 
+UniValue getrpcinfo(const JSONRPCRequest& jsonRequest)
+{
+    if (jsonRequest.fHelp || jsonRequest.params.size() > 0)
+        throw std::runtime_error(
+                "getrpcinfo\n"
+                        "\nReturns statistics of the queue of HTTP requests waiting for a worker thread.\n"
+                        "\nResult:\n"
+                        "{\n"
+                        "  \"workers\": xxxxx,           (numeric) The number of worker threads\n"
+                        "  \"depth\": xxxxx,             (numeric) The maximum number of queued requests (-rpcworkqueue)\n"
+                        "  \"classes\": [               (array) Statistics per priority class, highest first\n"
+                        "    {\n"
+                        "      \"name\": \"xxxx\",          (string) The priority class\n"
+                        "      \"queued\": xxxxx,        (numeric) Requests currently queued\n"
+                        "      \"requests\": xxxxx,      (numeric) Requests received since startup\n"
+                        "      \"rejected\": xxxxx,      (numeric) Requests rejected because the queue was full\n"
+                        "      \"stolen\": xxxxx,        (numeric) Requests run by another worker than the one they were queued to\n"
+                        "      \"latency\": [ n, ... ]   (array) Number of requests by time spent in the queue: entry i counts those that\n"
+                        "                                waited less than 2^i microseconds, the last one also those that waited longer\n"
+                        "    }, ...\n"
+                        "  ]\n"
+                        "}\n"
+                        "\nExamples:\n"
+                + HelpExampleCli("getrpcinfo", "")
+                + HelpExampleRpc("getrpcinfo", "")
+        );
+
+    int nWorkers, nMaxDepth;
+    std::vector<HTTPQueueStats> stats;
+    if (!GetHTTPQueueStats(nWorkers, nMaxDepth, stats))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "HTTP server not running");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("workers", nWorkers));
+    ret.push_back(Pair("depth", nMaxDepth));
+    UniValue classes(UniValue::VARR);
+    for (size_t i = 0; i < stats.size(); i++) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("name", HTTPPriorityName((HTTPPriority)i)));
+        entry.push_back(Pair("queued", stats[i].nQueued));
+        entry.push_back(Pair("requests", stats[i].nRequests));
+        entry.push_back(Pair("rejected", stats[i].nRejected));
+        entry.push_back(Pair("stolen", stats[i].nStolen));
+        UniValue latency(UniValue::VARR);
+        for (uint64_t nCount : stats[i].vLatency)
+            latency.push_back(nCount);
+        entry.push_back(Pair("latency", latency));
+        classes.push_back(entry);
+    }
+    ret.push_back(Pair("classes", classes));
+    return ret;
+}
+
 /**
  * Call Table
  */
@@ -273,6 +327,7 @@ static const CRPCCommand vRPCCommands[] =
     { "control",            "help",                   &help,                   true,  {"command"}  },
     { "control",            "stop",                   &stop,                   true,  {}  },
     { "control",            "uptime",                 &uptime,                 true,  {}  },
+    { "control",            "getrpcinfo",             &getrpcinfo,             true,  {}  },
 };
 
 CRPCTable::CRPCTable()
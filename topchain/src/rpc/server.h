@@ -46,8 +46,11 @@ public:
     bool fHelp;
     std::string URI;
     std::string authUser;
+    //! Sent to the binary endpoint: params[0] holds the raw request body, and
+    //! a string result goes back as raw bytes
+    bool fBinary;
 
-    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false) {}
+    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false), fBinary(false) {}
     void parse(const UniValue& valRequest);
 };
 
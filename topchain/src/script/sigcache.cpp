@@ -6,6 +6,7 @@
 #include "sigcache.h"
 
 #include "memusage.h"
+#include "primitives/transaction.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
@@ -66,6 +67,52 @@ public:
  * signatureCache could be made local to VerifySignature.
 */
 static CSignatureCache signatureCache;
+
+/**
+ * Valid subchain owner signatures, keyed by the transaction that carries them
+ * and the owner they were checked against. The txid commits to the whole
+ * extension data including the signature.
+ */
+class CExtDataSignatureCache
+{
+private:
+     //! Entries are SHA256(nonce || txid || owner):
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_extsigcache;
+
+public:
+    CExtDataSignatureCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void
+    ComputeEntry(uint256& entry, const uint256 &txid, const uint256 &hashOwner)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(txid.begin(), 32).Write(hashOwner.begin(), 32).Finalize(entry.begin());
+    }
+
+    bool
+    Get(const uint256& entry, const bool erase)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_extsigcache);
+        return setValid.contains(entry, erase);
+    }
+
+    void Set(uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_extsigcache);
+        setValid.insert(entry);
+    }
+    uint32_t setup_bytes(size_t n)
+    {
+        return setValid.setup_bytes(n);
+    }
+};
+
+static CExtDataSignatureCache extDataSignatureCache;
 } // namespace
 
 // To be called once in AppInitMain/BasicTestingSetup to initialize the
@@ -92,3 +139,26 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
         signatureCache.Set(entry);
     return true;
 }
+
+// To be called once in AppInitMain/BasicTestingSetup to initialize the
+// extDataSignatureCache. It gets an eighth of the signature cache budget.
+void InitExtDataSignatureCache()
+{
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 8), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = extDataSignatureCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB for subchain signature cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nElems);
+}
+
+bool CachingVerifyExtData(const CTransaction& tx, const uint256& hashOwner, bool store)
+{
+    uint256 entry;
+    extDataSignatureCache.ComputeEntry(entry, tx.GetHash(), hashOwner);
+    if (extDataSignatureCache.Get(entry, !store))
+        return true;
+    if (!VerifyExtData(tx.extData, hashOwner))
+        return false;
+    if (store)
+        extDataSignatureCache.Set(entry);
+    return true;
+}
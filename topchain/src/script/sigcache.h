@@ -18,6 +18,7 @@ static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
 static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
+class CTransaction;
 
 /**
  * We're hashing a nonce into the entries themselves, so we don't need extra
@@ -53,4 +54,14 @@ public:
 
 void InitSignatureCache();
 
+/**
+ * Verify the subchain owner signature in tx's extension data against
+ * hashOwner, as VerifyExtData does. Valid results are remembered by txid and
+ * owner, so a transaction checked at mempool acceptance is not checked again
+ * when its block connects.
+ */
+bool CachingVerifyExtData(const CTransaction& tx, const uint256& hashOwner, bool store);
+
+void InitExtDataSignatureCache();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
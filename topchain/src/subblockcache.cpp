@@ -0,0 +1,82 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "subblockcache.h"
+
+#include "prevector.h"
+#include "memusage.h"
+
+CSubBlockMsgCache subblockmsgcache(DEFAULT_SUBBLOCK_CACHE_SIZE << 20);
+
+CSubBlockMsgCache::CSubBlockMsgCache(size_t nMaxUsageIn) :
+    nUsage(0), nMaxUsage(nMaxUsageIn), nHits(0), nMisses(0)
+{
+}
+
+void CSubBlockMsgCache::Trim()
+{
+    AssertLockHeld(cs);
+    while (nUsage > nMaxUsage && !lru.empty()) {
+        const Entry& entry = lru.back();
+        nUsage -= entry.nUsage;
+        mapEntries.erase(entry.hash);
+        lru.pop_back();
+    }
+}
+
+CSubBlockMsgCache::DataRef CSubBlockMsgCache::Get(const uint256& hash)
+{
+    LOCK(cs);
+    auto it = mapEntries.find(hash);
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return nullptr;
+    }
+    nHits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->data;
+}
+
+void CSubBlockMsgCache::Insert(const uint256& hash, const DataRef& data)
+{
+    // List node, hash table node and bucket, plus the shared message buffer
+    size_t nEntryUsage = memusage::MallocUsage(sizeof(Entry) + 2 * sizeof(void*)) +
+                         memusage::MallocUsage(sizeof(std::pair<const uint256, EntryList::iterator>) + sizeof(void*)) + sizeof(void*) +
+                         memusage::DynamicUsage(data) + memusage::DynamicUsage(data->data);
+
+    LOCK(cs);
+    if (nEntryUsage > nMaxUsage || mapEntries.count(hash))
+        return;
+    lru.push_front(Entry{hash, data, nEntryUsage});
+    mapEntries.emplace(hash, lru.begin());
+    nUsage += nEntryUsage;
+    Trim();
+}
+
+void CSubBlockMsgCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Trim();
+}
+
+void CSubBlockMsgCache::Clear()
+{
+    LOCK(cs);
+    lru.clear();
+    mapEntries.clear();
+    nUsage = 0;
+}
+
+SubBlockCacheStats CSubBlockMsgCache::GetStats() const
+{
+    LOCK(cs);
+    SubBlockCacheStats stats;
+    stats.nEntries = mapEntries.size();
+    stats.nUsage = nUsage;
+    stats.nMaxUsage = nMaxUsage;
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    return stats;
+}
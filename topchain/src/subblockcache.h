@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUBBLOCKCACHE_H
+#define BITCOIN_SUBBLOCKCACHE_H
+
+#include "protocol.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <memory>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+/** Default for -subblockcachesize, maximum memory used by served subblock messages in MiB */
+static const unsigned int DEFAULT_SUBBLOCK_CACHE_SIZE = 32;
+
+struct SubBlockCacheStats
+{
+    size_t nEntries;
+    size_t nUsage;
+    size_t nMaxUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+};
+
+/**
+ * Bounded LRU cache of serialized subblock messages, keyed by subblock hash.
+ *
+ * When a newly published subblock is fetched by every peer, the serialized
+ * message is produced once and later getdata requests are answered from
+ * memory, without ReadSubBlockFromDisk and without serializing it again.
+ * The payload is shared with the peers' send queues, not copied into them.
+ * Entries are evicted least recently used first once the accounted memory
+ * exceeds the configured maximum.
+ */
+class CSubBlockMsgCache
+{
+public:
+    typedef CNetMsgPayloadRef DataRef;
+
+private:
+    struct Entry
+    {
+        uint256 hash;
+        DataRef data;
+        size_t nUsage;
+    };
+    typedef std::list<Entry> EntryList;
+
+    struct HashHasher
+    {
+        size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+    };
+
+    mutable CCriticalSection cs;
+    //! Most recently used first
+    EntryList lru;
+    std::unordered_map<uint256, EntryList::iterator, HashHasher> mapEntries;
+    size_t nUsage;
+    size_t nMaxUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Trim();
+
+public:
+    explicit CSubBlockMsgCache(size_t nMaxUsageIn);
+
+    /** Return the cached message for hash and mark it most recently used, or nullptr */
+    DataRef Get(const uint256& hash);
+    /** Add a serialized subblock message, evicting older entries to stay within the limit */
+    void Insert(const uint256& hash, const DataRef& data);
+    /** Change the memory limit, evicting entries if needed */
+    void SetMaxUsage(size_t nMaxUsageIn);
+    void Clear();
+    SubBlockCacheStats GetStats() const;
+};
+
+/** Serialized subblock messages recently sent to peers */
+extern CSubBlockMsgCache subblockmsgcache;
+
+#endif // BITCOIN_SUBBLOCKCACHE_H
@@ -0,0 +1,339 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "subblockcompress.h"
+
+#include "clientversion.h"
+#include "consensus/consensus.h"
+#include "crypto/common.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <string.h>
+
+CSubBlockCompressor subblockcompressor;
+CSubBlockDictCache subblockdictcache;
+
+namespace {
+
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_OFFSET = 65535;
+//! As in LZ4, the last match starts at least 12 bytes before the end, and
+//! the last 5 bytes are always literals
+const size_t LZ_MF_LIMIT = 12;
+const size_t LZ_LAST_LITERALS = 5;
+const int LZ_HASH_BITS = 16;
+
+//! Substring length that dictionary training counts recurrences of
+const size_t DICT_DMER_SIZE = 8;
+//! Length of the segments a dictionary is made of
+const size_t DICT_SEGMENT_SIZE = 256;
+const int DICT_HASH_BITS = 18;
+
+inline uint32_t LZHash(uint32_t nSeq)
+{
+    return (nSeq * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+inline uint32_t DmerHash(const unsigned char* p)
+{
+    return (ReadLE64(p) * 0x9E3779B97F4A7C15ULL) >> (64 - DICT_HASH_BITS);
+}
+
+void WriteLength(std::vector<unsigned char>& vOut, size_t nLen)
+{
+    while (nLen >= 255) {
+        vOut.push_back(255);
+        nLen -= 255;
+    }
+    vOut.push_back(nLen);
+}
+
+bool ReadLength(const unsigned char* pSrc, size_t nSrcSize, size_t& nPos, size_t& nLen)
+{
+    unsigned char ch;
+    do {
+        if (nPos >= nSrcSize)
+            return false;
+        ch = pSrc[nPos++];
+        nLen += ch;
+    } while (ch == 255);
+    return true;
+}
+
+/** Append a run of literals followed by a match; nMatchLen == 0 ends the block */
+void WriteSequence(std::vector<unsigned char>& vOut, const unsigned char* pLiterals, size_t nLiterals, size_t nMatchLen, size_t nOffset)
+{
+    const size_t nMatchCode = nMatchLen ? nMatchLen - LZ_MIN_MATCH : 0;
+    vOut.push_back((std::min<size_t>(nLiterals, 15) << 4) | std::min<size_t>(nMatchCode, 15));
+    if (nLiterals >= 15)
+        WriteLength(vOut, nLiterals - 15);
+    vOut.insert(vOut.end(), pLiterals, pLiterals + nLiterals);
+    if (!nMatchLen)
+        return;
+    vOut.push_back(nOffset & 0xff);
+    vOut.push_back(nOffset >> 8);
+    if (nMatchCode >= 15)
+        WriteLength(vOut, nMatchCode - 15);
+}
+
+} // namespace
+
+void LZCompress(const unsigned char* pDict, size_t nDictSize, const unsigned char* pSrc, size_t nSrcSize, std::vector<unsigned char>& vOut)
+{
+    vOut.clear();
+    vOut.reserve(nSrcSize / 2 + 16);
+
+    // Matches are looked for in the dictionary followed by the data
+    std::vector<unsigned char> vBuf;
+    vBuf.reserve(nDictSize + nSrcSize);
+    vBuf.insert(vBuf.end(), pDict, pDict + nDictSize);
+    vBuf.insert(vBuf.end(), pSrc, pSrc + nSrcSize);
+    const unsigned char* pBase = vBuf.data();
+    const size_t nEnd = vBuf.size();
+
+    // Position + 1 of the last occurrence of each hashed 4 byte sequence
+    std::vector<uint32_t> vTable(1 << LZ_HASH_BITS, 0);
+    for (size_t i = nDictSize > LZ_MAX_OFFSET ? nDictSize - LZ_MAX_OFFSET : 0; i + LZ_MIN_MATCH <= nDictSize; i++)
+        vTable[LZHash(ReadLE32(pBase + i))] = i + 1;
+
+    size_t nAnchor = nDictSize;
+    size_t nPos = nDictSize;
+    if (nSrcSize >= LZ_MF_LIMIT) {
+        const size_t nMatchLimit = nEnd - LZ_LAST_LITERALS;
+        while (nPos <= nEnd - LZ_MF_LIMIT) {
+            const uint32_t nSeq = ReadLE32(pBase + nPos);
+            uint32_t& nSlot = vTable[LZHash(nSeq)];
+            size_t nRef = nSlot;
+            nSlot = nPos + 1;
+            if (nRef == 0 || nPos - (nRef - 1) > LZ_MAX_OFFSET || ReadLE32(pBase + nRef - 1) != nSeq) {
+                // Step faster through data that does not compress
+                nPos += 1 + ((nPos - nAnchor) >> 6);
+                continue;
+            }
+            nRef--;
+            while (nPos > nAnchor && nRef > 0 && pBase[nPos - 1] == pBase[nRef - 1]) {
+                nPos--;
+                nRef--;
+            }
+            size_t nLen = LZ_MIN_MATCH;
+            while (nPos + nLen < nMatchLimit && pBase[nPos + nLen] == pBase[nRef + nLen])
+                nLen++;
+            WriteSequence(vOut, pBase + nAnchor, nPos - nAnchor, nLen, nPos - nRef);
+            nPos += nLen;
+            nAnchor = nPos;
+            if (nPos <= nEnd - LZ_MF_LIMIT)
+                vTable[LZHash(ReadLE32(pBase + nPos - 2))] = nPos - 2 + 1;
+        }
+    }
+    WriteSequence(vOut, pBase + nAnchor, nEnd - nAnchor, 0, 0);
+}
+
+bool LZDecompress(const unsigned char* pDict, size_t nDictSize, const unsigned char* pSrc, size_t nSrcSize, unsigned char* pDst, size_t nDstSize)
+{
+    size_t nIn = 0;
+    size_t nOut = 0;
+    while (true) {
+        if (nIn >= nSrcSize)
+            return false;
+        const unsigned char nToken = pSrc[nIn++];
+
+        size_t nLiterals = nToken >> 4;
+        if (nLiterals == 15 && !ReadLength(pSrc, nSrcSize, nIn, nLiterals))
+            return false;
+        if (nLiterals > nSrcSize - nIn || nLiterals > nDstSize - nOut)
+            return false;
+        if (nLiterals)
+            memcpy(pDst + nOut, pSrc + nIn, nLiterals);
+        nIn += nLiterals;
+        nOut += nLiterals;
+        // The last sequence has no match
+        if (nIn == nSrcSize)
+            return nOut == nDstSize;
+
+        if (nSrcSize - nIn < 2)
+            return false;
+        const size_t nOffset = pSrc[nIn] | (pSrc[nIn + 1] << 8);
+        nIn += 2;
+        size_t nLen = nToken & 15;
+        if (nLen == 15 && !ReadLength(pSrc, nSrcSize, nIn, nLen))
+            return false;
+        nLen += LZ_MIN_MATCH;
+        if (nOffset == 0 || nOffset > nOut + nDictSize || nLen > nDstSize - nOut)
+            return false;
+
+        if (nOffset > nOut) {
+            // Starts in the dictionary and may continue into the output
+            const size_t nBack = nOffset - nOut;
+            const size_t nCopy = std::min(nLen, nBack);
+            memcpy(pDst + nOut, pDict + nDictSize - nBack, nCopy);
+            nOut += nCopy;
+            nLen -= nCopy;
+        }
+        const unsigned char* pMatch = pDst + nOut - nOffset;
+        if (nOffset >= nLen) {
+            memcpy(pDst + nOut, pMatch, nLen);
+        } else {
+            // Overlapping match: repeats the last nOffset bytes
+            for (size_t i = 0; i < nLen; i++)
+                pDst[nOut + i] = pMatch[i];
+        }
+        nOut += nLen;
+    }
+}
+
+std::vector<unsigned char> TrainSubBlockDictionary(const std::deque<std::vector<unsigned char> >& vSamples, size_t nMaxSize)
+{
+    std::vector<unsigned char> vAll;
+    std::vector<size_t> vSampleEnd;
+    for (const std::vector<unsigned char>& sample : vSamples) {
+        vAll.insert(vAll.end(), sample.begin(), sample.end());
+        vSampleEnd.push_back(vAll.size());
+    }
+    const size_t nSegments = std::min(nMaxSize, vAll.size()) / DICT_SEGMENT_SIZE;
+    if (nSegments == 0)
+        return std::vector<unsigned char>();
+
+    // Count the samples each substring occurs in. Substrings seen in a
+    // single sample do not help compress the next ones.
+    std::vector<uint32_t> vFreq(1 << DICT_HASH_BITS, 0);
+    std::vector<uint32_t> vLastSample(1 << DICT_HASH_BITS, (uint32_t)-1);
+    size_t nBegin = 0;
+    for (size_t s = 0; s < vSampleEnd.size(); s++) {
+        for (size_t i = nBegin; i + DICT_DMER_SIZE <= vSampleEnd[s]; i++) {
+            const uint32_t h = DmerHash(&vAll[i]);
+            if (vLastSample[h] != s) {
+                vLastSample[h] = s;
+                vFreq[h]++;
+            }
+        }
+        nBegin = vSampleEnd[s];
+    }
+    for (uint32_t& nFreq : vFreq) {
+        if (nFreq < 2)
+            nFreq = 0;
+    }
+
+    // Split the samples into one epoch per segment and take the best scoring
+    // segment of each; its substrings then no longer count, so that later
+    // epochs add different content.
+    const size_t nEpochSize = vAll.size() / nSegments;
+    const size_t nWindowDmers = DICT_SEGMENT_SIZE - DICT_DMER_SIZE + 1;
+    std::vector<std::pair<uint64_t, size_t> > vChosen;
+    for (size_t nEpoch = 0; nEpoch < nSegments; nEpoch++) {
+        const size_t nEpochBegin = nEpoch * nEpochSize;
+        const size_t nEpochEnd = std::min(nEpochBegin + std::max(nEpochSize, DICT_SEGMENT_SIZE), vAll.size());
+        if (nEpochEnd - nEpochBegin < DICT_SEGMENT_SIZE)
+            break;
+        uint64_t nScore = 0;
+        for (size_t i = nEpochBegin; i < nEpochBegin + nWindowDmers; i++)
+            nScore += vFreq[DmerHash(&vAll[i])];
+        uint64_t nBestScore = nScore;
+        size_t nBestPos = nEpochBegin;
+        for (size_t nPos = nEpochBegin + 1; nPos + DICT_SEGMENT_SIZE <= nEpochEnd; nPos++) {
+            nScore += vFreq[DmerHash(&vAll[nPos + nWindowDmers - 1])];
+            nScore -= vFreq[DmerHash(&vAll[nPos - 1])];
+            if (nScore > nBestScore) {
+                nBestScore = nScore;
+                nBestPos = nPos;
+            }
+        }
+        if (nBestScore == 0)
+            continue;
+        vChosen.push_back(std::make_pair(nBestScore, nBestPos));
+        for (size_t i = nBestPos; i < nBestPos + nWindowDmers; i++)
+            vFreq[DmerHash(&vAll[i])] = 0;
+    }
+
+    std::stable_sort(vChosen.begin(), vChosen.end(),
+        [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) { return a.first < b.first; });
+    std::vector<unsigned char> vDict;
+    vDict.reserve(vChosen.size() * DICT_SEGMENT_SIZE);
+    for (const std::pair<uint64_t, size_t>& segment : vChosen)
+        vDict.insert(vDict.end(), vAll.begin() + segment.second, vAll.begin() + segment.second + DICT_SEGMENT_SIZE);
+    return vDict;
+}
+
+uint256 CSubBlockDictionary::ComputeHash() const
+{
+    return Hash(data.begin(), data.end());
+}
+
+bool CompressSubBlock(const CSubBlock& block, const CSubBlockDictionary* pdict, CCompressedSubBlock& compressed)
+{
+    compressed.subChainId = block.subChainId;
+    compressed.nHeight = block.nHeight;
+    compressed.nTime = block.nTime;
+    compressed.hashDict = pdict ? pdict->GetHash() : uint256();
+    compressed.nRawSize = block.subblockdata.size();
+    LZCompress(pdict ? pdict->data.data() : nullptr, pdict ? pdict->data.size() : 0,
+               block.subblockdata.data(), block.subblockdata.size(), compressed.vchData);
+    return ::GetSerializeSize(compressed, SER_DISK, CLIENT_VERSION) < ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+}
+
+bool DecompressSubBlock(const CCompressedSubBlock& compressed, const CSubBlockDictionary* pdict, CSubBlock& block)
+{
+    if (compressed.hashDict.IsNull() ? pdict != nullptr : (!pdict || pdict->GetHash() != compressed.hashDict))
+        return false;
+    if (compressed.nRawSize > MAX_BLOCK_SERIALIZED_SIZE)
+        return false;
+    block.subChainId = compressed.subChainId;
+    block.nHeight = compressed.nHeight;
+    block.nTime = compressed.nTime;
+    block.subblockdata.resize(compressed.nRawSize);
+    return LZDecompress(pdict ? pdict->data.data() : nullptr, pdict ? pdict->data.size() : 0,
+                        compressed.vchData.data(), compressed.vchData.size(), block.subblockdata.data(), block.subblockdata.size());
+}
+
+CSubBlockCompressor::CSubBlockCompressor() : nNewSamples(0)
+{
+}
+
+void CSubBlockCompressor::AddSample(const std::vector<unsigned char>& data)
+{
+    if (data.empty())
+        return;
+    LOCK(cs);
+    vSamples.emplace_back(data.begin(), data.begin() + std::min(data.size(), SUBBLOCK_DICT_SAMPLE_SIZE));
+    if (vSamples.size() > SUBBLOCK_DICT_SAMPLES)
+        vSamples.pop_front();
+    if (++nNewSamples < (dict ? SUBBLOCK_DICT_RETRAIN_INTERVAL : SUBBLOCK_DICT_SAMPLES))
+        return;
+    nNewSamples = 0;
+    std::vector<unsigned char> vDict = TrainSubBlockDictionary(vSamples, SUBBLOCK_DICT_SIZE);
+    if (!vDict.empty())
+        dict = std::make_shared<const CSubBlockDictionary>(std::move(vDict));
+}
+
+CSubBlockDictionaryRef CSubBlockCompressor::GetDictionary() const
+{
+    LOCK(cs);
+    return dict;
+}
+
+CSubBlockDictionaryRef CSubBlockDictCache::Get(const uint256& hash)
+{
+    LOCK(cs);
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        if (vEntries[i]->GetHash() == hash) {
+            CSubBlockDictionaryRef dict = vEntries[i];
+            vEntries.erase(vEntries.begin() + i);
+            vEntries.push_back(dict);
+            return dict;
+        }
+    }
+    return nullptr;
+}
+
+void CSubBlockDictCache::Insert(const CSubBlockDictionaryRef& dict)
+{
+    LOCK(cs);
+    for (const CSubBlockDictionaryRef& entry : vEntries) {
+        if (entry->GetHash() == dict->GetHash())
+            return;
+    }
+    vEntries.push_back(dict);
+    if (vEntries.size() > SUBBLOCK_DICT_CACHE_ENTRIES)
+        vEntries.erase(vEntries.begin());
+}
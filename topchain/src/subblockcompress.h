@@ -0,0 +1,170 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUBBLOCKCOMPRESS_H
+#define BITCOIN_SUBBLOCKCOMPRESS_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/** Default for -subblockcompress */
+static const bool DEFAULT_SUBBLOCK_COMPRESS = false;
+/** Largest dictionary trained from recent subblocks */
+static const size_t SUBBLOCK_DICT_SIZE = 32 * 1024;
+/** Leading bytes of each subblock payload kept as a training sample */
+static const size_t SUBBLOCK_DICT_SAMPLE_SIZE = 16 * 1024;
+/** Samples a dictionary is trained on */
+static const size_t SUBBLOCK_DICT_SAMPLES = 128;
+/** New samples after which the dictionary is trained again */
+static const size_t SUBBLOCK_DICT_RETRAIN_INTERVAL = 1024;
+/** Dictionaries kept in memory for reading compressed subblocks */
+static const size_t SUBBLOCK_DICT_CACHE_ENTRIES = 8;
+
+/**
+ * Flags in the size field of a subblk?????.dat record header. Plain subblock
+ * records have none, so files without compressed records are unchanged, and
+ * older versions skip the flagged records as oversized when reindexing.
+ */
+static const uint32_t SUBBLOCK_RECORD_COMPRESSED = 1U << 31;
+static const uint32_t SUBBLOCK_RECORD_DICTIONARY = 1U << 30;
+static const uint32_t SUBBLOCK_RECORD_FLAGS = SUBBLOCK_RECORD_COMPRESSED | SUBBLOCK_RECORD_DICTIONARY;
+/** Smallest record in a subblk file: a plain subblock without data */
+static const uint32_t MIN_SUBBLOCK_RECORD_SIZE = 41;
+
+/**
+ * LZ77 block compression in the format of LZ4 blocks: a sequence of tokens,
+ * each a run of literals followed by a match of at least four bytes up to
+ * 64 KiB back. Matches may reach back into a dictionary, which is treated as
+ * if it preceded the data.
+ */
+void LZCompress(const unsigned char* pDict, size_t nDictSize, const unsigned char* pSrc, size_t nSrcSize, std::vector<unsigned char>& vOut);
+/** Decompress exactly nDstSize bytes into pDst. Returns false on malformed input. */
+bool LZDecompress(const unsigned char* pDict, size_t nDictSize, const unsigned char* pSrc, size_t nSrcSize, unsigned char* pDst, size_t nDstSize);
+
+/**
+ * Build a dictionary of at most nMaxSize bytes from sample payloads. It is
+ * made of the segments whose substrings recur in the most samples, with the
+ * best ones last, closest to the data that is compressed against it.
+ */
+std::vector<unsigned char> TrainSubBlockDictionary(const std::deque<std::vector<unsigned char> >& vSamples, size_t nMaxSize);
+
+/**
+ * A dictionary as stored in a subblk file, ahead of the compressed records
+ * that use it. Records refer to it by hash, and every file that has such
+ * records holds its own copy, so that each file can be read on its own.
+ */
+class CSubBlockDictionary
+{
+private:
+    //! Memory only, computed on construction and when read
+    uint256 hash;
+
+    uint256 ComputeHash() const;
+
+public:
+    std::vector<unsigned char> data;
+
+    CSubBlockDictionary() {}
+    explicit CSubBlockDictionary(std::vector<unsigned char> dataIn) : data(std::move(dataIn)) { hash = ComputeHash(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(data);
+        if (ser_action.ForRead())
+            hash = ComputeHash();
+    }
+
+    const uint256& GetHash() const { return hash; }
+};
+
+typedef std::shared_ptr<const CSubBlockDictionary> CSubBlockDictionaryRef;
+
+/** A subblock as stored in a compressed record: the payload is compressed on its own against a dictionary */
+class CCompressedSubBlock
+{
+public:
+    uint256 subChainId;
+    uint32_t nHeight;
+    uint32_t nTime;
+    //! Null when compressed without a dictionary
+    uint256 hashDict;
+    //! Position of the dictionary record in the same file
+    uint32_t nDictPos;
+    uint32_t nRawSize;
+    std::vector<unsigned char> vchData;
+
+    CCompressedSubBlock() : nHeight(0), nTime(0), nDictPos(0), nRawSize(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(subChainId);
+        READWRITE(nHeight);
+        READWRITE(nTime);
+        READWRITE(hashDict);
+        READWRITE(nDictPos);
+        READWRITE(VARINT(nRawSize));
+        READWRITE(vchData);
+    }
+};
+
+/** Compress block against pdict (may be null). Returns false if that would not save space. */
+bool CompressSubBlock(const CSubBlock& block, const CSubBlockDictionary* pdict, CCompressedSubBlock& compressed);
+/** Restore the subblock; pdict must be the dictionary compressed was made with */
+bool DecompressSubBlock(const CCompressedSubBlock& compressed, const CSubBlockDictionary* pdict, CSubBlock& block);
+
+/**
+ * Dictionary for the subblocks written next. It keeps samples of the most
+ * recent payloads and trains a new dictionary from them every
+ * SUBBLOCK_DICT_RETRAIN_INTERVAL samples, or as soon as there are enough
+ * for the first one.
+ */
+class CSubBlockCompressor
+{
+private:
+    mutable CCriticalSection cs;
+    std::deque<std::vector<unsigned char> > vSamples;
+    size_t nNewSamples;
+    CSubBlockDictionaryRef dict;
+
+public:
+    CSubBlockCompressor();
+
+    /** Sample a payload that is about to be written */
+    void AddSample(const std::vector<unsigned char>& data);
+    /** The current dictionary, or nullptr while there are too few samples */
+    CSubBlockDictionaryRef GetDictionary() const;
+};
+
+/** Recently used dictionaries, by hash */
+class CSubBlockDictCache
+{
+private:
+    mutable CCriticalSection cs;
+    //! Most recently used last
+    std::vector<CSubBlockDictionaryRef> vEntries;
+
+public:
+    CSubBlockDictionaryRef Get(const uint256& hash);
+    void Insert(const CSubBlockDictionaryRef& dict);
+};
+
+/** Dictionary training for new subblocks, used with -subblockcompress */
+extern CSubBlockCompressor subblockcompressor;
+/** Dictionaries of compressed subblocks read from disk */
+extern CSubBlockDictCache subblockdictcache;
+
+#endif // BITCOIN_SUBBLOCKCOMPRESS_H
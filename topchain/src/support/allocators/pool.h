@@ -0,0 +1,150 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * Arena for many small, similarly sized allocations, such as the nodes of a
+ * node based container.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE bytes are carved from CHUNK_SIZE byte chunks
+ * and recycled through one free list per size class. Chunks are only given
+ * back when the arena is destroyed. Larger requests go to operator new.
+ *
+ * Not thread safe: the owner must serialize access, typically with the lock
+ * that already guards the container using it.
+ */
+template <std::size_t MAX_BLOCK_SIZE, std::size_t CHUNK_SIZE = 256 * 1024>
+class pool_resource
+{
+public:
+    //! Alignment of every block handed out, and the size class granularity
+    static const std::size_t BLOCK_ALIGN = 16;
+
+private:
+    static_assert(CHUNK_SIZE >= MAX_BLOCK_SIZE, "chunk must hold at least one block");
+    static const std::size_t NUM_SIZE_CLASSES = (MAX_BLOCK_SIZE + BLOCK_ALIGN - 1) / BLOCK_ALIGN + 1;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    FreeBlock* free_lists[NUM_SIZE_CLASSES];
+    std::vector<char*> chunks;
+    char* chunk_pos;
+    char* chunk_end;
+
+    static bool IsPooled(std::size_t bytes, std::size_t alignment)
+    {
+        return bytes > 0 && bytes <= MAX_BLOCK_SIZE && alignment <= BLOCK_ALIGN;
+    }
+
+public:
+    pool_resource() : chunk_pos(nullptr), chunk_end(nullptr)
+    {
+        std::fill(free_lists, free_lists + NUM_SIZE_CLASSES, nullptr);
+    }
+
+    ~pool_resource()
+    {
+        for (char* chunk : chunks)
+            ::operator delete(chunk);
+    }
+
+    pool_resource(const pool_resource&) = delete;
+    pool_resource& operator=(const pool_resource&) = delete;
+
+    void* allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsPooled(bytes, alignment))
+            return ::operator new(bytes);
+        const std::size_t nClass = (bytes + BLOCK_ALIGN - 1) / BLOCK_ALIGN;
+        if (free_lists[nClass]) {
+            FreeBlock* block = free_lists[nClass];
+            free_lists[nClass] = block->next;
+            return block;
+        }
+        const std::size_t nSize = nClass * BLOCK_ALIGN;
+        if ((std::size_t)(chunk_end - chunk_pos) < nSize) {
+            // The tail of the previous chunk is abandoned; it is smaller than one block
+            chunk_pos = static_cast<char*>(::operator new(CHUNK_SIZE));
+            chunk_end = chunk_pos + CHUNK_SIZE;
+            chunks.push_back(chunk_pos);
+        }
+        void* p = chunk_pos;
+        chunk_pos += nSize;
+        return p;
+    }
+
+    void deallocate(void* p, std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsPooled(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        const std::size_t nClass = (bytes + BLOCK_ALIGN - 1) / BLOCK_ALIGN;
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = free_lists[nClass];
+        free_lists[nClass] = block;
+    }
+
+    //! Memory held in chunks, whether handed out or on a free list
+    std::size_t ChunkUsage() const { return chunks.size() * CHUNK_SIZE; }
+};
+
+/** Allocator drawing from a pool_resource, for use with node based containers. */
+template <typename T, std::size_t MAX_BLOCK_SIZE>
+struct pool_allocator : public std::allocator<T> {
+    typedef std::allocator<T> base;
+    typedef pool_resource<MAX_BLOCK_SIZE> resource_type;
+    typedef typename base::size_type size_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::value_type value_type;
+
+    resource_type* resource;
+
+    explicit pool_allocator(resource_type* resourceIn) throw() : resource(resourceIn) {}
+    pool_allocator(const pool_allocator& a) throw() : base(a), resource(a.resource) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U, MAX_BLOCK_SIZE>& a) throw() : resource(a.resource)
+    {
+    }
+    ~pool_allocator() throw() {}
+    template <typename _Other>
+    struct rebind {
+        typedef pool_allocator<_Other, MAX_BLOCK_SIZE> other;
+    };
+
+    T* allocate(std::size_t n, const void* hint = 0)
+    {
+        return static_cast<T*>(resource->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        resource->deallocate(p, n * sizeof(T), alignof(T));
+    }
+};
+
+template <typename T, typename U, std::size_t MAX_BLOCK_SIZE>
+bool operator==(const pool_allocator<T, MAX_BLOCK_SIZE>& a, const pool_allocator<U, MAX_BLOCK_SIZE>& b)
+{
+    return a.resource == b.resource;
+}
+
+template <typename T, typename U, std::size_t MAX_BLOCK_SIZE>
+bool operator!=(const pool_allocator<T, MAX_BLOCK_SIZE>& a, const pool_allocator<U, MAX_BLOCK_SIZE>& b)
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
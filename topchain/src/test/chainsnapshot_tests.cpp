@@ -0,0 +1,103 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainsnapshot.h"
+
+#include "chain.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(chainsnapshot_tests, BasicTestingSetup)
+
+static void CheckSnapshot(const CChain& chain, const CChainSnapshot& snapshot)
+{
+    BOOST_CHECK_EQUAL(snapshot.Height(), chain.Height());
+    BOOST_CHECK(snapshot.Tip() == chain.Tip());
+    for (int nHeight = 0; nHeight <= chain.Height(); nHeight++) {
+        BOOST_CHECK(snapshot[nHeight] == chain[nHeight]);
+        BOOST_CHECK(snapshot.Contains(chain[nHeight]));
+        BOOST_CHECK(snapshot.Next(chain[nHeight]) == chain.Next(chain[nHeight]));
+    }
+    BOOST_CHECK(snapshot[chain.Height() + 1] == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(chainsnapshot_reorg)
+{
+    // Two branches forking off at a height in the middle of the second chunk
+    const int nFork = 1500;
+    std::vector<uint256> vHashes(8000);
+    std::vector<CBlockIndex> vMain(5000), vFork(3000);
+    for (size_t i = 0; i < vHashes.size(); i++)
+        vHashes[i] = InsecureRand256();
+    for (int i = 0; i < (int)vMain.size(); i++) {
+        vMain[i].nHeight = i;
+        vMain[i].pprev = i ? &vMain[i - 1] : nullptr;
+        vMain[i].phashBlock = &vHashes[i];
+        // Every other block has its data, the rest count as pruned
+        if (i % 2) {
+            vMain[i].nStatus |= BLOCK_HAVE_DATA;
+            vMain[i].nFile = i / 100;
+            vMain[i].nDataPos = i;
+        }
+    }
+    for (int i = 0; i < (int)vFork.size(); i++) {
+        vFork[i].nHeight = nFork + 1 + i;
+        vFork[i].pprev = i ? &vFork[i - 1] : &vMain[nFork];
+        vFork[i].phashBlock = &vHashes[vMain.size() + i];
+    }
+
+    CChain chain;
+    CChainSnapshot empty;
+    BOOST_CHECK(empty.Tip() == nullptr);
+    BOOST_CHECK_EQUAL(empty.Height(), -1);
+
+    chain.SetTip(&vMain[2000]);
+    CChainSnapshot first(chain, empty);
+    CheckSnapshot(chain, first);
+    for (int i = 0; i <= 2000; i++) {
+        const CDiskBlockPos pos = first.GetBlockPos(&vMain[i]);
+        BOOST_CHECK(i % 2 ? pos == vMain[i].GetBlockPos() : pos.IsNull());
+    }
+
+    // Extend, reorganize onto the fork and back
+    chain.SetTip(&vMain.back());
+    CChainSnapshot extended(chain, first);
+    CheckSnapshot(chain, extended);
+    chain.SetTip(&vFork.back());
+    CChainSnapshot reorged(chain, extended);
+    CheckSnapshot(chain, reorged);
+    BOOST_CHECK(!reorged.Contains(&vMain[nFork + 1]));
+    BOOST_CHECK(reorged.Next(&vMain[nFork]) == &vFork[0]);
+    chain.SetTip(&vMain[3000]);
+    CChainSnapshot back(chain, reorged);
+    CheckSnapshot(chain, back);
+
+    // Older snapshots are unaffected by the ones built from them
+    chain.SetTip(&vMain[2000]);
+    CheckSnapshot(chain, first);
+    BOOST_CHECK(extended.Contains(&vMain[nFork + 1]));
+    BOOST_CHECK_EQUAL(extended.Height(), 4999);
+}
+
+BOOST_AUTO_TEST_CASE(blockindexlookup)
+{
+    std::vector<uint256> vHashes(1000);
+    std::vector<CBlockIndex> vIndex(vHashes.size());
+    CBlockIndexLookup lookup;
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vHashes[i] = InsecureRand256();
+        vIndex[i].phashBlock = &vHashes[i];
+        lookup.Insert(&vIndex[i]);
+    }
+    for (size_t i = 0; i < vIndex.size(); i++)
+        BOOST_CHECK(lookup.Find(vHashes[i]) == &vIndex[i]);
+    BOOST_CHECK(lookup.Find(InsecureRand256()) == nullptr);
+    lookup.Clear();
+    BOOST_CHECK(lookup.Find(vHashes[0]) == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
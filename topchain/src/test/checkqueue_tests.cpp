@@ -269,6 +269,37 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
     tg.join_all();
 }
 
+// Test that the checks of several groups outstanding on the same queue
+// each get their own result, whichever order they are waited for in.
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Groups)
+{
+    auto fail_queue = std::unique_ptr<Failing_Queue>(new Failing_Queue {QUEUE_BATCH_SIZE});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{fail_queue->Thread();});
+    }
+
+    for (auto times = 0; times < 100; ++times) {
+        CCheckQueueControl<FailingCheck> session(fail_queue.get());
+        bool fails[3] = {false, (times & 1) != 0, (times & 2) != 0};
+        std::vector<std::unique_ptr<CCheckQueueGroupControl<FailingCheck>>> groups;
+        for (bool group_fails : fails) {
+            groups.emplace_back(new CCheckQueueGroupControl<FailingCheck>(fail_queue.get()));
+            std::vector<FailingCheck> vChecks;
+            vChecks.resize(100 + InsecureRandRange(100), false);
+            vChecks[InsecureRandRange(vChecks.size())] = group_fails;
+            groups.back()->Add(vChecks);
+        }
+        // Wait for the last group first, so the others may be done already
+        BOOST_REQUIRE_EQUAL(groups[2]->Wait(), !fails[2]);
+        BOOST_REQUIRE_EQUAL(groups[0]->Wait(), !fails[0]);
+        BOOST_REQUIRE_EQUAL(groups[1]->Wait(), !fails[1]);
+        BOOST_REQUIRE(session.Wait());
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
 // Test that unique checks are actually all called individually, rather than
 // just one check being called repeatedly. Test that checks are not called
 // more than once as well
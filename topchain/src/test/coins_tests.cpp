@@ -8,6 +8,7 @@
 #include "undo.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include "txdb.h"
 #include "validation.h"
 #include "consensus/validation.h"
 
@@ -855,4 +856,104 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_FIXTURE_TEST_CASE(ccoins_background_flush, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    std::vector<COutPoint> outpoints;
+
+    // Hand a cache full of coins over to the writer thread
+    uint256 hashFirst = InsecureRand256();
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 1000; i++) {
+            COutPoint outpoint(InsecureRand256(), 0);
+            Coin coin;
+            coin.out.nValue = InsecureRand32();
+            coin.nHeight = 1;
+            cache.AddCoin(outpoint, std::move(coin), false);
+            outpoints.push_back(outpoint);
+        }
+        cache.SetBestBlock(hashFirst);
+        BOOST_CHECK(cache.FlushBackground());
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+        BOOST_CHECK(cache.GetBestBlock() == hashFirst);
+
+        // Whether or not the write has landed, the coins are visible
+        for (const COutPoint& outpoint : outpoints)
+            BOOST_CHECK(cache.HaveCoin(outpoint));
+    }
+
+    // Spend half of them in a second flush, which waits for the first
+    uint256 hashSecond = InsecureRand256();
+    {
+        CCoinsViewCache cache(&db);
+        for (size_t i = 0; i < outpoints.size(); i += 2)
+            BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+        cache.SetBestBlock(hashSecond);
+        BOOST_CHECK(cache.FlushBackground());
+        BOOST_CHECK(db.GetBestBlock() == hashSecond);
+        for (size_t i = 0; i < outpoints.size(); i++)
+            BOOST_CHECK_EQUAL(db.HaveCoin(outpoints[i]), i % 2 == 1);
+    }
+
+    BOOST_CHECK(db.WaitForFlush());
+    BOOST_CHECK(db.GetBestBlock() == hashSecond);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    size_t nCoins = 0;
+    std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    for (; pcursor->Valid(); pcursor->Next())
+        nCoins++;
+    BOOST_CHECK_EQUAL(nCoins, outpoints.size() / 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_prefetch, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 100; i++) {
+            COutPoint outpoint(InsecureRand256(), 0);
+            Coin coin;
+            coin.out.nValue = i + 1;
+            coin.nHeight = 1;
+            cache.AddCoin(outpoint, std::move(coin), false);
+            outpoints.push_back(outpoint);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // A block spending all of them, an unknown coin, and an output of its own
+    CMutableTransaction spend;
+    for (const COutPoint& outpoint : outpoints)
+        spend.vin.emplace_back(outpoint);
+    spend.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+    spend.vout.resize(1);
+    CMutableTransaction child;
+    child.vin.emplace_back(COutPoint(spend.GetHash(), 0));
+    child.vout.resize(1);
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(spend));
+    block.vtx.push_back(MakeTransactionRef(child));
+
+    // One coin is spent in the cache already, the prefetch must not bring it back
+    CCoinsViewCacheTest cache(&db);
+    BOOST_CHECK(cache.SpendCoin(outpoints[0]));
+    PrefetchBlockInputs(block, cache, db);
+
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size());
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[0]));
+    for (size_t i = 1; i < outpoints.size(); i++) {
+        BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+        BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[i]).out.nValue, (CAmount)(i + 1));
+    }
+    BOOST_CHECK(!cache.HaveCoinInCache(spend.vin.back().prevout));
+    BOOST_CHECK(!cache.HaveCoinInCache(child.vin[0].prevout));
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,112 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "primitives/extdata.h"
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "script/sigcache.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(extdata_tests, BasicTestingSetup)
+
+static CKey MakeKey()
+{
+    CKey key;
+    key.MakeNewKey(true);
+    return key;
+}
+
+static CScript SignOwner(const CKey& key, const uint256& hash)
+{
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    return CScript() << vchSig << ToByteVector(key.GetPubKey());
+}
+
+static CCreateSubChainExt MakeCreate(const CKey& keyOwner, const CKey& keySigner)
+{
+    CCreateSubChainExt ext;
+    ext.subChainId = InsecureRand256();
+    ext.subChainOwner = GetSubChainOwner(keyOwner.GetPubKey());
+    ext.subChainName = "testchain";
+    ext.subCoinName = "TEST";
+    ext.signature = SignOwner(keySigner, ext.GetSignatureHash());
+    return ext;
+}
+
+static CBackupSubBlockExt MakeBackup(const CKey& keySigner)
+{
+    CBackupSubBlockExt ext;
+    ext.subChainId = InsecureRand256();
+    ext.subBlockHash = InsecureRand256();
+    ext.subBlockHeight = 7;
+    ext.signature = SignOwner(keySigner, ext.GetSignatureHash());
+    return ext;
+}
+
+BOOST_AUTO_TEST_CASE(create_signature)
+{
+    const CKey keyOwner = MakeKey();
+    const CKey keyOther = MakeKey();
+
+    BOOST_CHECK(MakeCreate(keyOwner, keyOwner).Verify());
+    // A valid signature by a key other than the one the create names
+    BOOST_CHECK(!MakeCreate(keyOwner, keyOther).Verify());
+
+    CCreateSubChainExt ext = MakeCreate(keyOwner, keyOwner);
+    ext.subChainName = "othername";
+    BOOST_CHECK(!ext.Verify());
+    // Claiming the subchain for another owner invalidates the signature too
+    ext = MakeCreate(keyOwner, keyOwner);
+    ext.subChainOwner = GetSubChainOwner(keyOther.GetPubKey());
+    BOOST_CHECK(!ext.Verify());
+
+    ext = MakeCreate(keyOwner, keyOwner);
+    ext.signature = CScript();
+    BOOST_CHECK(!ext.Verify());
+}
+
+BOOST_AUTO_TEST_CASE(backup_signature)
+{
+    const CKey keyOwner = MakeKey();
+    const CKey keyOther = MakeKey();
+    const uint256 hashOwner = GetSubChainOwner(keyOwner.GetPubKey());
+
+    CBackupSubBlockExt ext = MakeBackup(keyOwner);
+    BOOST_CHECK(ext.Verify(hashOwner));
+    // The subchain is unknown, or registered to someone else
+    BOOST_CHECK(!ext.Verify(uint256()));
+    BOOST_CHECK(!ext.Verify(GetSubChainOwner(keyOther.GetPubKey())));
+    // Signed by a key other than the registered owner's
+    BOOST_CHECK(!MakeBackup(keyOther).Verify(hashOwner));
+
+    ext.subBlockHash = InsecureRand256();
+    BOOST_CHECK(!ext.Verify(hashOwner));
+    ext = MakeBackup(keyOwner);
+    ext.subBlockHeight++;
+    BOOST_CHECK(!ext.Verify(hashOwner));
+}
+
+BOOST_AUTO_TEST_CASE(cached_verify_per_owner)
+{
+    const CKey keyOwner = MakeKey();
+    const CKey keyOther = MakeKey();
+    const uint256 hashOwner = GetSubChainOwner(keyOwner.GetPubKey());
+
+    CMutableTransaction mtx;
+    mtx.extData.nExtType = EXTDATA_BACKUPSUBBLOCK;
+    mtx.extData.data = MakeBackup(keyOwner);
+    const CTransaction tx(mtx);
+
+    BOOST_CHECK(CachingVerifyExtData(tx, hashOwner, true));
+    // A result cached for one owner is not reused for another
+    BOOST_CHECK(!CachingVerifyExtData(tx, GetSubChainOwner(keyOther.GetPubKey()), true));
+    BOOST_CHECK(!CachingVerifyExtData(tx, uint256(), true));
+    BOOST_CHECK(CachingVerifyExtData(tx, hashOwner, false));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
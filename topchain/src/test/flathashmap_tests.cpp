@@ -0,0 +1,118 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flathashmap.h"
+
+#include "coins.h"
+#include "test/test_bitcoin.h"
+
+#include <unordered_map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flathashmap_tests, BasicTestingSetup)
+
+typedef flat_hash_map<COutPoint, int, SaltedOutpointHasher> TestMap;
+
+static void CheckEqual(const TestMap& map, const std::unordered_map<COutPoint, int, SaltedOutpointHasher>& real)
+{
+    BOOST_CHECK_EQUAL(map.size(), real.size());
+    size_t nCount = 0;
+    for (TestMap::const_iterator it = map.begin(); it != map.end(); ++it) {
+        auto itReal = real.find(it->first);
+        BOOST_CHECK(itReal != real.end() && itReal->second == it->second);
+        nCount++;
+    }
+    BOOST_CHECK_EQUAL(nCount, real.size());
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_random)
+{
+    TestMap map;
+    std::unordered_map<COutPoint, int, SaltedOutpointHasher> real;
+    // A small key space, so that inserts hit existing keys and erases leave deleted slots behind
+    std::vector<COutPoint> keys;
+    for (int i = 0; i < 500; i++)
+        keys.emplace_back(InsecureRand256(), InsecureRandRange(4));
+
+    for (int i = 0; i < 100000; i++) {
+        const COutPoint& key = keys[InsecureRandRange(keys.size())];
+        const int value = InsecureRand32();
+        switch (InsecureRandRange(4)) {
+        case 0: {
+            auto ret = map.emplace(key, value);
+            auto retReal = real.emplace(key, value);
+            BOOST_CHECK_EQUAL(ret.second, retReal.second);
+            BOOST_CHECK_EQUAL(ret.first->second, retReal.first->second);
+            break;
+        }
+        case 1:
+            map[key] = value;
+            real[key] = value;
+            break;
+        case 2:
+            BOOST_CHECK_EQUAL(map.erase(key), real.erase(key));
+            break;
+        case 3: {
+            TestMap::const_iterator it = map.find(key);
+            BOOST_CHECK_EQUAL(it != map.end(), real.count(key) != 0);
+            BOOST_CHECK_EQUAL(map.count(key), real.count(key));
+            break;
+        }
+        }
+        if (InsecureRandRange(10000) == 0) {
+            CheckEqual(map, real);
+            if (InsecureRandBool()) {
+                map.clear();
+                real.clear();
+            }
+        }
+    }
+    CheckEqual(map, real);
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_erase_while_iterating)
+{
+    TestMap map;
+    for (int i = 0; i < 10000; i++)
+        map.emplace(COutPoint(InsecureRand256(), 0), i);
+
+    // Erase every odd entry the way the coins cache walks its map in BatchWrite
+    size_t nVisited = 0;
+    for (TestMap::iterator it = map.begin(); it != map.end(); ) {
+        nVisited++;
+        if (it->second % 2) {
+            TestMap::iterator itOld = it++;
+            map.erase(itOld);
+        } else {
+            ++it;
+        }
+    }
+    BOOST_CHECK_EQUAL(nVisited, 10000U);
+    BOOST_CHECK_EQUAL(map.size(), 5000U);
+    for (const auto& entry : map)
+        BOOST_CHECK_EQUAL(entry.second % 2, 0);
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_reference_stability)
+{
+    TestMap map;
+    const COutPoint key(InsecureRand256(), 0);
+    int& value = map[key];
+    value = 42;
+    // Growing the table moves slots around, but not the entries
+    for (int i = 0; i < 10000; i++)
+        map.emplace(COutPoint(InsecureRand256(), 1), i);
+    BOOST_CHECK_EQUAL(&map[key], &value);
+    BOOST_CHECK_EQUAL(value, 42);
+
+    TestMap other;
+    other.swap(map);
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK_EQUAL(other.size(), 10001U);
+    BOOST_CHECK_EQUAL(&other[key], &value);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,159 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "httpworkqueue.h"
+#include "test/test_bitcoin.h"
+
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(httpserver_tests, BasicTestingSetup)
+
+/** Records the order items are run in */
+struct RunLog
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    std::vector<int> vRun;
+
+    void WaitFor(size_t nItems)
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        while (vRun.size() < nItems)
+            cond.wait(lock);
+    }
+};
+
+class TestWorkItem
+{
+public:
+    TestWorkItem(RunLog& _log, int _n) : log(_log), n(_n) {}
+    void operator()()
+    {
+        std::lock_guard<std::mutex> lock(log.cs);
+        log.vRun.push_back(n);
+        log.cond.notify_all();
+    }
+
+private:
+    RunLog& log;
+    int n;
+};
+
+typedef WorkQueue<TestWorkItem> TestWorkQueue;
+
+static bool Enqueue(TestWorkQueue& queue, RunLog& log, int n, HTTPPriority priority)
+{
+    std::unique_ptr<TestWorkItem> item(new TestWorkItem(log, n));
+    if (!queue.Enqueue(item.get(), priority))
+        return false;
+    item.release();
+    return true;
+}
+
+/** Run worker nWorker until nItems have been run in total */
+static void RunWorker(TestWorkQueue& queue, RunLog& log, size_t nWorker, size_t nItems)
+{
+    std::thread thread(&TestWorkQueue::Run, &queue, nWorker);
+    log.WaitFor(nItems);
+    queue.Interrupt();
+    thread.join();
+    queue.WaitExit();
+}
+
+BOOST_AUTO_TEST_CASE(workqueue_priority)
+{
+    // Queued before the worker starts, so it finds them all at once
+    TestWorkQueue queue(16, 1);
+    RunLog log;
+    BOOST_CHECK(Enqueue(queue, log, 0, HTTP_PRIORITY_LOW));
+    BOOST_CHECK(Enqueue(queue, log, 1, HTTP_PRIORITY_NORMAL));
+    BOOST_CHECK(Enqueue(queue, log, 2, HTTP_PRIORITY_HIGH));
+    BOOST_CHECK(Enqueue(queue, log, 3, HTTP_PRIORITY_NORMAL));
+    BOOST_CHECK(Enqueue(queue, log, 4, HTTP_PRIORITY_HIGH));
+    RunWorker(queue, log, 0, 5);
+
+    // Highest class first, in queue order within a class
+    const std::vector<int> vExpected = {2, 4, 1, 3, 0};
+    BOOST_CHECK(log.vRun == vExpected);
+
+    const std::vector<HTTPQueueStats> stats = queue.GetStats();
+    BOOST_REQUIRE_EQUAL(stats.size(), (size_t)HTTP_PRIORITY_COUNT);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_HIGH].nRequests, 2U);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_NORMAL].nRequests, 2U);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_LOW].nRequests, 1U);
+    uint64_t nLatencies = 0;
+    for (const HTTPQueueStats& s : stats) {
+        BOOST_CHECK_EQUAL(s.nQueued, 0);
+        BOOST_CHECK_EQUAL(s.nStolen, 0U);
+        BOOST_CHECK_EQUAL(s.vLatency.size(), (size_t)HTTP_LATENCY_BUCKETS);
+        for (uint64_t nCount : s.vLatency)
+            nLatencies += nCount;
+    }
+    BOOST_CHECK_EQUAL(nLatencies, 5U);
+}
+
+BOOST_AUTO_TEST_CASE(workqueue_steal)
+{
+    // With no worker idle, items are queued round-robin: 0 and 2 to the
+    // first worker, 1 and 3 to the second
+    TestWorkQueue queue(16, 2);
+    RunLog log;
+    BOOST_CHECK(Enqueue(queue, log, 0, HTTP_PRIORITY_LOW));
+    BOOST_CHECK(Enqueue(queue, log, 1, HTTP_PRIORITY_NORMAL));
+    BOOST_CHECK(Enqueue(queue, log, 2, HTTP_PRIORITY_HIGH));
+    BOOST_CHECK(Enqueue(queue, log, 3, HTTP_PRIORITY_NORMAL));
+
+    // Only the second worker runs: it empties its own queues, then takes
+    // the first worker's items, highest class first
+    RunWorker(queue, log, 1, 4);
+    const std::vector<int> vExpected = {1, 3, 2, 0};
+    BOOST_CHECK(log.vRun == vExpected);
+
+    const std::vector<HTTPQueueStats> stats = queue.GetStats();
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_HIGH].nStolen, 1U);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_NORMAL].nStolen, 0U);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_LOW].nStolen, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(workqueue_full)
+{
+    const int nMaxDepth = 4;
+    TestWorkQueue queue(nMaxDepth, 1);
+    RunLog log;
+    int n = 0;
+
+    // Low items may take up half of the queue
+    BOOST_CHECK(Enqueue(queue, log, n++, HTTP_PRIORITY_LOW));
+    BOOST_CHECK(Enqueue(queue, log, n++, HTTP_PRIORITY_LOW));
+    BOOST_CHECK(!Enqueue(queue, log, n++, HTTP_PRIORITY_LOW));
+    // Normal items the rest of it
+    BOOST_CHECK(Enqueue(queue, log, n++, HTTP_PRIORITY_NORMAL));
+    BOOST_CHECK(Enqueue(queue, log, n++, HTTP_PRIORITY_NORMAL));
+    BOOST_CHECK(!Enqueue(queue, log, n++, HTTP_PRIORITY_NORMAL));
+    BOOST_CHECK(!Enqueue(queue, log, n++, HTTP_PRIORITY_LOW));
+    // High items are accepted up to twice the depth
+    for (int i = 0; i < nMaxDepth; i++)
+        BOOST_CHECK(Enqueue(queue, log, n++, HTTP_PRIORITY_HIGH));
+    BOOST_CHECK(!Enqueue(queue, log, n++, HTTP_PRIORITY_HIGH));
+
+    std::vector<HTTPQueueStats> stats = queue.GetStats();
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_HIGH].nQueued, nMaxDepth);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_HIGH].nRejected, 1U);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_NORMAL].nQueued, 2);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_NORMAL].nRejected, 1U);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_LOW].nQueued, 2);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_LOW].nRejected, 2U);
+    BOOST_CHECK_EQUAL(stats[HTTP_PRIORITY_LOW].nRequests, 4U);
+
+    // Once the queue drains, items are accepted again
+    RunWorker(queue, log, 0, 2 * nMaxDepth);
+    stats = queue.GetStats();
+    for (const HTTPQueueStats& s : stats)
+        BOOST_CHECK_EQUAL(s.nQueued, 0);
+    BOOST_CHECK(Enqueue(queue, log, n++, HTTP_PRIORITY_LOW));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -74,4 +74,23 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_FIXTURE_TEST_CASE(read_raw_block, TestChain100Setup)
+{
+    LOCK(cs_main);
+    const CBlockIndex* pindex = chainActive.Tip();
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+
+    // The stored bytes are the network serialization of the block, witnesses included
+    std::vector<uint8_t> vBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vBlock, pindex, Params().MessageStart()));
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    BOOST_CHECK(std::vector<uint8_t>(ssBlock.begin(), ssBlock.end()) == vBlock);
+
+    // Another network's magic, or the wrong block, are refused
+    BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, pindex, CreateChainParams(CBaseChainParams::MAIN)->MessageStart()));
+    BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, pindex->GetBlockPos(), pindex->pprev->GetBlockHash(), Params().MessageStart()));
+}
 BOOST_AUTO_TEST_SUITE_END()
@@ -502,4 +502,34 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(CreateNewBlock_reuse_selection)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const CChainParams& chainparams = *chainParams;
+    CScript scriptPubKey = CScript() << OP_TRUE;
+
+    LOCK(cs_main);
+    mempool.clear();
+    const BlockTemplateStats statsBefore = blocktemplateengine.GetStats();
+
+    // Nothing changed since the first template: its selection is reused
+    BOOST_CHECK(AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK(AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(blocktemplateengine.GetStats().nReused, statsBefore.nReused + 1);
+
+    // Different options need a selection of their own
+    BlockAssembler::Options options;
+    options.blockMinFeeRate = CFeeRate(2 * DEFAULT_BLOCK_MIN_TX_FEE);
+    BOOST_CHECK(BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(blocktemplateengine.GetStats().nReused, statsBefore.nReused + 1);
+
+    // Once the mempool changed, only callers that accept a stale selection get it
+    mempool.AddTransactionsUpdated(1);
+    BOOST_CHECK(BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey, true, true));
+    BOOST_CHECK_EQUAL(blocktemplateengine.GetStats().nReused, statsBefore.nReused + 2);
+    BOOST_CHECK(BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(blocktemplateengine.GetStats().nReused, statsBefore.nReused + 2);
+    BOOST_CHECK_EQUAL(blocktemplateengine.GetStats().nTemplates, statsBefore.nTemplates + 5);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -185,4 +185,32 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnetmessage_receive_in_place)
+{
+    std::vector<unsigned char> payload(300 * 1000);
+    for (size_t i = 0; i < payload.size(); i++)
+        payload[i] = InsecureRandBits(8);
+    CMessageHeader hdr(Params().MessageStart(), "subblock", payload.size());
+    std::vector<unsigned char> header;
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, header, 0, hdr};
+
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    BOOST_CHECK_EQUAL(msg.readHeader((const char*)header.data(), header.size()), (int)header.size());
+
+    // Receive into the message itself, as the socket handler does for large payloads
+    size_t nPos = 0;
+    while (!msg.complete()) {
+        unsigned int nBytes = 0;
+        char* pch = msg.GetDataBuffer(nBytes);
+        BOOST_REQUIRE(nBytes > 0 && nBytes <= payload.size() - nPos);
+        nBytes = std::min(nBytes, 100000U);
+        memcpy(pch, payload.data() + nPos, nBytes);
+        BOOST_CHECK_EQUAL(msg.readData(pch, nBytes), (int)nBytes);
+        nPos += nBytes;
+    }
+    BOOST_CHECK(std::equal(payload.begin(), payload.end(), (const unsigned char*)msg.vRecv.data()));
+    BOOST_CHECK_EQUAL(msg.vRecv.size(), payload.size());
+    BOOST_CHECK(msg.GetMessageHash() == Hash(payload.begin(), payload.end()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,195 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netpoll.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+BOOST_FIXTURE_TEST_SUITE(netpoll_tests, BasicTestingSetup)
+
+/** A connected pair of non-blocking sockets */
+struct SocketPair
+{
+    SOCKET hSocket[2];
+
+    SocketPair()
+    {
+        int fds[2];
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        hSocket[0] = fds[0];
+        hSocket[1] = fds[1];
+        for (SOCKET h : hSocket)
+            BOOST_REQUIRE(fcntl(h, F_SETFL, fcntl(h, F_GETFL, 0) | O_NONBLOCK) != SOCKET_ERROR);
+    }
+    ~SocketPair()
+    {
+        for (SOCKET h : hSocket)
+            close(h);
+    }
+};
+
+static std::vector<CSocketPoller::Event> Poll(CSocketPoller& poller)
+{
+    std::vector<CSocketPoller::Event> vEvents;
+    int nReady = poller.Wait(0, vEvents);
+    BOOST_CHECK_EQUAL(nReady, (int)vEvents.size());
+    return vEvents;
+}
+
+/** The events reported for nId, or 0 */
+static int EventsFor(const std::vector<CSocketPoller::Event>& vEvents, int64_t nId)
+{
+    int nEvents = 0;
+    for (const CSocketPoller::Event& ev : vEvents) {
+        if (ev.nId == nId)
+            nEvents |= ev.nEvents;
+    }
+    return nEvents;
+}
+
+static void WriteByte(SOCKET hSocket)
+{
+    const char ch = 0;
+    BOOST_REQUIRE_EQUAL(send(hSocket, &ch, 1, 0), 1);
+}
+
+/** Read until the socket would block; returns the number of bytes read */
+static size_t Drain(SOCKET hSocket)
+{
+    char pchBuf[256];
+    size_t nRead = 0;
+    ssize_t nBytes;
+    while ((nBytes = recv(hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT)) > 0)
+        nRead += nBytes;
+    BOOST_CHECK(WSAGetLastError() == WSAEWOULDBLOCK);
+    return nRead;
+}
+
+/** Watch and readiness checks that hold for any backend */
+static void CheckPoller(CSocketPoller& poller)
+{
+    SocketPair sockets;
+    const SOCKET hRecv = sockets.hSocket[0];
+    const SOCKET hSend = sockets.hSocket[1];
+    BOOST_CHECK(poller.IsWatchable(hRecv));
+    BOOST_CHECK(!poller.IsWatchable(INVALID_SOCKET));
+
+    // Nothing to read yet; the other end can be written to
+    BOOST_CHECK(poller.Watch(hRecv, 1, CSocketPoller::POLL_RECV | CSocketPoller::POLL_ERR));
+    BOOST_CHECK(poller.Watch(hSend, 2, CSocketPoller::POLL_SEND));
+    std::vector<CSocketPoller::Event> vEvents = Poll(poller);
+    BOOST_CHECK_EQUAL(EventsFor(vEvents, 1), 0);
+    BOOST_CHECK_EQUAL(EventsFor(vEvents, 2), CSocketPoller::POLL_SEND);
+    for (const CSocketPoller::Event& ev : vEvents) {
+        if (!poller.IsEdgeTriggered())
+            BOOST_CHECK_EQUAL(ev.hSocket, hSend);
+    }
+    poller.Unwatch(hSend);
+
+    WriteByte(hSend);
+    if (!poller.IsEdgeTriggered())
+        BOOST_CHECK(poller.Watch(hRecv, 1, CSocketPoller::POLL_RECV | CSocketPoller::POLL_ERR));
+    vEvents = Poll(poller);
+    BOOST_CHECK_EQUAL(vEvents.size(), 1U);
+    BOOST_CHECK_EQUAL(EventsFor(vEvents, 1), CSocketPoller::POLL_RECV);
+
+    if (poller.IsEdgeTriggered()) {
+        // Still registered, but not reported again until more data arrives
+        BOOST_CHECK(Poll(poller).empty());
+        WriteByte(hSend);
+        BOOST_CHECK_EQUAL(EventsFor(Poll(poller), 1), CSocketPoller::POLL_RECV);
+    } else {
+        // Forgotten after every Wait(), and reported again while unread
+        BOOST_CHECK(Poll(poller).empty());
+        BOOST_CHECK(poller.Watch(hRecv, 1, CSocketPoller::POLL_RECV));
+        BOOST_CHECK_EQUAL(EventsFor(Poll(poller), 1), CSocketPoller::POLL_RECV);
+        BOOST_CHECK(poller.Watch(hRecv, 1, CSocketPoller::POLL_RECV));
+    }
+    BOOST_CHECK(Drain(hRecv) > 0);
+    BOOST_CHECK(Poll(poller).empty());
+
+    // Unwatched sockets are not reported, whatever their state
+    BOOST_CHECK(poller.Watch(hRecv, 1, CSocketPoller::POLL_RECV));
+    poller.Unwatch(hRecv);
+    WriteByte(hSend);
+    BOOST_CHECK(Poll(poller).empty());
+    Drain(hRecv);
+
+    // A closed peer reads as ready, so the socket gets closed too
+    BOOST_CHECK(poller.Watch(hRecv, 1, CSocketPoller::POLL_RECV | CSocketPoller::POLL_ERR));
+    BOOST_CHECK(shutdown(hSend, SHUT_RDWR) == 0);
+    BOOST_CHECK(EventsFor(Poll(poller), 1) & CSocketPoller::POLL_RECV);
+    poller.Unwatch(hRecv);
+}
+
+/** A listening socket with a connection waiting is reported until accepted */
+static void CheckListener(CSocketPoller& poller)
+{
+    SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    BOOST_REQUIRE(hListen != INVALID_SOCKET);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    BOOST_REQUIRE(bind(hListen, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    BOOST_REQUIRE(listen(hListen, 1) == 0);
+    BOOST_REQUIRE(getsockname(hListen, (struct sockaddr*)&addr, &len) == 0);
+
+    SOCKET hConnect = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    BOOST_REQUIRE(hConnect != INVALID_SOCKET);
+    BOOST_REQUIRE(connect(hConnect, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+    const int nEvents = CSocketPoller::POLL_RECV | CSocketPoller::POLL_LEVEL;
+    BOOST_CHECK(poller.Watch(hListen, -1, nEvents));
+    BOOST_CHECK_EQUAL(EventsFor(Poll(poller), -1), CSocketPoller::POLL_RECV);
+    // Not accepted yet: reported again, even by an edge-triggered backend
+    if (!poller.IsEdgeTriggered())
+        BOOST_CHECK(poller.Watch(hListen, -1, nEvents));
+    BOOST_CHECK_EQUAL(EventsFor(Poll(poller), -1), CSocketPoller::POLL_RECV);
+
+    SOCKET hAccepted = accept(hListen, nullptr, nullptr);
+    BOOST_CHECK(hAccepted != INVALID_SOCKET);
+    if (!poller.IsEdgeTriggered())
+        BOOST_CHECK(poller.Watch(hListen, -1, nEvents));
+    BOOST_CHECK(Poll(poller).empty());
+
+    poller.Unwatch(hListen);
+    close(hAccepted);
+    close(hConnect);
+    close(hListen);
+}
+
+BOOST_AUTO_TEST_CASE(select_poller)
+{
+    std::unique_ptr<CSocketPoller> poller = MakeSelectPoller();
+    BOOST_REQUIRE(poller);
+    BOOST_CHECK(!poller->IsEdgeTriggered());
+    CheckPoller(*poller);
+    CheckListener(*poller);
+}
+
+BOOST_AUTO_TEST_CASE(epoll_poller)
+{
+    std::unique_ptr<CSocketPoller> poller = MakeEpollPoller();
+#ifdef USE_EPOLL
+    BOOST_REQUIRE(poller);
+    BOOST_CHECK(poller->IsEdgeTriggered());
+    CheckPoller(*poller);
+    CheckListener(*poller);
+#else
+    BOOST_CHECK(!poller);
+#endif
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif // WIN32
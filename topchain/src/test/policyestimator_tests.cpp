@@ -4,6 +4,9 @@
 
 #include "policy/policy.h"
 #include "policy/fees.h"
+#include "clientversion.h"
+#include "fs.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
@@ -179,4 +182,58 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+// The estimator decays its averages lazily and renormalizes them after long
+// runs of blocks. Check that what it writes after that reads back into the
+// same estimates.
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesWriteRead)
+{
+    CBlockPolicyEstimator feeEst;
+    CTxMemPool mpool(&feeEst);
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 0LL;
+
+    // Enough blocks for the short horizon decay to be renormalized
+    std::vector<CTransactionRef> block;
+    for (int blocknum = 0; blocknum < 2500; blocknum++) {
+        for (int j = 0; j < 5; j++) {
+            tx.vin[0].prevout.n = 100 * blocknum + j;
+            mpool.addUnchecked(tx.GetHash(), entry.Fee(2000 * (j + 1)).Time(GetTime()).Height(blocknum).FromTx(tx));
+            // Higher fee transactions confirm in the next block, lower ones later
+            if (j >= 2 || blocknum % (3 - j) == 0)
+                block.push_back(mpool.get(tx.GetHash()));
+        }
+        mpool.removeForBlock(block, blocknum + 1);
+        block.clear();
+    }
+
+    // As at shutdown: the mempool counts are not written
+    feeEst.FlushUnconfirmed(mpool);
+
+    fs::path path = fs::temp_directory_path() / fs::unique_path();
+    {
+        CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(feeEst.Write(fileout));
+    }
+    CBlockPolicyEstimator feeEstRead;
+    {
+        CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(feeEstRead.Read(filein));
+    }
+    fs::remove(path);
+
+    BOOST_CHECK_EQUAL(feeEstRead.BestSeenHeight(), feeEst.BestSeenHeight());
+    for (FeeEstimateHorizon horizon : {FeeEstimateHorizon::SHORT_HALFLIFE, FeeEstimateHorizon::MED_HALFLIFE, FeeEstimateHorizon::LONG_HALFLIFE}) {
+        for (unsigned int target = 1; target <= feeEst.HighestTargetTracked(horizon); target++) {
+            CFeeRate written = feeEst.estimateRawFee(target, 0.85, horizon);
+            CFeeRate read = feeEstRead.estimateRawFee(target, 0.85, horizon);
+            BOOST_CHECK(written.GetFeePerK() <= read.GetFeePerK() + 1 && read.GetFeePerK() <= written.GetFeePerK() + 1);
+        }
+    }
+    BOOST_CHECK(feeEst.estimateRawFee(2, 0.85, FeeEstimateHorizon::SHORT_HALFLIFE) != CFeeRate(0));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
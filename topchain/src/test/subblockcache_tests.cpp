@@ -0,0 +1,57 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "subblockcache.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(subblockcache_tests, BasicTestingSetup)
+
+static CSubBlockMsgCache::DataRef MakeData(size_t nSize)
+{
+    return std::make_shared<const CNetMsgPayload>(std::vector<unsigned char>(nSize, 0x42));
+}
+
+BOOST_AUTO_TEST_CASE(subblockcache_lru)
+{
+    // Room for a little more than three 10kB messages
+    CSubBlockMsgCache cache(35000);
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 4; i++)
+        hashes.push_back(InsecureRand256());
+
+    BOOST_CHECK(!cache.Get(hashes[0]));
+    for (int i = 0; i < 3; i++)
+        cache.Insert(hashes[i], MakeData(10000));
+    BOOST_CHECK_EQUAL(cache.GetStats().nEntries, 3);
+
+    // Touch the oldest entry so the second one is evicted next
+    BOOST_CHECK(cache.Get(hashes[0]));
+    cache.Insert(hashes[3], MakeData(10000));
+
+    SubBlockCacheStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nEntries, 3);
+    BOOST_CHECK(stats.nUsage <= stats.nMaxUsage);
+    BOOST_CHECK(cache.Get(hashes[0]));
+    BOOST_CHECK(!cache.Get(hashes[1]));
+    BOOST_CHECK(cache.Get(hashes[2]));
+    BOOST_CHECK(cache.Get(hashes[3]));
+
+    stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nHits, 4);
+    BOOST_CHECK_EQUAL(stats.nMisses, 2);
+
+    // Messages larger than the whole cache are not kept
+    cache.Insert(InsecureRand256(), MakeData(40000));
+    BOOST_CHECK_EQUAL(cache.GetStats().nEntries, 3);
+
+    cache.SetMaxUsage(0);
+    stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nEntries, 0);
+    BOOST_CHECK_EQUAL(stats.nUsage, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,184 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "subblockcompress.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/validation.h"
+#include "streams.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(subblockcompress_tests, TestingSetup)
+
+/** A payload like the contract calls subchains publish: the same JSON structure with different values */
+static std::vector<unsigned char> MakePayload(int nCalls)
+{
+    std::string str = "[";
+    for (int i = 0; i < nCalls; i++) {
+        str += strprintf("{\"contract\":\"%s\",\"method\":\"transfer\",\"abi\":{\"inputs\":[{\"name\":\"to\",\"type\":\"address\"},"
+                         "{\"name\":\"value\",\"type\":\"uint256\"}]},\"args\":[\"%s\",%u],\"nonce\":%u},",
+                         InsecureRand256().GetHex().substr(0, 40), InsecureRand256().GetHex().substr(0, 40), InsecureRand32(), InsecureRandRange(1000));
+    }
+    str += "]";
+    return std::vector<unsigned char>(str.begin(), str.end());
+}
+
+static bool RoundTrip(const std::vector<unsigned char>& vDict, const std::vector<unsigned char>& vData, size_t* pnCompressed = nullptr)
+{
+    std::vector<unsigned char> vCompressed;
+    LZCompress(vDict.data(), vDict.size(), vData.data(), vData.size(), vCompressed);
+    if (pnCompressed)
+        *pnCompressed = vCompressed.size();
+    std::vector<unsigned char> vOut(vData.size());
+    return LZDecompress(vDict.data(), vDict.size(), vCompressed.data(), vCompressed.size(), vOut.data(), vOut.size()) && vOut == vData;
+}
+
+BOOST_AUTO_TEST_CASE(lz_roundtrip)
+{
+    const std::vector<unsigned char> vNoDict;
+    BOOST_CHECK(RoundTrip(vNoDict, std::vector<unsigned char>()));
+    BOOST_CHECK(RoundTrip(vNoDict, std::vector<unsigned char>(7, 'a')));
+    BOOST_CHECK(RoundTrip(vNoDict, std::vector<unsigned char>(100000, 'a')));
+
+    std::vector<unsigned char> vRandom(100000);
+    GetRandBytes(vRandom.data(), vRandom.size());
+    size_t nCompressed;
+    BOOST_CHECK(RoundTrip(vNoDict, vRandom, &nCompressed));
+    BOOST_CHECK(nCompressed > vRandom.size());
+
+    // Matches reaching back into the dictionary, also across its end
+    std::vector<unsigned char> vDict = MakePayload(20);
+    std::vector<unsigned char> vData(vDict.end() - 1000, vDict.end());
+    vData.insert(vData.end(), vData.begin(), vData.end());
+    BOOST_CHECK(RoundTrip(vDict, vData, &nCompressed));
+    BOOST_CHECK(nCompressed < 50);
+
+    // Repetitive content beyond the 64 KiB window
+    std::vector<unsigned char> vLarge = MakePayload(2000);
+    BOOST_CHECK(vLarge.size() > 200000);
+    BOOST_CHECK(RoundTrip(vDict, vLarge, &nCompressed));
+    BOOST_CHECK(nCompressed < vLarge.size() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(lz_malformed)
+{
+    const std::vector<unsigned char> vData = MakePayload(50);
+    std::vector<unsigned char> vCompressed;
+    LZCompress(nullptr, 0, vData.data(), vData.size(), vCompressed);
+    std::vector<unsigned char> vOut(vData.size());
+
+    // Wrong sizes
+    BOOST_CHECK(!LZDecompress(nullptr, 0, vCompressed.data(), vCompressed.size(), vOut.data(), vOut.size() - 1));
+    vOut.resize(vData.size() + 1);
+    BOOST_CHECK(!LZDecompress(nullptr, 0, vCompressed.data(), vCompressed.size(), vOut.data(), vOut.size()));
+    vOut.resize(vData.size());
+    BOOST_CHECK(!LZDecompress(nullptr, 0, vCompressed.data(), vCompressed.size() - 1, vOut.data(), vOut.size()));
+    BOOST_CHECK(!LZDecompress(nullptr, 0, vCompressed.data(), 0, vOut.data(), vOut.size()));
+
+    // A match before the start of the data, without a dictionary to reach into
+    const unsigned char vBadOffset[] = {0x10, 'x', 0x02, 0x00, 0x00};
+    BOOST_CHECK(!LZDecompress(nullptr, 0, vBadOffset, sizeof(vBadOffset), vOut.data(), 6));
+
+    // Corruption is detected or at least stays within bounds
+    for (int i = 0; i < 1000; i++) {
+        std::vector<unsigned char> vCorrupt(vCompressed);
+        vCorrupt[InsecureRandRange(vCorrupt.size())] ^= 1 + InsecureRandRange(255);
+        LZDecompress(nullptr, 0, vCorrupt.data(), vCorrupt.size(), vOut.data(), vOut.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(subblock_dictionary)
+{
+    std::deque<std::vector<unsigned char> > vSamples;
+    for (int i = 0; i < 64; i++)
+        vSamples.push_back(MakePayload(10));
+    std::vector<unsigned char> vDict = TrainSubBlockDictionary(vSamples, 8192);
+    BOOST_CHECK(!vDict.empty());
+    BOOST_CHECK(vDict.size() <= 8192);
+    BOOST_CHECK(TrainSubBlockDictionary(std::deque<std::vector<unsigned char> >(), 8192).empty());
+
+    // Small subblocks share little with themselves; the dictionary provides the structure
+    CSubBlock block;
+    block.subChainId = InsecureRand256();
+    block.subblockdata = MakePayload(2);
+    block.nHeight = 7;
+    block.nTime = 1500000000;
+    const CSubBlockDictionary dict(vDict);
+    CCompressedSubBlock withoutDict;
+    CCompressedSubBlock withDict;
+    BOOST_CHECK(CompressSubBlock(block, nullptr, withoutDict));
+    BOOST_CHECK(CompressSubBlock(block, &dict, withDict));
+    BOOST_CHECK(withDict.vchData.size() < withoutDict.vchData.size());
+    BOOST_CHECK(withDict.hashDict == dict.GetHash());
+
+    CSubBlock restored;
+    BOOST_CHECK(DecompressSubBlock(withDict, &dict, restored));
+    BOOST_CHECK(restored.GetHash() == block.GetHash());
+    BOOST_CHECK(!DecompressSubBlock(withDict, nullptr, restored));
+    BOOST_CHECK(!DecompressSubBlock(withoutDict, &dict, restored));
+    BOOST_CHECK(DecompressSubBlock(withoutDict, nullptr, restored));
+    BOOST_CHECK(restored.GetHash() == block.GetHash());
+
+    // The hash of a dictionary read back matches
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << dict;
+    CSubBlockDictionary dictRead;
+    ss >> dictRead;
+    BOOST_CHECK(dictRead.GetHash() == dict.GetHash());
+
+    // Incompressible subblocks are stored as they are
+    block.subblockdata.resize(1000);
+    GetRandBytes(block.subblockdata.data(), block.subblockdata.size());
+    BOOST_CHECK(!CompressSubBlock(block, &dict, withDict));
+}
+
+BOOST_AUTO_TEST_CASE(subblock_store)
+{
+    fSubBlockCompress = true;
+    std::vector<CSubBlock> vBlocks;
+    std::vector<CDiskBlockPos> vPos;
+    size_t nRawSize = 0;
+    {
+        LOCK(cs_main);
+        // Enough subblocks for a dictionary to be trained part way through
+        for (unsigned int i = 0; i < SUBBLOCK_DICT_SAMPLES + 20; i++) {
+            CSubBlock block;
+            block.subChainId = InsecureRand256();
+            block.subblockdata = MakePayload(1 + InsecureRandRange(20));
+            block.nHeight = i;
+            block.nTime = 1500000000 + i;
+            nRawSize += ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + 8;
+            CValidationState state;
+            CDiskBlockPos pos;
+            BOOST_CHECK(SaveSubBlockToDisk(block, state, pos));
+            vBlocks.push_back(block);
+            vPos.push_back(pos);
+        }
+    }
+    fSubBlockCompress = DEFAULT_SUBBLOCK_COMPRESS;
+
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        CSubBlock block;
+        BOOST_CHECK(ReadSubBlockFromDisk(block, vPos[i], Params().GetConsensus()));
+        BOOST_CHECK(block.GetHash() == vBlocks[i].GetHash());
+    }
+    // Dictionaries are read back from the files as well
+    const CDiskBlockPos& posLast = vPos.back();
+    CAutoFile file(OpenSubBlockFile(CDiskBlockPos(posLast.nFile, posLast.nPos - sizeof(uint32_t)), true), SER_DISK, CLIENT_VERSION);
+    uint32_t nSize;
+    file >> nSize;
+    BOOST_CHECK(nSize & SUBBLOCK_RECORD_COMPRESSED);
+    CCompressedSubBlock compressed;
+    file >> compressed;
+    BOOST_CHECK(!compressed.hashDict.IsNull());
+
+    // Storage: the records, dictionary included, take well under the space of the plain ones
+    BOOST_CHECK(posLast.nPos + ::GetSerializeSize(compressed, SER_DISK, CLIENT_VERSION) - vPos.front().nPos + 8 < nRawSize * 2 / 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
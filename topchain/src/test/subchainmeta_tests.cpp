@@ -0,0 +1,434 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "miner.h"
+#include "pow.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+/** A chain with mature coinbases to fund subchain operations from */
+struct SubChainMetaSetup : public TestChain100Setup {
+    int nNextCoinbase = 0;
+
+    //! A transaction spending the next unused coinbase, carrying extData
+    CMutableTransaction MakeMetaTx(const CExtData& extData)
+    {
+        const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+        CMutableTransaction mtx;
+        mtx.nVersion = 1;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(coinbaseTxns[nNextCoinbase++].GetHash(), 0);
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = 11 * CENT;
+        mtx.vout[0].scriptPubKey = scriptPubKey;
+        mtx.extData = extData;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, mtx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        mtx.vin[0].scriptSig << vchSig;
+        return mtx;
+    }
+
+    CMutableTransaction MakeCreateTx(const uint256& subChainId)
+    {
+        CCreateSubChainExt ext;
+        ext.subChainId = subChainId;
+        ext.subChainOwner = InsecureRand256();
+        ext.subChainName = "testchain";
+        ext.subCoinName = "TEST";
+        CExtData extData;
+        extData.nExtType = EXTDATA_CREATESUBCHAIN;
+        extData.data = ext;
+        return MakeMetaTx(extData);
+    }
+
+    CMutableTransaction MakeBackupTx(const uint256& subChainId, uint32_t nSubBlockHeight)
+    {
+        CBackupSubBlockExt ext;
+        ext.subChainId = subChainId;
+        ext.subBlockHash = InsecureRand256();
+        ext.subBlockHeight = nSubBlockHeight;
+        CExtData extData;
+        extData.nExtType = EXTDATA_BACKUPSUBBLOCK;
+        extData.data = ext;
+        return MakeMetaTx(extData);
+    }
+
+    //! A block with txns at nHeight on top of hashPrev, which need not be
+    //! stored yet, built like CreateAndProcessBlock() builds them
+    CBlock CreateMetaBlock(const std::vector<CMutableTransaction>& txns, const uint256& hashPrev, int nHeight)
+    {
+        const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptPubKey);
+        CBlock block = pblocktemplate->block;
+        block.hashPrevBlock = hashPrev;
+        block.nTime += nHeight - (chainActive.Height() + 1);
+        block.vtx.resize(1);
+        for (const CMutableTransaction& tx : txns)
+            block.vtx.push_back(MakeTransactionRef(tx));
+        CBlockIndex indexPrev;
+        indexPrev.nHeight = nHeight - 1;
+        unsigned int extraNonce = 0;
+        IncrementExtraNonce(&block, &indexPrev, extraNonce);
+        while (!CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus())) ++block.nNonce;
+        return block;
+    }
+
+    CBlock ConnectMetaBlock(const std::vector<CMutableTransaction>& txns)
+    {
+        const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+        CBlock block = CreateAndProcessBlock(txns, scriptPubKey);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+        return block;
+    }
+};
+
+/** The operations of a subchain as the pool reports them, oldest first */
+static std::vector<std::pair<uint256, uint8_t> > GetSubChainOps(const CSubChainMetaMemPool& pool, const uint256& subChainId, size_t& nTotal)
+{
+    std::vector<std::pair<uint256, uint8_t> > vOps;
+    nTotal = pool.ForEachSubChainOp(subChainId, 0, [&vOps](const CSubChainMetaMemPoolEntry& entry) {
+        BOOST_CHECK_EQUAL(entry.GetExtData().nExtType, entry.GetOpType());
+        vOps.push_back(std::make_pair(entry.GetTxId(), entry.GetOpType()));
+        return true;
+    });
+    return vOps;
+}
+
+static uint256 GetLatestSubChainOp(const CSubChainMetaMemPool& pool, const uint256& subChainId)
+{
+    uint256 txid;
+    pool.VisitLatestSubChainOp(subChainId, [&txid](const CSubChainMetaMemPoolEntry& entry) {
+        txid = entry.GetTxId();
+        return true;
+    });
+    return txid;
+}
+
+BOOST_FIXTURE_TEST_SUITE(subchainmeta_tests, SubChainMetaSetup)
+
+BOOST_AUTO_TEST_CASE(load_records_and_blocks)
+{
+    const uint256 subChainA = InsecureRand256();
+    const uint256 subChainB = InsecureRand256();
+    const CMutableTransaction createA = MakeCreateTx(subChainA);
+    const CMutableTransaction createB = MakeCreateTx(subChainB);
+    const CMutableTransaction backupA1 = MakeBackupTx(subChainA, 1);
+    const CMutableTransaction backupA2 = MakeBackupTx(subChainA, 2);
+    // A backup of a subchain that was never created is not an operation
+    const CMutableTransaction backupUnknown = MakeBackupTx(InsecureRand256(), 1);
+    ConnectMetaBlock({createA});
+    ConnectMetaBlock({createB, backupA1, backupUnknown});
+    ConnectMetaBlock({backupA2});
+    const int nTipHeight = chainActive.Height();
+
+    // What ConnectBlock wrote
+    CSubChainMetaRecord record;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMeta(subChainA, record));
+    BOOST_CHECK(record.createTxId == createA.GetHash());
+    BOOST_CHECK_EQUAL(record.nCreateHeight, nTipHeight - 2);
+    BOOST_CHECK(record.createExt.subChainOwner == GetExtPayload<CCreateSubChainExt>(createA.extData).subChainOwner);
+    BOOST_CHECK(record.lastTxId == backupA2.GetHash());
+    BOOST_CHECK_EQUAL(record.nOpType, EXTDATA_BACKUPSUBBLOCK);
+    BOOST_CHECK_EQUAL(record.lastExtData.nExtType, EXTDATA_BACKUPSUBBLOCK);
+    BOOST_CHECK_EQUAL(record.nHeight, nTipHeight);
+    BOOST_CHECK_EQUAL(record.nOps, 3U);
+    BOOST_CHECK(!psubchainmeta->ReadSubChainMeta(backupUnknown.extData.GetSubChainId(), record));
+    CDiskTxPos postx;
+    BOOST_CHECK(psubchainmeta->ReadTxIndex(backupA1.GetHash(), postx));
+    BOOST_CHECK(!psubchainmeta->ReadTxIndex(backupUnknown.GetHash(), postx));
+
+    // A node upgraded with subchains already created has records for some
+    // of them and no version marker: everything is rebuilt from the blocks
+    BOOST_CHECK(psubchainmeta->Erase(std::make_pair(DB_SUBCHAIN_META, subChainB), true));
+    BOOST_CHECK(psubchainmeta->Erase(DB_SUBCHAIN_VERSION, true));
+    CSubChainMetaMemPool poolRebuilt;
+    BOOST_CHECK(poolRebuilt.LoadSubChainMetaData());
+    BOOST_CHECK_EQUAL(psubchainmeta->ReadVersion(), SUBCHAIN_META_VERSION);
+    BOOST_CHECK(psubchainmeta->ReadSubChainMeta(subChainB, record));
+    BOOST_CHECK(record.createTxId == createB.GetHash());
+
+    // Loading from the records finds both subchains, labels the create and
+    // the latest backup as what they are, and keeps the operation count
+    CSubChainMetaMemPool poolRecords;
+    BOOST_CHECK(poolRecords.LoadSubChainMetaData());
+    size_t nTotal;
+    std::vector<std::pair<uint256, uint8_t> > vOps = GetSubChainOps(poolRecords, subChainA, nTotal);
+    BOOST_CHECK_EQUAL(nTotal, 3U);
+    BOOST_REQUIRE_EQUAL(vOps.size(), 2U);
+    BOOST_CHECK(vOps[0] == std::make_pair(createA.GetHash(), (uint8_t)EXTDATA_CREATESUBCHAIN));
+    BOOST_CHECK(vOps[1] == std::make_pair(backupA2.GetHash(), (uint8_t)EXTDATA_BACKUPSUBBLOCK));
+    BOOST_CHECK(GetLatestSubChainOp(poolRecords, subChainA) == backupA2.GetHash());
+    vOps = GetSubChainOps(poolRecords, subChainB, nTotal);
+    BOOST_CHECK_EQUAL(nTotal, 1U);
+    BOOST_REQUIRE_EQUAL(vOps.size(), 1U);
+    BOOST_CHECK(vOps[0] == std::make_pair(createB.GetHash(), (uint8_t)EXTDATA_CREATESUBCHAIN));
+
+    // Loading from the blocks has every operation, and agrees with the records
+    CSubChainMetaMemPool poolBlocks;
+    BOOST_CHECK(poolBlocks.LoadSubChainMetaFromBlocks());
+    vOps = GetSubChainOps(poolBlocks, subChainA, nTotal);
+    BOOST_CHECK_EQUAL(nTotal, 3U);
+    BOOST_REQUIRE_EQUAL(vOps.size(), 3U);
+    BOOST_CHECK(vOps[1] == std::make_pair(backupA1.GetHash(), (uint8_t)EXTDATA_BACKUPSUBBLOCK));
+    BOOST_CHECK(GetLatestSubChainOp(poolBlocks, subChainB) == createB.GetHash());
+    // A page starts at its operation number and stops where the visitor does
+    std::vector<uint256> vPage;
+    nTotal = poolBlocks.ForEachSubChainOp(subChainA, 1, [&vPage](const CSubChainMetaMemPoolEntry& entry) {
+        vPage.push_back(entry.GetTxId());
+        return false;
+    });
+    BOOST_CHECK_EQUAL(nTotal, 3U);
+    BOOST_REQUIRE_EQUAL(vPage.size(), 1U);
+    BOOST_CHECK(vPage[0] == backupA1.GetHash());
+    vPage.clear();
+    poolRecords.ForEachSubChainOp(subChainA, 1, [&vPage](const CSubChainMetaMemPoolEntry& entry) {
+        vPage.push_back(entry.GetTxId());
+        return true;
+    });
+    BOOST_REQUIRE_EQUAL(vPage.size(), 1U);
+    BOOST_CHECK(vPage[0] == backupA2.GetHash());
+
+    std::map<uint256, CSubChainMetaRecord> mapFromBlocks;
+    poolBlocks.GetRecords(mapFromBlocks);
+    BOOST_CHECK_EQUAL(mapFromBlocks.size(), 2U);
+    std::map<uint256, CSubChainMetaRecord> mapFromRecords;
+    poolRecords.GetRecords(mapFromRecords);
+    BOOST_CHECK_EQUAL(mapFromRecords.size(), 2U);
+    for (const std::pair<const uint256, CSubChainMetaRecord>& item : mapFromBlocks) {
+        BOOST_CHECK(psubchainmeta->ReadSubChainMeta(item.first, record));
+        for (const CSubChainMetaRecord& other : {record, mapFromRecords[item.first]}) {
+            BOOST_CHECK(other.createTxId == item.second.createTxId);
+            BOOST_CHECK_EQUAL(other.nCreateHeight, item.second.nCreateHeight);
+            BOOST_CHECK(other.lastTxId == item.second.lastTxId);
+            BOOST_CHECK_EQUAL(other.nOpType, item.second.nOpType);
+            BOOST_CHECK_EQUAL(other.nHeight, item.second.nHeight);
+            BOOST_CHECK_EQUAL(other.nOps, item.second.nOps);
+        }
+    }
+
+    // Headers-first sync stores blocks in the order they arrive: here the
+    // backups of a subchain land in the block file before its create, the
+    // latest backup first. The rebuild still replays them in chain order.
+    const uint256 subChainC = InsecureRand256();
+    const CMutableTransaction createC = MakeCreateTx(subChainC);
+    const CMutableTransaction backupC1 = MakeBackupTx(subChainC, 1);
+    const CMutableTransaction backupC2 = MakeBackupTx(subChainC, 2);
+    const CBlock blockCreateC = CreateMetaBlock({createC}, chainActive.Tip()->GetBlockHash(), nTipHeight + 1);
+    const CBlock blockBackupC1 = CreateMetaBlock({backupC1}, blockCreateC.GetHash(), nTipHeight + 2);
+    const CBlock blockBackupC2 = CreateMetaBlock({backupC2}, blockBackupC1.GetHash(), nTipHeight + 3);
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlockHeaders({blockCreateC.GetBlockHeader(), blockBackupC1.GetBlockHeader(), blockBackupC2.GetBlockHeader()}, state, Params()));
+    for (const CBlock* pblock : {&blockBackupC2, &blockBackupC1, &blockCreateC})
+        BOOST_CHECK(ProcessNewBlock(Params(), std::make_shared<const CBlock>(*pblock), true, nullptr));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blockBackupC2.GetHash());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(mapBlockIndex[blockBackupC2.GetHash()]->GetBlockPos().nPos < mapBlockIndex[blockCreateC.GetHash()]->GetBlockPos().nPos);
+    }
+
+    BOOST_CHECK(psubchainmeta->Erase(std::make_pair(DB_SUBCHAIN_META, subChainC), true));
+    BOOST_CHECK(psubchainmeta->Erase(DB_SUBCHAIN_VERSION, true));
+    CSubChainMetaMemPool poolReordered;
+    BOOST_CHECK(poolReordered.LoadSubChainMetaData());
+    BOOST_CHECK(psubchainmeta->ReadSubChainMeta(subChainC, record));
+    BOOST_CHECK(record.createTxId == createC.GetHash());
+    BOOST_CHECK_EQUAL(record.nCreateHeight, nTipHeight + 1);
+    BOOST_CHECK(record.lastTxId == backupC2.GetHash());
+    BOOST_CHECK_EQUAL(record.nHeight, nTipHeight + 3);
+    BOOST_CHECK_EQUAL(record.nOps, 3U);
+    vOps = GetSubChainOps(poolReordered, subChainC, nTotal);
+    BOOST_CHECK_EQUAL(nTotal, 3U);
+    BOOST_REQUIRE_EQUAL(vOps.size(), 2U);
+    BOOST_CHECK(vOps[0].first == createC.GetHash());
+    BOOST_CHECK(vOps[1].first == backupC2.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(disconnect_block)
+{
+    const uint256 subChainA = InsecureRand256();
+    const CMutableTransaction createA = MakeCreateTx(subChainA);
+    const CMutableTransaction backupA1 = MakeBackupTx(subChainA, 1);
+    const CBlock blockCreate = ConnectMetaBlock({createA});
+    const CBlock blockBackup = ConnectMetaBlock({backupA1});
+    BOOST_CHECK(psubchainmeta->ReadBestBlock() == blockBackup.GetHash());
+
+    CSubChainMetaUndo undoBackup;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMetaUndo(blockBackup.GetHash(), undoBackup));
+    BOOST_REQUIRE_EQUAL(undoBackup.vTxIds.size(), 1U);
+    BOOST_CHECK(undoBackup.vTxIds[0] == backupA1.GetHash());
+    BOOST_REQUIRE_EQUAL(undoBackup.vPrevRecords.size(), 1U);
+    BOOST_CHECK(undoBackup.vPrevRecords[0].second.lastTxId == createA.GetHash());
+    CSubChainMetaUndo undoCreate;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMetaUndo(blockCreate.GetHash(), undoCreate));
+
+    CSubChainMetaMemPool pool;
+    BOOST_CHECK(pool.LoadSubChainMetaData());
+    size_t nTotal;
+    BOOST_CHECK_EQUAL(GetSubChainOps(pool, subChainA, nTotal).size(), 2U);
+
+    // Disconnecting the backup restores the record of the create
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[blockBackup.GetHash()]));
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blockCreate.GetHash());
+    }
+    BOOST_CHECK(psubchainmeta->ReadBestBlock() == blockCreate.GetHash());
+    CSubChainMetaRecord record;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMeta(subChainA, record));
+    BOOST_CHECK(record.lastTxId == createA.GetHash());
+    BOOST_CHECK_EQUAL(record.nOpType, EXTDATA_CREATESUBCHAIN);
+    BOOST_CHECK_EQUAL(record.nOps, 1U);
+    CDiskTxPos postx;
+    BOOST_CHECK(!psubchainmeta->ReadTxIndex(backupA1.GetHash(), postx));
+    CSubChainMetaUndo undoMissing;
+    BOOST_CHECK(!psubchainmeta->ReadSubChainMetaUndo(blockBackup.GetHash(), undoMissing));
+
+    pool.DisconnectSubChainOps(undoBackup);
+    std::vector<std::pair<uint256, uint8_t> > vOps = GetSubChainOps(pool, subChainA, nTotal);
+    BOOST_CHECK_EQUAL(nTotal, 1U);
+    BOOST_REQUIRE_EQUAL(vOps.size(), 1U);
+    BOOST_CHECK(vOps[0].first == createA.GetHash());
+    BOOST_CHECK(GetLatestSubChainOp(pool, subChainA) == createA.GetHash());
+
+    // Disconnecting the create removes the subchain
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[blockCreate.GetHash()]));
+    }
+    BOOST_CHECK(!psubchainmeta->ReadSubChainMeta(subChainA, record));
+    BOOST_CHECK(!psubchainmeta->ReadTxIndex(createA.GetHash(), postx));
+    pool.DisconnectSubChainOps(undoCreate);
+    BOOST_CHECK(GetSubChainOps(pool, subChainA, nTotal).empty());
+    BOOST_CHECK_EQUAL(nTotal, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_connect)
+{
+    const uint256 subChainA = InsecureRand256();
+    const CMutableTransaction createA = MakeCreateTx(subChainA);
+    const CMutableTransaction backupA1 = MakeBackupTx(subChainA, 1);
+    const CBlock blockCreate = ConnectMetaBlock({createA});
+    const CBlock blockBackup = ConnectMetaBlock({backupA1});
+    const uint256 hashPrev = blockCreate.hashPrevBlock;
+
+    // Disconnect both blocks, then connect them again in one pipelined run
+    BOOST_REQUIRE(fValidationPipeline && nScriptCheckThreads);
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[blockCreate.GetHash()]));
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashPrev);
+        BOOST_CHECK(ResetBlockFailureFlags(mapBlockIndex[blockCreate.GetHash()]));
+    }
+    BOOST_CHECK(psubchainmeta->ReadBestBlock() == hashPrev);
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blockBackup.GetHash());
+    BOOST_CHECK(psubchainmeta->ReadBestBlock() == blockBackup.GetHash());
+
+    // The backup applied on top of the create, not of the missing subchain
+    CSubChainMetaRecord record;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMeta(subChainA, record));
+    BOOST_CHECK(record.createTxId == createA.GetHash());
+    BOOST_CHECK(record.lastTxId == backupA1.GetHash());
+    BOOST_CHECK_EQUAL(record.nOps, 2U);
+    CDiskTxPos postx;
+    BOOST_CHECK(psubchainmeta->ReadTxIndex(backupA1.GetHash(), postx));
+    CSubChainMetaUndo undo;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMetaUndo(blockBackup.GetHash(), undo));
+    BOOST_REQUIRE_EQUAL(undo.vPrevRecords.size(), 1U);
+    BOOST_CHECK(undo.vPrevRecords[0].second.lastTxId == createA.GetHash());
+    BOOST_CHECK_EQUAL(undo.vPrevRecords[0].second.nOps, 1U);
+
+    // And both disconnect again cleanly
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[blockCreate.GetHash()]));
+    }
+    BOOST_CHECK(psubchainmeta->ReadBestBlock() == hashPrev);
+    BOOST_CHECK(!psubchainmeta->ReadSubChainMeta(subChainA, record));
+    BOOST_CHECK(!psubchainmeta->ReadTxIndex(createA.GetHash(), postx));
+    BOOST_CHECK(!psubchainmeta->ReadTxIndex(backupA1.GetHash(), postx));
+}
+
+BOOST_AUTO_TEST_CASE(replay_after_crash)
+{
+    const uint256 subChainA = InsecureRand256();
+    const CMutableTransaction createA = MakeCreateTx(subChainA);
+    const CMutableTransaction backupA1 = MakeBackupTx(subChainA, 1);
+    ConnectMetaBlock({createA});
+    const CBlock blockBackup = ConnectMetaBlock({backupA1});
+    const uint256 hashPrev = blockBackup.hashPrevBlock;
+
+    // What connecting the backup block wrote
+    std::map<uint256, CSubChainMetaRecord> mapRecords;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMeta(subChainA, mapRecords[subChainA]));
+    CSubChainMetaUndo undo;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMetaUndo(blockBackup.GetHash(), undo));
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos(1);
+    vPos[0].first = backupA1.GetHash();
+    BOOST_CHECK(psubchainmeta->ReadTxIndex(backupA1.GetHash(), vPos[0].second));
+
+    // The metadata is behind the chainstate: the revert of the tip was
+    // written, and the chainstate flushed before the block was disconnected
+    BOOST_CHECK(psubchainmeta->DisconnectSubChainMeta(blockBackup.GetHash(), undo, hashPrev));
+    BOOST_CHECK(ReplaySubChainMeta(Params()));
+    BOOST_CHECK(psubchainmeta->ReadBestBlock() == blockBackup.GetHash());
+    CSubChainMetaRecord record;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMeta(subChainA, record));
+    BOOST_CHECK(record.lastTxId == backupA1.GetHash());
+    BOOST_CHECK_EQUAL(record.nOps, 2U);
+    CDiskTxPos postx;
+    BOOST_CHECK(psubchainmeta->ReadTxIndex(backupA1.GetHash(), postx));
+    BOOST_CHECK(postx.nFile == vPos[0].second.nFile && postx.nPos == vPos[0].second.nPos && postx.nTxOffset == vPos[0].second.nTxOffset);
+    BOOST_CHECK(psubchainmeta->ReadSubChainMetaUndo(blockBackup.GetHash(), undo));
+
+    // The metadata is ahead: the block was written to it, but the chainstate
+    // was last flushed without it
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[blockBackup.GetHash()]));
+    }
+    BOOST_CHECK(psubchainmeta->WriteTxIndex(vPos, mapRecords, blockBackup.GetHash(), undo));
+    BOOST_CHECK(ReplaySubChainMeta(Params()));
+    BOOST_CHECK(psubchainmeta->ReadBestBlock() == hashPrev);
+    BOOST_CHECK(psubchainmeta->ReadSubChainMeta(subChainA, record));
+    BOOST_CHECK(record.lastTxId == createA.GetHash());
+    BOOST_CHECK_EQUAL(record.nOps, 1U);
+    BOOST_CHECK(!psubchainmeta->ReadTxIndex(backupA1.GetHash(), postx));
+}
+
+BOOST_AUTO_TEST_CASE(prune_undo)
+{
+    const uint256 subChainA = InsecureRand256();
+    const CBlock blockCreate = ConnectMetaBlock({MakeCreateTx(subChainA)});
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (unsigned int i = 0; i < MIN_BLOCKS_TO_KEEP; i++)
+        CreateAndProcessBlock({}, scriptPubKey);
+    const CBlock blockBackup = ConnectMetaBlock({MakeBackupTx(subChainA, 1)});
+
+    // Undo data is kept until the chainstate is flushed past it
+    CSubChainMetaUndo undo;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMetaUndo(blockCreate.GetHash(), undo));
+    FlushStateToDisk();
+    BOOST_CHECK(!psubchainmeta->ReadSubChainMetaUndo(blockCreate.GetHash(), undo));
+    BOOST_CHECK(psubchainmeta->ReadSubChainMetaUndo(blockBackup.GetHash(), undo));
+    CSubChainMetaRecord record;
+    BOOST_CHECK(psubchainmeta->ReadSubChainMeta(subChainA, record));
+    BOOST_CHECK_EQUAL(record.nOps, 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
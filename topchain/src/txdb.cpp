@@ -42,19 +42,51 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true),
+    fFlushFailed(false), fFlushStop(false)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_flush);
+        fFlushStop = true;
+    }
+    condFlush.notify_all();
+    // The writer finishes a pending write before it exits
+    if (threadFlush.joinable())
+        threadFlush.join();
+}
+
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_flush);
+        CCoinsMap::const_iterator it = mapFlushing.find(outpoint);
+        if (it != mapFlushing.end()) {
+            coin = it->second.coin;
+            return !coin.IsSpent();
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_flush);
+        CCoinsMap::const_iterator it = mapFlushing.find(outpoint);
+        if (it != mapFlushing.end())
+            return !it->second.coin.IsSpent();
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_flush);
+        if (!hashFlushing.IsNull())
+            return hashFlushing;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -70,6 +102,87 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    // A write still in flight must land first
+    if (!WaitForFlush())
+        return false;
+    return WriteCoins(mapCoins, hashBlock, true);
+}
+
+bool CCoinsViewDB::BatchWriteBackground(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    assert(!hashBlock.IsNull());
+    {
+        boost::unique_lock<boost::mutex> lock(cs_flush);
+        while (!hashFlushing.IsNull() && !fFlushFailed)
+            condFlush.wait(lock);
+        if (fFlushFailed)
+            return false;
+        if (!threadFlush.joinable())
+            threadFlush = std::thread(&TraceThread<std::function<void()> >, "coinsflush", std::function<void()>(std::bind(&CCoinsViewDB::ThreadFlush, this)));
+        assert(mapFlushing.empty());
+        mapFlushing.swap(mapCoins);
+        hashFlushing = hashBlock;
+    }
+    condFlush.notify_all();
+    return true;
+}
+
+bool CCoinsViewDB::WaitForFlush() const {
+    boost::unique_lock<boost::mutex> lock(cs_flush);
+    while (!hashFlushing.IsNull() && !fFlushFailed)
+        condFlush.wait(lock);
+    return !fFlushFailed;
+}
+
+void CCoinsViewDB::ThreadFlush()
+{
+    while (true) {
+        uint256 hashBlock;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_flush);
+            while (hashFlushing.IsNull() && !fFlushStop)
+                condFlush.wait(lock);
+            if (hashFlushing.IsNull())
+                return;
+            hashBlock = hashFlushing;
+        }
+
+        // mapFlushing is left alone by everyone else until hashFlushing is
+        // reset, so it is read here without the lock; readers only look up
+        // entries in it.
+        int64_t nStart = GetTimeMillis();
+        bool fOk = false;
+        try {
+            fOk = WriteCoins(mapFlushing, hashBlock, false);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+
+        if (!fOk) {
+            // Keep the unwritten coins readable so nothing validates against
+            // a database that is missing them, and stop the node.
+            {
+                boost::unique_lock<boost::mutex> lock(cs_flush);
+                fFlushFailed = true;
+            }
+            condFlush.notify_all();
+            uiInterface.ThreadSafeMessageBox(_("Error writing to coin database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+            StartShutdown();
+            return;
+        }
+
+        CCoinsMap mapWritten;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_flush);
+            mapWritten.swap(mapFlushing);
+            hashFlushing.SetNull();
+        }
+        condFlush.notify_all();
+        LogPrint(BCLog::COINDB, "Background flush of %u coins for %s took %dms\n", mapWritten.size(), hashBlock.ToString(), GetTimeMillis() - nStart);
+        // mapWritten is freed here, outside the lock
+    }
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -77,7 +190,10 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
-    uint256 old_tip = GetBestBlock();
+    // Read the database itself: GetBestBlock reports a pending background write as done
+    uint256 old_tip;
+    if (!db.Read(DB_BEST_BLOCK, old_tip))
+        old_tip.SetNull();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
         std::vector<uint256> old_heads = GetHeadBlocks();
@@ -104,8 +220,12 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -164,6 +284,8 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    // Iterate over a database that has every handed over coin in it
+    WaitForFlush();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -251,13 +373,98 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
-bool CSubChainMetaDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+bool CSubChainMetaDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+    return Read(std::make_pair(DB_TXINDEX, txid), pos);
+}
+
+bool CSubChainMetaDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect, const std::map<uint256, CSubChainMetaRecord> &mapRecords,
+                                   const uint256 &hashBlock, const CSubChainMetaUndo &undo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(std::make_pair(DB_TXINDEX, it->first), it->second);
+    for (const std::pair<const uint256, CSubChainMetaRecord>& item : mapRecords)
+        batch.Write(std::make_pair(DB_SUBCHAIN_META, item.first), item.second);
+    if (!undo.IsEmpty())
+        batch.Write(std::make_pair(DB_SUBCHAIN_UNDO, hashBlock), undo);
+    batch.Write(DB_BEST_BLOCK, hashBlock);
     return WriteBatch(batch);
 }
 
+bool CSubChainMetaDB::ReadSubChainMeta(const uint256 &subchainid, CSubChainMetaRecord &record) {
+    return Read(std::make_pair(DB_SUBCHAIN_META, subchainid), record);
+}
+
+bool CSubChainMetaDB::ReadSubChainMetaUndo(const uint256 &hashBlock, CSubChainMetaUndo &undo) {
+    return Read(std::make_pair(DB_SUBCHAIN_UNDO, hashBlock), undo);
+}
+
+bool CSubChainMetaDB::DisconnectSubChainMeta(const uint256 &hashBlock, const CSubChainMetaUndo &undo, const uint256 &hashPrevBlock) {
+    CDBBatch batch(*this);
+    for (const uint256& txid : undo.vTxIds)
+        batch.Erase(std::make_pair(DB_TXINDEX, txid));
+    for (const std::pair<uint256, CSubChainMetaRecord>& item : undo.vPrevRecords) {
+        if (item.second.lastTxId.IsNull())
+            batch.Erase(std::make_pair(DB_SUBCHAIN_META, item.first));
+        else
+            batch.Write(std::make_pair(DB_SUBCHAIN_META, item.first), item.second);
+    }
+    batch.Erase(std::make_pair(DB_SUBCHAIN_UNDO, hashBlock));
+    batch.Write(DB_BEST_BLOCK, hashPrevBlock);
+    return WriteBatch(batch);
+}
+
+uint256 CSubChainMetaDB::ReadBestBlock() {
+    uint256 hashBestBlock;
+    if (!Read(DB_BEST_BLOCK, hashBestBlock))
+        return uint256();
+    return hashBestBlock;
+}
+
+bool CSubChainMetaDB::WriteBestBlock(const uint256 &hashBlock) {
+    return Write(DB_BEST_BLOCK, hashBlock);
+}
+
+bool CSubChainMetaDB::PruneSubChainMetaUndo(const std::function<bool(const uint256&)> &fnPrune) {
+    CDBBatch batch(*this);
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_SUBCHAIN_UNDO, uint256()));
+    while (pcursor->Valid()) {
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_SUBCHAIN_UNDO)
+            break;
+        if (fnPrune(key.second))
+            batch.Erase(key);
+        pcursor->Next();
+    }
+    return WriteBatch(batch);
+}
+
+int CSubChainMetaDB::ReadVersion() {
+    int nVersion = 0;
+    if (!Read(DB_SUBCHAIN_VERSION, nVersion))
+        return 0;
+    return nVersion;
+}
+
+bool CSubChainMetaDB::WriteRebuiltRecords(const std::map<uint256, CSubChainMetaRecord> &mapRecords) {
+    CDBBatch batch(*this);
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    for (char chKey : {DB_SUBCHAIN_META, DB_SUBCHAIN_UNDO}) {
+        pcursor->Seek(std::make_pair(chKey, uint256()));
+        while (pcursor->Valid()) {
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != chKey)
+                break;
+            batch.Erase(key);
+            pcursor->Next();
+        }
+    }
+    for (const std::pair<const uint256, CSubChainMetaRecord>& item : mapRecords)
+        batch.Write(std::make_pair(DB_SUBCHAIN_META, item.first), item.second);
+    batch.Write(DB_SUBCHAIN_VERSION, SUBCHAIN_META_VERSION);
+    return WriteBatch(batch, true);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
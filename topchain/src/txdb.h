@@ -9,9 +9,11 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "sync.h"
 
 #include <map>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -26,6 +28,12 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_SUBCHAIN_META = 's';
+static const char DB_SUBCHAIN_UNDO = 'u';
+static const char DB_SUBCHAIN_VERSION = 'V';
+
+//! Format of the records in the subchain metadata database; older databases are rebuilt on load
+static const int SUBCHAIN_META_VERSION = 1;
 
 class CBlockIndex;
 // class CCoinsViewDBCursor;
@@ -75,21 +83,115 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+/**
+ * Compact per-subchain state kept in the subchain metadata database, so that
+ * the metadata mempool can be rebuilt without touching the block files. The
+ * create operation and the latest operation are kept apart: the latest one
+ * is usually a backup, and the create is what identifies the subchain.
+ */
+struct CSubChainMetaRecord
+{
+    uint256 createTxId;              //!< txid of the create operation
+    int nCreateHeight;               //!< height of the block containing it
+    CCreateSubChainExt createExt;    //!< data the subchain was created with
+    uint256 lastTxId;                //!< txid of the latest metadata operation
+    uint8_t nOpType;                 //!< ExtDataType of the latest operation
+    int nHeight;                     //!< height of the block containing it
+    CExtData lastExtData;            //!< extension data of the latest operation, empty if it is the create
+    uint32_t nOps;                   //!< number of operations on the subchain, the create included
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(createTxId);
+        READWRITE(VARINT(nCreateHeight));
+        READWRITE(createExt);
+        READWRITE(lastTxId);
+        READWRITE(nOpType);
+        READWRITE(VARINT(nHeight));
+        READWRITE(lastExtData);
+        READWRITE(VARINT(nOps));
+    }
+
+    CSubChainMetaRecord() {
+        SetNull();
+    }
+
+    void SetNull() {
+        createTxId.SetNull();
+        nCreateHeight = 0;
+        createExt = CCreateSubChainExt();
+        lastTxId.SetNull();
+        nOpType = EXTDATA_NO;
+        nHeight = 0;
+        lastExtData = CExtData();
+        nOps = 0;
+    }
+};
+
+/**
+ * Subchain metadata written by one block, kept in the metadata database under
+ * the block hash so that disconnecting the block only reverts what it changed.
+ */
+struct CSubChainMetaUndo
+{
+    //! metadata transactions of the block, in block order
+    std::vector<uint256> vTxIds;
+    //! every subchain the block touched with its record before the block; a
+    //! null lastTxId means the subchain had no record yet
+    std::vector<std::pair<uint256, CSubChainMetaRecord> > vPrevRecords;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vTxIds);
+        READWRITE(vPrevRecords);
+    }
+
+    bool IsEmpty() const { return vTxIds.empty(); }
+};
+
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    /**
+     * Background writer. Coins handed over by BatchWriteBackground stay in
+     * mapFlushing, where reads still find them, until the writer thread has
+     * committed them. Only one write is in flight at a time, so writes reach
+     * the database in order.
+     */
+    mutable boost::mutex cs_flush;
+    mutable CConditionVariable condFlush;
+    CCoinsMap mapFlushing;
+    uint256 hashFlushing;   //!< Best block once mapFlushing is written; null when no write is pending
+    bool fFlushFailed;
+    bool fFlushStop;
+    std::thread threadFlush;
+
+    void ThreadFlush();
+    //! Write the dirty entries of mapCoins in -dbbatchsize chunks, erasing all entries from it as they are processed if fErase
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWriteBackground(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! Wait until no background write is pending. Returns false if one failed.
+    bool WaitForFlush() const;
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
@@ -151,6 +253,31 @@ private:
 public:
     // bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    /**
+     * Write the transaction positions, the updated subchain records and the
+     * block's undo data in one batch, and make the block the best block.
+     */
+    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list, const std::map<uint256, CSubChainMetaRecord> &mapRecords,
+                      const uint256 &hashBlock, const CSubChainMetaUndo &undo);
+    bool ReadSubChainMeta(const uint256 &subchainid, CSubChainMetaRecord &record);
+    bool ReadSubChainMetaUndo(const uint256 &hashBlock, CSubChainMetaUndo &undo);
+    //! Revert what WriteTxIndex stored for a block, in one batch, and make its parent the best block
+    bool DisconnectSubChainMeta(const uint256 &hashBlock, const CSubChainMetaUndo &undo, const uint256 &hashPrevBlock);
+    /**
+     * The block the metadata was last written for. It runs ahead of, or
+     * behind, the chainstate until the next chainstate flush; null if the
+     * database predates it.
+     */
+    uint256 ReadBestBlock();
+    bool WriteBestBlock(const uint256 &hashBlock);
+    //! Erase the undo data of every block for which fnPrune returns true
+    bool PruneSubChainMetaUndo(const std::function<bool(const uint256&)> &fnPrune);
+    //! Format of the stored records, 0 if the database predates the version marker
+    int ReadVersion();
+    /**
+     * Replace the records with ones rebuilt from the transaction index and
+     * mark the database as current. Undo data in an older format is dropped.
+     */
+    bool WriteRebuiltRecords(const std::map<uint256, CSubChainMetaRecord> &mapRecords);
 };
 #endif // BITCOIN_TXDB_H
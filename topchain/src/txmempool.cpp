@@ -18,6 +18,11 @@
 #include "utilmoneystr.h"
 #include "utiltime.h"
 
+#include <atomic>
+#include <tuple>
+
+#include <boost/thread.hpp>
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, unsigned int _entryHeight,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
@@ -1067,15 +1072,26 @@ bool CTxMemPool::TransactionWithinChainLimit(const uint256& txid, size_t chainLi
 
 CSubChainMetaMemPoolEntry::CSubChainMetaMemPoolEntry(const CTransactionRef& _tx, const CMetaEntryRef& _previous, 
                     const uint256& _subChainId, uint8_t _nOpType, 
-                    int64_t _nTime, unsigned int _entryHeight, LockPoints lp):
-    tx(_tx), previous(_previous), subChainId(_subChainId), nOpType(_nOpType), nTime(_nTime),
-    entryHeight(_entryHeight), lockPoints(lp) {}
+                    int64_t _nTime, unsigned int _entryHeight, LockPoints lp, uint32_t _nSequence):
+    txid(_tx->GetHash()), tx(_tx), previous(_previous), subChainId(_subChainId), nOpType(_nOpType),
+    nTime(_nTime), entryHeight(_entryHeight), lockPoints(lp), nSequence(_nSequence) {}
+
+CSubChainMetaMemPoolEntry::CSubChainMetaMemPoolEntry(const uint256& _txid, const CExtData& _extData, const CMetaEntryRef& _previous,
+                    const uint256& _subChainId, uint8_t _nOpType,
+                    int64_t _nTime, unsigned int _entryHeight, LockPoints lp, uint32_t _nSequence):
+    txid(_txid), extData(_extData), previous(_previous), subChainId(_subChainId), nOpType(_nOpType),
+    nTime(_nTime), entryHeight(_entryHeight), lockPoints(lp), nSequence(_nSequence) {}
 
 CSubChainMetaMemPoolEntry::CSubChainMetaMemPoolEntry(const CSubChainMetaMemPoolEntry& other)
 {
     *this = other;
 }
 
+CSubChainMetaMemPool::CSubChainMetaMemPool() :
+    mapSubChainMeta(indexed_subchainmeta_set::ctor_args_list(), indexed_subchainmeta_set::allocator_type(&entryArena))
+{
+}
+
 bool CSubChainMetaMemPool::addToMemPool(const CSubChainMetaMemPoolEntry &entry) 
 {
     LOCK(cs_meta);
@@ -1083,10 +1099,10 @@ bool CSubChainMetaMemPool::addToMemPool(const CSubChainMetaMemPoolEntry &entry)
     if (it != mapLastOperation.end())
     {
         uint256 last = it->second;
-        CSubChainMetaMemPoolEntry::CMetaEntryRef ppre = entry.GetSharedPreEntry();
-        if(ppre && last == ppre->GetTx().GetHash())
+        CSubChainMetaMemPoolEntry::CMetaEntryRef ppre = entry.GetPreEntry();
+        if(ppre && last == ppre->GetTxId())
         {
-            it->second = entry.GetTx().GetHash();
+            it->second = entry.GetTxId();
             mapSubChainMeta.insert(entry);
             return true;
         }
@@ -1095,7 +1111,7 @@ bool CSubChainMetaMemPool::addToMemPool(const CSubChainMetaMemPoolEntry &entry)
     {
         if(entry.GetOpType() == EXTDATA_CREATESUBCHAIN)
         {
-            mapLastOperation.insert(std::make_pair(entry.GetSubChainId(), entry.GetTx().GetHash()));
+            mapLastOperation.insert(std::make_pair(entry.GetSubChainId(), entry.GetTxId()));
             mapSubChainMeta.insert(entry);
             return true;
         }
@@ -1106,23 +1122,30 @@ bool CSubChainMetaMemPool::addToMemPool(const CSubChainMetaMemPoolEntry &entry)
 bool CSubChainMetaMemPool::addToMemPool(const CTransactionRef& ptx, int64_t nTime, unsigned int entryHeight, LockPoints lp)
 {
     LOCK(cs_meta);
-    uint256 subchainid = ptx->extData.GetSubChainId();
+    const uint256& subchainid = ptx->GetSubChainId();
     if(!subchainid.IsNull())
     {
         if(ptx->extData.nExtType == EXTDATA_CREATESUBCHAIN)
         {
-            CSubChainMetaMemPoolEntry entry(ptx, CSubChainMetaMemPoolEntry::CMetaEntryRef(), subchainid, ptx->extData.nExtType, nTime, entryHeight, lp);
+            CSubChainMetaMemPoolEntry entry(ptx, CSubChainMetaMemPoolEntry::CMetaEntryRef(), subchainid, ptx->extData.nExtType, nTime, entryHeight, lp, 0);
             return addToMemPool(entry);
         }
         else
         {
             uint256 pretxid = ptx->extData.GetPreTxId();
+            if(pretxid.IsNull())
+            {
+                // Backups do not name the operation they follow; they extend the latest one
+                SubChainHashMap::const_iterator last = mapLastOperation.find(subchainid);
+                if (last != mapLastOperation.end())
+                    pretxid = last->second;
+            }
             if(!pretxid.IsNull())
             {
                 CSubChainMetaMemPoolEntry::CMetaEntryRef ppre = GetEntryByTxId(pretxid);
                 if(ppre)
                 {
-                    CSubChainMetaMemPoolEntry entry(ptx, ppre, subchainid, ptx->extData.nExtType, nTime, entryHeight, lp);
+                    CSubChainMetaMemPoolEntry entry(ptx, ppre, subchainid, ptx->extData.nExtType, nTime, entryHeight, lp, ppre->GetSequence() + 1);
                     return addToMemPool(entry);
                 }
             }
@@ -1131,55 +1154,245 @@ bool CSubChainMetaMemPool::addToMemPool(const CTransactionRef& ptx, int64_t nTim
     return false;
 }
 
-CSubChainMetaMemPoolEntry::CMetaEntryRef CSubChainMetaMemPool::GetEntryByTxId(uint256& txid) const
+CSubChainMetaMemPoolEntry::CMetaEntryRef CSubChainMetaMemPool::GetEntryByTxId(const uint256& txid) const
 {
-    LOCK(cs_meta);
+    AssertLockHeld(cs_meta);
     txid_iterator it =  mapSubChainMeta.find(txid);
     if (it != mapSubChainMeta.end()) 
     {
-        return CSubChainMetaMemPoolEntry::CMetaEntryRef(&*it);
+        return &*it;
     }
     return nullptr;
 }
 
-std::vector<CSubChainMetaMemPoolEntry> CSubChainMetaMemPool::GetEntryBySubChainId(uint256& subchainid)
+size_t CSubChainMetaMemPool::ForEachSubChainOp(const uint256& subchainid, size_t nStart, const SubChainOpVisitor& fn) const
 {
     LOCK(cs_meta);
-    std::vector<CSubChainMetaMemPoolEntry> ret;
-    subchanid_index& idx = mapSubChainMeta.get<1>();
-    subchanid_iterator it = idx.find(subchainid);
-    while(it != idx.end())
-    {
-        ret.push_back(*it);
-        it++;
+    SubChainHashMap::const_iterator last = mapLastOperation.find(subchainid);
+    if (last == mapLastOperation.end())
+        return 0;
+    txid_iterator it = mapSubChainMeta.find(last->second);
+    if (it == mapSubChainMeta.end())
+        return 0;
+    const size_t nOps = it->GetSequence() + 1;
+    if (nStart >= nOps)
+        return nOps;
+
+    const subchanid_index& index = mapSubChainMeta.get<1>();
+    subchanid_iterator end = index.upper_bound(subchainid);
+    for (subchanid_iterator op = index.lower_bound(std::make_tuple(subchainid, (uint32_t)nStart)); op != end; ++op) {
+        if (!fn(*op))
+            break;
     }
-    return ret;
+    return nOps;
+}
+
+bool CSubChainMetaMemPool::VisitLatestSubChainOp(const uint256& subchainid, const SubChainOpVisitor& fn) const
+{
+    LOCK(cs_meta);
+    SubChainHashMap::const_iterator last = mapLastOperation.find(subchainid);
+    if (last == mapLastOperation.end())
+        return false;
+    txid_iterator it = mapSubChainMeta.find(last->second);
+    if (it == mapSubChainMeta.end())
+        return false;
+    fn(*it);
+    return true;
+}
+
+bool CSubChainMetaMemPool::GetSubChainOwner(const uint256& subchainid, uint256& hashOwner) const
+{
+    LOCK(cs_meta);
+    const subchanid_index& index = mapSubChainMeta.get<1>();
+    subchanid_iterator create = index.find(std::make_tuple(subchainid, (uint32_t)0));
+    const CCreateSubChainExt* ext = create != index.end() ? create->GetExtData().Get<CCreateSubChainExt>() : nullptr;
+    if (!ext)
+        return false;
+    hashOwner = ext->subChainOwner;
+    return true;
+}
+
+void CSubChainMetaMemPool::RemoveSubChainOp(const uint256& txid)
+{
+    AssertLockHeld(cs_meta);
+    txid_iterator it = mapSubChainMeta.find(txid);
+    if (it == mapSubChainMeta.end())
+        return;
+
+    SubChainHashMap::iterator last = mapLastOperation.find(it->GetSubChainId());
+    if (last != mapLastOperation.end()) {
+        // Operations are linked oldest to newest, so everything between the
+        // latest operation and this one links to it and would be left dangling
+        std::vector<uint256> vLater;
+        txid_iterator itLast = mapSubChainMeta.find(last->second);
+        CSubChainMetaMemPoolEntry::CMetaEntryRef pentry = itLast == mapSubChainMeta.end() ? nullptr : &*itLast;
+        while (pentry && pentry != &*it) {
+            vLater.push_back(pentry->GetTxId());
+            pentry = pentry->GetPreEntry();
+        }
+        if (pentry) {
+            for (const uint256& later : vLater)
+                mapSubChainMeta.erase(later);
+            if (it->GetPreEntry())
+                last->second = it->GetPreEntry()->GetTxId();
+            else
+                mapLastOperation.erase(last);
+        }
+    }
+    mapSubChainMeta.erase(it);
+}
+
+void CSubChainMetaMemPool::AddRecordEntry(const uint256& subchainid, const CSubChainMetaRecord& record)
+{
+    AssertLockHeld(cs_meta);
+    CSubChainMetaMemPoolEntry::CMetaEntryRef pcreate = GetEntryByTxId(record.createTxId);
+    if (!pcreate) {
+        CExtData createData;
+        createData.nExtType = EXTDATA_CREATESUBCHAIN;
+        createData.data = record.createExt;
+        CSubChainMetaMemPoolEntry entry(record.createTxId, createData, CSubChainMetaMemPoolEntry::CMetaEntryRef(),
+                                        subchainid, EXTDATA_CREATESUBCHAIN, 0, record.nCreateHeight, LockPoints(), 0);
+        pcreate = &*mapSubChainMeta.insert(entry).first;
+    }
+    if (record.lastTxId != record.createTxId && !mapSubChainMeta.count(record.lastTxId)) {
+        // The operations in between are not part of the record; the latest
+        // one links straight to the create and keeps its own number
+        CSubChainMetaMemPoolEntry entry(record.lastTxId, record.lastExtData, pcreate,
+                                        subchainid, record.nOpType, 0, record.nHeight, LockPoints(), record.nOps - 1);
+        mapSubChainMeta.insert(entry);
+    }
+    mapLastOperation[subchainid] = record.lastTxId;
+}
+
+void CSubChainMetaMemPool::GetRecords(std::map<uint256, CSubChainMetaRecord>& mapRecords) const
+{
+    LOCK(cs_meta);
+    for (const std::pair<const uint256, uint256>& item : mapLastOperation) {
+        txid_iterator it = mapSubChainMeta.find(item.second);
+        if (it == mapSubChainMeta.end())
+            continue;
+        CSubChainMetaMemPoolEntry::CMetaEntryRef plast = &*it;
+        CSubChainMetaMemPoolEntry::CMetaEntryRef pcreate = plast;
+        while (pcreate->GetPreEntry())
+            pcreate = pcreate->GetPreEntry();
+        const CCreateSubChainExt* createExt = pcreate->GetExtData().Get<CCreateSubChainExt>();
+        if (!createExt)
+            continue;
+
+        CSubChainMetaRecord& record = mapRecords[item.first];
+        record.createTxId = pcreate->GetTxId();
+        record.nCreateHeight = pcreate->GetHeight();
+        record.createExt = *createExt;
+        record.lastTxId = plast->GetTxId();
+        record.nOpType = plast->GetOpType();
+        record.nHeight = plast->GetHeight();
+        if (plast != pcreate)
+            record.lastExtData = plast->GetExtData();
+        record.nOps = plast->GetSequence() + 1;
+    }
+}
+
+void CSubChainMetaMemPool::DisconnectSubChainOps(const CSubChainMetaUndo& undo)
+{
+    LOCK(cs_meta);
+    for (std::vector<uint256>::const_reverse_iterator it = undo.vTxIds.rbegin(); it != undo.vTxIds.rend(); ++it)
+        RemoveSubChainOp(*it);
+
+    for (const std::pair<uint256, CSubChainMetaRecord>& item : undo.vPrevRecords) {
+        const uint256& subchainid = item.first;
+        const CSubChainMetaRecord& record = item.second;
+        if (record.lastTxId.IsNull()) {
+            // Created by the disconnected block
+            mapLastOperation.erase(subchainid);
+            continue;
+        }
+        // A pool rebuilt from records only knows the latest operation, which
+        // may have been removed above; restore it from the undo record
+        if (mapSubChainMeta.count(record.lastTxId))
+            mapLastOperation[subchainid] = record.lastTxId;
+        else
+            AddRecordEntry(subchainid, record);
+    }
+}
+
+/**
+ * Read the metadata transactions stored in one block file, each with the hash
+ * of its block. The positions must be sorted by offset so that the file is
+ * consumed in a single forward pass.
+ */
+static bool ReadSubChainMetaFile(int nFile, const std::vector<CDiskTxPos>& vPos, std::vector<std::pair<uint256, CTransactionRef> >& vtx)
+{
+    FILE* fileIn = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+    if (!fileIn)
+        return error("%s: OpenBlockFile failed for blk%05u.dat", __func__, nFile);
+
+    // CDiskTxPos::nTxOffset is relative to the end of the block header
+    const uint64_t nHeaderSize = ::GetSerializeSize(CBlockHeader(), SER_DISK, CLIENT_VERSION);
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+    vtx.reserve(vPos.size());
+    try {
+        uint256 hashBlock;
+        unsigned int nBlockPos = std::numeric_limits<unsigned int>::max();
+        for (const CDiskTxPos& postx : vPos) {
+            if (postx.nPos != nBlockPos) {
+                // First transaction of a block: its header comes before it
+                if (!blkdat.SetPos(postx.nPos) && !blkdat.Seek(postx.nPos))
+                    return error("%s: seek to %u in blk%05u.dat failed", __func__, postx.nPos, nFile);
+                CBlockHeader header;
+                blkdat >> header;
+                hashBlock = header.GetHash();
+                nBlockPos = postx.nPos;
+            }
+            uint64_t nTxPos = (uint64_t)postx.nPos + nHeaderSize + postx.nTxOffset;
+            // Stay inside the buffered window when possible, otherwise skip ahead
+            if (!blkdat.SetPos(nTxPos) && !blkdat.Seek(nTxPos))
+                return error("%s: seek to %u in blk%05u.dat failed", __func__, nTxPos, nFile);
+            CTransactionRef ptx;
+            blkdat >> ptx;
+            vtx.push_back(std::make_pair(hashBlock, std::move(ptx)));
+        }
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
 }
 
 bool CSubChainMetaMemPool::LoadSubChainMetaData()
 {
+    if (psubchainmeta->ReadVersion() < SUBCHAIN_META_VERSION) {
+        // Without the version marker there may be records for only some of
+        // the subchains, or none at all: rebuild every one of them once.
+        // cs_main keeps ConnectBlock from writing records in the meantime.
+        LOCK(cs_main);
+        CSubChainMetaMemPool rebuilt;
+        if (!rebuilt.LoadSubChainMetaFromBlocks())
+            return false;
+        std::map<uint256, CSubChainMetaRecord> mapRecords;
+        rebuilt.GetRecords(mapRecords);
+        if (!psubchainmeta->WriteRebuiltRecords(mapRecords))
+            return error("%s: failed to write the rebuilt subchain metadata records", __func__);
+        LogPrintf("Rebuilt %u subchain metadata records\n", mapRecords.size());
+    }
+    return LoadSubChainMetaRecords();
+}
+
+bool CSubChainMetaMemPool::LoadSubChainMetaRecords()
+{
+    int64_t nStart = GetTimeMillis();
     std::unique_ptr<CDBIterator> pcursor(psubchainmeta->NewIterator());
 
-    pcursor->Seek(std::make_pair(DB_TXINDEX, uint256()));
+    pcursor->Seek(std::make_pair(DB_SUBCHAIN_META, uint256()));
 
-    // Load subchain  metadata to subchainmempool
+    LOCK(cs_meta);
+    size_t nCount = 0;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_TXINDEX) {
-            CDiskTxPos postx;
-            if (pcursor->GetValue(postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CTransactionRef ptx;
-                try {
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> ptx;
-                    addToMemPool(ptx,  0, 0, LockPoints());
-                } catch (const std::exception& e) {
-                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-                }
+        if (pcursor->GetKey(key) && key.first == DB_SUBCHAIN_META) {
+            CSubChainMetaRecord record;
+            if (pcursor->GetValue(record)) {
+                AddRecordEntry(key.second, record);
+                nCount++;
                 pcursor->Next();
             } else {
                 return error("%s: failed to read value", __func__);
@@ -1189,6 +1402,93 @@ bool CSubChainMetaMemPool::LoadSubChainMetaData()
         }
     }
 
+    LogPrintf("Loaded %u subchain metadata records in %dms\n", nCount, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CSubChainMetaMemPool::LoadSubChainMetaFromBlocks()
+{
+    int64_t nStart = GetTimeMillis();
+    std::map<int, std::vector<CDiskTxPos> > mapFilePos;
+    size_t nCount = 0;
+    {
+        std::unique_ptr<CDBIterator> pcursor(psubchainmeta->NewIterator());
+
+        pcursor->Seek(std::make_pair(DB_TXINDEX, uint256()));
+
+        // Collect the positions of all subchain metadata transactions, grouped by block file
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, uint256> key;
+            if (pcursor->GetKey(key) && key.first == DB_TXINDEX) {
+                CDiskTxPos postx;
+                if (pcursor->GetValue(postx)) {
+                    mapFilePos[postx.nFile].push_back(postx);
+                    nCount++;
+                    pcursor->Next();
+                } else {
+                    return error("%s: failed to read value", __func__);
+                }
+            } else {
+                break;
+            }
+        }
+    }
+
+    // Sort every file's positions so it is read front to back exactly once
+    std::vector<std::pair<int, std::vector<CDiskTxPos> > > vFilePos(mapFilePos.begin(), mapFilePos.end());
+    for (auto& item : vFilePos) {
+        std::sort(item.second.begin(), item.second.end(), [](const CDiskTxPos& a, const CDiskTxPos& b) {
+            return std::make_pair(a.nPos, a.nTxOffset) < std::make_pair(b.nPos, b.nTxOffset);
+        });
+    }
+
+    // Read and deserialize the block files on a small worker pool
+    std::vector<std::vector<std::pair<uint256, CTransactionRef> > > vFileTxs(vFilePos.size());
+    std::atomic<size_t> nNextFile(0);
+    std::atomic<bool> fFailed(false);
+    auto worker = [&]() {
+        while (!fFailed) {
+            size_t i = nNextFile++;
+            if (i >= vFilePos.size())
+                break;
+            if (!ReadSubChainMetaFile(vFilePos[i].first, vFilePos[i].second, vFileTxs[i]))
+                fFailed = true;
+        }
+    };
+    int nThreads = std::max(1, std::min(std::min((int)vFilePos.size(), GetNumCores()), MAX_SUBCHAIN_META_LOAD_THREADS));
+    boost::thread_group threadGroup;
+    for (int i = 1; i < nThreads; i++)
+        threadGroup.create_thread(worker);
+    worker();
+    threadGroup.join_all();
+    if (fFailed)
+        return false;
+
+    // Block files hold blocks in the order they were downloaded, not in
+    // chain order, and may hold blocks that are not in the active chain.
+    // Every operation of a subchain builds on the one before it, so insert
+    // those of the active chain by height, and by position within a block.
+    LOCK2(cs_main, cs_meta);
+    std::vector<std::tuple<int, unsigned int, CTransactionRef> > vChainTxs;
+    vChainTxs.reserve(nCount);
+    for (size_t i = 0; i < vFileTxs.size(); i++) {
+        for (size_t j = 0; j < vFileTxs[i].size(); j++) {
+            BlockMap::const_iterator mi = mapBlockIndex.find(vFileTxs[i][j].first);
+            if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+                continue;
+            vChainTxs.emplace_back(mi->second->nHeight, vFilePos[i].second[j].nTxOffset, std::move(vFileTxs[i][j].second));
+        }
+    }
+    std::stable_sort(vChainTxs.begin(), vChainTxs.end(), [](const std::tuple<int, unsigned int, CTransactionRef>& a, const std::tuple<int, unsigned int, CTransactionRef>& b) {
+        return std::make_pair(std::get<0>(a), std::get<1>(a)) < std::make_pair(std::get<0>(b), std::get<1>(b));
+    });
+
+    mapSubChainMeta.reserve(mapSubChainMeta.size() + vChainTxs.size());
+    for (const std::tuple<int, unsigned int, CTransactionRef>& item : vChainTxs)
+        addToMemPool(std::get<2>(item), 0, std::get<0>(item), LockPoints());
+
+    LogPrintf("Loaded %u subchain metadata transactions from %u block files in %dms\n", nCount, vFilePos.size(), GetTimeMillis() - nStart);
     return true;
 }
 
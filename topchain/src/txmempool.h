@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <functional>
 #include <memory>
 #include <set>
 #include <map>
@@ -20,10 +21,12 @@
 #include "primitives/transaction.h"
 #include "sync.h"
 #include "random.h"
+#include "support/allocators/pool.h"
 
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index/hashed_index.hpp"
+#include "boost/multi_index/composite_key.hpp"
 #include <boost/multi_index/sequenced_index.hpp>
 
 #include <boost/signals2/signal.hpp>
@@ -136,33 +139,46 @@ public:
 class CSubChainMetaMemPoolEntry
 {
 public:
-    typedef std::shared_ptr<const CSubChainMetaMemPoolEntry> CMetaEntryRef;
+    /**
+     * Reference to an entry inside CSubChainMetaMemPool::mapSubChainMeta.
+     * Container nodes never move, so it stays valid until the entry is
+     * removed; hold cs_meta while dereferencing it. It does not own the entry.
+     */
+    typedef const CSubChainMetaMemPoolEntry* CMetaEntryRef;
 
 private:
-    CTransactionRef tx;
-    CMetaEntryRef previous;
+    uint256 txid;
+    CTransactionRef tx;        //!< Not set for entries rebuilt from the metadata DB
+    CExtData extData;          //!< Only used when tx is not set
+    CMetaEntryRef previous;    //!< Previous operation on the same subchain, or nullptr
     uint256 subChainId;
     uint8_t nOpType;
     int64_t nTime;             //!< Local time when entering the mempool
     unsigned int entryHeight;  //!< Chain height when entering the mempool
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
+    uint32_t nSequence;        //!< Position among the subchain's operations, the create being 0
 
 public:
     CSubChainMetaMemPoolEntry(const CTransactionRef& _tx, const CMetaEntryRef& _previous, 
                     const uint256& _subChainId, uint8_t _nOpType, 
                     int64_t _nTime, unsigned int _entryHeight, 
-                    LockPoints lp);
+                    LockPoints lp, uint32_t _nSequence);
+    CSubChainMetaMemPoolEntry(const uint256& _txid, const CExtData& _extData, const CMetaEntryRef& _previous,
+                    const uint256& _subChainId, uint8_t _nOpType,
+                    int64_t _nTime, unsigned int _entryHeight,
+                    LockPoints lp, uint32_t _nSequence);
 
     CSubChainMetaMemPoolEntry(const CSubChainMetaMemPoolEntry& other);
 
-    const CTransaction& GetTx() const { return *this->tx; }
-    CTransactionRef GetSharedTx() const { return this->tx; }
-    CMetaEntryRef GetSharedPreEntry() const {return this->previous; }
+    const uint256& GetTxId() const { return this->txid; }
+    const CExtData& GetExtData() const { return this->tx ? this->tx->extData : this->extData; }
+    CMetaEntryRef GetPreEntry() const { return this->previous; }
     uint256 GetSubChainId() const {return this->subChainId; }
     uint8_t GetOpType() const {return this->nOpType; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return entryHeight; }
     const LockPoints& GetLockPoints() const { return lockPoints; }
+    uint32_t GetSequence() const { return nSequence; }
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -233,6 +249,16 @@ struct mempoolentry_txid
     }
 };
 
+// extracts the txid of a subchain metadata operation
+struct metaentry_txid
+{
+    typedef uint256 result_type;
+    result_type operator() (const CSubChainMetaMemPoolEntry &entry) const
+    {
+        return entry.GetTxId();
+    }
+};
+
 struct mempoolentry_subchainid
 {
     typedef uint256 result_type;
@@ -243,6 +269,16 @@ struct mempoolentry_subchainid
     }
 };
 
+// extracts the position of a subchain metadata operation among its subchain's operations
+struct metaentry_sequence
+{
+    typedef uint32_t result_type;
+    result_type operator() (const CSubChainMetaMemPoolEntry &entry) const
+    {
+        return entry.GetSequence();
+    }
+};
+
 /** \class CompareTxMemPoolEntryByDescendantScore
  *
  *  Sort an entry by max(score/size of entry's tx, score/size with all descendants).
@@ -709,24 +745,46 @@ private:
     void removeUnchecked(txiter entry, MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
 };
 
+/** Maximum number of threads used to read block files in LoadSubChainMetaData */
+static const int MAX_SUBCHAIN_META_LOAD_THREADS = 4;
+
 struct EntryHasher
 {
     size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
 };
 
+struct CSubChainMetaRecord;
+struct CSubChainMetaUndo;
+
 class CSubChainMetaMemPool
 {
 public:
+    //! Largest allocation served from the entry arena: an entry plus its index links
+    static const size_t META_NODE_MAX_SIZE = sizeof(CSubChainMetaMemPoolEntry) + 8 * sizeof(void*);
+    typedef pool_resource<META_NODE_MAX_SIZE> meta_resource;
+
     typedef boost::multi_index_container<
         CSubChainMetaMemPoolEntry,
         boost::multi_index::indexed_by<
             // sorted by txid
-            boost::multi_index::hashed_unique<mempoolentry_txid, SaltedTxidHasher>,
-            boost::multi_index::hashed_non_unique<mempoolentry_subchainid, SaltedTxidHasher>
-        >
+            boost::multi_index::hashed_unique<metaentry_txid, SaltedTxidHasher>,
+            // sorted by subchain, then operation number
+            boost::multi_index::ordered_unique<
+                boost::multi_index::composite_key<
+                    CSubChainMetaMemPoolEntry,
+                    mempoolentry_subchainid,
+                    metaentry_sequence
+                >
+            >
+        >,
+        pool_allocator<CSubChainMetaMemPoolEntry, META_NODE_MAX_SIZE>
     > indexed_subchainmeta_set;
 
     mutable CCriticalSection cs_meta;
+private:
+    //! Arena the entries are allocated from, guarded by cs_meta. Declared before mapSubChainMeta, which uses it.
+    meta_resource entryArena;
+public:
     indexed_subchainmeta_set mapSubChainMeta;
 
     typedef indexed_subchainmeta_set::nth_index<0>::type::iterator txid_iterator;
@@ -737,11 +795,55 @@ public:
     SubChainHashMap mapLastOperation;
 
 public:
+    CSubChainMetaMemPool();
+
     bool addToMemPool(const CTransactionRef& ptx, int64_t nTime, unsigned int entryHeight, LockPoints lp);
     bool addToMemPool(const CSubChainMetaMemPoolEntry &entry);
-    CSubChainMetaMemPoolEntry::CMetaEntryRef GetEntryByTxId(uint256& txid) const;
-    std::vector<CSubChainMetaMemPoolEntry> GetEntryBySubChainId(uint256& subchainid);
+    /** Look up an entry by txid. The result is only valid while cs_meta is held. */
+    CSubChainMetaMemPoolEntry::CMetaEntryRef GetEntryByTxId(const uint256& txid) const;
+
+    /** Visitor over subchain operations; return false to stop the iteration. */
+    typedef std::function<bool(const CSubChainMetaMemPoolEntry&)> SubChainOpVisitor;
+    /**
+     * Call fn on the operations of a subchain in operation order, oldest first,
+     * skipping the first nStart. Entries are passed by reference with cs_meta
+     * held instead of being copied, so fn must not call back into the pool.
+     * Operations are numbered from the create, and a pool loaded from the
+     * metadata records only holds the create and the latest operation of
+     * each subchain, so nStart counts operation numbers, not entries.
+     * Iteration starts at nStart in the subchain index, so a caller that
+     * stops after a page pays for the page, not for the whole history.
+     * Returns the number of operations on the subchain.
+     */
+    size_t ForEachSubChainOp(const uint256& subchainid, size_t nStart, const SubChainOpVisitor& fn) const;
+    /** Call fn on the latest operation of a subchain only. Returns false if the subchain is unknown. */
+    bool VisitLatestSubChainOp(const uint256& subchainid, const SubChainOpVisitor& fn) const;
+    /** The owner named by the create of a subchain in the pool. Returns false if there is none. */
+    bool GetSubChainOwner(const uint256& subchainid, uint256& hashOwner) const;
+    /**
+     * Load from the per-subchain records. If the database has no records in
+     * the current format, which is the case for nodes upgraded with subchains
+     * already created, they are first rebuilt from the block files.
+     */
     bool LoadSubChainMetaData();
+    //! Rebuild by reading every metadata transaction from the block files
+    bool LoadSubChainMetaFromBlocks();
+    //! The metadata record of every subchain in the pool, as ConnectBlock would have written it
+    void GetRecords(std::map<uint256, CSubChainMetaRecord>& mapRecords) const;
+    /**
+     * Revert a disconnected block: remove its operations, and any later ones
+     * built on them, and point each subchain back at its record from before
+     * the block.
+     */
+    void DisconnectSubChainOps(const CSubChainMetaUndo& undo);
+
+private:
+    //! Remove one operation together with the later operations linking to it
+    void RemoveSubChainOp(const uint256& txid);
+    //! Add the create and the latest operation of a subchain as described by its metadata record
+    void AddRecordEntry(const uint256& subchainid, const CSubChainMetaRecord& record);
+    //! Rebuild from the per-subchain records
+    bool LoadSubChainMetaRecords();
 };
 
 /** 
@@ -8,6 +8,7 @@
 #include "arith_uint256.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "chainsnapshot.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/consensus.h"
@@ -29,6 +30,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "subblockcompress.h"
 #include "timedata.h"
 #include "tinyformat.h"
 #include "txdb.h"
@@ -67,6 +69,7 @@ CBlockIndex *pindexBestHeader = nullptr;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nPrefetchThreads = 0;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
 bool fTxIndex = false;
@@ -76,6 +79,10 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fBackgroundCoinFlush = DEFAULT_BACKGROUND_COIN_FLUSH;
+bool fValidationPipeline = DEFAULT_VALIDATION_PIPELINE;
+bool fCheckSubChainSigs = DEFAULT_CHECK_SUBCHAIN_SIGS;
+bool fSubBlockCompress = DEFAULT_SUBBLOCK_COMPRESS;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -144,6 +151,10 @@ namespace {
     std::vector<CBlockFileInfo> vinfoSubBlockFile;
     int nLastSubBlockFile = 0;
 
+    /** The dictionary most recently written to a subblk file, and its position there. Protected by cs_main. */
+    uint256 hashLastSubBlockDict;
+    CDiskBlockPos posLastSubBlockDict;
+
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -473,6 +484,24 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
     return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
 }
 
+/**
+ * The owner a backup of a subchain is signed by: the one named by the
+ * subchain's create. The records of a block being connected, if given, are
+ * consulted before the metadata database. Null if the subchain does not exist.
+ */
+static uint256 GetRegisteredSubChainOwner(const uint256& subchainid, const std::map<uint256, CSubChainMetaRecord>* pmapRecords)
+{
+    if (pmapRecords) {
+        std::map<uint256, CSubChainMetaRecord>::const_iterator it = pmapRecords->find(subchainid);
+        if (it != pmapRecords->end())
+            return it->second.createExt.subChainOwner;
+    }
+    CSubChainMetaRecord record;
+    if (!psubchainmeta->ReadSubChainMeta(subchainid, record))
+        return uint256();
+    return record.createExt.subChainOwner;
+}
+
 static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                               bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
@@ -838,6 +867,20 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             return false; // state filled in by CheckInputs
         }
 
+        // Subchain owner signature carried in the extension data. A backup
+        // must be signed by the owner of a subchain created on chain or in
+        // the mempool.
+        if (fCheckSubChainSigs && tx.extData.HasOwnerSignature()) {
+            uint256 hashOwner;
+            if (tx.extData.nExtType == EXTDATA_BACKUPSUBBLOCK) {
+                hashOwner = GetRegisteredSubChainOwner(tx.GetSubChainId(), nullptr);
+                if (hashOwner.IsNull())
+                    subchainmempool.GetSubChainOwner(tx.GetSubChainId(), hashOwner);
+            }
+            if (!CachingVerifyExtData(tx, hashOwner, true))
+                return state.DoS(100, false, REJECT_INVALID, "bad-txns-extdata-sig");
+        }
+
         // Check again against the current block tip's script verification
         // flags to cache our script execution flags. This is, of course,
         // useless if the next block has different script flags from the
@@ -942,8 +985,7 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
 {
     CBlockIndex *pindexSlow = nullptr;
 
-    LOCK(cs_main);
-
+    // The mempool and the transaction index can be queried without cs_main
     CTransactionRef ptx = mempool.get(hash);
     if (ptx)
     {
@@ -972,6 +1014,8 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
         }
     }
 
+    LOCK(cs_main);
+
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         const Coin& coin = AccessByTxid(*pcoinsTip, hash);
         if (!coin.IsSpent()) pindexSlow = chainActive[coin.nHeight];
@@ -997,41 +1041,85 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
 //////////////////////////////////////////////////////////////////////////////
 //
 
-bool WriteSubBlockToDisk(const CSubBlock& block, CDiskBlockPos& pos)
+/** Append a record with the given header flags to a subblk file; pos is moved to the record's data */
+template <typename T>
+static bool WriteSubBlockRecord(const T& obj, uint32_t nFlags, CDiskBlockPos& pos)
 {
-   LogPrintf("\nwritenfile=%d npos=%d\n", pos.nFile, pos.nPos);
     // Open history file to append
     CAutoFile fileout(OpenSubBlockFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
-        return error("WriteSubBlockToDisk: OpenSubBlockFile failed");
-
+        return error("%s: OpenSubBlockFile failed", __func__);
 
     const CChainParams& chainparams = Params();
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
-    fileout << FLATDATA(chainparams.MessageStart()) << nSize;
+    unsigned int nSize = GetSerializeSize(fileout, obj);
+    fileout << FLATDATA(chainparams.MessageStart()) << (nSize | nFlags);
 
-    // Write block
+    // Write record
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
-        return error("WriteSubBlockToDisk: ftell failed");
+        return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    fileout << obj;
 
     return true;
 }
 
+bool WriteSubBlockToDisk(const CSubBlock& block, CDiskBlockPos& pos)
+{
+   LogPrintf("\nwritenfile=%d npos=%d\n", pos.nFile, pos.nPos);
+    return WriteSubBlockRecord(block, 0, pos);
+}
+
+/** Restore a subblock from a compressed record in subblk file nFile */
+static bool ExpandSubBlock(const CCompressedSubBlock& compressed, int nFile, CSubBlock& block)
+{
+    CSubBlockDictionaryRef dict;
+    if (!compressed.hashDict.IsNull()) {
+        dict = subblockdictcache.Get(compressed.hashDict);
+        if (!dict) {
+            CDiskBlockPos posDict(nFile, compressed.nDictPos);
+            CAutoFile filein(OpenSubBlockFile(posDict, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("%s: OpenSubBlockFile failed for dictionary at %s", __func__, posDict.ToString());
+            std::shared_ptr<CSubBlockDictionary> dictRead = std::make_shared<CSubBlockDictionary>();
+            try {
+                filein >> *dictRead;
+            } catch (const std::exception& e) {
+                return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), posDict.ToString());
+            }
+            if (dictRead->GetHash() != compressed.hashDict)
+                return error("%s: no dictionary %s at %s", __func__, compressed.hashDict.ToString(), posDict.ToString());
+            dict = dictRead;
+            subblockdictcache.Insert(dict);
+        }
+    }
+    if (!DecompressSubBlock(compressed, dict.get(), block))
+        return error("%s: corrupt compressed subblock in subblk%05u.dat", __func__, nFile);
+    return true;
+}
+
 bool ReadSubBlockFromDisk(CSubBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenSubBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    // Open history file to read, at the size field of the record header
+    // that tells how the subblock is stored
+    if (pos.nPos < sizeof(uint32_t))
+        return error("ReadSubBlockFromDisk: no record at %s", pos.ToString());
+    CAutoFile filein(OpenSubBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(uint32_t)), true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadSubBlockFromDisk: OpenSubBlockFile failed for %s", pos.ToString());
 
     // Read block
     try {
+        uint32_t nSize;
+        filein >> nSize;
+        if (nSize & SUBBLOCK_RECORD_COMPRESSED) {
+            CCompressedSubBlock compressed;
+            filein >> compressed;
+            return ExpandSubBlock(compressed, pos.nFile, block);
+        }
         filein >> block;
     }
     catch (const std::exception& e) {
@@ -1114,6 +1202,64 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+FILE* OpenRawBlockFile(const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start, unsigned int& nSize)
+{
+    // The network magic and the block length are stored right before the block
+    const unsigned int nMetaSize = CMessageHeader::MESSAGE_START_SIZE + sizeof(nSize);
+    if (pos.IsNull() || pos.nPos < nMetaSize) {
+        LogPrintf("%s: no block data at %s\n", __func__, pos.ToString());
+        return nullptr;
+    }
+    CDiskBlockPos posMeta(pos.nFile, pos.nPos - nMetaSize);
+    CAutoFile filein(OpenBlockFile(posMeta, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        LogPrintf("%s: OpenBlockFile failed for %s\n", __func__, pos.ToString());
+        return nullptr;
+    }
+
+    try {
+        CMessageHeader::MessageStartChars blk_start;
+        filein >> FLATDATA(blk_start) >> nSize;
+        if (memcmp(blk_start, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
+            LogPrintf("%s: block magic mismatch at %s\n", __func__, pos.ToString());
+            return nullptr;
+        }
+        if (nSize > MAX_BLOCK_SERIALIZED_SIZE) {
+            LogPrintf("%s: block data at %s larger than the maximum (%u)\n", __func__, pos.ToString(), nSize);
+            return nullptr;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: I/O error - %s at %s\n", __func__, e.what(), pos.ToString());
+        return nullptr;
+    }
+    return filein.release();
+}
+
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& message_start)
+{
+    unsigned int nSize;
+    CAutoFile filein(OpenRawBlockFile(pos, message_start, nSize), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+
+    try {
+        block.resize(nSize);
+        filein.read((char*)block.data(), nSize);
+    } catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    // The serialized header is the first 80 bytes of the block
+    if (block.size() < 80 || Hash(block.begin(), block.begin() + 80) != hash)
+        return error("%s: hash doesn't match %s at %s", __func__, hash.ToString(), pos.ToString());
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+{
+    return ReadRawBlockFromDisk(block, pindex->GetBlockPos(), pindex->GetBlockHash(), message_start);
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1293,6 +1439,8 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 }
 
 bool CScriptCheck::operator()() {
+    if (fExtData)
+        return CachingVerifyExtData(*ptxTo, hashOwner, cacheStore);
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
     return VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata), &error);
@@ -1600,6 +1748,49 @@ static DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex*
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
+/**
+ * Revert the subchain metadata written when the block was connected, using the
+ * undo data stored with it. This writes the metadata database directly, so it
+ * is applied after DisconnectBlock and not by it: DisconnectBlock also runs on
+ * throwaway views in VerifyDB. Undo data is pruned MIN_BLOCKS_TO_KEEP blocks
+ * below the flushed tip, so deeper reorgs leave the metadata as it is.
+ */
+static bool DisconnectSubChainMeta(const CBlock& block, const CBlockIndex* pindex)
+{
+    CSubChainMetaUndo undo;
+    if (!psubchainmeta->ReadSubChainMetaUndo(pindex->GetBlockHash(), undo)) {
+        for (const CTransactionRef& tx : block.vtx) {
+            if (tx->extData.NeedsToSaveMeta()) {
+                LogPrintf("%s: no subchain metadata undo data for block %s, metadata is left as is\n", __func__, pindex->GetBlockHash().ToString());
+                break;
+            }
+        }
+    }
+
+    if (!psubchainmeta->DisconnectSubChainMeta(pindex->GetBlockHash(), undo, pindex->pprev->GetBlockHash()))
+        return error("%s: failed to write subchain metadata for block %s", __func__, pindex->GetBlockHash().ToString());
+    subchainmempool.DisconnectSubChainOps(undo);
+    return true;
+}
+
+/**
+ * Drop subchain metadata undo data no reorg can reach anymore: that of blocks
+ * MIN_BLOCKS_TO_KEEP below the tip, and of blocks we do not know. Blocks above
+ * nDurableHeight may still be rolled back by ReplaySubChainMeta() after a crash
+ * and keep theirs.
+ */
+static bool PruneSubChainMetaUndo(int nDurableHeight)
+{
+    AssertLockHeld(cs_main);
+    const int nPruneHeight = std::min(nDurableHeight, chainActive.Height() - (int)MIN_BLOCKS_TO_KEEP);
+    if (nPruneHeight < 0)
+        return true;
+    return psubchainmeta->PruneSubChainMetaUndo([nPruneHeight](const uint256& hashBlock) {
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+        return it == mapBlockIndex.end() || it->second->nHeight <= nPruneHeight;
+    });
+}
+
 
 void static FlushSubBlockFile(bool fFinalize = false)
 {
@@ -1624,6 +1815,27 @@ void static FlushSubBlockFile(bool fFinalize = false)
     //}
 }
 
+/** Write the dirty subblock index entries and subblock file info to psubblocktree in one batch. */
+static bool FlushSubBlockIndex()
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_LastSubBlockFile);
+
+    std::vector<std::pair<int, const CBlockFileInfo*> > vSubFiles;
+    vSubFiles.reserve(setDirtySubFileInfo.size());
+    for (std::set<int>::iterator it = setDirtySubFileInfo.begin(); it != setDirtySubFileInfo.end(); ) {
+        vSubFiles.push_back(std::make_pair(*it, &vinfoSubBlockFile[*it]));
+        setDirtySubFileInfo.erase(it++);
+    }
+    std::vector<const CSubBlockIndex*> vSubBlocks;
+    vSubBlocks.reserve(setDirtySubBlockIndex.size());
+    for (std::set<CSubBlockIndex*>::iterator it = setDirtySubBlockIndex.begin(); it != setDirtySubBlockIndex.end(); ) {
+        vSubBlocks.push_back(*it);
+        setDirtySubBlockIndex.erase(it++);
+    }
+    return psubblocktree->WriteBatchSync(vSubFiles, nLastSubBlockFile, vSubBlocks);
+}
+
 void static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
@@ -1656,6 +1868,90 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Read of one coin from the database, run on the prefetch threads */
+class CCoinPrefetch
+{
+private:
+    const CCoinsView* db;
+    COutPoint outpoint;
+    Coin* coin;
+    char* pfFound;
+
+public:
+    CCoinPrefetch() : db(nullptr), coin(nullptr), pfFound(nullptr) {}
+    CCoinPrefetch(const CCoinsView* dbIn, const COutPoint& outpointIn, Coin* coinIn, char* pfFoundIn) :
+        db(dbIn), outpoint(outpointIn), coin(coinIn), pfFound(pfFoundIn) {}
+
+    bool operator()()
+    {
+        try {
+            *pfFound = db->GetCoin(outpoint, *coin);
+        } catch (const std::runtime_error&) {
+            // Leave it to the lookup in ConnectBlock, which handles read errors
+            *pfFound = false;
+        }
+        return true;
+    }
+
+    void swap(CCoinPrefetch& check)
+    {
+        std::swap(db, check.db);
+        std::swap(outpoint, check.outpoint);
+        std::swap(coin, check.coin);
+        std::swap(pfFound, check.pfFound);
+    }
+};
+
+// Small batches: every read may wait for the disk, so spread them out
+static CCheckQueue<CCoinPrefetch> prefetchqueue(16);
+
+void ThreadCoinPrefetch() {
+    RenameThread("bitcoin-prefetch");
+    prefetchqueue.Thread();
+}
+
+void PrefetchBlockInputs(const CBlock& block, CCoinsViewCache& cache, const CCoinsView& db)
+{
+    if (!nPrefetchThreads)
+        return;
+
+    // Outputs created in the block itself are not in the database
+    std::vector<uint256> vTxids;
+    vTxids.reserve(block.vtx.size());
+    for (const auto& tx : block.vtx)
+        vTxids.push_back(tx->GetHash());
+    std::sort(vTxids.begin(), vTxids.end());
+
+    std::vector<COutPoint> vOutPoints;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!cache.HaveCoinInCache(txin.prevout) && !std::binary_search(vTxids.begin(), vTxids.end(), txin.prevout.hash))
+                vOutPoints.push_back(txin.prevout);
+        }
+    }
+    if (vOutPoints.empty())
+        return;
+
+    std::vector<Coin> vCoins(vOutPoints.size());
+    std::vector<char> vFound(vOutPoints.size(), false);
+    {
+        std::vector<CCoinPrefetch> vChecks;
+        vChecks.reserve(vOutPoints.size());
+        for (size_t i = 0; i < vOutPoints.size(); i++)
+            vChecks.emplace_back(&db, vOutPoints[i], &vCoins[i], &vFound[i]);
+        CCheckQueueControl<CCoinPrefetch> control(&prefetchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    for (size_t i = 0; i < vOutPoints.size(); i++) {
+        if (vFound[i])
+            cache.AddFetchedCoin(vOutPoints[i], std::move(vCoins[i]));
+    }
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1734,7 +2030,49 @@ static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consens
     return flags;
 }
 
+/**
+ * Apply a subchain metadata operation to the per-subchain records written
+ * alongside the metadata transaction index. Records not yet touched by this
+ * block are read from the metadata database first, and saved to undo as they
+ * were before the block. Returns false, leaving the records alone, for an
+ * operation that does not apply: a create of a subchain that already exists,
+ * or any other operation on one that does not.
+ */
+static bool UpdateSubChainMetaRecord(const CTransaction& tx, int nHeight, std::map<uint256, CSubChainMetaRecord>& mapRecords, CSubChainMetaUndo& undo)
+{
+    const uint256& subchainid = tx.GetSubChainId();
+    if (subchainid.IsNull())
+        return false;
+
+    const bool fCreate = tx.extData.nExtType == EXTDATA_CREATESUBCHAIN;
+    std::map<uint256, CSubChainMetaRecord>::iterator it = mapRecords.find(subchainid);
+    if (it == mapRecords.end()) {
+        CSubChainMetaRecord record;
+        if (!psubchainmeta->ReadSubChainMeta(subchainid, record))
+            record.SetNull();
+        if (fCreate != record.createTxId.IsNull())
+            return false;
+        undo.vPrevRecords.push_back(std::make_pair(subchainid, record));
+        it = mapRecords.insert(std::make_pair(subchainid, record)).first;
+    } else if (fCreate != it->second.createTxId.IsNull()) {
+        return false;
+    }
 
+    CSubChainMetaRecord& record = it->second;
+    if (fCreate) {
+        record.createTxId = tx.GetHash();
+        record.nCreateHeight = nHeight;
+        record.createExt = GetExtPayload<CCreateSubChainExt>(tx.extData);
+        record.lastExtData = CExtData();
+    } else {
+        record.lastExtData = tx.extData;
+    }
+    record.lastTxId = tx.GetHash();
+    record.nOpType = tx.extData.nExtType;
+    record.nHeight = nHeight;
+    record.nOps++;
+    return true;
+}
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
@@ -1744,11 +2082,36 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
- *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
-static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false)
+/**
+ * What is left of connecting a block once ConnectBlockInputs has applied it
+ * to a view: its script checks, which may still be running on the script
+ * check threads, and the undo and index data to write when they pass.
+ */
+struct CBlockConnectPending
+{
+    //! The genesis block has nothing left to do
+    bool fGenesis = false;
+    int nInputs = 0;
+    int64_t nTimeConnectStart = 0;
+    CBlockUndo blockundo;
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    std::vector<std::pair<uint256, CDiskTxPos> > vPosForSubChain;
+    std::map<uint256, CSubChainMetaRecord> mapSubChainRecords;
+    CSubChainMetaUndo subchainundo;
+    //! Referenced by the queued script checks
+    std::vector<PrecomputedTransactionData> txdata;
+    //! Last, so the checks are finished before what they reference is freed
+    std::unique_ptr<CCheckQueueGroupControl<CScriptCheck> > control;
+};
+
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins,
+ *  and queue its script checks in pending.control rather than waiting for them.
+ *  Validity checks that depend on the UTXO set are also done; ConnectBlockInputs()
+ *  can fail if those validity checks fail (among other reasons). The caller must hold
+ *  a CCheckQueueControl on scriptcheckqueue, and keep block alive until the checks
+ *  are finished by FinishConnectBlock(). */
+static bool ConnectBlockInputs(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
+                  CCoinsViewCache& view, const CChainParams& chainparams, CBlockConnectPending& pending, bool fJustCheck)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -1770,6 +2133,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
         if (!fJustCheck)
             view.SetBestBlock(pindex->GetBlockHash());
+        pending.fGenesis = true;
         return true;
     }
 
@@ -1851,22 +2215,25 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
-    CBlockUndo blockundo;
+    CBlockUndo& blockundo = pending.blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    pending.control.reset(new CCheckQueueGroupControl<CScriptCheck>(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr));
+    CCheckQueueGroupControl<CScriptCheck>& control = *pending.control;
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
     int nInputs = 0;
     int64_t nSigOpsCost = 0;
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    std::vector<std::pair<uint256, CDiskTxPos> >& vPos = pending.vPos;
 
-    std::vector<std::pair<uint256, CDiskTxPos> > vPosForSubChain;
+    std::vector<std::pair<uint256, CDiskTxPos> >& vPosForSubChain = pending.vPosForSubChain;
+    std::map<uint256, CSubChainMetaRecord>& mapSubChainRecords = pending.mapSubChainRecords;
+    CSubChainMetaUndo& subchainundo = pending.subchainundo;
 
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<PrecomputedTransactionData> txdata;
+    std::vector<PrecomputedTransactionData>& txdata = pending.txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
@@ -1913,6 +2280,20 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
+            if (fScriptChecks && fCheckSubChainSigs && tx.extData.HasOwnerSignature()) {
+                // Subchains created earlier in this block are in its records already
+                uint256 hashOwner;
+                if (tx.extData.nExtType == EXTDATA_BACKUPSUBBLOCK)
+                    hashOwner = GetRegisteredSubChainOwner(tx.GetSubChainId(), &mapSubChainRecords);
+                CScriptCheck check(tx, hashOwner, fCacheResults);
+                if (nScriptCheckThreads) {
+                    vChecks.push_back(CScriptCheck());
+                    check.swap(vChecks.back());
+                } else if (!check()) {
+                    return state.DoS(100, error("ConnectBlock(): extension data signature of %s is invalid", tx.GetHash().ToString()),
+                                     REJECT_INVALID, "bad-txns-extdata-sig");
+                }
+            }
             control.Add(vChecks);
         }
 
@@ -1925,9 +2306,10 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         //注释单元开始
         //涉及subchain的元数据变更的交易单独摘出来
-        if(tx.extData.NeedsToSaveMeta())
+        if(tx.extData.NeedsToSaveMeta() && UpdateSubChainMetaRecord(tx, pindex->nHeight, mapSubChainRecords, subchainundo))
         {
             vPosForSubChain.push_back(std::make_pair(tx.GetHash(), pos));
+            subchainundo.vTxIds.push_back(tx.GetHash());
         }
         //注释单元结束
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
@@ -1942,7 +2324,29 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
                                block.vtx[0]->GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
-    if (!control.Wait())
+    pending.nInputs = nInputs;
+    pending.nTimeConnectStart = nTime2;
+
+    // add this block to the view's block chain now, as a block pipelined on
+    // top of it is connected before this one is finished
+    if (!fJustCheck)
+        view.SetBestBlock(pindex->GetBlockHash());
+
+    return true;
+}
+
+/** Wait for the script checks of a block applied by ConnectBlockInputs() and,
+ *  unless fJustCheck, write its undo and index data. */
+static bool FinishConnectBlock(CValidationState& state, CBlockIndex* pindex, const CChainParams& chainparams,
+                  CBlockConnectPending& pending, bool fJustCheck)
+{
+    AssertLockHeld(cs_main);
+    if (pending.fGenesis)
+        return true;
+
+    const int nInputs = pending.nInputs;
+    const int64_t nTime2 = pending.nTimeConnectStart;
+    if (!pending.control->Wait())
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
@@ -1950,6 +2354,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     if (fJustCheck)
         return true;
 
+    const CBlockUndo& blockundo = pending.blockundo;
+
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
     {
@@ -1970,17 +2376,14 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     }
 
     if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
+        if (!pblocktree->WriteTxIndex(pending.vPos))
             return AbortNode(state, "Failed to write transaction index");
     //注释单元开始
     //将摘出的涉及子链元数据的交易写入leveldb
-    if (!psubchainmeta->WriteTxIndex(vPosForSubChain))
+    if (!psubchainmeta->WriteTxIndex(pending.vPosForSubChain, pending.mapSubChainRecords, pindex->GetBlockHash(), pending.subchainundo))
         return AbortNode(state, "Failed to write subchainmeta transaction index");
     //注释单元结束
 
-    // add this block to the view's block chain
-    view.SetBestBlock(pindex->GetBlockHash());
-
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
     LogPrint(BCLog::BENCH, "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime5 - nTime4), nTimeIndex * 0.000001);
 
@@ -1990,6 +2393,19 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     return true;
 }
 
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
+ *  can fail if those validity checks fail (among other reasons). */
+static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false)
+{
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    CBlockConnectPending pending;
+    if (!ConnectBlockInputs(block, state, pindex, view, chainparams, pending, fJustCheck))
+        return false;
+    return FinishConnectBlock(state, pindex, chainparams, pending, fJustCheck);
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -2002,6 +2418,7 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
     static int64_t nLastSetChain = 0;
+    static int nLastFlushHeight = -1;
     std::set<int> setFilesToPrune;
     bool fFlushForPrune = false;
     bool fDoFullFlush = false;
@@ -2074,21 +2491,7 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     return AbortNode(state, "Failed to write to block index database");
                 }
 
-                std::vector<std::pair<int, const CBlockFileInfo*> > vSubFiles;
-                vSubFiles.reserve(setDirtySubFileInfo.size());
-                for (std::set<int>::iterator it = setDirtySubFileInfo.begin(); it != setDirtySubFileInfo.end(); ) {
-                    vSubFiles.push_back(std::make_pair(*it, &vinfoSubBlockFile[*it]));
-                    setDirtySubFileInfo.erase(it++);
-                }
-
-
-                std::vector<const CSubBlockIndex*> vSubBlocks;
-                vSubBlocks.reserve(setDirtySubBlockIndex.size());
-                for (std::set<CSubBlockIndex*>::iterator it = setDirtySubBlockIndex.begin(); it != setDirtySubBlockIndex.end(); ) {
-                    vSubBlocks.push_back(*it);
-                    setDirtySubBlockIndex.erase(it++);
-                }
-                if (!psubblocktree->WriteBatchSync(vSubFiles, nLastSubBlockFile, vSubBlocks)) {
+                if (!FlushSubBlockIndex()) {
                     return AbortNode(state, "Failed to write to block index database");
                 }
             }
@@ -2107,9 +2510,18 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Routine flushes only hand the cache over to the database's
+            // writer thread; explicit ones, and those that make room for
+            // pruning, wait for the data to be on disk.
+            bool fBackground = fBackgroundCoinFlush && mode != FLUSH_STATE_ALWAYS && !fFlushForPrune;
+            if (!(fBackground ? pcoinsTip->FlushBackground() : pcoinsTip->Flush()))
                 return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
+            // A background flush may still be in progress, but the previous
+            // one has completed: the chainstate is on disk at least up to it.
+            if (!PruneSubChainMetaUndo(fBackground ? nLastFlushHeight : chainActive.Height()))
+                return AbortNode(state, "Failed to prune subchain metadata undo data");
+            nLastFlushHeight = chainActive.Height();
         }
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2229,6 +2641,8 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
         bool flushed = view.Flush();
         assert(flushed);
     }
+    if (!DisconnectSubChainMeta(block, pindexDelete))
+        return AbortNode(state, "Failed to revert subchain metadata");
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED))
@@ -2256,6 +2670,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2332,43 +2747,89 @@ LogPrintf("runhere46\n");
     }
 };
 
+/** A block being connected to chainActive, between StartConnectTip and FinishConnectTip */
+struct CTipConnectPending
+{
+    CBlockIndex* pindex = nullptr;
+    std::shared_ptr<const CBlock> pblock;
+    //! The block's changes to the UTXO set, not flushed to pcoinsTip yet
+    std::unique_ptr<CCoinsViewCache> view;
+    int64_t nTimeStart = 0;
+    int64_t nTimeLoaded = 0;
+    CBlockConnectPending connect;
+};
+
 /**
- * Connect a new block to chainActive. pblock is either nullptr or a pointer to a CBlock
- * corresponding to pindexNew, to bypass loading it again from disk.
+ * Start connecting a new block to chainActive: load it, and apply it to a
+ * view on top of pviewParent while its script checks are queued. pblock is
+ * either nullptr or a pointer to a CBlock corresponding to pindexNew, to
+ * bypass loading it again from disk.
  *
- * The block is added to connectTrace if connection succeeds.
+ * On failure pending.pblock is only set if the block was loaded, in which
+ * case the failure must be reported with ConnectTipFailed().
  */
-bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+static bool StartConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, CCoinsView* pviewParent, CTipConnectPending& pending)
 {
-    assert(pindexNew->pprev == chainActive.Tip());
+    pending.pindex = pindexNew;
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
-    std::shared_ptr<const CBlock> pthisBlock;
     if (!pblock) {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
-        pthisBlock = pblockNew;
+        pending.pblock = pblockNew;
     } else {
-        pthisBlock = pblock;
+        pending.pblock = pblock;
     }
-    const CBlock& blockConnecting = *pthisBlock;
-    // Apply the block atomically to the chain state.
+    const CBlock& blockConnecting = *pending.pblock;
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
-    int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    pending.nTimeStart = nTime1;
+    pending.nTimeLoaded = nTime2;
+
+    // The block passed CheckBlock when it was accepted. Read the coins it
+    // spends from disk in parallel now, rather than one at a time as
+    // ConnectBlock looks them up.
+    PrefetchBlockInputs(blockConnecting, *pcoinsTip, *pcoinsdbview);
+    int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTimePrefetched - nTime2) * 0.001, nTimePrefetch * 0.000001);
+
+    pending.view.reset(new CCoinsViewCache(pviewParent));
+    return ConnectBlockInputs(blockConnecting, state, pindexNew, *pending.view, chainparams, pending.connect, false);
+}
+
+/** Report a block that StartConnectTip() loaded but that failed to connect */
+static bool ConnectTipFailed(CValidationState& state, const CTipConnectPending& pending)
+{
+    GetMainSignals().BlockChecked(*pending.pblock, state);
+    if (state.IsInvalid())
+        InvalidBlockFound(pending.pindex, state);
+    return error("ConnectTip(): ConnectBlock %s failed", pending.pindex->GetBlockHash().ToString());
+}
+
+/**
+ * Finish connecting a block started by StartConnectTip(), whose parent must
+ * be the tip by now: wait for its script checks, write it and flush its view
+ * to pcoinsTip, and make it the tip.
+ *
+ * The block is added to connectTrace if connection succeeds.
+ */
+static bool FinishConnectTip(CValidationState& state, const CChainParams& chainparams, CTipConnectPending& pending, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+{
+    CBlockIndex* pindexNew = pending.pindex;
+    assert(pindexNew->pprev == chainActive.Tip());
+    const CBlock& blockConnecting = *pending.pblock;
+    int64_t nTime1 = pending.nTimeStart;
+    int64_t nTime2 = pending.nTimeLoaded;
+    // Apply the block atomically to the chain state.
+    int64_t nTime3;
     {
-        CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        if (!FinishConnectBlock(state, pindexNew, chainparams, pending.connect, false))
+            return ConnectTipFailed(state, pending);
         GetMainSignals().BlockChecked(blockConnecting, state);
-        if (!rv) {
-            if (state.IsInvalid())
-                InvalidBlockFound(pindexNew, state);
-            return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
-        }
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
-        bool flushed = view.Flush();
+        bool flushed = pending.view->Flush();
         assert(flushed);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
@@ -2388,7 +2849,77 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
 
-    connectTrace.BlockConnected(pindexNew, std::move(pthisBlock));
+    connectTrace.BlockConnected(pindexNew, pending.pblock);
+    return true;
+}
+
+/**
+ * Connect a new block to chainActive. pblock is either nullptr or a pointer to a CBlock
+ * corresponding to pindexNew, to bypass loading it again from disk.
+ *
+ * The block is added to connectTrace if connection succeeds.
+ */
+bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+{
+    assert(pindexNew->pprev == chainActive.Tip());
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    CTipConnectPending pending;
+    if (!StartConnectTip(state, chainparams, pindexNew, pblock, pcoinsTip, pending))
+        return pending.pblock ? ConnectTipFailed(state, pending) : false;
+    return FinishConnectTip(state, chainparams, pending, connectTrace, disconnectpool);
+}
+
+/**
+ * Connect the blocks of vpindexToConnect (highest first) to chainActive like
+ * ConnectTip() does one at a time, but start on each block before the
+ * script checks of the block before it are finished. While the script
+ * check threads verify block N, this thread fetches the inputs of block
+ * N+1 and applies it to a view on top of block N's, and queues its checks
+ * behind N's. Block N is written and made the tip once its own checks
+ * passed. pblock is either nullptr or a pointer to the CBlock corresponding
+ * to pindexMostWork.
+ *
+ * Block N+1 reads the subchain metadata as block N leaves it, so it is only
+ * started once N is finished if N changed any. At most MAX_PIPELINED_BLOCKS
+ * are connected, so that cs_main is not held for the whole batch.
+ *
+ * Returns false, with state set as by ConnectTip(), at the first block that
+ * fails to connect; the blocks before it stay connected.
+ */
+static bool ConnectTipsPipelined(CValidationState& state, const CChainParams& chainparams, const std::vector<CBlockIndex*>& vpindexToConnect, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+{
+    AssertLockHeld(cs_main);
+    // Keep the script check threads to ourselves while any block is in flight
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    std::unique_ptr<CTipConnectPending> pendingPrev;
+    const size_t nBlocks = std::min(vpindexToConnect.size(), (size_t)MAX_PIPELINED_BLOCKS);
+    for (std::vector<CBlockIndex*>::const_reverse_iterator it = vpindexToConnect.rbegin(); it != vpindexToConnect.rbegin() + nBlocks; ++it) {
+        CBlockIndex *pindexConnect = *it;
+        if (pendingPrev && !pendingPrev->connect.mapSubChainRecords.empty()) {
+            if (!FinishConnectTip(state, chainparams, *pendingPrev, connectTrace, disconnectpool))
+                return false;
+            pendingPrev.reset();
+        }
+        std::unique_ptr<CTipConnectPending> pending(new CTipConnectPending());
+        CValidationState stateStart;
+        bool fStarted = StartConnectTip(stateStart, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(),
+                                        pendingPrev ? pendingPrev->view.get() : pcoinsTip, *pending);
+        if (pendingPrev) {
+            if (!FinishConnectTip(state, chainparams, *pendingPrev, connectTrace, disconnectpool))
+                return false;
+            // The parent view is flushed now; read through to pcoinsTip directly
+            if (pending->view)
+                pending->view->SetBackend(*pcoinsTip);
+            pendingPrev.reset();
+        }
+        if (!fStarted) {
+            state = stateStart;
+            return pending->pblock ? ConnectTipFailed(state, *pending) : false;
+        }
+        pendingPrev = std::move(pending);
+    }
+    if (pendingPrev)
+        return FinishConnectTip(state, chainparams, *pendingPrev, connectTrace, disconnectpool);
     return true;
 }
 
@@ -2502,9 +3033,15 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         }
         nHeight = nTargetHeight;
 
-        // Connect new blocks.
+        // Connect new blocks. When catching up on a chain extending the tip,
+        // pipeline the first blocks of the batch: every block connected
+        // improves on the old tip, so the loop below ends after that one pass.
+        bool fPipeline = fValidationPipeline && nScriptCheckThreads && !fBlocksDisconnected && vpindexToConnect.size() > 1;
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            bool fConnected = fPipeline ?
+                ConnectTipsPipelined(state, chainparams, vpindexToConnect, pindexMostWork, pblock, connectTrace, disconnectpool) :
+                ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool);
+            if (!fConnected) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2610,7 +3147,10 @@ LogPrintf("runhere25\n");
             bool fInvalidFound = false;
             std::shared_ptr<const CBlock> nullBlockPtr;
 LogPrintf("runhere26\n");
-            if (!ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : nullBlockPtr, fInvalidFound, connectTrace))
+            bool fStepOk = ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : nullBlockPtr, fInvalidFound, connectTrace);
+            // Publish the tip reached so far even on failure, blocks may have been disconnected
+            PublishChainSnapshot(chainActive);
+            if (!fStepOk)
                 return false;
 
 LogPrintf("runhere27\n");
@@ -2749,6 +3289,7 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
         it++;
     }
 
+    PublishChainSnapshot(chainActive);
     InvalidChainFound(pindex);
     uiInterface.NotifyBlockTip(IsInitialBlockDownload(), pindex->pprev);
     return true;
@@ -2838,6 +3379,7 @@ static CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     if (pindexBestHeader == nullptr || pindexBestHeader->nChainWork < pindexNew->nChainWork)
         pindexBestHeader = pindexNew;
 
+    blockIndexLookup.Insert(pindexNew);
     setDirtyBlockIndex.insert(pindexNew);
 
     return pindexNew;
@@ -2914,17 +3456,20 @@ bool FindSubBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int n
 
     LogPrintf("nFile=%d nsize=%d\n", pos.nFile, pos.nPos);
 
-    if ((int)nFile != nLastSubBlockFile) {
-        if (!fKnown) {
-            LogPrintf("Leaving block file %i: %s\n", nLastSubBlockFile, vinfoSubBlockFile[nLastBlockFile].ToString());
-        }
-        FlushSubBlockFile(!fKnown);
+    if (fKnown) {
+        // Reindex readers register files concurrently and out of order, and
+        // the data is already on disk: just track the highest file seen.
+        if ((int)nFile > nLastSubBlockFile)
+            nLastSubBlockFile = nFile;
+    } else if ((int)nFile != nLastSubBlockFile) {
+        LogPrintf("Leaving block file %i: %s\n", nLastSubBlockFile, vinfoSubBlockFile[nLastSubBlockFile].ToString());
+        FlushSubBlockFile(true);
         nLastSubBlockFile = nFile;
     }
 
     vinfoSubBlockFile[nFile].AddBlock(nHeight, nTime);
     if (fKnown)
-        vinfoSubBlockFile[nFile].nSize = std::max(pos.nPos + nAddSize, vinfoBlockFile[nFile].nSize);
+        vinfoSubBlockFile[nFile].nSize = std::max(pos.nPos + nAddSize, vinfoSubBlockFile[nFile].nSize);
     else
         vinfoSubBlockFile[nFile].nSize += nAddSize;
     LogPrintf("nFile=%d nsize=%d\n", nFile, vinfoSubBlockFile[nFile].nSize);
@@ -2952,6 +3497,57 @@ bool FindSubBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int n
     return true;
 }
 
+/** Whether nAddSize more bytes still go to subblk file nFile, as the current file */
+static bool FitsLastSubBlockFile(int nFile, unsigned int nAddSize)
+{
+    LOCK(cs_LastSubBlockFile);
+    return nFile == nLastSubBlockFile && (size_t)nFile < vinfoSubBlockFile.size() &&
+           vinfoSubBlockFile[nFile].nSize + nAddSize < MAX_BLOCKFILE_SIZE;
+}
+
+bool SaveSubBlockToDisk(const CSubBlock& block, CValidationState& state, CDiskBlockPos& pos)
+{
+    AssertLockHeld(cs_main);
+
+    CCompressedSubBlock compressed;
+    CSubBlockDictionaryRef dict;
+    bool fCompressed = false;
+    if (fSubBlockCompress) {
+        subblockcompressor.AddSample(block.subblockdata);
+        dict = subblockcompressor.GetDictionary();
+        fCompressed = CompressSubBlock(block, dict.get(), compressed);
+    }
+    if (!fCompressed) {
+        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        if (!FindSubBlockPos(state, pos, nBlockSize+8, block.nHeight, block.GetBlockTime()))
+            return false;
+        if (!WriteSubBlockToDisk(block, pos))
+            return state.Error("Failed to write subblock");
+        return true;
+    }
+
+    // A file with compressed records holds a copy of their dictionary, ahead
+    // of the first of them
+    unsigned int nRecordSize = ::GetSerializeSize(compressed, SER_DISK, CLIENT_VERSION) + 8;
+    bool fWriteDict = dict && !(hashLastSubBlockDict == dict->GetHash() && FitsLastSubBlockFile(posLastSubBlockDict.nFile, nRecordSize));
+    unsigned int nDictSize = fWriteDict ? ::GetSerializeSize(*dict, SER_DISK, CLIENT_VERSION) : 0;
+    if (!FindSubBlockPos(state, pos, (fWriteDict ? nDictSize + 8 : 0) + nRecordSize, block.nHeight, block.GetBlockTime()))
+        return false;
+    if (fWriteDict) {
+        if (!WriteSubBlockRecord(*dict, SUBBLOCK_RECORD_DICTIONARY, pos))
+            return state.Error("Failed to write subblock dictionary");
+        hashLastSubBlockDict = dict->GetHash();
+        posLastSubBlockDict = pos;
+        subblockdictcache.Insert(dict);
+        pos.nPos += nDictSize;
+    }
+    if (dict)
+        compressed.nDictPos = posLastSubBlockDict.nPos;
+    if (!WriteSubBlockRecord(compressed, SUBBLOCK_RECORD_COMPRESSED, pos))
+        return state.Error("Failed to write subblock");
+    return true;
+}
+
 static bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false)
 {
     LOCK(cs_LastBlockFile);
@@ -3463,8 +4059,8 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     return true;
 }
 
-/** Store subblock on disk. If dbp is non-nullptr, the file is known to already reside on disk */
-static bool AcceptSubBlock(const std::shared_ptr<const CSubBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CSubBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+/** Store subblock on disk. If dbp is non-nullptr, the file is known to already reside on disk, in a record of nRecordSize bytes after its header */
+static bool AcceptSubBlock(const std::shared_ptr<const CSubBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CSubBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, unsigned int nRecordSize, bool* fNewBlock)
 {
 LogPrintf("d5\n");
     const CSubBlock& block = *pblock;
@@ -3476,23 +4072,26 @@ LogPrintf("d5\n");
     CSubBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
     CDiskBlockPos blockPos;
+    if (dbp != nullptr)
+        blockPos = *dbp;
     uint256 hash = block.GetHash();
     SubBlockMap::iterator it = mapSubBlockIndex.find(hash);
     if (it == mapSubBlockIndex.end()) {
-        uint32_t nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
-        if (!FindSubBlockPos(state, blockPos, nBlockSize+8, block.nHeight, block.GetBlockTime()))
-        {
-	  LogPrintf("Error: The transaction was rejected! Reason given: %s", state.GetRejectReason());
-          return false;
-        }
-        LogPrintf("beginsave\n");
-        if (!WriteSubBlockToDisk(block, blockPos))
-        {
-          LogPrintf("Fail to write block to disk hash=%s",hash.ToString());
-          return false;
+        if (dbp != nullptr) {
+            if (!FindSubBlockPos(state, blockPos, nRecordSize+8, block.nHeight, block.GetBlockTime(), true))
+            {
+	      LogPrintf("Error: The transaction was rejected! Reason given: %s", state.GetRejectReason());
+              return false;
+            }
+        } else {
+            LogPrintf("beginsave\n");
+            if (!SaveSubBlockToDisk(block, state, blockPos))
+            {
+              LogPrintf("Fail to write block to disk hash=%s reason=%s",hash.ToString(), state.GetRejectReason());
+              return false;
+            }
+            LogPrintf("savesucc\n");
         }
-           
-        LogPrintf("savesucc\n");
         pindex = AddToSubBlockIndex(block, blockPos);
     }else{
         LogPrintf("sameblock repeated recv hash=%s",hash.ToString());
@@ -3516,7 +4115,7 @@ bool ProcessNewSubBlock(const CChainParams& chainparams, const std::shared_ptr<c
 
             // Store to disk
         LogPrintf("runhere12");
-        bool ret = AcceptSubBlock(pblock, state, chainparams, &pindex, fForceProcessing, nullptr, fNewBlock);
+        bool ret = AcceptSubBlock(pblock, state, chainparams, &pindex, fForceProcessing, nullptr, 0, fNewBlock);
         LogPrintf("runhere13");
         if (!ret) {
         LogPrintf("runhere16");
@@ -3956,6 +4555,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
+        blockIndexLookup.Insert(pindex);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
         if (pindex->nTx > 0) {
@@ -4055,6 +4655,7 @@ bool LoadChainTip(const CChainParams& chainparams)
     if (it == mapBlockIndex.end())
         return false;
     chainActive.SetTip(it->second);
+    PublishChainSnapshot(chainActive);
 
     PruneBlockIndexCandidates();
 
@@ -4255,6 +4856,69 @@ bool ReplayBlocks(const CChainParams& params, CCoinsView* view)
     return true;
 }
 
+/** Write the subchain metadata of a block, ignoring that it may be missing from the database. */
+static bool RollforwardSubChainMeta(const CBlockIndex* pindex, const CChainParams& params)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, params.GetConsensus())) {
+        return error("RollforwardSubChainMeta(): ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+    }
+
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    std::map<uint256, CSubChainMetaRecord> mapRecords;
+    CSubChainMetaUndo undo;
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    for (const CTransactionRef& tx : block.vtx) {
+        if (tx->extData.NeedsToSaveMeta() && UpdateSubChainMetaRecord(*tx, pindex->nHeight, mapRecords, undo)) {
+            vPos.push_back(std::make_pair(tx->GetHash(), pos));
+            undo.vTxIds.push_back(tx->GetHash());
+        }
+        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+    return psubchainmeta->WriteTxIndex(vPos, mapRecords, pindex->GetBlockHash(), undo);
+}
+
+bool ReplaySubChainMeta(const CChainParams& params)
+{
+    LOCK(cs_main);
+
+    // The metadata is written as blocks are connected and disconnected, the
+    // chainstate only when it is flushed: after a crash either may be ahead.
+    const CBlockIndex* pindexNew = chainActive.Tip();
+    const uint256 hashMeta = psubchainmeta->ReadBestBlock();
+    if (hashMeta == pindexNew->GetBlockHash()) return true;
+    if (hashMeta.IsNull()) {
+        // Written before the database tracked its best block
+        return psubchainmeta->WriteBestBlock(pindexNew->GetBlockHash());
+    }
+    if (mapBlockIndex.count(hashMeta) == 0) {
+        return error("ReplaySubChainMeta(): subchain metadata is at unknown block %s", hashMeta.ToString());
+    }
+
+    LogPrintf("Replaying subchain metadata\n");
+    const CBlockIndex* pindexOld = mapBlockIndex[hashMeta];
+    const CBlockIndex* pindexFork = LastCommonAncestor(pindexOld, pindexNew);
+    assert(pindexFork != nullptr);
+
+    // The metadata mempool is not loaded yet; only the database is reverted.
+    while (pindexOld != pindexFork) {
+        LogPrintf("Rolling back subchain metadata of %s (%i)\n", pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+        CSubChainMetaUndo undo;
+        psubchainmeta->ReadSubChainMetaUndo(pindexOld->GetBlockHash(), undo);
+        if (!psubchainmeta->DisconnectSubChainMeta(pindexOld->GetBlockHash(), undo, pindexOld->pprev->GetBlockHash())) {
+            return error("ReplaySubChainMeta(): failed to revert subchain metadata at %d, hash=%s", pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
+        }
+        pindexOld = pindexOld->pprev;
+    }
+
+    for (int nHeight = pindexFork->nHeight + 1; nHeight <= pindexNew->nHeight; ++nHeight) {
+        const CBlockIndex* pindex = pindexNew->GetAncestor(nHeight);
+        LogPrintf("Rolling forward subchain metadata of %s (%i)\n", pindex->GetBlockHash().ToString(), nHeight);
+        if (!RollforwardSubChainMeta(pindex, params)) return false;
+    }
+    return true;
+}
+
 bool RewindBlockIndex(const CChainParams& params)
 {
     LOCK(cs_main);
@@ -4288,6 +4952,7 @@ bool RewindBlockIndex(const CChainParams& params)
         if (!FlushStateToDisk(params, state, FLUSH_STATE_PERIODIC))
             return false;
     }
+    PublishChainSnapshot(chainActive);
 
     // Reduce validity flag and have-data flags.
     // We do this after actual disconnecting, otherwise we'll end up writing the lack of data
@@ -4356,6 +5021,7 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(nullptr);
+    PublishChainSnapshot(chainActive);
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
     mempool.clear();
@@ -4375,6 +5041,7 @@ void UnloadBlockIndex()
         delete entry.second;
     }
     mapBlockIndex.clear();
+    blockIndexLookup.Clear();
     fHavePruned = false;
 }
 
@@ -4456,30 +5123,52 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return true;
 }
 
+/** A subblock read by LoadExternalSubBlockFile, and the record it was read from */
+struct CSubBlockImport
+{
+    std::shared_ptr<const CSubBlock> pblock;
+    CDiskBlockPos pos;
+    //! Size of the record on disk, after its header
+    unsigned int nRecordSize;
+};
+
+/** Store a batch of subblocks read by LoadExternalSubBlockFile under a single cs_main acquisition, and write their index entries in one batch. */
+static bool AcceptSubBlockBatch(const CChainParams& chainparams, std::vector<CSubBlockImport>& vBatch, bool fKnown, int& nLoaded)
+{
+    LOCK(cs_main);
+    for (const CSubBlockImport& entry : vBatch) {
+        CValidationState state;
+        if (AcceptSubBlock(entry.pblock, state, chainparams, nullptr, true, fKnown ? &entry.pos : nullptr, entry.nRecordSize, nullptr))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    }
+    vBatch.clear();
+    if (!FlushSubBlockIndex())
+        return AbortNode("Failed to write to subblock index database");
+    return true;
+}
+
 bool LoadExternalSubBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
-LogPrintf("mx1\n");
     int nLoaded = 0;
+    std::vector<CSubBlockImport> vBatch;
+    vBatch.reserve(SUBBLOCK_IMPORT_BATCH_SIZE);
     try {
-LogPrintf("mx2\n");
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
-LogPrintf("mx4\n");
         while (!blkdat.eof()) {
-LogPrintf("mx3\n");
             boost::this_thread::interruption_point();
 
             blkdat.SetPos(nRewind);
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
             unsigned int nSize = 0;
+            uint32_t nFlags = 0;
             try {
-LogPrintf("mx5\n");
                 // locate a header
                 unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
                 blkdat.FindByte(chainparams.MessageStart()[0]);
@@ -4489,13 +5178,14 @@ LogPrintf("mx5\n");
                     continue;
                 // read size
                 blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                nFlags = nSize & SUBBLOCK_RECORD_FLAGS;
+                nSize &= ~SUBBLOCK_RECORD_FLAGS;
+                if (nSize < MIN_SUBBLOCK_RECORD_SIZE || nSize > MAX_BLOCK_SERIALIZED_SIZE)
                     continue;
             } catch (const std::exception&) {
                 // no valid block header found; don't complain
                 break;
             }
-LogPrintf("d3\n");
             try {
                 // read block
                 uint64_t nBlockPos = blkdat.GetPos();
@@ -4503,33 +5193,37 @@ LogPrintf("d3\n");
                     dbp->nPos = nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
+                if (nFlags & SUBBLOCK_RECORD_DICTIONARY) {
+                    // Read when a compressed subblock needs it
+                    nRewind = nBlockPos + nSize;
+                    continue;
+                }
                 std::shared_ptr<CSubBlock> pblock = std::make_shared<CSubBlock>();
-                CSubBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-
-LogPrintf("d1\n");
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 ) {
-LogPrintf("d2\n");
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (AcceptSubBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
-LogPrintf("d4\n");
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if ( mapSubBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint(BCLog::REINDEX, "SubBlock Import: already had subblock %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                if (nFlags & SUBBLOCK_RECORD_COMPRESSED) {
+                    CCompressedSubBlock compressed;
+                    blkdat >> compressed;
+                    nRewind = blkdat.GetPos();
+                    // The dictionary is found through the file's position, so
+                    // compressed subblocks only load from the subblk files
+                    if (!dbp || !ExpandSubBlock(compressed, dbp->nFile, *pblock))
+                        continue;
+                } else {
+                    blkdat >> *pblock;
+                    nRewind = blkdat.GetPos();
                 }
 
+                // Parsing happens without cs_main; subblocks are handed to
+                // AcceptSubBlock (which skips known ones) in batches. A
+                // compressed record takes up nSize, not the expanded size.
+                vBatch.push_back(CSubBlockImport{pblock, dbp ? *dbp : CDiskBlockPos(), nSize});
+                if (vBatch.size() >= SUBBLOCK_IMPORT_BATCH_SIZE && !AcceptSubBlockBatch(chainparams, vBatch, dbp != nullptr, nLoaded))
+                    break;
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
+        if (!vBatch.empty())
+            AcceptSubBlockBatch(chainparams, vBatch, dbp != nullptr, nLoaded);
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -83,6 +83,14 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads reading coins ahead of ConnectBlock */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -dbprefetchthreads default */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum number of threads reading subblock files during -reindex */
+static const int MAX_SUBBLOCK_REINDEX_THREADS = 4;
+/** Number of subblocks read from a file before they are stored and their index entries written */
+static const size_t SUBBLOCK_IMPORT_BATCH_SIZE = 1000;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -132,7 +140,15 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 /** Default for -permitbaremultisig */
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+/** Default for -checksubchainsigs */
+static const bool DEFAULT_CHECK_SUBCHAIN_SIGS = false;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -dbbackgroundflush */
+static const bool DEFAULT_BACKGROUND_COIN_FLUSH = true;
+/** Default for -validationpipeline */
+static const bool DEFAULT_VALIDATION_PIPELINE = true;
+/** Maximum number of blocks to pipeline before releasing cs_main */
+static const unsigned int MAX_PIPELINED_BLOCKS = 4;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
@@ -176,12 +192,21 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nPrefetchThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Whether subchain owner signatures in transaction extension data are verified */
+extern bool fCheckSubChainSigs;
 extern size_t nCoinCacheUsage;
+/** Whether routine UTXO cache flushes are written to disk by a background thread */
+extern bool fBackgroundCoinFlush;
+/** Whether a run of blocks is connected with the script checks of each block overlapping the next */
+extern bool fValidationPipeline;
+/** Whether new subblocks are stored compressed when that saves space */
+extern bool fSubBlockCompress;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -271,6 +296,7 @@ FILE* OpenSubBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
+/** Import subblocks from an external file. Safe to run on several files concurrently, and alongside LoadExternalBlockFile */
 bool LoadExternalSubBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
@@ -285,6 +311,16 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the coin prefetch thread */
+void ThreadCoinPrefetch();
+/**
+ * Read the coins spent by block that are not in cache yet from db, in
+ * parallel on the nPrefetchThreads prefetch threads, and add them to cache.
+ * db must be the database cache is backed by (with no other cache in
+ * between) and be safe to read from several threads. Does nothing without
+ * prefetch threads.
+ */
+void PrefetchBlockInputs(const CBlock& block, CCoinsViewCache& cache, const CCoinsView& db);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -381,12 +417,17 @@ private:
     bool cacheStore;
     ScriptError error;
     PrecomputedTransactionData *txdata;
+    bool fExtData; //!< check the subchain owner signature in ptxTo's extension data instead of an input script
+    uint256 hashOwner; //!< with fExtData, the owner registered for the subchain
 
 public:
-    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), fExtData(false) {}
     CScriptCheck(const CScript& scriptPubKeyIn, const CAmount amountIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
         scriptPubKey(scriptPubKeyIn), amount(amountIn),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn), fExtData(false) { }
+    /** Construct a check of txToIn's subchain owner signature against hashOwnerIn, run on the same queue as the script checks */
+    CScriptCheck(const CTransaction& txToIn, const uint256& hashOwnerIn, bool cacheIn) :
+        amount(0), ptxTo(&txToIn), nIn(0), nFlags(0), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(nullptr), fExtData(true), hashOwner(hashOwnerIn) { }
 
     bool operator()();
 
@@ -399,6 +440,8 @@ public:
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
+        std::swap(fExtData, check.fExtData);
+        std::swap(hashOwner, check.hashOwner);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -411,6 +454,16 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Open the block file at pos, checking the network magic and length stored
+ *  in front of the block. The file is positioned at the block, and nSize set to
+ *  its length. */
+FILE* OpenRawBlockFile(const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start, unsigned int& nSize);
+/** Read a block as it is serialized on disk (which is its network
+ *  serialization including witnesses), without deserializing it. */
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& message_start);
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+/** Store a new subblock in the subblk files, compressed with -subblockcompress; pos receives its position */
+bool SaveSubBlockToDisk(const CSubBlock& block, CValidationState& state, CDiskBlockPos& pos);
 bool ReadSubBlockFromDisk(CSubBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadSubBlockFromDisk(CSubBlock& block, const CSubBlockIndex* pindex, const Consensus::Params& consensusParams);
 
@@ -444,6 +497,8 @@ public:
 
 /** Replay blocks that aren't fully applied to the database. */
 bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
+/** Bring the subchain metadata database to chainActive's tip after an unclean shutdown. */
+bool ReplaySubChainMeta(const CChainParams& params);
 
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
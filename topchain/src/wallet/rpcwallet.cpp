@@ -33,11 +33,11 @@
 #include <univalue.h>
 
 static const std::string WALLET_ENDPOINT_BASE = "/wallet/";
+//! Paid to the platform by every backup-subblock transaction
+//! TODO: read from genesis
+static const CAmount BACKUP_SUBBLOCK_AMOUNT = COIN / 100;
 static std::map<std::string, bool>  vbridge_owner_methods;
 
-extern bool FindSubBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false);
-
-extern bool WriteSubBlockToDisk(const CSubBlock& block, CDiskBlockPos& pos);
 extern CSubBlockIndex* AddToSubBlockIndex(const CSubBlock& block, const CDiskBlockPos& pos);
 extern SubBlockMap mapSubBlockIndex;
 extern void RelaySubBlock(const CSubBlock& block, CConnman* connman);
@@ -528,6 +528,23 @@ static void SendMoney(CWallet * const pwallet, const CTxDestination &address, CA
     }
 }
 
+/** Store a subblock that is being backed up, unless it is already known */
+static void WriteBackupSubBlock(const CSubBlock& block)
+{
+    AssertLockHeld(cs_main);
+
+    uint256 hash = block.GetHash();
+    if (mapSubBlockIndex.count(hash)) {
+        LogPrintf("sameblock repeated recv hash=%s\n", hash.ToString());
+        return;
+    }
+    CValidationState state;
+    CDiskBlockPos blockPos;
+    if (!SaveSubBlockToDisk(block, state, blockPos))
+        throw std::runtime_error(strprintf("Error: The transaction was rejected! Reason given: %s", state.GetRejectReason()));
+    AddToSubBlockIndex(block, blockPos);
+}
+
 UniValue commitsubchaininfo(const JSONRPCRequest& request)
 {
 
@@ -602,35 +619,17 @@ UniValue commitsubchaininfo(const JSONRPCRequest& request)
      CSubBlock block;
     if(wtxNew.tx->extData.nExtType == EXTDATA_BACKUPSUBBLOCK){
      LogPrintf("\nhere1\n");
-	    CDiskBlockPos blockPos;
-	    unsigned int nBlockSize = 0;
 	    const CBackupSubBlockExt* extblock = NULL;
 	    LogPrintf("blocksize=%d", subchainblockdata.getValStr().size());
 	    block.subblockdata = ParseHex(subchainblockdata.getValStr()); 
 	    if(block.subblockdata.size() == 0){
 		    throw std::runtime_error("lack suchainblockdata");
 	    }
-	    extblock = boost::any_cast<CBackupSubBlockExt>(&(wtxNew.tx->extData.data)); 
+	    extblock = wtxNew.tx->extData.Get<CBackupSubBlockExt>(); 
 
 	    //write subblockdata to file 
 	    block.nHeight =  extblock->subBlockHeight; 
-
-            uint256 hash = block.GetHash(); 
-	    SubBlockMap::iterator it = mapSubBlockIndex.find(hash);
-            if (it == mapSubBlockIndex.end()) {
-		    nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
-		    if (!FindSubBlockPos(state, blockPos, nBlockSize+8, block.nHeight, block.GetBlockTime()))
-		    {
-			    throw std::runtime_error(strprintf("Error: The transaction was rejected! Reason given: %s", state.GetRejectReason()));
-		    }
-		    LogPrintf("beginsave\n");
-		    if (!WriteSubBlockToDisk(block, blockPos))
-			    throw JSONRPCError(RPC_WALLET_ERROR, "Fail to write block to disk");
-		    LogPrintf("savesucc\n");
-		    AddToSubBlockIndex(block, blockPos);
-            }else{
-              LogPrintf("sameblock repeated recv hash=%s",hash.ToString());
-           }
+	    WriteBackupSubBlock(block);
     }
 
      LogPrintf("here34\n");
@@ -759,14 +758,11 @@ UniValue gensubchainblock(const JSONRPCRequest& request)
     LogPrintf("\nh8\n");
         throw std::runtime_error("createsign fail");
     }
-    extdata.signature << vchSig; 
+    extdata.signature << vchSig << ToByteVector(::bridgeownerpwallet->vchDefaultKey);
     LogPrintf("\nh6\n");
 
     // Amount
-    // TODO: read from gensis
-    CAmount nAmount = AmountFromValue("0.01");
-    if (nAmount <= 0)
-        throw JSONRPCError(RPC_TYPE_ERROR, "Invalid amount for send");
+    CAmount nAmount = BACKUP_SUBBLOCK_AMOUNT;
 
     // Wallet comments
     CWalletTx wtx;
@@ -798,6 +794,195 @@ UniValue gensubchainblock(const JSONRPCRequest& request)
 }
 
 
+UniValue fundbackuplanes(const JSONRPCRequest& request)
+{
+    CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
+    if (!EnsureWalletIsAvailable(pwallet, request.fHelp)) {
+        return NullUniValue;
+    }
+
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw std::runtime_error(
+            "fundbackuplanes \"subchainid\" ( lanes amount )\n"
+            "\nSet coins aside for the backup transactions of a subchain, see submitsubblocks.\n"
+            "One transaction creates the given number of lanes. Each lane pays for backups with\n"
+            "its own chain of unconfirmed transactions, so the number of lanes bounds how many\n"
+            "backups can wait for the same topchain block. Until the funding transaction confirms,\n"
+            "its lanes together are also held to the mempool descendant limit of that transaction.\n"
+            "The lanes are kept in memory only: after a restart their coins are ordinary wallet coins again.\n"
+            + HelpRequiringPassphrase(pwallet) +
+            "\nArguments:\n"
+            "1. \"subchainid\"     (string, required) The subchain id\n"
+            "2. lanes              (numeric, optional, default=" + std::to_string(DEFAULT_BACKUP_LANES) + ") The number of lanes to add\n"
+            "3. amount             (numeric or string, optional, default=1) The amount in " + CURRENCY_UNIT + " of each lane\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\": \"id\",     (string) The funding transaction id\n"
+            "  \"lanes\": n         (numeric) The lanes the subchain has now\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("fundbackuplanes", "\"cf057bbfb72640471fd910bcb67639c22df9f92470936cddc1ade0e2f2e7dc4e\" 16")
+            + HelpExampleRpc("fundbackuplanes", "\"cf057bbfb72640471fd910bcb67639c22df9f92470936cddc1ade0e2f2e7dc4e\", 16, 0.5")
+        );
+
+    uint256 subChainId = ParseHashV(request.params[0], "subchainid");
+    int nLanes = DEFAULT_BACKUP_LANES;
+    if (request.params.size() > 1 && !request.params[1].isNull())
+        nLanes = request.params[1].get_int();
+    if (nLanes <= 0 || (unsigned int)nLanes > MAX_BACKUP_LANES)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid number of lanes, must be between 1 and %d", MAX_BACKUP_LANES));
+    CAmount nLaneValue = COIN;
+    if (request.params.size() > 2 && !request.params[2].isNull())
+        nLaneValue = AmountFromValue(request.params[2]);
+    if (nLaneValue <= BACKUP_SUBBLOCK_AMOUNT)
+        throw JSONRPCError(RPC_TYPE_ERROR, "Lane amount must exceed the backup payment");
+
+    LOCK2(cs_main, pwallet->cs_wallet);
+    EnsureWalletIsUnlocked(pwallet);
+
+    if (pwallet->GetBroadcastTransactions() && !g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    CWalletTx wtx;
+    std::string strError;
+    if (!pwallet->FundBackupLanes(subChainId, nLanes, nLaneValue, g_connman.get(), wtx, strError))
+        throw JSONRPCError(RPC_WALLET_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("txid", wtx.GetHash().GetHex()));
+    ret.push_back(Pair("lanes", (uint64_t)pwallet->mapBackupLanes[subChainId].vLanes.size()));
+    return ret;
+}
+
+UniValue submitsubblocks(const JSONRPCRequest& request)
+{
+    CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
+    if (!EnsureWalletIsAvailable(pwallet, request.fHelp)) {
+        return NullUniValue;
+    }
+
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "submitsubblocks \"subblocks\"\n"
+            "\nBack up a batch of subblocks in one call. This does gensubchainblock and commitsubchaininfo\n"
+            "for each subblock, without the round trip. Each subblock is stored and relayed. A backup\n"
+            "transaction pays for it from one of its subchain's lanes (see fundbackuplanes) instead of\n"
+            "going through coin selection. POST /binary/submitsubblocks (or /wallet/<name>/binary/submitsubblocks)\n"
+            "takes the serialized batch as the raw request body and returns the serialized txids.\n"
+            + HelpRequiringPassphrase(pwallet) +
+            "\nArguments:\n"
+            "1. \"subblocks\"      (string, required) The hex of the serialized vector of subblocks\n"
+            "                      (subchain id, data, height and time of each)\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"txid\"            (string) The backup transaction of each subblock, in order\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("submitsubblocks", "\"subblocks\"")
+        );
+
+    std::vector<CSubBlock> vSubBlocks;
+    std::vector<unsigned char> vData;
+    if (request.fBinary)
+        vData.assign(request.params[0].get_str().begin(), request.params[0].get_str().end());
+    else
+        vData = ParseHexV(request.params[0], "subblocks");
+    try {
+        CDataStream ssData(vData, SER_NETWORK, PROTOCOL_VERSION);
+        ssData >> vSubBlocks;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Subblock batch decode failed");
+    }
+    if (vSubBlocks.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Empty subblock batch");
+
+    LOCK2(cs_main, pwallet->cs_wallet);
+    EnsureWalletIsUnlocked(pwallet);
+
+    if (!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    CGenesisCoinBaseExt genesis;
+    CBitcoinAddress address(genesis.platformAddress);
+    if (!address.IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
+
+    // Sign the owner extensions of the whole batch with one key lookup
+    CKey keyOwner;
+    if (!::bridgeownerpwallet || !::bridgeownerpwallet->GetKey(::bridgeownerpwallet->vchDefaultKey.GetID(), keyOwner))
+        throw std::runtime_error("createsign fail");
+    const std::vector<unsigned char> vchOwnerPubKey = ToByteVector(::bridgeownerpwallet->vchDefaultKey);
+
+    std::vector<CBackupSubBlockExt> vExt;
+    for (const CSubBlock& block : vSubBlocks) {
+        if (block.subblockdata.empty())
+            throw std::runtime_error("lack suchainblockdata");
+        CBackupSubBlockExt ext;
+        ext.subChainId = block.subChainId;
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << block.subblockdata;
+        ext.subBlockHash = ss.GetHash();
+        ext.subBlockHeight = block.nHeight;
+        std::vector<unsigned char> vchSig;
+        if (!keyOwner.Sign(ext.GetSignatureHash(), vchSig))
+            throw std::runtime_error("createsign fail");
+        ext.signature = CScript() << vchSig << vchOwnerPubKey;
+        vExt.push_back(ext);
+    }
+
+    // Store the subblocks first. Lanes move on as soon as their transactions
+    // are built, so nothing may fail between building and committing them.
+    for (const CSubBlock& block : vSubBlocks)
+        WriteBackupSubBlock(block);
+
+    std::vector<CWalletTx> vwtx;
+    std::string strError;
+    bool fCreated = pwallet->CreateBackupTransactions(vExt, GetScriptForDestination(address.Get()), BACKUP_SUBBLOCK_AMOUNT, vwtx, strError);
+
+    std::vector<uint256> vTxid;
+    // Backups that did not make it into the mempool, and those chained on them
+    std::set<uint256> setRejected;
+    std::string strReject;
+    for (size_t i = 0; i < vwtx.size(); i++) {
+        CWalletTx& wtx = vwtx[i];
+        if (setRejected.count(wtx.tx->vin[0].prevout.hash)) {
+            setRejected.insert(wtx.GetHash());
+            continue;
+        }
+        wtx.mapValue["comment"] = "gensubblock tx=" + vSubBlocks[i].subChainId.GetHex();
+        // Lanes pay their change to themselves: nothing is taken from the keypool
+        CReserveKey reservekey(pwallet);
+        CValidationState state;
+        if (!pwallet->CommitTransaction(wtx, reservekey, g_connman.get(), state) || !state.IsValid() ||
+            (pwallet->GetBroadcastTransactions() && !wtx.InMempool())) {
+            if (strReject.empty())
+                strReject = strprintf("The backup of subblock %u was rejected: %s", i, FormatStateMessage(state));
+            pwallet->AbandonTransaction(wtx.GetHash());
+            setRejected.insert(wtx.GetHash());
+            continue;
+        }
+        RelaySubBlock(vSubBlocks[i], g_connman.get());
+        vTxid.push_back(wtx.GetHash());
+    }
+    if (!setRejected.empty()) {
+        pwallet->RollBackBackupTransactions(vwtx, setRejected);
+        throw JSONRPCError(RPC_WALLET_ERROR, strprintf("%s (backed up %u of %u subblocks)", strReject, vTxid.size(), vSubBlocks.size()));
+    }
+    if (!fCreated)
+        throw JSONRPCError(RPC_WALLET_ERROR, strprintf("%s (backed up %u of %u subblocks)", strError, vwtx.size(), vSubBlocks.size()));
+
+    if (request.fBinary) {
+        CDataStream ssTxid(SER_NETWORK, PROTOCOL_VERSION);
+        ssTxid << vTxid;
+        return ssTxid.str();
+    }
+    UniValue ret(UniValue::VARR);
+    for (const uint256& txid : vTxid)
+        ret.push_back(txid.GetHex());
+    return ret;
+}
+
 UniValue createsubchaininfo(const JSONRPCRequest& request)
 {
     CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
@@ -811,7 +996,8 @@ UniValue createsubchaininfo(const JSONRPCRequest& request)
             "\ncreatesubchain gen a transaction of an amount to a light platform.\n"
             + HelpRequiringPassphrase(pwallet) +
             "\nArguments:\n"
-            "1. \"subchainowner\"            (string, required) subchainowner.\n"
+            "1. \"subchainowner\"            (string, required) subchainowner, the hash of the bridge owner public key that signs for the subchain.\n"
+            "                                With -checksubchainsigs it must be the key hash of the bridge owner wallet.\n"
             "2. \"subchainid\"            (string, required) subchainid.\n"
             "3. \"subchainname\"            (string, required) subchainname.\n"
             "4. \"subcoinname\"            (string, required) subcoinname.\n"
@@ -820,6 +1006,9 @@ UniValue createsubchaininfo(const JSONRPCRequest& request)
             "\"transactiondata\"                  (transaction) data.\n"
         );
 
+    if (!::bridgeownerpwallet)
+        throw JSONRPCError(RPC_WALLET_NOT_FOUND, "Bridge owner wallet is not loaded");
+
     LOCK2(cs_main, pwallet->cs_wallet);
 
     //TODO change it to get platform addr
@@ -852,6 +1041,13 @@ UniValue createsubchaininfo(const JSONRPCRequest& request)
 
     uint256 usubchainowner = uint256S(subchainowner.getValStr());
     uint256 usubchainid = uint256S(subchainid.getValStr());
+    // Where signatures are checked, backups are only valid when signed by
+    // the owner the create names
+    if (fCheckSubChainSigs) {
+        const uint256 hashBridgeOwner = GetSubChainOwner(::bridgeownerpwallet->vchDefaultKey);
+        if (usubchainowner != hashBridgeOwner)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "subchainowner must be the bridge owner key hash " + hashBridgeOwner.GetHex());
+    }
 
     CCreateSubChainExt extdata;
     extdata.subChainOwner = usubchainowner;
@@ -866,7 +1062,7 @@ UniValue createsubchaininfo(const JSONRPCRequest& request)
     if(!signresult){
         throw std::runtime_error("createsign fail");
     }
-    extdata.signature << vchSig; 
+    extdata.signature << vchSig << ToByteVector(::bridgeownerpwallet->vchDefaultKey); 
     std::string tmps; 
     tmps.assign(vchSig.begin(),vchSig.end());
     LogPrintf("signdatas[%d][%s]",tmps.size(), tmps.c_str());
@@ -3708,6 +3904,8 @@ static const CRPCCommand commands[] =
     { "wallet",             "createsubchaininfo",       &createsubchaininfo,       false,  {"subchainowner","subchainid","subchainname","subcoinname","subchainseeds","signature"} },
     { "wallet",             "gensubchainblock",       &gensubchainblock,       false,  {"data","amount","comment","comment_to","subtractfeefromamount","replaceable","conf_target","estimate_mode"} },
     { "wallet",             "commitsubchaininfo",       &commitsubchaininfo,       false,  {"wtxdata"} },
+    { "wallet",             "fundbackuplanes",          &fundbackuplanes,          false,  {"subchainid","lanes","amount"} },
+    { "wallet",             "submitsubblocks",          &submitsubblocks,          false,  {"subblocks"} },
     { "wallet",             "genbridgeowner",       &genbridgeowner,       false,  {} },
     { "wallet",             "setaccount",               &setaccount,               true,   {"address","account"} },
     { "wallet",             "settxfee",                 &settxfee,                 true,   {"amount"} },
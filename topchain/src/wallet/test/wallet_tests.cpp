@@ -680,4 +680,91 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 2);
 }
 
+// Balances and AvailableCoins walk the wallet's index of unspent outputs.
+// Check that it follows a spend and that rebuilding it from mapWallet gives
+// the same answers as the incremental updates.
+BOOST_FIXTURE_TEST_CASE(wallet_utxo_index, ListCoinsTestingSetup)
+{
+    LOCK2(cs_main, wallet->cs_wallet);
+
+    std::vector<COutput> available;
+    wallet->AvailableCoins(available);
+    BOOST_CHECK_EQUAL(available.size(), 1);
+    const COutPoint spent(available[0].tx->GetHash(), available[0].i);
+
+    // The spent coinbase output drops out, the change and the coinbase that
+    // matured with the new block come in.
+    AddTx(CRecipient{GetScriptForRawPubKey({}), 1 * COIN, false /* subtract fee */});
+    wallet->AvailableCoins(available);
+    BOOST_CHECK_EQUAL(available.size(), 2);
+    for (const COutput& out : available) {
+        BOOST_CHECK(COutPoint(out.tx->GetHash(), out.i) != spent);
+    }
+    const CAmount balance = wallet->GetBalance();
+    BOOST_CHECK_EQUAL(wallet->GetAvailableBalance(), balance);
+
+    wallet->MarkDirty();
+    std::vector<COutput> rebuilt;
+    wallet->AvailableCoins(rebuilt);
+    BOOST_CHECK_EQUAL(rebuilt.size(), available.size());
+    BOOST_CHECK_EQUAL(wallet->GetBalance(), balance);
+}
+
+BOOST_FIXTURE_TEST_CASE(backup_lanes, ListCoinsTestingSetup)
+{
+    LOCK2(cs_main, wallet->cs_wallet);
+    const uint256 subChainId = GetRandHash();
+
+    CWalletTx wtxFund;
+    std::string error;
+    BOOST_CHECK(wallet->FundBackupLanes(subChainId, 2, COIN, nullptr, wtxFund, error));
+    const std::vector<CBackupLane>& vLanes = wallet->mapBackupLanes[subChainId].vLanes;
+    BOOST_CHECK_EQUAL(vLanes.size(), 2);
+    const COutPoint lane0 = vLanes[0].outpoint;
+    const COutPoint lane1 = vLanes[1].outpoint;
+    BOOST_CHECK(wallet->IsLockedCoin(lane0.hash, lane0.n));
+
+    std::vector<CBackupSubBlockExt> vExt(3);
+    for (CBackupSubBlockExt& ext : vExt)
+        ext.subChainId = subChainId;
+    std::vector<CWalletTx> vwtx;
+    BOOST_CHECK(wallet->CreateBackupTransactions(vExt, GetScriptForRawPubKey({}), COIN / 100, vwtx, error));
+    BOOST_CHECK_EQUAL(vwtx.size(), 3);
+
+    // The lanes take turns, and each continues from the change of its last backup
+    BOOST_CHECK(vwtx[0].tx->vin[0].prevout == lane0);
+    BOOST_CHECK(vwtx[1].tx->vin[0].prevout == lane1);
+    BOOST_CHECK(vwtx[2].tx->vin[0].prevout == COutPoint(vwtx[0].GetHash(), 1));
+    BOOST_CHECK(!wallet->IsLockedCoin(lane0.hash, lane0.n));
+    BOOST_CHECK(wallet->IsLockedCoin(vwtx[2].GetHash(), 1));
+    BOOST_CHECK(wallet->IsLockedCoin(vwtx[1].GetHash(), 1));
+
+    // A rejected backup takes the one chained on it along, and its lane goes
+    // back to the coin it started from
+    wallet->RollBackBackupTransactions(vwtx, {vwtx[0].GetHash(), vwtx[2].GetHash()});
+    BOOST_CHECK(vLanes[0].outpoint == lane0);
+    BOOST_CHECK(vLanes[0].txout == wtxFund.tx->vout[lane0.n]);
+    BOOST_CHECK_EQUAL(vLanes[0].nChained, 0U);
+    BOOST_CHECK(wallet->IsLockedCoin(lane0.hash, lane0.n));
+    BOOST_CHECK(!wallet->IsLockedCoin(vwtx[2].GetHash(), 1));
+    BOOST_CHECK(vLanes[1].outpoint == COutPoint(vwtx[1].GetHash(), 1));
+    BOOST_CHECK_EQUAL(vLanes[1].nChained, 1U);
+
+    // Until the funding transaction confirms, all its lanes together stay
+    // within its descendant limit
+    const std::vector<CBackupSubBlockExt> vMore(DEFAULT_DESCENDANT_LIMIT - 2, vExt[0]);
+    vwtx.clear();
+    BOOST_CHECK(wallet->CreateBackupTransactions(vMore, GetScriptForRawPubKey({}), COIN / 100, vwtx, error));
+    BOOST_CHECK_EQUAL(vwtx.size(), vMore.size());
+    vwtx.clear();
+    BOOST_CHECK(!wallet->CreateBackupTransactions({vExt[0]}, GetScriptForRawPubKey({}), COIN / 100, vwtx, error));
+    BOOST_CHECK(vwtx.empty());
+
+    // Backups of a subchain without lanes fail
+    vExt[0].subChainId = GetRandHash();
+    vwtx.clear();
+    BOOST_CHECK(!wallet->CreateBackupTransactions(vExt, GetScriptForRawPubKey({}), COIN / 100, vwtx, error));
+    BOOST_CHECK(vwtx.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
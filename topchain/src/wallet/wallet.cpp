@@ -622,6 +622,9 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
     std::pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
     SyncMetaData(range);
+
+    if (!fWalletUTXODirty && IsSpent(outpoint.hash, outpoint.n))
+        setWalletUTXO.erase(outpoint);
 }
 
 
@@ -636,6 +639,53 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::UpdateWalletUTXO(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (fWalletUTXODirty)
+        return;
+
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+        if (IsMine(wtx.tx->vout[i]) != ISMINE_NO && !IsSpent(hash, i))
+            setWalletUTXO.insert(COutPoint(hash, i));
+        else
+            setWalletUTXO.erase(COutPoint(hash, i));
+    }
+}
+
+const std::set<COutPoint>& CWallet::GetWalletUTXO() const
+{
+    AssertLockHeld(cs_wallet);
+    if (fWalletUTXODirty) {
+        setWalletUTXO.clear();
+        for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+            const CWalletTx& wtx = item.second;
+            for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+                if (IsMine(wtx.tx->vout[i]) != ISMINE_NO && !IsSpent(item.first, i))
+                    setWalletUTXO.insert(setWalletUTXO.end(), COutPoint(item.first, i));
+            }
+        }
+        fWalletUTXODirty = false;
+    }
+    return setWalletUTXO;
+}
+
+std::vector<const CWalletTx*> CWallet::GetWalletUTXOTxs() const
+{
+    std::vector<const CWalletTx*> vTxs;
+    const uint256* phashLast = nullptr;
+    for (const COutPoint& outpoint : GetWalletUTXO()) {
+        if (phashLast && *phashLast == outpoint.hash)
+            continue;
+        phashLast = &outpoint.hash;
+        std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash);
+        if (it != mapWallet.end())
+            vTxs.push_back(&it->second);
+    }
+    return vTxs;
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -894,6 +944,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        fWalletUTXODirty = true;
     }
 }
 
@@ -994,6 +1045,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     // Break debit/credit balance caches:
     wtx.MarkDirty();
+    UpdateWalletUTXO(wtx);
 
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1163,8 +1215,10 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             for (const CTxIn& txin : wtx.tx->vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    UpdateWalletUTXO(mapWallet[txin.prevout.hash]);
+                }
             }
         }
     }
@@ -1224,8 +1278,10 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             for (const CTxIn& txin : wtx.tx->vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    UpdateWalletUTXO(mapWallet[txin.prevout.hash]);
+                }
             }
         }
     }
@@ -1243,8 +1299,10 @@ LogPrintf("runhere51\n");
     // recomputed, also:
     for (const CTxIn& txin : tx.vin)
     {
-        if (mapWallet.count(txin.prevout.hash))
+        if (mapWallet.count(txin.prevout.hash)) {
             mapWallet[txin.prevout.hash].MarkDirty();
+            UpdateWalletUTXO(mapWallet[txin.prevout.hash]);
+        }
     }
 }
 
@@ -2026,9 +2084,8 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const CWalletTx* pcoin : GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -2042,9 +2099,8 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const CWalletTx* pcoin : GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -2057,9 +2113,8 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const CWalletTx* pcoin : GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -2071,9 +2126,8 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const CWalletTx* pcoin : GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -2087,9 +2141,8 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const CWalletTx* pcoin : GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -2102,9 +2155,8 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const CWalletTx* pcoin : GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -2178,10 +2230,19 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
 
         CAmount nTotal = 0;
 
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        // Only transactions with outputs in the unspent index can contribute;
+        // the outputs of one transaction are adjacent in it.
+        const std::set<COutPoint>& setUTXO = GetWalletUTXO();
+        std::set<COutPoint>::const_iterator itNext;
+        for (std::set<COutPoint>::const_iterator it = setUTXO.begin(); it != setUTXO.end(); it = itNext)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256& wtxid = it->hash;
+            itNext = setUTXO.upper_bound(COutPoint(wtxid, std::numeric_limits<uint32_t>::max()));
+
+            std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
+            if (mit == mapWallet.end())
+                continue;
+            const CWalletTx* pcoin = &mit->second;
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -2238,14 +2299,18 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
             if (nDepth < nMinDepth || nDepth > nMaxDepth)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
+            for (std::set<COutPoint>::const_iterator itOut = it; itOut != itNext; ++itOut) {
+                const unsigned int i = itOut->n;
+                if (i >= pcoin->tx->vout.size())
+                    continue;
+
                 if (pcoin->tx->vout[i].nValue < nMinimumAmount || pcoin->tx->vout[i].nValue > nMaximumAmount)
                     continue;
 
-                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint((*it).first, i)))
+                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(*itOut))
                     continue;
 
-                if (IsLockedCoin((*it).first, i))
+                if (IsLockedCoin(wtxid, i))
                     continue;
 
                 if (IsSpent(wtxid, i))
@@ -3060,6 +3125,234 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CCon
     return true;
 }
 
+void CWallet::AddBackupLane(const uint256& subChainId, const COutPoint& outpoint, const CTxOut& txout)
+{
+    AssertLockHeld(cs_wallet);
+    // Keep ordinary coin selection away from the lane
+    LockCoin(outpoint);
+    mapBackupLanes[subChainId].vLanes.push_back(CBackupLane{outpoint, txout, 0, outpoint.hash});
+}
+
+bool CWallet::FundBackupLanes(const uint256& subChainId, unsigned int nLanes, CAmount nLaneValue, CConnman* connman, CWalletTx& wtxNew, std::string& strFailReason)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    // All lanes of a subchain pay to one key, so that signing a batch only
+    // needs to look it up once
+    if (!IsLocked())
+        TopUpKeyPool();
+    CPubKey laneKey;
+    if (!GetKeyFromPool(laneKey, true)) {
+        strFailReason = _("Keypool ran out, please call keypoolrefill first");
+        return false;
+    }
+    const CScript scriptLane = GetScriptForDestination(laneKey.GetID());
+
+    std::vector<CRecipient> vecSend(nLanes, CRecipient{scriptLane, nLaneValue, false});
+    CReserveKey reservekey(this);
+    CAmount nFeeRet;
+    int nChangePosRet = -1;
+    CCoinControl coin_control;
+    if (!CreateTransaction(vecSend, wtxNew, reservekey, nFeeRet, nChangePosRet, strFailReason, coin_control))
+        return false;
+    CValidationState state;
+    if (!CommitTransaction(wtxNew, reservekey, connman, state)) {
+        strFailReason = strprintf(_("The transaction was rejected: %s"), state.GetRejectReason());
+        return false;
+    }
+
+    for (unsigned int i = 0; i < wtxNew.tx->vout.size(); i++) {
+        if ((int)i != nChangePosRet)
+            AddBackupLane(subChainId, COutPoint(wtxNew.GetHash(), i), wtxNew.tx->vout[i]);
+    }
+
+    // Until it confirms, the lanes count against the mempool chain limits
+    // of the funding transaction
+    CBackupFunding funding{1, 0};
+    {
+        LOCK(mempool.cs);
+        CTxMemPool::txiter itMempool = mempool.mapTx.find(wtxNew.GetHash());
+        if (itMempool != mempool.mapTx.end())
+            funding.nAncestors = itMempool->GetCountWithAncestors();
+    }
+    mapBackupLanes[subChainId].mapFunding[wtxNew.GetHash()] = funding;
+    return true;
+}
+
+bool CWallet::CreateBackupTransactions(const std::vector<CBackupSubBlockExt>& vExt, const CScript& scriptPlatform, CAmount nAmount, std::vector<CWalletTx>& vwtx, std::string& strFailReason)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    const unsigned int nAncestorLimit = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    const unsigned int nDescendantLimit = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    CCoinControl coin_control;
+    // Every backup has one lane input and the platform and change outputs, so
+    // a single fee estimate covers the batch
+    CAmount nFee = -1;
+    // Lane keys, looked up (and decrypted) once per batch
+    CBasicKeyStore keystoreBatch;
+
+    for (const CBackupSubBlockExt& ext : vExt) {
+        std::map<uint256, CBackupLaneSet>::iterator it = mapBackupLanes.find(ext.subChainId);
+        if (it == mapBackupLanes.end() || it->second.vLanes.empty()) {
+            strFailReason = strprintf(_("No backup lanes funded for subchain %s"), ext.subChainId.ToString());
+            return false;
+        }
+        CBackupLaneSet& lanes = it->second;
+
+        CMutableTransaction mtx;
+        mtx.vin.push_back(CTxIn(lanes.vLanes[0].outpoint));
+        mtx.vout.push_back(CTxOut(nAmount, scriptPlatform));
+        mtx.vout.push_back(lanes.vLanes[0].txout);
+        mtx.extData.nExtType = EXTDATA_BACKUPSUBBLOCK;
+        mtx.extData.data = ext;
+
+        if (nFee < 0) {
+            CMutableTransaction txDummy(mtx);
+            SignatureData sigdata;
+            if (!ProduceSignature(DummySignatureCreator(this), lanes.vLanes[0].txout.scriptPubKey, sigdata)) {
+                strFailReason = _("Signing transaction failed");
+                return false;
+            }
+            UpdateTransaction(txDummy, 0, sigdata);
+            nFee = GetMinimumFee(GetVirtualTransactionSize(txDummy), coin_control, ::mempool, ::feeEstimator, nullptr);
+        }
+
+        // Retire lanes that can no longer pay for a backup and hand their
+        // coins back to the wallet
+        std::vector<CBackupLane>::iterator itLane = lanes.vLanes.begin();
+        while (itLane != lanes.vLanes.end()) {
+            CTxOut txoutChange(itLane->txout.nValue - nAmount - nFee, itLane->txout.scriptPubKey);
+            if (txoutChange.nValue < GetDustThreshold(txoutChange, ::dustRelayFee)) {
+                UnlockCoin(itLane->outpoint);
+                itLane = lanes.vLanes.erase(itLane);
+            } else {
+                ++itLane;
+            }
+        }
+
+        std::map<uint256, CBackupFunding>::iterator itFunding = lanes.mapFunding.begin();
+        while (itFunding != lanes.mapFunding.end()) {
+            std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(itFunding->first);
+            if (mi == mapWallet.end() || mi->second.GetDepthInMainChain() > 0)
+                itFunding = lanes.mapFunding.erase(itFunding);
+            else
+                ++itFunding;
+        }
+
+        CBackupLane* pLane = nullptr;
+        CBackupFunding* pFunding = nullptr;
+        for (size_t nTried = 0; nTried < lanes.vLanes.size() && !pLane; nTried++) {
+            CBackupLane& lane = lanes.vLanes[lanes.nNext++ % lanes.vLanes.size()];
+            if (lane.nChained > 0) {
+                std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(lane.outpoint.hash);
+                if (mi != mapWallet.end() && mi->second.GetDepthInMainChain() > 0)
+                    lane.nChained = 0;
+            }
+            itFunding = lanes.mapFunding.find(lane.hashFunding);
+            if (itFunding == lanes.mapFunding.end()) {
+                if (lane.nChained < nAncestorLimit)
+                    pLane = &lane;
+            } else if (lane.nChained + itFunding->second.nAncestors < nAncestorLimit &&
+                       itFunding->second.nDescendants + 1 < nDescendantLimit) {
+                pLane = &lane;
+                pFunding = &itFunding->second;
+            }
+        }
+        lanes.nNext %= std::max<size_t>(lanes.vLanes.size(), 1);
+        if (!pLane) {
+            strFailReason = strprintf(_("All backup lanes of subchain %s are spent or at the mempool chain limit"), ext.subChainId.ToString());
+            return false;
+        }
+
+        mtx.vin[0].prevout = pLane->outpoint;
+        mtx.vout[1] = CTxOut(pLane->txout.nValue - nAmount - nFee, pLane->txout.scriptPubKey);
+
+        const CKeyStore* pkeystore = this;
+        CTxDestination dest;
+        if (ExtractDestination(pLane->txout.scriptPubKey, dest) && dest.type() == typeid(CKeyID)) {
+            const CKeyID& keyID = boost::get<CKeyID>(dest);
+            CKey key;
+            if (keystoreBatch.HaveKey(keyID) || (GetKey(keyID, key) && keystoreBatch.AddKey(key)))
+                pkeystore = &keystoreBatch;
+        }
+        const CTransaction txConst(mtx);
+        SignatureData sigdata;
+        if (!ProduceSignature(TransactionSignatureCreator(pkeystore, &txConst, 0, pLane->txout.nValue, SIGHASH_ALL), pLane->txout.scriptPubKey, sigdata)) {
+            strFailReason = _("Signing transaction failed");
+            return false;
+        }
+        UpdateTransaction(mtx, 0, sigdata);
+
+        CWalletTx wtx(this, MakeTransactionRef(std::move(mtx)));
+        wtx.fTimeReceivedIsTxTime = true;
+        wtx.fFromMe = true;
+
+        UnlockCoin(pLane->outpoint);
+        pLane->outpoint = COutPoint(wtx.GetHash(), 1);
+        pLane->txout = wtx.tx->vout[1];
+        pLane->nChained++;
+        if (pFunding)
+            pFunding->nDescendants++;
+        LockCoin(pLane->outpoint);
+        vwtx.push_back(wtx);
+    }
+    return true;
+}
+
+void CWallet::RollBackBackupTransactions(const std::vector<CWalletTx>& vwtx, const std::set<uint256>& setRejected)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    std::map<uint256, CTransactionRef> mapBatch;
+    for (const CWalletTx& wtx : vwtx)
+        mapBatch[wtx.GetHash()] = wtx.tx;
+
+    // Newest first, so a lane that went through several rejected
+    // transactions steps back through each of them
+    for (std::vector<CWalletTx>::const_reverse_iterator itTx = vwtx.rbegin(); itTx != vwtx.rend(); ++itTx) {
+        if (!setRejected.count(itTx->GetHash()))
+            continue;
+        std::map<uint256, CBackupLaneSet>::iterator it = mapBackupLanes.find(itTx->tx->GetSubChainId());
+        if (it == mapBackupLanes.end())
+            continue;
+        std::vector<CBackupLane>& vLanes = it->second.vLanes;
+        const COutPoint outpoint(itTx->GetHash(), 1);
+        std::vector<CBackupLane>::iterator itLane = vLanes.begin();
+        while (itLane != vLanes.end() && itLane->outpoint != outpoint)
+            ++itLane;
+        if (itLane == vLanes.end())
+            continue;
+        UnlockCoin(outpoint);
+
+        // The coin spent is the change of an earlier backup of the batch, or
+        // one already in the wallet
+        const COutPoint& prevout = itTx->tx->vin[0].prevout;
+        const CTransaction* ptxPrev = nullptr;
+        std::map<uint256, CTransactionRef>::const_iterator mi = mapBatch.find(prevout.hash);
+        if (mi != mapBatch.end()) {
+            ptxPrev = mi->second.get();
+        } else {
+            std::map<uint256, CWalletTx>::const_iterator mw = mapWallet.find(prevout.hash);
+            if (mw != mapWallet.end())
+                ptxPrev = mw->second.tx.get();
+        }
+        if (!ptxPrev || prevout.n >= ptxPrev->vout.size()) {
+            vLanes.erase(itLane);
+            it->second.nNext = 0;
+            continue;
+        }
+        itLane->outpoint = prevout;
+        itLane->txout = ptxPrev->vout[prevout.n];
+        if (itLane->nChained > 0)
+            itLane->nChained--;
+        std::map<uint256, CBackupFunding>::iterator itFunding = it->second.mapFunding.find(itLane->hashFunding);
+        if (itFunding != it->second.mapFunding.end() && itFunding->second.nDescendants > 0)
+            itFunding->second.nDescendants--;
+        LockCoin(prevout);
+    }
+}
+
 void CWallet::ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& entries) {
     CWalletDB walletdb(*dbw);
     return walletdb.ListAccountCreditDebit(strAccount, entries);
@@ -69,6 +69,10 @@ static const bool DEFAULT_DISABLE_WALLET = false;
 static const bool DEFAULT_DISABLE_OWNER = true;
 //! if set, all keys will be derived by using BIP32
 static const bool DEFAULT_USE_HD_WALLET = true;
+//! Default for the number of backup lanes funded at once for a subchain
+static const unsigned int DEFAULT_BACKUP_LANES = 8;
+//! Largest number of backup lanes funded by one transaction
+static const unsigned int MAX_BACKUP_LANES = 256;
 
 extern const char * DEFAULT_WALLET_DAT;
 
@@ -537,6 +541,49 @@ public:
 };
 
 
+/**
+ * A wallet coin set aside for the backup transactions of one subchain. A
+ * backup spends the lane's coin, pays the platform and returns the change to
+ * the same script, which becomes the lane's next coin. Backups thus skip coin
+ * selection, and subchains never compete for the same coins.
+ */
+struct CBackupLane
+{
+    COutPoint outpoint;
+    CTxOut txout;
+    //! Backups chained on this lane since its coin was last seen confirmed
+    unsigned int nChained;
+    //! The transaction that funded the lane
+    uint256 hashFunding;
+};
+
+/**
+ * The mempool chain budget of an unconfirmed transaction funding lanes. All
+ * its lanes descend from it, so they share its descendant limit, and each
+ * lane's chain sits on top of its unconfirmed ancestry.
+ */
+struct CBackupFunding
+{
+    //! The funding transaction and its unconfirmed ancestors
+    unsigned int nAncestors;
+    //! Backups chained on any of its lanes
+    unsigned int nDescendants;
+};
+
+/**
+ * The lanes of one subchain. Each lane is a chain of unconfirmed spends, so
+ * they are used round-robin to stay within the mempool's ancestor limit
+ * between topchain blocks.
+ */
+struct CBackupLaneSet
+{
+    std::vector<CBackupLane> vLanes;
+    size_t nNext;
+    //! Funding transactions of the lanes that are not confirmed yet
+    std::map<uint256, CBackupFunding> mapFunding;
+
+    CBackupLaneSet() : nNext(0) {}
+};
 
 
 /** Private key that includes an expiration date in case it never gets used. */
@@ -689,6 +736,22 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * Outputs of wallet transactions that pay to us and that no wallet
+     * transaction spends. The balance and coin availability queries walk this
+     * instead of all of mapWallet, so it holds every such output; an entry
+     * whose spender came back through a reorg may linger until the next
+     * rebuild, so readers still check IsSpent(). Rebuilt from mapWallet on the
+     * first query after MarkDirty(), e.g. after loading or importing keys.
+     */
+    mutable std::set<COutPoint> setWalletUTXO;
+    mutable bool fWalletUTXODirty;
+    /* Re-evaluate the outputs of wtx against the index. */
+    void UpdateWalletUTXO(const CWalletTx& wtx);
+    const std::set<COutPoint>& GetWalletUTXO() const;
+    /* Wallet transactions owning at least one indexed output, in txid order. */
+    std::vector<const CWalletTx*> GetWalletUTXOTxs() const;
+
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
@@ -809,6 +872,7 @@ public:
         nRelockTime = 0;
         fAbortRescan = false;
         fScanningWallet = false;
+        fWalletUTXODirty = true;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -828,6 +892,10 @@ public:
 
     std::set<COutPoint> setLockedCoins;
 
+    //! Backup lanes by subchain id. Kept in memory only: after a restart the
+    //! lane coins are ordinary wallet coins again.
+    std::map<uint256, CBackupLaneSet> mapBackupLanes;
+
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
     //! check whether we are allowed to upgrade (or already support) to the named feature
@@ -968,6 +1036,28 @@ public:
                            std::string& strFailReason, const CCoinControl& coin_control, bool sign = true);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state);
 
+    /** Reserve a coin as a backup lane of a subchain, see CBackupLane */
+    void AddBackupLane(const uint256& subChainId, const COutPoint& outpoint, const CTxOut& txout);
+    /** Create and commit one transaction funding nLanes new lanes of nLaneValue each */
+    bool FundBackupLanes(const uint256& subChainId, unsigned int nLanes, CAmount nLaneValue, CConnman* connman, CWalletTx& wtxNew, std::string& strFailReason);
+    /**
+     * Build and sign one backup transaction per extension. Each spends the
+     * next usable lane of its subchain and pays nAmount to scriptPlatform.
+     * All transactions of the batch share one fee estimate and one lookup
+     * of each lane key. The lanes move on to the change of the new
+     * transactions, so the caller must commit every transaction returned in
+     * vwtx, or roll its lane back, even if this fails part way through the
+     * batch.
+     */
+    bool CreateBackupTransactions(const std::vector<CBackupSubBlockExt>& vExt, const CScript& scriptPlatform, CAmount nAmount, std::vector<CWalletTx>& vwtx, std::string& strFailReason);
+    /**
+     * Move the lanes of a batch from CreateBackupTransactions() back past the
+     * transactions in setRejected, which did not make it into the mempool,
+     * to the coins they spent. A transaction chained on a rejected one must
+     * be rejected too.
+     */
+    void RollBackBackupTransactions(const std::vector<CWalletTx>& vwtx, const std::set<uint256>& setRejected);
+
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& entries);
     bool AddAccountingEntry(const CAccountingEntry&);
     bool AddAccountingEntry(const CAccountingEntry&, CWalletDB *pwalletdb);